@@ -0,0 +1,77 @@
+/*
+ * CPU capabilities                               Runtime feature detection
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <hpc/compiler.h>
+#include <hpc/cpu.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/*
+ * The capabilities a binary built for the baseline of its architecture may or
+ * may not find on the machine it runs on: x86 asks cpuid leaf 1, ARMv8 on
+ * Linux the hwcaps the kernel put in the aux vector (the instructions trap at
+ * EL0 on other systems, so there the answer is no). Cheap enough to call, but
+ * the callers ask once and keep the answer.
+ */
+int
+cpu_has_cap(int capability)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return 0;
+	switch (capability) {
+	case CPU_CAP_CRYPTO_CRC32C:
+		return !!(c & bit_SSE4_2);
+	case CPU_CAP_CRYPTO_CLMUL:
+		return !!(c & bit_PCLMUL);
+	}
+#elif defined(__aarch64__) && defined(__linux__)
+	unsigned long hwcap = getauxval(AT_HWCAP);
+
+	switch (capability) {
+	case CPU_CAP_CRYPTO_CRC32C:
+		return !!(hwcap & HWCAP_CRC32);
+	case CPU_CAP_CRYPTO_CLMUL:
+		return !!(hwcap & HWCAP_PMULL);
+	}
+#else
+	(void)capability;
+#endif
+	return 0;
+}
+
+int
+cpu_has_crc32c(void)
+{
+	return cpu_has_cap(CPU_CAP_CRYPTO_CRC32C);
+}
@@ -25,6 +25,8 @@
 
 /* Hardware-accelerated implementation of CRC-32C (Castagnoli) */
 #define CPU_CAP_CRYPTO_CRC32C             1
+/* Carry-less multiplication: PCLMULQDQ on x86, PMULL on ARMv8 */
+#define CPU_CAP_CRYPTO_CLMUL              2
 
 /*
  * 32 bytes appears to be the most common cache line size,
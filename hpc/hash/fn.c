@@ -0,0 +1,487 @@
+/*
+ * Buffer hash backends                 CRC-32C, CLHASH and runtime dispatch
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <hpc/compiler.h>
+#include <hpc/cpu.h>
+#include <hpc/hash/fn.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#define HASH_CRC32C_X86 1
+#ifdef __x86_64__
+#define HASH_CLHASH_X86 1
+#endif
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#define HASH_CRC32C_ARM 1
+#endif
+
+/*
+ * Every entry point starts out pointing at a stub that runs hash_fn_init()
+ * and calls through again, so a hash taken from another constructor, before
+ * ours has run, already gets the backend of the process. hash_fn_init()
+ * stores the real functions with release semantics after the tables they
+ * read are written; hash_buffer() loads its pointer with acquire.
+ */
+static u64 hash_buffer_stub(const void *ptr, size_t size);
+static u32 crc32c_stub(u32 crc, const u8 *p, size_t size);
+static u64 clhash_stub(const u8 *p, size_t size);
+
+u64 (*__hash_buffer_fn)(const void *, size_t) = hash_buffer_stub;
+static u32 (*crc32c_fn)(u32, const u8 *, size_t) = crc32c_stub;
+static u64 (*clhash_fn)(const u8 *, size_t) = clhash_stub;
+
+static pthread_once_t hash_fn_once = PTHREAD_ONCE_INIT;
+static int hash_hw[HASH_BACKEND_COUNT];
+static enum hash_backend hash_current;
+
+static inline u64
+load_u64(const u8 *p)
+{
+	u64 x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+
+/*
+ * CRC-32C
+ * -------
+ * The reflected Castagnoli polynomial, initial value and final xor all ~0, the
+ * checksum of iSCSI, ext4 and friends: the hardware computes exactly it, and
+ * the byte-wise table below is the fallback with the same values.
+ */
+#define CRC32C_POLY 0x82F63B78u
+
+static u32 crc32c_table[256];
+
+static void
+crc32c_table_init(void)
+{
+	for (u32 i = 0; i < 256; i++) {
+		u32 c = i;
+		for (int k = 0; k < 8; k++)
+			c = (c >> 1) ^ (CRC32C_POLY & (0u - (c & 1)));
+		crc32c_table[i] = c;
+	}
+}
+
+static u32
+crc32c_sw(u32 crc, const u8 *p, size_t size)
+{
+	crc = ~crc;
+	while (size--)
+		crc = (crc >> 8) ^ crc32c_table[(crc ^ *p++) & 0xff];
+	return ~crc;
+}
+
+/*
+ * One stream, eight bytes an instruction: the crc32 latency of three cycles
+ * bounds it near 3 bytes a cycle. Interleaving three streams and combining
+ * them would triple that on long buffers, for keys far longer than a table's.
+ */
+#if defined(HASH_CRC32C_X86)
+__attribute__((target("sse4.2"))) static u32
+crc32c_hw(u32 crc, const u8 *p, size_t size)
+{
+#ifdef __x86_64__
+	u64 c = ~crc;
+	for (; size >= 8; size -= 8, p += 8)
+		c = _mm_crc32_u64(c, load_u64(p));
+#else
+	u32 c = ~crc;
+	for (; size >= 4; size -= 4, p += 4) {
+		u32 w;
+		memcpy(&w, p, sizeof(w));
+		c = _mm_crc32_u32(c, w);
+	}
+#endif
+	for (; size; size--, p++)
+		c = _mm_crc32_u8((u32)c, *p);
+	return ~(u32)c;
+}
+#elif defined(HASH_CRC32C_ARM)
+__attribute__((target("arch=armv8-a+crc"))) static u32
+crc32c_hw(u32 crc, const u8 *p, size_t size)
+{
+	u32 c = ~crc;
+	for (; size >= 8; size -= 8, p += 8)
+		c = __crc32cd(c, load_u64(p));
+	for (; size; size--, p++)
+		c = __crc32cb(c, *p);
+	return ~c;
+}
+#endif
+
+/*
+ * CLHASH
+ * ------
+ * The data, zero-padded to 16 bytes, is cut into 1 KiB blocks of 64 pairs of
+ * words (m0, m1). A block hashes to the xor over its pairs of the carry-less
+ * product (k0 ^ m0) x (k1 ^ m1), k the 128 key words; the blocks combine as a
+ * polynomial in the key word @poly over GF(2^64) modulo x^64 + x^4 + x^3 + x
+ * + 1; and the product of the key word @len with the length in bytes is added
+ * so that the padding does not collide with real zeroes. A finaliser
+ * (a bijection, collisions stay collisions) mixes the 64 bits for bucketing.
+ *
+ * The key is 130 words of splitmix64 from a fixed seed. It is no secret then,
+ * and chosen keys can collide, but every process on the machine computes the
+ * same values, as they did with seed 0 xxhash - tables shared between them
+ * (<mem/slab_shm.h>) keep working.
+ */
+#define CLHASH_PAIRS   64
+#define CLHASH_POLY    (2 * CLHASH_PAIRS)
+#define CLHASH_LEN     (CLHASH_POLY + 1)
+#define CLHASH_IRRED   0x1Bu       /* x^4 + x^3 + x + 1 */
+#define CLHASH_SEED    0x243f6a8885a308d3ull
+
+static u64 clhash_key[CLHASH_LEN + 1] _align(16);
+
+static inline u64
+splitmix64(u64 *s)
+{
+	u64 z = (*s += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+static void
+clhash_key_init(void)
+{
+	u64 s = CLHASH_SEED;
+
+	for (unsigned i = 0; i <= CLHASH_LEN; i++)
+		clhash_key[i] = splitmix64(&s);
+	if (!clhash_key[CLHASH_POLY])
+		clhash_key[CLHASH_POLY] = 1;
+}
+
+static inline u64
+clhash_final(u64 h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	return h ^ (h >> 33);
+}
+
+struct u128 {
+	u64 lo, hi;
+};
+
+static inline struct u128
+clmul_sw(u64 a, u64 b)
+{
+	struct u128 r = { 0, 0 };
+
+	for (int i = 0; i < 64; i++)
+		if (b >> i & 1) {
+			r.lo ^= a << i;
+			r.hi ^= i ? a >> (64 - i) : 0;
+		}
+	return r;
+}
+
+static inline u64
+reduce_sw(struct u128 a)
+{
+	struct u128 q = clmul_sw(a.hi, CLHASH_IRRED);
+	return a.lo ^ q.lo ^ clmul_sw(q.hi, CLHASH_IRRED).lo;
+}
+
+static inline void
+xor_sw(struct u128 *acc, struct u128 x)
+{
+	acc->lo ^= x.lo;
+	acc->hi ^= x.hi;
+}
+
+/*
+ * The reference for the hardware one, and where there is no carry-less
+ * multiply: 64 shifts a product makes it slow, but its values are the same.
+ */
+static u64
+clhash_sw(const u8 *p, size_t size)
+{
+	const u64 *k = clhash_key;
+	size_t pairs = size / 16, tail = size % 16;
+	struct u128 acc = { 0, 0 };
+	bool first = true;
+	u8 buf[16];
+
+	if (tail) {
+		memset(buf, 0, sizeof(buf));
+		memcpy(buf, p + pairs * 16, tail);
+	}
+	for (;;) {
+		size_t n = __min(pairs, (size_t)CLHASH_PAIRS);
+		struct u128 h = { 0, 0 };
+
+		for (size_t i = 0; i < n; i++, p += 16)
+			xor_sw(&h, clmul_sw(k[2 * i] ^ load_u64(p),
+			                    k[2 * i + 1] ^ load_u64(p + 8)));
+		pairs -= n;
+		if (n < CLHASH_PAIRS && tail) {
+			xor_sw(&h, clmul_sw(k[2 * n] ^ load_u64(buf),
+			                    k[2 * n + 1] ^ load_u64(buf + 8)));
+			tail = 0;
+		}
+		if (!first) {
+			acc = clmul_sw(reduce_sw(acc), k[CLHASH_POLY]);
+			xor_sw(&acc, h);
+		} else
+			acc = h;
+		first = false;
+		if (!pairs && !tail)
+			break;
+	}
+	xor_sw(&acc, clmul_sw(k[CLHASH_LEN], (u64)size));
+	return clhash_final(reduce_sw(acc));
+}
+
+#if defined(HASH_CLHASH_X86)
+#define __clhash_target __attribute__((target("pclmul,sse2")))
+
+__clhash_target static inline u64
+reduce_hw(__m128i a)
+{
+	const __m128i c = _mm_cvtsi64_si128(CLHASH_IRRED);
+	__m128i q = _mm_clmulepi64_si128(a, c, 0x01);
+	__m128i r = _mm_clmulepi64_si128(q, c, 0x01);
+
+	return (u64)_mm_cvtsi128_si64(_mm_xor_si128(_mm_xor_si128(a, q), r));
+}
+
+/* The low word of a pair times its high word, the first key word's side. */
+__clhash_target static inline __m128i
+pair_hw(const __m128i *k, const u8 *p)
+{
+	__m128i x = _mm_xor_si128(_mm_load_si128(k),
+	                          _mm_loadu_si128((const __m128i *)p));
+	return _mm_clmulepi64_si128(x, x, 0x10);
+}
+
+__clhash_target static u64
+clhash_hw(const u8 *p, size_t size)
+{
+	const __m128i *k = (const __m128i *)clhash_key;
+	const __m128i poly = _mm_cvtsi64_si128((long long)clhash_key[CLHASH_POLY]);
+	size_t pairs = size / 16, tail = size % 16;
+	__m128i acc = _mm_setzero_si128();
+	bool first = true;
+	u8 buf[16];
+
+	if (tail) {
+		memset(buf, 0, sizeof(buf));
+		memcpy(buf, p + pairs * 16, tail);
+	}
+	for (;;) {
+		size_t n = __min(pairs, (size_t)CLHASH_PAIRS);
+		__m128i h0 = _mm_setzero_si128(), h1 = _mm_setzero_si128();
+		size_t i = 0;
+
+		/* two accumulators: the products pipeline, the xors don't wait */
+		for (; i + 1 < n; i += 2, p += 32) {
+			h0 = _mm_xor_si128(h0, pair_hw(k + i, p));
+			h1 = _mm_xor_si128(h1, pair_hw(k + i + 1, p + 16));
+		}
+		if (i < n) {
+			h0 = _mm_xor_si128(h0, pair_hw(k + i, p));
+			p += 16;
+		}
+		h0 = _mm_xor_si128(h0, h1);
+		pairs -= n;
+		if (n < CLHASH_PAIRS && tail) {
+			h0 = _mm_xor_si128(h0, pair_hw(k + n, buf));
+			tail = 0;
+		}
+		if (!first) {
+			__m128i r = _mm_cvtsi64_si128((long long)reduce_hw(acc));
+			acc = _mm_xor_si128(_mm_clmulepi64_si128(r, poly, 0x00),
+			                    h0);
+		} else
+			acc = h0;
+		first = false;
+		if (!pairs && !tail)
+			break;
+	}
+	acc = _mm_xor_si128(acc, _mm_clmulepi64_si128(
+		_mm_cvtsi64_si128((long long)clhash_key[CLHASH_LEN]),
+		_mm_cvtsi64_si128((long long)size), 0x00));
+	return clhash_final(reduce_hw(acc));
+}
+#endif
+
+/*
+ * hash_buffer() backends
+ * ----------------------
+ * The CRC is spread over 64 bits by an odd multiplier: the low 32 bits stay a
+ * bijection of it, and hash_u64()-style users taking the top bits get all of
+ * it too.
+ */
+static u64
+hash_buffer_xxhash(const void *ptr, size_t size)
+{
+	return hash_xxhash(ptr, size);
+}
+
+static u64
+hash_buffer_crc32c(const void *ptr, size_t size)
+{
+	return (u64)crc32c_fn(0, (const u8 *)ptr, size) * 0x9e3779b97f4a7c15ull;
+}
+
+static u64
+hash_buffer_clhash(const void *ptr, size_t size)
+{
+	return clhash_fn((const u8 *)ptr, size);
+}
+
+static u64 (*const hash_buffer_backend[HASH_BACKEND_COUNT])(const void *,
+                                                            size_t) = {
+	[HASH_BACKEND_XXHASH] = hash_buffer_xxhash,
+	[HASH_BACKEND_CRC32C] = hash_buffer_crc32c,
+	[HASH_BACKEND_CLHASH] = hash_buffer_clhash,
+};
+
+static const char *const hash_backend_names[HASH_BACKEND_COUNT] = {
+	[HASH_BACKEND_XXHASH] = "xxhash",
+	[HASH_BACKEND_CRC32C] = "crc32c",
+	[HASH_BACKEND_CLHASH] = "clhash",
+};
+
+static void
+hash_fn_select(void)
+{
+	u32 (*crc)(u32, const u8 *, size_t) = crc32c_sw;
+	u64 (*cl)(const u8 *, size_t) = clhash_sw;
+
+	crc32c_table_init();
+	clhash_key_init();
+	hash_hw[HASH_BACKEND_XXHASH] = 1;
+#if defined(HASH_CRC32C_X86) || defined(HASH_CRC32C_ARM)
+	if ((hash_hw[HASH_BACKEND_CRC32C] = cpu_has_crc32c()))
+		crc = crc32c_hw;
+#endif
+#if defined(HASH_CLHASH_X86)
+	if ((hash_hw[HASH_BACKEND_CLHASH] = cpu_has_cap(CPU_CAP_CRYPTO_CLMUL)))
+		cl = clhash_hw;
+#endif
+	hash_current = hash_hw[HASH_BACKEND_CLHASH] ? HASH_BACKEND_CLHASH :
+	               hash_hw[HASH_BACKEND_CRC32C] ? HASH_BACKEND_CRC32C :
+	               HASH_BACKEND_XXHASH;
+
+	__atomic_store_n(&crc32c_fn, crc, __ATOMIC_RELEASE);
+	__atomic_store_n(&clhash_fn, cl, __ATOMIC_RELEASE);
+	__atomic_store_n(&__hash_buffer_fn, hash_buffer_backend[hash_current],
+	                 __ATOMIC_RELEASE);
+}
+
+static inline void
+hash_fn_init(void)
+{
+	pthread_once(&hash_fn_once, hash_fn_select);
+}
+
+_constructor static void
+hash_fn_ctor(void)
+{
+	hash_fn_init();
+}
+
+static u64
+hash_buffer_stub(const void *ptr, size_t size)
+{
+	hash_fn_init();
+	return __atomic_load_n(&__hash_buffer_fn, __ATOMIC_ACQUIRE)(ptr, size);
+}
+
+static u32
+crc32c_stub(u32 crc, const u8 *p, size_t size)
+{
+	hash_fn_init();
+	return __atomic_load_n(&crc32c_fn, __ATOMIC_ACQUIRE)(crc, p, size);
+}
+
+static u64
+clhash_stub(const u8 *p, size_t size)
+{
+	hash_fn_init();
+	return __atomic_load_n(&clhash_fn, __ATOMIC_ACQUIRE)(p, size);
+}
+
+u32
+hash_crc32c(u32 crc, const void *ptr, size_t size)
+{
+	return __atomic_load_n(&crc32c_fn, __ATOMIC_ACQUIRE)(crc,
+	                       (const u8 *)ptr, size);
+}
+
+u64
+hash_clhash(const void *ptr, size_t size)
+{
+	return __atomic_load_n(&clhash_fn, __ATOMIC_ACQUIRE)((const u8 *)ptr,
+	                       size);
+}
+
+enum hash_backend
+hash_backend(void)
+{
+	hash_fn_init();
+	return __atomic_load_n(&hash_current, __ATOMIC_RELAXED);
+}
+
+int
+hash_backend_hw(enum hash_backend b)
+{
+	hash_fn_init();
+	return (unsigned)b < HASH_BACKEND_COUNT ? hash_hw[b] : 0;
+}
+
+const char *
+hash_backend_name(enum hash_backend b)
+{
+	return (unsigned)b < HASH_BACKEND_COUNT ? hash_backend_names[b] : "?";
+}
+
+int
+hash_backend_set(enum hash_backend b)
+{
+	if ((unsigned)b >= HASH_BACKEND_COUNT)
+		return -1;
+	hash_fn_init();
+	__atomic_store_n(&hash_current, b, __ATOMIC_RELAXED);
+	__atomic_store_n(&__hash_buffer_fn, hash_buffer_backend[b],
+	                 __ATOMIC_RELEASE);
+	return 0;
+}
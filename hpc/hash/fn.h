@@ -1,5 +1,5 @@
 /*
- * Generic hash functions 
+ * Generic hash functions
  *
  * The MIT License (MIT)
  *
@@ -31,6 +31,8 @@
 #include <hpc/cpu.h>
 #include <math.h>
 #include <limits.h>
+#include <stddef.h>
+#include <string.h>
 
 #ifndef XXH_INLINE_ALL
 #define XXH_INLINE_ALL
@@ -94,8 +96,72 @@ hash_ptr(void *ptr, unsigned int bits)
 	return (unsigned long)hash_u64((u64)ptr, bits);
 }
 
-static inline unsigned long long
-hash_buffer(const u8 *ptr, unsigned int size)
+/*
+ * Buffer hashes
+ * -------------
+ * hash_buffer() runs one of three backends, picked once per process from what
+ * the CPU offers (see <hpc/cpu.h>), on the first call or at load time,
+ * whichever comes first:
+ *
+ *   clhash  CLHASH, the carry-less multiplication family of the paper cited
+ *           at the end of this file - PCLMULQDQ on x86-64. 64 bits, almost
+ *           universal for keys not chosen against its (fixed) key, and
+ *           the fastest from a few hundred bytes up, by 2-3x at 4 KiB. The
+ *           first choice where it runs in hardware.
+ *   crc32c  CRC-32C (Castagnoli), the SSE4.2 crc32 instruction or the ARMv8
+ *           crc32c ones, spread to 64 bits by a multiply. The cheapest below
+ *           about 128 bytes, but only 32 bits of it, and linear: fine for
+ *           buckets, no defence against chosen keys. The choice where only
+ *           it is there, and worth hash_backend_set() for short keys only.
+ *   xxhash  XXH64 (XXH32 on 32-bit), portable; where neither is there.
+ *
+ * The value of a buffer therefore differs from one machine to another -
+ * nothing that leaves the machine may depend on it. Processes on one machine
+ * agree, and within a process it never changes, unless the process
+ * changes backend with hash_backend_set(), which is meant for benchmarks and
+ * tests, before any table exists. hash_crc32c() and hash_clhash() are each
+ * backend callable directly, in hardware when there is one, in software
+ * otherwise - hash_crc32c() is the standard checksum and may be stored.
+ */
+enum hash_backend {
+	HASH_BACKEND_XXHASH,
+	HASH_BACKEND_CRC32C,
+	HASH_BACKEND_CLHASH,
+	HASH_BACKEND_COUNT
+};
+
+__BEGIN_DECLS
+
+extern u64 (*__hash_buffer_fn)(const void *ptr, size_t size);
+
+/* CRC-32C of @size bytes at @ptr continuing @crc, 0 to start a new one. */
+u32
+hash_crc32c(u32 crc, const void *ptr, size_t size);
+
+u64
+hash_clhash(const void *ptr, size_t size);
+
+/*
+ * The backend hash_buffer() runs, and whether @b runs at full speed here:
+ * xxhash always, the other two when the CPU has their instructions.
+ */
+enum hash_backend
+hash_backend(void);
+
+int
+hash_backend_hw(enum hash_backend b);
+
+const char *
+hash_backend_name(enum hash_backend b);
+
+/* Switch hash_buffer() to @b, hardware or not. Returns 0, or -1 when unknown. */
+int
+hash_backend_set(enum hash_backend b);
+
+__END_DECLS
+
+static inline u64
+hash_xxhash(const void *ptr, size_t size)
 {
     unsigned long long const seed = 0;
 #if CPU_ARCH_BITS == 32
@@ -106,6 +172,12 @@ hash_buffer(const u8 *ptr, unsigned int size)
     return hash;
 }
 
+static inline unsigned long long
+hash_buffer(const u8 *ptr, unsigned int size)
+{
+	return __atomic_load_n(&__hash_buffer_fn, __ATOMIC_ACQUIRE)(ptr, size);
+}
+
 static inline u32
 hash_buffer_u32(const u8 *ptr, unsigned int size, unsigned int bits)
 {
@@ -133,6 +205,12 @@ hash_string(const char *str)
  * function designed for speed (Google's CityHash). We find that CLHASH is 40% 
  * faster than CityHash on inputs larger than 64 bytes and just as fast 
  * otherwise.
+ *
+ * hash_clhash() follows the construction - NH-style products of key and data
+ * words over 1 KiB blocks, a polynomial over the blocks, a length term - but
+ * reduces to GF(2^64) after every block rather than lazily modulo x^127 and
+ * runs a 64-bit finaliser over the result, so that the low bits make buckets
+ * on their own. Its values are not those of the reference implementation.
  */
 
 #endif
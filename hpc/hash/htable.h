@@ -0,0 +1,297 @@
+/*
+ * Chained hash table resized a few buckets at a time          Resizable table
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * DECLARE_HASHTABLE in <hpc/hash/table.h> fixes its buckets at build time.
+ * struct htable is the same array of struct queue chains on the heap, grown
+ * when it holds more elements than buckets and shrunk when it holds fewer
+ * than an eighth, by powers of two.
+ *
+ * Incremental rehash
+ * ------------------
+ * A resize allocates the new array and keeps the old one beside it; from then
+ * on every add, del and lookup first moves up to @step non-empty buckets of
+ * the old array (visiting at most ten times as many empty ones) into the new,
+ * oldest index first, and frees the old array once the last has moved. No
+ * single operation walks the table, so none stalls for O(n) the way one
+ * rehash of everything would. The new array comes from calloc(), which for
+ * anything large is fresh zero pages from the kernel: its cost, too, is spread
+ * over the first touches rather than paid by the operation that grew.
+ *
+ * While a resize runs, every element is in exactly one place. A bucket of the
+ * old array below @migrate has moved, so an element whose old bucket is below
+ * it lives in the new array and one whose old bucket is not yet moved lives
+ * in that bucket - an add puts it there too. htable_bucket() picks the one
+ * chain to walk; a lookup never looks in both arrays.
+ *
+ * The element embeds a struct hnode: the queue link and the element's 32-bit
+ * hash, kept so that moving it does not call back into the caller. Set
+ * @step to 0 for the stop-the-world behaviour, the whole table rehashed by
+ * the operation that crossed the threshold - the benchmark's baseline.
+ *
+ * With a struct htable_measure (<hpc/hash/measure.h>) attached as t->measure
+ * the table counts adds, dels, collisions, resizes and the buckets and
+ * elements they moved.
+ *
+ * Single writer: lookups move buckets too, so every call needs the table to
+ * itself.
+ */
+
+#ifndef __HPC_HASH_HTABLE_H__
+#define __HPC_HASH_HTABLE_H__
+
+#include <hpc/compiler.h>
+#include <hpc/queue.h>
+#include <hpc/hash/measure.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+__BEGIN_DECLS
+
+#ifndef HTABLE_STEP
+#define HTABLE_STEP 4             /* buckets moved per operation            */
+#endif
+#define HTABLE_MIN_BITS 4
+
+struct hnode {
+	struct qnode q;
+	u32 hash;
+};
+
+struct htable {
+	struct queue *tab;        /* the current array, 1 << bits buckets   */
+	struct queue *old;        /* the array being emptied, or NULL       */
+	u32 bits;
+	u32 old_bits;
+	u32 migrate;              /* next bucket of @old to move            */
+	u32 count;
+	u32 step;                 /* buckets per operation, 0 all at once   */
+	u32 min_bits;             /* never shrinks below                    */
+	measure_member(htable)
+};
+
+static inline void
+__htable_account(struct htable *t)
+{
+	measure_set(t->measure, entries, t->count);
+	measure_set(t->measure, buckets, 1U << t->bits);
+}
+
+/*
+ * htable_init - an empty table of 1 << @bits buckets, which is also the
+ * smallest it shrinks to. Returns 0, or -1 when out of memory.
+ */
+static inline int
+htable_init(struct htable *t, unsigned bits)
+{
+	memset(t, 0, sizeof(*t));
+	if (bits < HTABLE_MIN_BITS)
+		bits = HTABLE_MIN_BITS;
+	if (bits > 31 || !(t->tab = (struct queue *)calloc(1UL << bits,
+	                                                   sizeof(*t->tab))))
+		return -1;
+	t->bits = t->min_bits = bits;
+	t->step = HTABLE_STEP;
+	return 0;
+}
+
+/* Free the arrays; the elements are the caller's. */
+static inline void
+htable_fini(struct htable *t)
+{
+	free(t->tab);
+	free(t->old);
+	t->tab = t->old = NULL;
+	t->count = 0;
+}
+
+static inline u32
+htable_count(struct htable *t)
+{
+	return t->count;
+}
+
+static inline bool
+htable_resizing(struct htable *t)
+{
+	return t->old != NULL;
+}
+
+/*
+ * Move old bucket @b into the new array. The chain is taken whole and each
+ * node pushed onto its new chain, so a move touches the node and the chain
+ * it lands on - the node moved before it, when growing - and never the next
+ * node's back link, which queue_del() would.
+ */
+static inline void
+__htable_move(struct htable *t, struct queue *b)
+{
+	u32 mask = (1U << t->bits) - 1;
+	struct qnode *it = b->first, *next;
+
+	b->first = NULL;
+	for (; it; it = next) {
+		struct hnode *n = container_of(it, struct hnode, q);
+		next = it->next;
+		queue_add(&t->tab[n->hash & mask], it);
+		measure_inc(t->measure, move);
+	}
+	measure_inc(t->measure, migrate);
+}
+
+/* Move up to @n non-empty buckets, all of them when @n is 0. */
+static inline void
+__htable_step(struct htable *t, u32 n)
+{
+	u32 size = 1U << t->old_bits, visits = n ? n * 10 : size;
+
+	while (visits-- && t->migrate < size) {
+		struct queue *b = &t->old[t->migrate++];
+		if (queue_empty(b))
+			continue;
+		__htable_move(t, b);
+		if (n && !--n)
+			break;
+	}
+	if (t->migrate == size) {
+		free(t->old);
+		t->old = NULL;
+	}
+}
+
+/*
+ * Start a resize to 1 << @bits buckets, finishing one under way first.
+ * Returns 0, or -1 when the new array cannot be had - the table stays as it
+ * was and works on, only longer chains.
+ */
+static inline int
+__htable_resize(struct htable *t, u32 bits)
+{
+	struct queue *tab;
+
+	if (t->old)
+		__htable_step(t, 0);
+	if (!(tab = (struct queue *)calloc(1UL << bits, sizeof(*tab))))
+		return -1;
+	if (bits > t->bits)
+		measure_inc(t->measure, grow);
+	else
+		measure_inc(t->measure, shrink);
+	t->old = t->tab;
+	t->old_bits = t->bits;
+	t->migrate = 0;
+	t->tab = tab;
+	t->bits = bits;
+	if (!t->step)
+		__htable_step(t, 0);
+	__htable_account(t);
+	return 0;
+}
+
+/* An operation's share of the rehash. */
+static inline void
+htable_advance(struct htable *t)
+{
+	if (unlikely(t->old != NULL))
+		__htable_step(t, t->step);
+}
+
+/* Finish a resize under way now, e.g. before a walk of the whole table. */
+static inline void
+htable_flush(struct htable *t)
+{
+	if (t->old)
+		__htable_step(t, 0);
+}
+
+/* The chain an element of @hash is in, or goes into; no rehash step. */
+static inline struct queue *
+__htable_chain(struct htable *t, u32 hash)
+{
+	if (unlikely(t->old != NULL)) {
+		u32 b = hash & ((1U << t->old_bits) - 1);
+		if (b >= t->migrate)
+			return &t->old[b];
+	}
+	return &t->tab[hash & ((1U << t->bits) - 1)];
+}
+
+/*
+ * htable_bucket - the one chain that holds any element of @hash, after this
+ * operation's share of the rehash. Walk it with htable_for_each_possible().
+ */
+static inline struct queue *
+htable_bucket(struct htable *t, u32 hash)
+{
+	htable_advance(t);
+	return __htable_chain(t, hash);
+}
+
+static inline void
+htable_add(struct htable *t, struct hnode *n, u32 hash)
+{
+	struct queue *b = htable_bucket(t, hash);
+
+	measure_inc_if(t->measure, !queue_empty(b), collision);
+	n->hash = hash;
+	queue_add(b, &n->q);
+	t->count++;
+	measure_inc(t->measure, add);
+	if (unlikely(t->count > (1U << t->bits)) && !t->old && t->bits < 31)
+		__htable_resize(t, t->bits + 1);
+	__htable_account(t);
+}
+
+static inline void
+htable_del(struct htable *t, struct hnode *n)
+{
+	htable_advance(t);
+	queue_del(&n->q);
+	t->count--;
+	measure_inc(t->measure, del);
+	if (unlikely(t->count < (1U << t->bits) / 8) && !t->old &&
+	    t->bits > t->min_bits)
+		__htable_resize(t, t->bits - 1);
+	__htable_account(t);
+}
+
+/* Iterate the elements that may have @hash; compare keys in the body. */
+#define htable_for_each_possible(t, hash, it, type, member) \
+	queue_for_each(htable_bucket(t, hash), it, type, member.q)
+
+/*
+ * Iterate every element, both arrays while a resize runs; a break leaves the
+ * inner loop only. Nothing may be added or deleted during the walk - call
+ * htable_flush() first and use queue_for_each_delsafe() for that.
+ */
+#define htable_for_each(t, it, type, member) \
+	for (u32 __a = 0; __a < 2; __a++) \
+	for (u32 __b = 0, __n = __a ? ((t)->old ? 1U << (t)->old_bits : 0) \
+	                            : 1U << (t)->bits; __b < __n; __b++) \
+	queue_for_each(&(__a ? (t)->old : (t)->tab)[__b], it, type, member.q)
+
+__END_DECLS
+
+#endif/*__HPC_HASH_HTABLE_H__*/
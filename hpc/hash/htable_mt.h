@@ -0,0 +1,251 @@
+/*
+ * Chained hash table for many writers and lockless readers   Striped table
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * Every other hpc container takes one serialised writer, which a table shared
+ * by many threads - a session table - turns into one lock every insert and
+ * delete queues on. struct htable_mt lets writers in side by side: the bucket
+ * array is covered by a smaller array of stripes, bucket i by stripe
+ * i mod stripes, and a writer holds only the stripe of the bucket it changes.
+ * Two writers collide only when their buckets share a stripe, and with a few
+ * hundred stripes that is rare.
+ *
+ * A stripe is a struct spinlock (<hpc/spinlock.h>) and the stripe's element
+ * count, padded to a cache line of its own: a writer's lock and count traffic
+ * never invalidates the line of the stripe next to it, and there is no shared
+ * counter for every writer to bounce. The sections are a chain walk and a few
+ * stores, the length a spinlock is meant for.
+ *
+ * Readers take no lock at all. The chains are the queue RCU primitives of
+ * <hpc/queue.h> - the writer publishes with queue_add_head_rcu() and unlinks
+ * with queue_del_rcu() - so a reader walks a bucket inside rcu_read_lock()
+ * while writers change it, exactly as with hash_for_each_rcu() on a table with
+ * one writer. A deleted element is freed after a grace period, call_rcu() being
+ * the usual way when many threads delete.
+ *
+ * Insert-if-absent
+ * ----------------
+ * A lookup followed by an add races another writer adding the same key in
+ * between. htable_mt_insert() does both under the stripe lock: it walks the
+ * bucket for an element equal to the new one and either returns that, leaving
+ * the new one out, or links the new one - of any number of writers inserting
+ * a key at once exactly one succeeds. htable_mt_del() likewise says whether
+ * this call unlinked the element, so two writers deleting the same one found
+ * by a lookup do not both unlink it.
+ *
+ * The size is fixed at htable_mt_init(): resizing under many writers would
+ * stop all of them for the grace periods a lockless resize needs (see
+ * <hpc/hash/htable_rcu.h> for a single writer's). Size it for the peak.
+ *
+ * With a struct htable_measure attached as t->measure the table counts adds,
+ * dels, collisions, contended stripes and the entries gauge, with relaxed
+ * atomics since many writers share it.
+ *
+ * This header needs CONFIG_RCU and contributes nothing without it, see
+ * <hpc/rcu.h>.
+ */
+
+#ifndef __HPC_HASH_HTABLE_MT_H__
+#define __HPC_HASH_HTABLE_MT_H__
+
+#include <hpc/compiler.h>
+#include <hpc/cpu.h>
+#include <hpc/queue.h>
+#include <hpc/spinlock.h>
+#include <hpc/hash/measure.h>
+#include <hpc/hash/htable.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef CONFIG_RCU
+
+#include <hpc/rcu.h>
+
+__BEGIN_DECLS
+
+#ifndef HTABLE_MT_STRIPE_BITS
+#define HTABLE_MT_STRIPE_BITS 8   /* 256 stripes, 16 KiB of locks           */
+#endif
+
+struct htable_mt_stripe {
+	struct spinlock lock;
+	u32 count;                /* elements in the stripe's buckets       */
+} _align(CPU_CACHE_LINE);
+
+struct htable_mt {
+	struct queue *tab;
+	struct htable_mt_stripe *stripe;
+	u32 bits;
+	u32 stripe_bits;
+	measure_member(htable)
+};
+
+/*
+ * htable_mt_init - an empty table of 1 << @bits buckets under 1 << @stripe_bits
+ * locks, no more stripes than buckets. Returns 0, or -1 when out of memory.
+ */
+static inline int
+htable_mt_init(struct htable_mt *t, unsigned bits, unsigned stripe_bits)
+{
+	size_t size;
+
+	memset(t, 0, sizeof(*t));
+	if (bits > 31)
+		return -1;
+	t->bits = bits;
+	t->stripe_bits = __min(stripe_bits, bits);
+	size = sizeof(struct htable_mt_stripe) << t->stripe_bits;
+	if (!(t->tab = (struct queue *)calloc(1UL << bits, sizeof(*t->tab))) ||
+	    !(t->stripe = (struct htable_mt_stripe *)
+	                  aligned_alloc(CPU_CACHE_LINE, size))) {
+		free(t->tab);
+		return -1;
+	}
+	memset(t->stripe, 0, size);
+	return 0;
+}
+
+/* Free the arrays once no reader or writer can be in them. */
+static inline void
+htable_mt_fini(struct htable_mt *t)
+{
+	free(t->tab);
+	free(t->stripe);
+	t->tab = NULL;
+	t->stripe = NULL;
+}
+
+/* Elements in the table, as of some moment during the call. */
+static inline u32
+htable_mt_count(struct htable_mt *t)
+{
+	u32 n = 0;
+
+	for (u32 i = 0; i < 1U << t->stripe_bits; i++)
+		n += __atomic_load_n(&t->stripe[i].count, __ATOMIC_RELAXED);
+	return n;
+}
+
+static inline struct queue *
+htable_mt_bucket(struct htable_mt *t, u32 hash)
+{
+	return &t->tab[hash & ((1U << t->bits) - 1)];
+}
+
+static inline struct htable_mt_stripe *
+__htable_mt_lock(struct htable_mt *t, u32 hash)
+{
+	struct htable_mt_stripe *s =
+		&t->stripe[hash & ((1U << t->stripe_bits) - 1)];
+
+	if (unlikely(!spin_trylock(&s->lock))) {
+		measure_add_atomic(t->measure, contended, 1);
+		spin_lock(&s->lock);
+	}
+	return s;
+}
+
+/* Under the stripe lock: link @n, and count it. */
+static inline void
+__htable_mt_link(struct htable_mt *t, struct htable_mt_stripe *s,
+                 struct queue *b, struct hnode *n, u32 hash)
+{
+	if (!queue_empty(b))
+		measure_add_atomic(t->measure, collision, 1);
+	n->hash = hash;
+	queue_add_head_rcu(b, &n->q);
+	__atomic_store_n(&s->count, s->count + 1, __ATOMIC_RELAXED);
+	measure_add_atomic(t->measure, add, 1);
+	measure_add_atomic(t->measure, entries, 1);
+}
+
+/* Add @n, whether or not an equal element is in the table already. */
+static inline void
+htable_mt_add(struct htable_mt *t, struct hnode *n, u32 hash)
+{
+	struct htable_mt_stripe *s = __htable_mt_lock(t, hash);
+
+	__htable_mt_link(t, s, htable_mt_bucket(t, hash), n, hash);
+	spin_unlock(&s->lock);
+}
+
+/*
+ * htable_mt_insert - add @n unless an element of the same hash for which
+ * @eq(element, @n) holds is in the table, atomically with respect to every
+ * other writer. Returns NULL when @n went in, else the element that was there
+ * and @n stays the caller's. Use the returned element inside the read-side
+ * section the call was made in: another writer may delete it the moment the
+ * stripe is unlocked.
+ */
+static inline struct hnode *
+htable_mt_insert(struct htable_mt *t, struct hnode *n, u32 hash,
+                 bool (*eq)(const struct hnode *, const struct hnode *))
+{
+	struct htable_mt_stripe *s = __htable_mt_lock(t, hash);
+	struct queue *b = htable_mt_bucket(t, hash);
+
+	queue_for_each(b, it, struct hnode, q)
+		if (it->hash == hash && eq(it, n)) {
+			spin_unlock(&s->lock);
+			return it;
+		}
+	__htable_mt_link(t, s, b, n, hash);
+	spin_unlock(&s->lock);
+	return NULL;
+}
+
+/*
+ * htable_mt_del - unlink @n, found by a lookup inside the read-side section
+ * this is called in. Returns true when this call unlinked it, false when
+ * another writer got there first. Free it after a grace period.
+ */
+static inline bool
+htable_mt_del(struct htable_mt *t, struct hnode *n)
+{
+	struct htable_mt_stripe *s = __htable_mt_lock(t, n->hash);
+	bool hashed = !qnode_unhashed(&n->q);
+
+	if (hashed) {
+		queue_del_rcu(&n->q);
+		__atomic_store_n(&s->count, s->count - 1, __ATOMIC_RELAXED);
+		measure_add_atomic(t->measure, del, 1);
+		measure_sub_atomic(t->measure, entries, 1);
+	}
+	spin_unlock(&s->lock);
+	return hashed;
+}
+
+/*
+ * Iterate, inside the caller's read-side section, the elements that may have
+ * @hash; compare keys in the body.
+ */
+#define htable_mt_for_each_possible(t, hash, it, type, member) \
+	queue_for_each_rcu(htable_mt_bucket(t, hash), it, type, member.q)
+
+__END_DECLS
+
+#endif/*CONFIG_RCU*/
+
+#endif/*__HPC_HASH_HTABLE_MT_H__*/
@@ -0,0 +1,332 @@
+/*
+ * Chained hash table resized under lockless readers    Relativistic table
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * hash_add_rcu() and friends in <hpc/hash/table.h> work on a bucket array of
+ * fixed size. struct htable_rcu is the RCU spelling of struct htable
+ * (<hpc/hash/htable.h>): the same struct hnode chains, doubled when the table
+ * holds more elements than buckets and halved below an eighth, while readers
+ * walk it under nothing but rcu_read_lock(). No reader ever misses an element
+ * that is in the table for the whole of its lookup, resize or not.
+ *
+ * Relativistic resize
+ * -------------------
+ * The array is published as one struct htable_rcu_tab, its size with it, so a
+ * reader that picked it up hashes into it consistently whichever array is
+ * current. What makes a resize safe is the order of the chain rewrites, after
+ * Triplett, McKenney and Walpole, "Resizable, Scalable, Concurrent Hash Tables
+ * via Relativistic Programming" (USENIX ATC 2011):
+ *
+ *   grow    Old bucket i splits into new buckets i and i + old size. Each new
+ *           bucket head is pointed at the first node of the old chain that
+ *           belongs to it, and the new array is published: the two new chains
+ *           are "zipped" together in the one old chain, so a reader of either
+ *           walks past the other's nodes, but misses none of its own. After a
+ *           grace period nobody reads the old array, and the chains are
+ *           unzipped, one link per old bucket per pass: the last node of a run
+ *           is pointed past the other bucket's run that follows it. A reader may
+ *           be standing in that run, on its way to the nodes after it, so the
+ *           next link of the same chain is rewritten only after another grace
+ *           period. A chain of k alternating runs takes k - 1 passes; at a load
+ *           of at most one element per bucket that is rarely more than three.
+ *   shrink  New bucket i is old buckets i and i + new size, so the tail of the
+ *           first is linked to the head of the second - a reader of the first
+ *           sees extra nodes, a reader of the second nothing new - and the new
+ *           array published. One grace period later the old one is freed.
+ *
+ * Readers do nothing special: they compare keys, so a node of another bucket
+ * on the way is skipped like any collision. The cost is on the writer, which
+ * waits out a grace period per pass with synchronize_rcu(): a grow blocks the
+ * writer for a few grace periods, and it must not be inside a read-side
+ * section itself while it does.
+ *
+ * The qnode @prev links are the writer's and never read by a reader. They are
+ * meaningless while chains are zipped, so a resize rebuilds them once the
+ * chains are final; the resize runs to completion inside the one writer call,
+ * so no add or del ever sees them half done.
+ *
+ * Single writer: adds, dels and resizes are serialised by the caller; lookups
+ * take no lock and move nothing. A deleted element is freed, or added again,
+ * only after a grace period - synchronize_rcu() or call_rcu() - as with any
+ * RCU list.
+ *
+ * With a struct htable_measure attached as t->measure the table counts adds,
+ * dels, collisions and resizes; @migrate counts old buckets split or joined and
+ * @move the links an unzip rewrote.
+ *
+ * This header needs CONFIG_RCU and contributes nothing without it, see
+ * <hpc/rcu.h>.
+ */
+
+#ifndef __HPC_HASH_HTABLE_RCU_H__
+#define __HPC_HASH_HTABLE_RCU_H__
+
+#include <hpc/compiler.h>
+#include <hpc/queue.h>
+#include <hpc/hash/measure.h>
+#include <hpc/hash/htable.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef CONFIG_RCU
+
+#include <hpc/rcu.h>
+
+__BEGIN_DECLS
+
+struct htable_rcu_tab {
+	u32 bits;
+	struct queue b[];
+};
+
+struct htable_rcu {
+	struct htable_rcu_tab *tab;  /* published with rcu_assign_pointer() */
+	u32 count;
+	u32 min_bits;                /* never shrinks below                  */
+	measure_member(htable)
+};
+
+static inline struct htable_rcu_tab *
+__htable_rcu_alloc(u32 bits)
+{
+	return (struct htable_rcu_tab *)calloc(1, sizeof(struct htable_rcu_tab) +
+	                                      (sizeof(struct queue) << bits));
+}
+
+static inline void
+__htable_rcu_account(struct htable_rcu *t)
+{
+	measure_set(t->measure, entries, t->count);
+	measure_set(t->measure, buckets, 1U << t->tab->bits);
+}
+
+/*
+ * htable_rcu_init - an empty table of 1 << @bits buckets, which is also the
+ * smallest it shrinks to. Returns 0, or -1 when out of memory.
+ */
+static inline int
+htable_rcu_init(struct htable_rcu *t, unsigned bits)
+{
+	memset(t, 0, sizeof(*t));
+	if (bits < HTABLE_MIN_BITS)
+		bits = HTABLE_MIN_BITS;
+	if (bits > 31 || !(t->tab = __htable_rcu_alloc(bits)))
+		return -1;
+	t->tab->bits = t->min_bits = bits;
+	return 0;
+}
+
+/* Free the array once no reader can be in it; the elements are the caller's. */
+static inline void
+htable_rcu_fini(struct htable_rcu *t)
+{
+	free(t->tab);
+	t->tab = NULL;
+	t->count = 0;
+}
+
+static inline u32
+htable_rcu_count(struct htable_rcu *t)
+{
+	return t->count;
+}
+
+/*
+ * htable_rcu_bucket - the chain to walk for @hash, inside the caller's
+ * read-side section. Walk it with htable_rcu_for_each_possible().
+ */
+static inline struct queue *
+htable_rcu_bucket(struct htable_rcu *t, u32 hash)
+{
+	struct htable_rcu_tab *tab = rcu_dereference(t->tab);
+	return &tab->b[hash & ((1U << tab->bits) - 1)];
+}
+
+/* Point every @prev link at its predecessor again, once chains are final. */
+static inline void
+__htable_rcu_relink(struct htable_rcu_tab *tab)
+{
+	for (u32 i = 0; i < 1U << tab->bits; i++) {
+		struct qnode **prev = &tab->b[i].first;
+		for (struct qnode *it = *prev; it; it = it->next) {
+			it->prev = prev;
+			prev = &it->next;
+		}
+	}
+}
+
+/*
+ * One unzip step from @it, the first node of a run: point the run's last node
+ * past the other bucket's run that follows, at the next node of its own
+ * bucket. Returns the other run, where the chain goes on, or NULL when there
+ * is none and the chain is done.
+ */
+static inline struct qnode *
+__htable_rcu_unzip(struct qnode *it, u32 bit)
+{
+	u32 side = container_of(it, struct hnode, q)->hash & bit;
+	struct qnode *other, *far;
+
+	while (it->next &&
+	       (container_of(it->next, struct hnode, q)->hash & bit) == side)
+		it = it->next;
+	if (!(other = it->next))
+		return NULL;
+	for (far = other->next; far; far = far->next)
+		if ((container_of(far, struct hnode, q)->hash & bit) == side)
+			break;
+	rcu_assign_pointer(it->next, far);
+	return other;
+}
+
+static inline void
+__htable_rcu_grow(struct htable_rcu *t, struct htable_rcu_tab *old,
+                  struct htable_rcu_tab *tab)
+{
+	u32 size = 1U << old->bits, mask = (1U << tab->bits) - 1;
+	bool more = true;
+
+	/* new heads into the zipped chains, then readers off the old array */
+	for (u32 i = 0; i < size; i++)
+		for (struct qnode *it = old->b[i].first; it; it = it->next) {
+			struct queue *b = &tab->b[
+				container_of(it, struct hnode, q)->hash & mask];
+			if (!b->first)
+				b->first = it;
+		}
+	rcu_assign_pointer(t->tab, tab);
+	synchronize_rcu();
+	for (u32 i = 0; i < size; i++)
+		measure_inc_if(t->measure, old->b[i].first != NULL, migrate);
+
+	/* the old heads are nobody's now: the unzip cursors, one per chain */
+	while (more) {
+		more = false;
+		for (u32 i = 0; i < size; i++) {
+			struct qnode *it = old->b[i].first;
+			if (!it)
+				continue;
+			if ((old->b[i].first = __htable_rcu_unzip(it, size))) {
+				measure_inc(t->measure, move);
+				more = true;
+			}
+		}
+		if (more)
+			synchronize_rcu();
+	}
+	__htable_rcu_relink(tab);
+	free(old);
+}
+
+static inline void
+__htable_rcu_shrink(struct htable_rcu *t, struct htable_rcu_tab *old,
+                    struct htable_rcu_tab *tab)
+{
+	u32 size = 1U << tab->bits;
+
+	for (u32 i = 0; i < size; i++) {
+		struct qnode **tail = &old->b[i].first;
+		while (*tail)
+			tail = &(*tail)->next;
+		rcu_assign_pointer(*tail, old->b[i + size].first);
+		tab->b[i].first = old->b[i].first;
+		measure_inc_if(t->measure, tab->b[i].first != NULL, migrate);
+	}
+	rcu_assign_pointer(t->tab, tab);
+	__htable_rcu_relink(tab);
+	synchronize_rcu();
+	free(old);
+}
+
+/*
+ * htable_rcu_resize - resize to 1 << @bits buckets, under readers, waiting out
+ * the grace periods it needs. Sizes other than half or double the current are
+ * reached a power of two at a time. Returns 0, or -1 when an array cannot be
+ * had - the table stays as it was at the last size reached.
+ */
+static inline int
+htable_rcu_resize(struct htable_rcu *t, unsigned bits)
+{
+	if (bits < HTABLE_MIN_BITS || bits > 31)
+		return -1;
+	while (t->tab->bits != bits) {
+		struct htable_rcu_tab *old = t->tab, *tab;
+		u32 to = bits > old->bits ? old->bits + 1 : old->bits - 1;
+
+		if (!(tab = __htable_rcu_alloc(to)))
+			return -1;
+		tab->bits = to;
+		if (to > old->bits) {
+			measure_inc(t->measure, grow);
+			__htable_rcu_grow(t, old, tab);
+		} else {
+			measure_inc(t->measure, shrink);
+			__htable_rcu_shrink(t, old, tab);
+		}
+		__htable_rcu_account(t);
+	}
+	return 0;
+}
+
+static inline void
+htable_rcu_add(struct htable_rcu *t, struct hnode *n, u32 hash)
+{
+	struct queue *b = &t->tab->b[hash & ((1U << t->tab->bits) - 1)];
+
+	measure_inc_if(t->measure, !queue_empty(b), collision);
+	n->hash = hash;
+	queue_add_head_rcu(b, &n->q);
+	t->count++;
+	measure_inc(t->measure, add);
+	if (unlikely(t->count > (1U << t->tab->bits)) && t->tab->bits < 31)
+		htable_rcu_resize(t, t->tab->bits + 1);
+	__htable_rcu_account(t);
+}
+
+/* Unlink @n; free it or add it again only after a grace period. */
+static inline void
+htable_rcu_del(struct htable_rcu *t, struct hnode *n)
+{
+	queue_del_rcu(&n->q);
+	t->count--;
+	measure_inc(t->measure, del);
+	if (unlikely(t->count < (1U << t->tab->bits) / 8) &&
+	    t->tab->bits > t->min_bits)
+		htable_rcu_resize(t, t->tab->bits - 1);
+	__htable_rcu_account(t);
+}
+
+/*
+ * Iterate, inside the caller's read-side section, the elements that may have
+ * @hash; compare keys in the body.
+ */
+#define htable_rcu_for_each_possible(t, hash, it, type, member) \
+	queue_for_each_rcu(htable_rcu_bucket(t, hash), it, type, member.q)
+
+__END_DECLS
+
+#endif/*CONFIG_RCU*/
+
+#endif/*__HPC_HASH_HTABLE_RCU_H__*/
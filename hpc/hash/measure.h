@@ -60,4 +60,40 @@
 
 DEFINE_MEASURE(hash, HASH_METRICS);
 
+/*
+ * The tables with a handle - <hpc/hash/htable.h> and its RCU and multi-writer
+ * spellings - hang the struct off it as t->measure rather than a per-unit
+ * pointer.
+ *
+ * Counters:
+ * - add, del, collision: as above
+ * - grow:      resizes started to twice the buckets
+ * - shrink:    resizes started to half the buckets
+ * - migrate:   buckets moved from the old array to the new one
+ * - move:      elements moved with them
+ * - contended: stripe locks found held by another writer, multi-writer
+ *              table only
+ *
+ * Gauges:
+ * - entries:   elements in the table
+ * - buckets:   buckets of the current array
+ *
+ * Ratio:
+ * - load:      entries as a percent of buckets
+ */
+#define HTABLE_METRICS(_ns, C, G, R) \
+	C(_ns, add,       "Elements inserted into the table") \
+	C(_ns, del,       "Elements removed from the table") \
+	C(_ns, collision, "Insertions into a non-empty bucket") \
+	C(_ns, grow,      "Resizes started to twice the buckets") \
+	C(_ns, shrink,    "Resizes started to half the buckets") \
+	C(_ns, migrate,   "Buckets moved to the new array") \
+	C(_ns, move,      "Elements moved with them") \
+	C(_ns, contended, "Stripe locks found held by another writer") \
+	G(_ns, entries,   "Elements currently in the table") \
+	G(_ns, buckets,   "Buckets of the current array") \
+	R(_ns, load, entries, buckets, "Elements as percent of buckets")
+
+DEFINE_MEASURE(htable, HTABLE_METRICS);
+
 #endif/*__HPC_HASH_MEASURE_H__*/
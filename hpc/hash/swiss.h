@@ -0,0 +1,420 @@
+/*
+ * Open-addressing hash map probed 16 slots at a time            Swiss table
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * The second hash engine next to the chained table of <hpc/hash/table.h>: the
+ * keys and values live in one flat slot array, and beside it a control byte
+ * per slot - 0x80 for an empty slot, or the low 7 bits of the key's hash for a
+ * full one. A lookup loads the control bytes of 16 slots at once (SSE2 on x86,
+ * NEON on arm64, 8 at a time in a u64 elsewhere), compares them all to the
+ * 7-bit tag in one instruction and looks only at the slots that match - one
+ * in 128 of the wrong ones on average - so a probe costs a cache line of
+ * control bytes and, for a hit, one of slots. No pointer is chased and no
+ * object carries a link.
+ *
+ * Probing is linear by slot, a window of 16 at a time starting anywhere: the
+ * first 16 control bytes are repeated after the last, so a window that runs
+ * off the end reads the start. A key sits at the first empty slot at or after
+ * its home slot (the hash bits above the tag), which keeps the one invariant the
+ * lookup relies on - no empty slot between a key's home and the key - and a
+ * lookup stops at the first window with an empty slot in it.
+ *
+ * Deletion is backward shift, not a tombstone: the keys after the freed slot,
+ * up to the next empty one, are moved back into it when that is still at or
+ * after their home. The table never fills with deleted markers, a lookup miss
+ * stays as short as the live keys make it, and only a delete pays, rehashing
+ * the keys of its run to find their homes. Runs grow fast with the load - a
+ * few slots at half full, tens at 0.9 - so a table with many deletes wants
+ * max_load left where it is.
+ *
+ * The table doubles when an insert would take it past max_load percent full
+ * (SWISS_MAX_LOAD unless set after init), and name##_resize() sizes it for a
+ * given count either way. Capacity is a power of two, 16 slots at least.
+ *
+ * Generated per key and value type, the way DEFINE_INTRO_SORT is:
+ *
+ *   DEFINE_SWISS_TABLE(name, key_type, value_type, hash_fn, eq_fn)
+ *
+ * where @hash_fn(key) returns a u64 - its low 7 bits are the tag and the bits
+ * above them choose the home slot, so it has to mix all of them
+ * (hash_u64(x, 64), hash_buffer()) - and @eq_fn(a, b) compares two keys; either
+ * may be a static inline function or a function-style macro. Generates struct
+ * name and:
+ *
+ *   int  name_init(t, n)                 room for @n keys; 0, or -1
+ *   void name_fini(t)
+ *   value_type *name_find(t, key)        NULL if absent
+ *   value_type *name_insert(t, key, &added)  the key's value, inserted
+ *                                        (zeroed) if absent; NULL on OOM
+ *   int  name_put(t, key, value)         insert or overwrite; 0, or -1
+ *   bool name_del(t, key)
+ *   int  name_resize(t, n)               capacity for @n keys, down as well
+ *   int  name_rehash(t, cap)             exactly @cap slots, a power of two
+ *   u32  name_count(t)
+ *   struct name##_slot *name_next(t, &pos)   walk, pos from 0; NULL at the end
+ *
+ * Pointers returned into the table are void after the next insert or delete:
+ * a resize moves every slot and a delete may move a neighbour.
+ *
+ * With a struct hash_measure (<hpc/hash/measure.h>) attached as t->measure
+ * the table counts as the chained one does: add, del, collision (an insert
+ * whose home slot was taken) and the entries gauge.
+ */
+
+#ifndef __HPC_HASH_SWISS_H__
+#define __HPC_HASH_SWISS_H__
+
+#include <hpc/compiler.h>
+#include <hpc/cpu.h>
+#include <hpc/hash/measure.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+# include <arm_neon.h>
+#endif
+
+__BEGIN_DECLS
+
+#define SWISS_EMPTY ((u8)0x80)
+
+#ifndef SWISS_MAX_LOAD
+#define SWISS_MAX_LOAD 87          /* percent full before an insert grows */
+#endif
+
+/*
+ * A group: the control bytes of SWISS_GROUP consecutive slots, compared at
+ * once into a mask with a bit (or bits) per slot. __swiss_lane() turns the
+ * lowest set bit into the slot's offset in the group.
+ */
+#if defined(__SSE2__)
+
+#define SWISS_GROUP 16
+
+static inline u64
+__swiss_match(const u8 *ctrl, u8 tag)
+{
+	__m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+	return (u64)(u32)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)tag)));
+}
+
+static inline u64
+__swiss_match_empty(const u8 *ctrl)
+{
+	return (u64)(u32)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+}
+
+#define __swiss_lane(mask) ((u32)__builtin_ctzll(mask))
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+#define SWISS_GROUP 16
+
+/* A nibble per slot, narrowed from the byte compare; one bit of it kept. */
+static inline u64
+__swiss_nibbles(uint8x16_t eq)
+{
+	uint8x8_t n = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+	return vget_lane_u64(vreinterpret_u64_u8(n), 0) & 0x8888888888888888ull;
+}
+
+static inline u64
+__swiss_match(const u8 *ctrl, u8 tag)
+{
+	return __swiss_nibbles(vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(tag)));
+}
+
+static inline u64
+__swiss_match_empty(const u8 *ctrl)
+{
+	return __swiss_nibbles(vcltzq_s8(vreinterpretq_s8_u8(vld1q_u8(ctrl))));
+}
+
+#define __swiss_lane(mask) ((u32)__builtin_ctzll(mask) >> 2)
+
+#else
+
+#define SWISS_GROUP 8
+
+/*
+ * Eight bytes in a u64, the high bit of each that matches. The zero-byte trick
+ * may also flag a byte above a true match; the caller compares keys anyway.
+ */
+static inline u64
+__swiss_match(const u8 *ctrl, u8 tag)
+{
+	u64 g, x;
+	memcpy(&g, ctrl, sizeof(g));
+	x = g ^ (0x0101010101010101ull * tag);
+	return (x - 0x0101010101010101ull) & ~x & 0x8080808080808080ull;
+}
+
+static inline u64
+__swiss_match_empty(const u8 *ctrl)
+{
+	u64 g;
+	memcpy(&g, ctrl, sizeof(g));
+	return g & 0x8080808080808080ull;
+}
+
+#define __swiss_lane(mask) ((u32)__builtin_ctzll(mask) >> 3)
+
+#endif
+
+#define __swiss_h1(h)  ((h) >> 7)
+#define __swiss_h2(h)  ((u8)((h) & 0x7f))
+
+/* Slots for @n keys at @load percent: a power of two, one group at least. */
+static inline u32
+__swiss_capacity(u32 n, u32 load)
+{
+	u64 want = (u64)n * 100 / load + 1;
+	u32 cap = SWISS_GROUP;
+	while (cap < want && cap < (1U << 31))
+		cap <<= 1;
+	return cap;
+}
+
+/* Set the control byte of slot @i, and its copy past the end. */
+static inline void
+__swiss_set_ctrl(u8 *ctrl, u32 mask, u32 i, u8 v)
+{
+	ctrl[i] = v;
+	ctrl[((i - SWISS_GROUP) & mask) + SWISS_GROUP] = v;
+}
+
+/* Is @i outside the cyclic range (@from, @to]? */
+static inline bool
+__swiss_outside(u32 i, u32 from, u32 to, u32 mask)
+{
+	return ((i - from - 1) & mask) >= ((to - from) & mask);
+}
+
+#define DEFINE_SWISS_TABLE(name, key_type, value_type, hash_fn, eq_fn) \
+\
+struct name##_slot { \
+	key_type key; \
+	value_type value; \
+}; \
+\
+struct name { \
+	u8 *ctrl;                  /* mask + 1 + SWISS_GROUP bytes */ \
+	struct name##_slot *slot; \
+	u32 mask; \
+	u32 count; \
+	u32 max_load;              /* percent */ \
+	measure_member(hash) \
+}; \
+\
+static inline int name##_alloc(struct name *t, u32 cap) \
+{ \
+	t->ctrl = (u8 *)malloc((size_t)cap + SWISS_GROUP); \
+	t->slot = (struct name##_slot *)malloc((size_t)cap * sizeof(*t->slot)); \
+	if (!t->ctrl || !t->slot) { \
+		free(t->ctrl); \
+		free(t->slot); \
+		return -1; \
+	} \
+	memset(t->ctrl, SWISS_EMPTY, (size_t)cap + SWISS_GROUP); \
+	t->mask = cap - 1; \
+	t->count = 0; \
+	return 0; \
+} \
+\
+static inline int name##_init(struct name *t, u32 n) \
+{ \
+	memset(t, 0, sizeof(*t)); \
+	t->max_load = SWISS_MAX_LOAD; \
+	return name##_alloc(t, __swiss_capacity(n, t->max_load)); \
+} \
+\
+static inline void name##_fini(struct name *t) \
+{ \
+	free(t->ctrl); \
+	free(t->slot); \
+	t->ctrl = NULL; \
+	t->slot = NULL; \
+	t->count = 0; \
+} \
+\
+static inline u32 name##_count(struct name *t) \
+{ \
+	return t->count; \
+} \
+\
+/* The slot holding @key, or ~0U. */ \
+static inline u32 name##_lookup(struct name *t, key_type key, u64 h) \
+{ \
+	u32 pos = (u32)__swiss_h1(h) & t->mask; \
+	u8 tag = __swiss_h2(h); \
+	for (;;) { \
+		u64 m = __swiss_match(t->ctrl + pos, tag); \
+		for (; m; m &= m - 1) { \
+			u32 i = (pos + __swiss_lane(m)) & t->mask; \
+			if (likely(eq_fn(t->slot[i].key, key))) \
+				return i; \
+		} \
+		if (likely(__swiss_match_empty(t->ctrl + pos))) \
+			return ~0U; \
+		pos = (pos + SWISS_GROUP) & t->mask; \
+	} \
+} \
+\
+/* The first empty slot at or after the home of @h. */ \
+static inline u32 name##_first_empty(struct name *t, u64 h) \
+{ \
+	u32 pos = (u32)__swiss_h1(h) & t->mask; \
+	for (;;) { \
+		u64 m = __swiss_match_empty(t->ctrl + pos); \
+		if (m) \
+			return (pos + __swiss_lane(m)) & t->mask; \
+		pos = (pos + SWISS_GROUP) & t->mask; \
+	} \
+} \
+\
+static inline value_type *name##_find(struct name *t, key_type key) \
+{ \
+	u32 i = name##_lookup(t, key, (u64)hash_fn(key)); \
+	return i == ~0U ? NULL : &t->slot[i].value; \
+} \
+\
+/* Place a key known absent; no growth, no counting. */ \
+static inline u32 name##_place(struct name *t, key_type key, u64 h) \
+{ \
+	u32 i = name##_first_empty(t, h); \
+	__swiss_set_ctrl(t->ctrl, t->mask, i, __swiss_h2(h)); \
+	t->slot[i].key = key; \
+	t->count++; \
+	return i; \
+} \
+\
+static inline int name##_rehash(struct name *t, u32 cap) \
+{ \
+	struct name old = *t; \
+	if (cap <= old.count || name##_alloc(t, cap)) { \
+		*t = old; \
+		return -1; \
+	} \
+	for (u32 i = 0; i <= old.mask; i++) { \
+		if (old.ctrl[i] & SWISS_EMPTY) \
+			continue; \
+		u32 j = name##_place(t, old.slot[i].key, \
+		                     (u64)hash_fn(old.slot[i].key)); \
+		t->slot[j].value = old.slot[i].value; \
+	} \
+	free(old.ctrl); \
+	free(old.slot); \
+	return 0; \
+} \
+\
+static inline int name##_resize(struct name *t, u32 n) \
+{ \
+	if (n < t->count) \
+		n = t->count; \
+	return name##_rehash(t, __swiss_capacity(n, t->max_load)); \
+} \
+\
+static inline value_type *name##_insert(struct name *t, key_type key, \
+                                        bool *added) \
+{ \
+	u64 h = (u64)hash_fn(key); \
+	u32 i = name##_lookup(t, key, h); \
+	if (i != ~0U) { \
+		if (added) \
+			*added = false; \
+		return &t->slot[i].value; \
+	} \
+	if (((u64)(t->count + 1) * 100 > (u64)(t->mask + 1) * t->max_load || \
+	     t->count + 1 > t->mask) && \
+	    name##_rehash(t, (t->mask + 1) * 2)) \
+		return NULL; \
+	measure_inc_if(t->measure, \
+	               !(t->ctrl[(u32)__swiss_h1(h) & t->mask] & SWISS_EMPTY), \
+	               collision); \
+	i = name##_place(t, key, h); \
+	memset(&t->slot[i].value, 0, sizeof(t->slot[i].value)); \
+	measure_inc(t->measure, add); \
+	measure_inc(t->measure, entries); \
+	if (added) \
+		*added = true; \
+	return &t->slot[i].value; \
+} \
+\
+static inline int name##_put(struct name *t, key_type key, value_type value) \
+{ \
+	value_type *v = name##_insert(t, key, NULL); \
+	if (!v) \
+		return -1; \
+	*v = value; \
+	return 0; \
+} \
+\
+/* Empty slot @i, and shift back the keys behind it that may move. */ \
+static inline void name##_erase(struct name *t, u32 i) \
+{ \
+	u32 j = i; \
+	for (;;) { \
+		j = (j + 1) & t->mask; \
+		if (t->ctrl[j] & SWISS_EMPTY) \
+			break; \
+		u32 home = (u32)__swiss_h1((u64)hash_fn(t->slot[j].key)) & t->mask; \
+		if (!__swiss_outside(home, i, j, t->mask)) \
+			continue; \
+		t->slot[i] = t->slot[j]; \
+		__swiss_set_ctrl(t->ctrl, t->mask, i, t->ctrl[j]); \
+		i = j; \
+	} \
+	__swiss_set_ctrl(t->ctrl, t->mask, i, SWISS_EMPTY); \
+	t->count--; \
+} \
+\
+static inline bool name##_del(struct name *t, key_type key) \
+{ \
+	u32 i = name##_lookup(t, key, (u64)hash_fn(key)); \
+	if (i == ~0U) \
+		return false; \
+	name##_erase(t, i); \
+	measure_inc(t->measure, del); \
+	measure_dec(t->measure, entries); \
+	return true; \
+} \
+\
+static inline struct name##_slot *name##_next(struct name *t, u32 *pos) \
+{ \
+	for (u32 i = *pos; t->ctrl && i <= t->mask; i++) { \
+		if (t->ctrl[i] & SWISS_EMPTY) \
+			continue; \
+		*pos = i + 1; \
+		return &t->slot[i]; \
+	} \
+	*pos = t->mask + 1; \
+	return NULL; \
+}
+
+__END_DECLS
+
+#endif/*__HPC_HASH_SWISS_H__*/
@@ -555,6 +555,12 @@ measure_lookup(const measure_metric *meta, u64 *values, unsigned nfield,
  * - measure_set(m, ev, v):     m ? m->ev = v        (sample an absolute level)
  * reading back:
  * - measure_get(m, ev):        m ? m->ev : 0        (an rvalue, not an lvalue)
+ * shared between threads:
+ * - measure_add_atomic(m, ev, n) / measure_sub_atomic(m, ev, n):
+ *                        the same update as a relaxed atomic add, for a measure
+ *                        counted from several threads at once (the lock-free
+ *                        slab paths). Relaxed is enough: a counter orders
+ *                        nothing, it only must not lose an update.
  *
  * @m is a measure pointer or NULL; a NULL measure counts nothing (one
  * predicted-not-taken branch). always_measure_get() is the one to reach for
@@ -582,6 +588,12 @@ measure_lookup(const measure_metric *meta, u64 *values, unsigned nfield,
 	do { if (_m) (*(u64 *)((u8 *)(_m) + (_off)))++; } while (0)
 #define always_measure_get(_m, _ev) \
 	((_m) ? (_m)->_ev : (u64)0)
+#define always_measure_add_atomic(_m, _ev, _n) \
+	do { if (_m) __atomic_fetch_add(&(_m)->_ev, (u64)(_n), \
+	                                __ATOMIC_RELAXED); } while (0)
+#define always_measure_sub_atomic(_m, _ev, _n) \
+	do { if (_m) __atomic_fetch_sub(&(_m)->_ev, (u64)(_n), \
+	                                __ATOMIC_RELAXED); } while (0)
 
 #ifdef CONFIG_MEASURE
 
@@ -596,6 +608,8 @@ measure_lookup(const measure_metric *meta, u64 *values, unsigned nfield,
 #define measure_inc_if(_m, _cond, _ev)  always_measure_inc_if(_m, _cond, _ev)
 #define measure_inc_at(_m, _off)        always_measure_inc_at(_m, _off)
 #define measure_get(_m, _ev)            always_measure_get(_m, _ev)
+#define measure_add_atomic(_m, _ev, _n) always_measure_add_atomic(_m, _ev, _n)
+#define measure_sub_atomic(_m, _ev, _n) always_measure_sub_atomic(_m, _ev, _n)
 
 #else
 
@@ -617,6 +631,8 @@ measure_lookup(const measure_metric *meta, u64 *values, unsigned nfield,
  */
 #define measure_inc_at(_m, _off)        
 #define measure_get(_m, _ev)            ((u64)0)
+#define measure_add_atomic(_m, _ev, _n) ((void)0)
+#define measure_sub_atomic(_m, _ev, _n) ((void)0)
 
 #endif
 
@@ -52,6 +52,8 @@
 #define MM_FAST_ALIGN  (1 << 8)  /* Aligned to CPU_SIMD_ALIGN                */
 #define MM_LOCK_ALIGN  (1 << 9)  /* Aligned to CPU_CACHE_LINE                */
 #define MM_PAGE_ALIGN  (1 << 9)  /* Aligned to CPU_PAGE_SIZE                 */
+/* Backed by 2 MiB pages: hugetlbfs, else THP, else base pages (mm_pool) */
+#define MM_HUGE_PAGE   (1 << 10)
 
 struct mm {
 	void *(*alloc)(struct mm *mm, size_t bytes);
@@ -57,6 +57,23 @@ vm_vblock_alloc(size_t size)
 	return b;
 }
 
+/*
+ * vm_vblock_alloc_huge - a block on huge pages where there are any; see
+ * vm_page_alloc_huge() for the order tried and @backing. @size plus the
+ * header must be a multiple of VM_HUGE_PAGE_SIZE. Freed by vm_vblock_free().
+ */
+static inline void *
+vm_vblock_alloc_huge(size_t size, int *backing)
+{
+	struct mm_vblock *b;
+	size_t aligned = size + align_addr(sizeof(*b));
+	b = (struct mm_vblock *)vm_page_alloc_huge(aligned, backing);
+	b = (struct mm_vblock *)((u8 *)b + size);
+	b->size = size;
+	snode_init(&b->node);
+	return b;
+}
+
 void
 static inline 
 vm_vblock_free(struct mm_vblock *b)
@@ -0,0 +1,373 @@
+#include <hpc/compiler.h>
+#include <hpc/cpu.h>
+#include <mem/alloc.h>
+#include <mem/page.h>
+#include <mem/cache.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifndef MEM_MALLOC_FREE
+
+/* Free runs are binned by the power of two below their length. */
+static inline u32
+__cache_bin(u32 pages)
+{
+	return 31 - __builtin_clz(pages);
+}
+
+/* Dirty runs in the first set of bins, clean ones in the second. */
+static inline u32
+__cache_set(u32 state)
+{
+	return state == MM_CACHE_CLEAN;
+}
+
+static inline void
+__cache_account(struct mm_cache *c)
+{
+	measure_set(c->measure, total, c->pages.total);
+	measure_set(c->measure, used, c->used);
+	measure_set(c->measure, dirty, c->dirty);
+	measure_set(c->measure, clean, c->clean);
+}
+
+/* Write the run's length and state at its head and its tail. */
+static inline void
+__cache_mark(struct mm_cache *c, u32 i, u32 n, u32 state)
+{
+	c->run[i].pages = c->run[i + n - 1].pages = n;
+	c->run[i].state = c->run[i + n - 1].state = state;
+}
+
+static void
+__cache_bin_add(struct mm_cache *c, u32 i)
+{
+	struct mm_cache_run *r = &c->run[i];
+	u32 s = __cache_set(r->state), b = __cache_bin(r->pages);
+
+	r->prev = MM_CACHE_NIL;
+	r->next = c->bin[s][b];
+	if (r->next != MM_CACHE_NIL)
+		c->run[r->next].prev = i;
+	c->bin[s][b] = i;
+	c->binmap[s] |= 1U << b;
+	if (s)
+		c->clean += r->pages;
+	else
+		c->dirty += r->pages;
+}
+
+static void
+__cache_bin_del(struct mm_cache *c, u32 i)
+{
+	struct mm_cache_run *r = &c->run[i];
+	u32 s = __cache_set(r->state), b = __cache_bin(r->pages);
+
+	if (r->prev != MM_CACHE_NIL)
+		c->run[r->prev].next = r->next;
+	else
+		c->bin[s][b] = r->next;
+	if (r->next != MM_CACHE_NIL)
+		c->run[r->next].prev = r->prev;
+	if (c->bin[s][b] == MM_CACHE_NIL)
+		c->binmap[s] &= ~(1U << b);
+	if (s)
+		c->clean -= r->pages;
+	else
+		c->dirty -= r->pages;
+}
+
+/*
+ * File pages [@i, @i + @n) as a free run of @state, merged with the free runs
+ * of the same state on either side. Returns the index past the merged run.
+ */
+static u32
+__cache_put(struct mm_cache *c, u32 i, u32 n, u32 state)
+{
+	u32 end = i + n;
+
+	if (i && c->run[i - 1].state == state) {
+		u32 left = i - c->run[i - 1].pages;
+		__cache_bin_del(c, left);
+		i = left;
+		measure_inc(c->measure, merge);
+	}
+	if (end < c->pages.total && c->run[end].state == state) {
+		__cache_bin_del(c, end);
+		end += c->run[end].pages;
+		measure_inc(c->measure, merge);
+	}
+	__cache_mark(c, i, end - i, state);
+	__cache_bin_add(c, i);
+	return end;
+}
+
+/* The head of a free run of @state with at least @n pages, or MM_CACHE_NIL. */
+static u32
+__cache_find(struct mm_cache *c, u32 state, u32 n)
+{
+	u32 s = __cache_set(state), b = __cache_bin(n), mask, i;
+
+	/* the run's own bin holds lengths up to twice @n: first fit */
+	for (i = c->bin[s][b]; i != MM_CACHE_NIL; i = c->run[i].next)
+		if (c->run[i].pages >= n)
+			return i;
+	/* any run of a larger bin fits */
+	mask = c->binmap[s] & ~((2U << b) - 1);
+	return mask ? c->bin[s][__builtin_ctz(mask)] : MM_CACHE_NIL;
+}
+
+/* Take @n pages from the head of free run @i, the rest stays free. */
+static void
+__cache_take(struct mm_cache *c, u32 i, u32 n)
+{
+	u32 len = c->run[i].pages, state = c->run[i].state;
+
+	__cache_bin_del(c, i);
+	if (len > n) {
+		__cache_mark(c, i + n, len - n, state);
+		__cache_bin_add(c, i + n);
+		measure_inc(c->measure, split);
+	}
+	__cache_mark(c, i, n, MM_CACHE_USED);
+}
+
+static void
+__cache_release_run(struct mm_cache *c, u32 i, u32 n)
+{
+	madvise(get_page(&c->pages, i), (size_t)n << c->pages.shift,
+	        MADV_DONTNEED);
+	measure_add(c->measure, release, n);
+	__cache_put(c, i, n, MM_CACHE_CLEAN);
+}
+
+/*
+ * Room for @n pages split between a dirty run and the clean runs beside it:
+ * release the dirty run that makes up the difference, and it merges with them.
+ * Returns the head of the merged clean run, or MM_CACHE_NIL.
+ */
+static u32
+__cache_bridge(struct mm_cache *c, u32 n)
+{
+	for (u32 mask = c->binmap[0]; mask; mask &= mask - 1) {
+		u32 b = __builtin_ctz(mask), i;
+		for (i = c->bin[0][b]; i != MM_CACHE_NIL; i = c->run[i].next) {
+			u32 len = c->run[i].pages, end = i + len, left = 0, right = 0;
+			if (i && c->run[i - 1].state == MM_CACHE_CLEAN)
+				left = c->run[i - 1].pages;
+			if (end < c->pages.total && c->run[end].state == MM_CACHE_CLEAN)
+				right = c->run[end].pages;
+			if (left + len + right < n)
+				continue;
+			__cache_bin_del(c, i);
+			__cache_release_run(c, i, len);
+			return i - left;
+		}
+	}
+	return MM_CACHE_NIL;
+}
+
+/* Free the used run at @i; returns the index past the free run it joins. */
+static u32
+__cache_free(struct mm_cache *c, u32 i)
+{
+	u32 n = c->run[i].pages;
+
+	c->used -= n;
+	c->live--;
+	measure_inc(c->measure, free);
+	return __cache_put(c, i, n, MM_CACHE_DIRTY);
+}
+
+int
+mm_cache_init(struct mm_cache *cache, unsigned int page_bits, u32 total,
+              const struct mm_cache_policy *policy)
+{
+	memset(cache, 0, sizeof(*cache));
+	if ((1UL << page_bits) < CPU_PAGE_SIZE || page_bits > 30 || !total)
+		return -1;
+	if (pages_map(&cache->pages, PROT_READ | PROT_WRITE,
+	              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+	              (int)page_bits, total))
+		return -1;
+	cache->run = (struct mm_cache_run *)calloc(total, sizeof(*cache->run));
+	if (!cache->run) {
+		pages_free(&cache->pages);
+		return -1;
+	}
+	memset(cache->bin, 0xff, sizeof(cache->bin));
+	if (policy)
+		cache->policy = *policy;
+
+	/* never touched: one clean run of everything */
+	__cache_mark(cache, 0, total, MM_CACHE_CLEAN);
+	__cache_bin_add(cache, 0);
+	return 0;
+}
+
+void
+mm_cache_fini(struct mm_cache *cache)
+{
+	if (cache->run)
+		pages_free(&cache->pages);
+	free(cache->run);
+	cache->run = NULL;
+}
+
+struct page *
+mm_cache_alloc_ex(struct mm_cache *cache, size_t size, timestamp_t now,
+                  u32 ttl, u32 idle)
+{
+	size_t limit = (size_t)cache->pages.total << cache->pages.shift;
+	/* bounded before rounding up, which wraps for sizes near SIZE_MAX */
+	size_t want = size > limit ? 0 :
+	              (size + ((size_t)1 << cache->pages.shift) - 1) >>
+	              cache->pages.shift;
+	u32 n = want ? (u32)want : 1, i = MM_CACHE_NIL;
+	struct mm_cache_run *r;
+
+	if (size <= limit) {
+		if ((i = __cache_find(cache, MM_CACHE_DIRTY, n)) == MM_CACHE_NIL)
+			i = __cache_find(cache, MM_CACHE_CLEAN, n);
+		/* the room may be there, split between dirty and clean runs */
+		if (i == MM_CACHE_NIL && cache->dirty) {
+			measure_inc(cache->measure, purge);
+			if ((i = __cache_bridge(cache, n)) == MM_CACHE_NIL) {
+				mm_cache_release(cache, 0);
+				i = __cache_find(cache, MM_CACHE_CLEAN, n);
+			}
+		}
+	}
+	if (i == MM_CACHE_NIL) {
+		measure_inc(cache->measure, fail);
+		__cache_account(cache);
+		return NULL;
+	}
+
+	__cache_take(cache, i, n);
+	r = &cache->run[i];
+	r->ttl_at = ttl ? now + ttl : 0;
+	r->atime = now;
+	r->idle = idle;
+	cache->used += n;
+	cache->live++;
+	measure_inc(cache->measure, alloc);
+	__cache_account(cache);
+	return get_page(&cache->pages, i);
+}
+
+void
+mm_cache_free(struct mm_cache *cache, struct page *page)
+{
+	u32 i = page_index(&cache->pages, page);
+
+	assert(cache->run[i].state == MM_CACHE_USED);
+	__cache_free(cache, i);
+	__cache_account(cache);
+}
+
+u32
+mm_cache_reap(struct mm_cache *cache, timestamp_t now)
+{
+	u32 i = 0, reaped = 0;
+
+	/* run to run; a freed run skips to the end of the free run it joins */
+	while (i < cache->pages.total) {
+		struct mm_cache_run *r = &cache->run[i];
+		if (!mm_cache_run_expired(r, now)) {
+			i += r->pages;
+			continue;
+		}
+		if (cache->policy.expire)
+			cache->policy.expire(cache->policy.arg,
+			                     get_page(&cache->pages, i));
+		i = __cache_free(cache, i);
+		reaped++;
+	}
+	measure_add(cache->measure, expire, reaped);
+	__cache_account(cache);
+	return reaped;
+}
+
+u32
+mm_cache_release(struct mm_cache *cache, u32 keep)
+{
+	u32 released = 0;
+
+	while (cache->dirty > keep && cache->binmap[0]) {
+		u32 b = 31 - __builtin_clz(cache->binmap[0]);
+		u32 i = cache->bin[0][b], n = cache->run[i].pages;
+		u32 excess = cache->dirty - keep;
+
+		__cache_bin_del(cache, i);
+		/* keep the head of a run longer than the excess dirty */
+		if (n > excess) {
+			__cache_mark(cache, i, n - excess, MM_CACHE_DIRTY);
+			__cache_bin_add(cache, i);
+			measure_inc(cache->measure, split);
+			i += n - excess;
+			n = excess;
+		}
+		__cache_release_run(cache, i, n);
+		released += n;
+	}
+	__cache_account(cache);
+	return released;
+}
+
+u32
+mm_cache_gc(struct mm_cache *cache, timestamp_t now)
+{
+	mm_cache_reap(cache, now);
+	return mm_cache_release(cache, cache->policy.keep);
+}
+
+#else
+
+int
+mm_cache_init(struct mm_cache *cache, unsigned int page_bits, u32 total,
+              const struct mm_cache_policy *policy)
+{
+	memset(cache, 0, sizeof(*cache));
+	return -1;
+}
+
+void
+mm_cache_fini(struct mm_cache *cache)
+{
+}
+
+struct page *
+mm_cache_alloc_ex(struct mm_cache *cache, size_t size, timestamp_t now,
+                  u32 ttl, u32 idle)
+{
+	return NULL;
+}
+
+void
+mm_cache_free(struct mm_cache *cache, struct page *page)
+{
+}
+
+u32
+mm_cache_reap(struct mm_cache *cache, timestamp_t now)
+{
+	return 0;
+}
+
+u32
+mm_cache_release(struct mm_cache *cache, u32 keep)
+{
+	return 0;
+}
+
+u32
+mm_cache_gc(struct mm_cache *cache, timestamp_t now)
+{
+	return 0;
+}
+
+#endif
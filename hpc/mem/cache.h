@@ -24,31 +24,243 @@
  * THE SOFTWARE.
  */
  
+/*
+ * An expiring page cache for variable-length payloads - response bodies,
+ * rendered fragments, decoded blobs - on top of the page array of
+ * <mem/page.h>. What struct slab_cache (<mem/slab_cache.h>) is for blocks of
+ * one size, this is for runs of pages of any size.
+ *
+ * Runs
+ * ----
+ * mm_cache_alloc() hands out a run of contiguous pages, as many as @size
+ * takes, page aligned; the struct page it returns is the first byte of the
+ * payload. The page array is mapped once with pages_map() and managed by page
+ * index: every page has an out-of-band struct mm_cache_run, meaningful at the
+ * head and the tail page of a run - its length and state at both, so a freed
+ * run finds and merges with its neighbours in O(1), and the expiry and free
+ * list links at the head. A request takes the first fit from size bins, one
+ * per power of two of pages, and splits off what it does not need; a free
+ * merges the run with its free neighbours. Pages freed by a run of one size
+ * so serve the next run of any other.
+ *
+ * Expiry
+ * ------
+ * As for slab_cache, a run expires when either deadline passes: the TTL since
+ * it was allocated, or the idle window since it was last touched.
+ * mm_cache_touch() opens a new idle window, mm_cache_expires() moves the TTL.
+ * mm_cache_reap() frees the runs expired at @now, calling @policy.expire on
+ * each first so an index pointing at it can drop the entry; it walks the runs,
+ * not the pages. Times are milliseconds, as everywhere in mem/.
+ *
+ * Giving pages back
+ * -----------------
+ * A free run stays dirty - resident, and the first choice of the next
+ * allocation - until a gc gives its pages back to the OS with MADV_DONTNEED.
+ * mm_cache_gc() reaps, then releases dirty pages down to @policy.keep, the
+ * largest runs first and splitting the last, so the cache holds at most that
+ * much memory it does not use. Released (clean) runs merge only with clean
+ * neighbours and are allocated when no dirty run fits. An allocation that
+ * fits neither releases a dirty run whose clean neighbours make up the room,
+ * so the three merge, or failing that every dirty run, and tries once more.
+ * A @keep below what a gc period frees costs page faults: what a gc gives
+ * back, the allocations after it fault in again. Nothing is ever unmapped
+ * before mm_cache_fini().
+ *
+ * With a struct mm_cache_measure (<mem/measure.h>) attached as cache->measure
+ * the cache counts its allocations, splits, merges, expiries and releases,
+ * and keeps the page figures of mm_cache_used(), _dirty() and _clean() as
+ * gauges.
+ *
+ * A cache belongs to one thread at a time. Under MEM_MALLOC_FREE, with no
+ * page array to manage, mm_cache_init() fails.
+ */
+
 #ifndef __MM_CACHE_GENERIC_H__
 #define __MM_CACHE_GENERIC_H__
 
 #include <hpc/compiler.h>
 #include <hpc/cpu.h>
-#include <hpc/log.h>
 #include <mem/alloc.h>
-#include <mem/savep.h>
-#include <mem/debug.h>
-#include <mem/generic.h>
-#include <assert.h>
+#include <mem/page.h>
+#include <mem/measure.h>
+
+__BEGIN_DECLS
+
+#define MM_CACHE_NIL   ((u32)~0U)
+#define MM_CACHE_BINS  32
+
+/* Run states, at the head and the tail page of a run. */
+enum mm_cache_state {
+	MM_CACHE_USED  = 1,           /* handed out                           */
+	MM_CACHE_DIRTY = 2,           /* free, pages resident                 */
+	MM_CACHE_CLEAN = 3,           /* free, pages given back to the OS     */
+};
 
-struct page;
+/*
+ * @ttl     default TTL of a run (ms), 0 = none
+ * @idle    default idle timeout (ms), 0 = none
+ * @keep    dirty pages a gc leaves resident
+ * @expire  called on a run mm_cache_reap() is about to free
+ */
+struct mm_cache_policy {
+	u32 ttl;
+	u32 idle;
+	u32 keep;
+	void (*expire)(void *arg, struct page *page);
+	void *arg;
+};
+
+struct mm_cache_run {
+	u32 pages;                    /* run length: head and tail page       */
+	u32 state;                    /* enum mm_cache_state: head and tail   */
+	u32 next, prev;               /* size bin links: free run's head      */
+	timestamp_t ttl_at;           /* absolute TTL deadline, 0 = none      */
+	timestamp_t atime;            /* last touch                           */
+	u32 idle;                     /* idle timeout, 0 = none               */
+	u32 unused;
+};
 
 struct mm_cache {
-	int unused;
+	struct pages pages;           /* the page array                       */
+	struct mm_cache_run *run;     /* per page [pages.total]               */
+	u32 bin[2][MM_CACHE_BINS];    /* free runs by size: dirty, clean      */
+	u32 binmap[2];                /* non-empty bins                       */
+	u32 used;                     /* pages in live runs                   */
+	u32 dirty;                    /* pages in dirty free runs             */
+	u32 clean;                    /* pages in clean free runs             */
+	u32 live;                     /* live runs                            */
+	struct mm_cache_policy policy;
+	measure_member(mm_cache);
 };
 
+/*
+ * mm_cache_init - map @total pages of 1 << @page_bits for the cache.
+ *
+ * @page_bits is at least the CPU page. Nothing is faulted in: all pages start
+ * as one clean run. Returns 0, or -1 when the array cannot be mapped.
+ */
+int
+mm_cache_init(struct mm_cache *cache, unsigned int page_bits, u32 total,
+              const struct mm_cache_policy *policy);
+
+void
+mm_cache_fini(struct mm_cache *cache);
+
+/*
+ * mm_cache_alloc_ex - a run of pages for @size bytes, with its own TTL and
+ * idle timeout. Returns NULL when no free run, merged or not, is big enough.
+ */
 struct page *
-mm_cache_alloc(struct mm_cache *cache, size_t size, int flags);
+mm_cache_alloc_ex(struct mm_cache *cache, size_t size, timestamp_t now,
+                  u32 ttl, u32 idle);
+
+/* mm_cache_alloc - as above, with the policy's TTL and idle timeout. */
+static inline struct page *
+mm_cache_alloc(struct mm_cache *cache, size_t size, timestamp_t now)
+{
+	return mm_cache_alloc_ex(cache, size, now, cache->policy.ttl,
+	                         cache->policy.idle);
+}
 
 void
 mm_cache_free(struct mm_cache *cache, struct page *page);
 
-void
-mm_cache_expires(struct page *page);
+#ifndef MEM_MALLOC_FREE
+static inline struct mm_cache_run *
+mm_cache_run(struct mm_cache *cache, struct page *page)
+{
+	return &cache->run[page_index(&cache->pages, page)];
+}
+
+static inline bool
+mm_cache_run_expired(const struct mm_cache_run *r, timestamp_t now)
+{
+	if (r->state != MM_CACHE_USED)
+		return false;
+	if (r->ttl_at && now >= r->ttl_at)
+		return true;
+	if (r->idle && now >= r->atime && (now - r->atime) >= r->idle)
+		return true;
+	return false;
+}
+
+/* mm_cache_size - payload bytes of the run, whole pages. */
+static inline size_t
+mm_cache_size(struct mm_cache *cache, struct page *page)
+{
+	return (size_t)mm_cache_run(cache, page)->pages << cache->pages.shift;
+}
+
+/*
+ * mm_cache_expires - set the run's TTL deadline to @at, absolute; 0 lifts it.
+ * A deadline already passed expires the run at the next reap.
+ */
+static inline void
+mm_cache_expires(struct mm_cache *cache, struct page *page, timestamp_t at)
+{
+	mm_cache_run(cache, page)->ttl_at = at;
+}
+
+/*
+ * mm_cache_touch - mark the run used at @now, opening a new idle window.
+ * Returns false when it has already expired and is the next reap's.
+ */
+static inline bool
+mm_cache_touch(struct mm_cache *cache, struct page *page, timestamp_t now)
+{
+	struct mm_cache_run *r = mm_cache_run(cache, page);
+	if (mm_cache_run_expired(r, now))
+		return false;
+	r->atime = now;
+	return true;
+}
+
+static inline bool
+mm_cache_expired(struct mm_cache *cache, struct page *page, timestamp_t now)
+{
+	return mm_cache_run_expired(mm_cache_run(cache, page), now);
+}
+#endif
+
+/* mm_cache_reap - free every run expired at @now; returns how many. */
+u32
+mm_cache_reap(struct mm_cache *cache, timestamp_t now);
+
+/*
+ * mm_cache_release - give dirty pages back to the OS until at most @keep stay
+ * resident. Returns the pages released.
+ */
+u32
+mm_cache_release(struct mm_cache *cache, u32 keep);
+
+/* mm_cache_gc - reap at @now, then release down to the policy's @keep. */
+u32
+mm_cache_gc(struct mm_cache *cache, timestamp_t now);
+
+static inline u32
+mm_cache_used(struct mm_cache *cache)
+{
+	return cache->used;
+}
+
+static inline u32
+mm_cache_dirty(struct mm_cache *cache)
+{
+	return cache->dirty;
+}
+
+static inline u32
+mm_cache_clean(struct mm_cache *cache)
+{
+	return cache->clean;
+}
+
+static inline u32
+mm_cache_live(struct mm_cache *cache)
+{
+	return cache->live;
+}
+
+__END_DECLS
 
 #endif
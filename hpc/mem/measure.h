@@ -42,14 +42,17 @@
 
 /*
  * Counters (monotonic event totals):
- * - alloc:   blocks handed out by slab_alloc()
- * - free:    blocks returned by slab_free()
- * - fail:    allocations that returned NULL (reservation exhausted)
+ * - alloc:   blocks handed out by slab_alloc() and slab_alloc_bulk()
+ * - free:    blocks returned by slab_free() and slab_free_bulk()
+ * - fail:    allocations that returned NULL, or batches that came back short
+ *            (reservation exhausted)
  * - grow:    grow steps taken (working set committed)
  * - shrink:  shrink steps taken (tail memory returned to the OS)
  * - gc:      slab_gc() passes that changed the committed set
  * - commit:  blocks committed, summed across all grow steps
  * - reclaim: blocks reclaimed, summed across all shrink steps
+ * - compact: blocks moved out of the tail by slab_compact()
+ * - virgin:  blocks slab_zalloc() handed out known zero, without a memset
  *
  * Gauges (current levels, move up and down):
  * - used:      live (allocated) blocks right now
@@ -69,10 +72,176 @@
 	C(_ns, gc,        "GC passes that changed the committed set") \
 	C(_ns, commit,    "Blocks committed across all grows") \
 	C(_ns, reclaim,   "Blocks reclaimed across all shrinks") \
+	C(_ns, compact,   "Blocks moved down by slab_compact") \
+	C(_ns, virgin,    "Zeroed blocks handed out without a memset") \
+	C(_ns, prefault,  "Pages populated ahead - first-touch faults avoided") \
+	C(_ns, lazy,      "Blocks released lazily with MADV_FREE") \
+	C(_ns, cold,      "Lazily released blocks advised cold or paged out") \
+	C(_ns, zap,       "Blocks released for good with MADV_DONTNEED") \
+	C(_ns, rewarm,    "Lazily released blocks committed again before a zap") \
 	G(_ns, used,      "Live (allocated) blocks") \
 	G(_ns, committed, "Blocks currently committed") \
 	R(_ns, usage, used, committed, "Live blocks as percent of committed")
 
 DEFINE_MEASURE(slab, SLAB_METRICS);
 
+/*
+ * Decisions of the adaptive policy controller, <mem/slab_tune.h>. One struct per
+ * controller, attached as tune->measure; the controller is what counts here,
+ * not the slab.
+ *
+ * Counters:
+ * - decide:     history rows the controller looked at
+ * - step_up:    grow_step raised - growth came in many small steps, or failed
+ * - step_down:  grow_step lowered - over the budget, or growth settled
+ * - dwell_up:   shrink_after lengthened - grow/shrink oscillation
+ * - dwell_down: shrink_after shortened - over the budget, or memory held idle
+ * - over:       rows that found the committed peak over the RSS budget
+ * - flips:      grow/shrink direction changes seen, summed over the decisions
+ *
+ * Gauges:
+ * - grow_step, shrink_after: the knobs in force (blocks, milliseconds)
+ * - peak:       the committed peak of the last window, blocks
+ * - budget:     the RSS budget, blocks (0: none)
+ *
+ * Ratio:
+ * - budget_use: peak as percent of budget
+ */
+#define SLAB_TUNE_METRICS(_ns, C, G, R) \
+	C(_ns, decide,       "History rows the controller decided on") \
+	C(_ns, step_up,      "grow_step raised: many small grows, or failures") \
+	C(_ns, step_down,    "grow_step lowered: over budget, or growth settled") \
+	C(_ns, dwell_up,     "shrink_after lengthened: grow/shrink oscillation") \
+	C(_ns, dwell_down,   "shrink_after shortened: over budget, or idle") \
+	C(_ns, over,         "Rows with the committed peak over the RSS budget") \
+	C(_ns, flips,        "Grow/shrink direction changes seen") \
+	G(_ns, grow_step,    "grow_step in force, blocks") \
+	G(_ns, shrink_after, "shrink_after in force, ms") \
+	G(_ns, peak,         "Committed peak of the last window, blocks") \
+	G(_ns, budget,       "RSS budget, blocks") \
+	R(_ns, budget_use, peak, budget, "Committed peak as percent of budget")
+
+DEFINE_MEASURE(slab_tune, SLAB_TUNE_METRICS);
+
+/*
+ * Buddy mode of the page array, <mem/page.h>. Attached as pages->measure.
+ *
+ * Counters:
+ * - alloc:    blocks handed out by pages_alloc_order()
+ * - free:     blocks returned by pages_free_order()
+ * - fail:     allocations no free block was large enough for
+ * - split:    blocks split in two for a smaller order
+ * - merge:    blocks merged with their buddy on a free
+ *
+ * Gauges:
+ * - avail:    pages free
+ * - largest:  pages in the largest free block
+ * - frag:     free pages outside the largest free block, percent of avail:
+ *             0 when all free memory is one block, near 100 when it is
+ *             scattered in small ones
+ *
+ * Ratio:
+ * - merge_rate: merges per freed block, percent
+ */
+#define PAGES_METRICS(_ns, C, G, R) \
+	C(_ns, alloc,    "Blocks handed out") \
+	C(_ns, free,     "Blocks returned") \
+	C(_ns, fail,     "Allocations no free block was large enough for") \
+	C(_ns, split,    "Blocks split for a smaller order") \
+	C(_ns, merge,    "Blocks merged with their buddy") \
+	G(_ns, avail,    "Pages free") \
+	G(_ns, largest,  "Pages in the largest free block") \
+	G(_ns, frag,     "Free pages outside the largest free block, percent") \
+	R(_ns, merge_rate, merge, free, "Merges per freed block")
+
+DEFINE_MEASURE(pages, PAGES_METRICS);
+
+/*
+ * Chunked arena, <mem/pool.h>. One struct per arena or shared by several,
+ * attached as pool->measure.
+ *
+ * Counters:
+ * - alloc:    allocations handed out, open allocations ended included
+ * - large:    allocations over the threshold, on a chunk of their own
+ * - chunk:    chunks mapped from the OS
+ * - recycle:  chunks taken from the block cache instead
+ * - release:  chunks returned to the OS by a trim or destroy
+ * - save:     savepoints taken, saved or pushed
+ * - restore:  rewinds to a savepoint
+ * - flush:    rewinds to empty
+ * - rewind:   frees of the last allocation, reclaimed at once
+ * - defer:    frees left to the next restore or flush
+ * - hugetlb:  chunks mapped on hugetlbfs pages (MM_HUGE_PAGE)
+ * - thp:      chunks mapped aligned and advised MADV_HUGEPAGE instead
+ *
+ * Gauges:
+ * - size:     bytes handed out and not rewound
+ * - total:    chunk bytes in use
+ * - cached:   chunk bytes in the block cache
+ * - backing:  the weakest backing of any chunk: 0 base pages, 1 THP,
+ *             2 hugetlbfs (VM_BACKING_* in <mem/vm.h>)
+ *
+ * Ratio:
+ * - fill:     size as percent of total
+ */
+#define MM_POOL_METRICS(_ns, C, G, R) \
+	C(_ns, alloc,    "Allocations handed out") \
+	C(_ns, large,    "Allocations on a chunk of their own") \
+	C(_ns, chunk,    "Chunks mapped from the OS") \
+	C(_ns, recycle,  "Chunks reused from the block cache") \
+	C(_ns, release,  "Chunks returned to the OS") \
+	C(_ns, save,     "Savepoints taken") \
+	C(_ns, restore,  "Rewinds to a savepoint") \
+	C(_ns, flush,    "Rewinds to empty") \
+	C(_ns, rewind,   "Frees of the last allocation, reclaimed at once") \
+	C(_ns, defer,    "Frees left to the next restore or flush") \
+	C(_ns, hugetlb,  "Chunks mapped on hugetlbfs pages") \
+	C(_ns, thp,      "Chunks mapped for transparent huge pages") \
+	G(_ns, size,     "Bytes handed out and not rewound") \
+	G(_ns, total,    "Chunk bytes in use") \
+	G(_ns, cached,   "Chunk bytes in the block cache") \
+	G(_ns, backing,  "Weakest chunk backing: 0 page, 1 THP, 2 hugetlbfs") \
+	R(_ns, fill, size, total, "Bytes handed out as percent of chunk bytes")
+
+DEFINE_MEASURE(mm_pool, MM_POOL_METRICS);
+
+/*
+ * Expiring page cache, <mem/cache.h>. Attached as cache->measure.
+ *
+ * Counters:
+ * - alloc:    runs handed out
+ * - free:     runs freed, by mm_cache_free() or a reap
+ * - fail:     allocations no free run could take
+ * - split:    free runs split for a smaller request or a partial release
+ * - merge:    free runs merged with a free neighbour
+ * - expire:   runs freed by a reap
+ * - release:  pages given back to the OS
+ * - purge:    allocations that released dirty runs to find room
+ *
+ * Gauges:
+ * - total:    pages in the array
+ * - used:     pages in live runs
+ * - dirty:    pages free and resident
+ * - clean:    pages free and given back
+ *
+ * Ratio:
+ * - usage:    used as percent of total
+ */
+#define MM_CACHE_METRICS(_ns, C, G, R) \
+	C(_ns, alloc,    "Runs handed out") \
+	C(_ns, free,     "Runs freed") \
+	C(_ns, fail,     "Allocations no free run could take") \
+	C(_ns, split,    "Free runs split") \
+	C(_ns, merge,    "Free runs merged with a neighbour") \
+	C(_ns, expire,   "Runs freed by a reap") \
+	C(_ns, release,  "Pages given back to the OS") \
+	C(_ns, purge,    "Allocations that released dirty runs for room") \
+	G(_ns, total,    "Pages in the array") \
+	G(_ns, used,     "Pages in live runs") \
+	G(_ns, dirty,    "Pages free and resident") \
+	G(_ns, clean,    "Pages free and given back") \
+	R(_ns, usage, used, total, "Pages used as percent of the array")
+
+DEFINE_MEASURE(mm_cache, MM_CACHE_METRICS);
+
 #endif/*__HPC_MEM_MEASURE_H__*/
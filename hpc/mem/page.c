@@ -4,6 +4,8 @@
 #include <hpc/list.h>
 #include <mem/page.h>
 
+#include <stdlib.h>
+
 #ifndef MEM_MALLOC_FREE
 static inline u64
 pages_total_bytes(unsigned int bits, unsigned int page_bits, unsigned int total)
@@ -25,6 +27,11 @@ pages_alloc(struct pages *pages, int prot, int mode,
 	pages->list  = 0;
 	pages->total = pages->avail = total;
 	pages->shift = page_bits;
+	pages->buddy = 0;
+	pages->bitmap = NULL;
+#ifdef CONFIG_MEASURE
+	pages->measure = NULL;
+#endif
 
 	pages->page = mmap(NULL, pages->size, prot, mode, -1, 0);
 	if (pages->page == MAP_FAILED)
@@ -38,6 +45,33 @@ failed:
 #endif
 }
 
+int
+pages_map(struct pages *pages, int prot, int mode, int page_bits, u32 total)
+{
+	pages->shift = page_bits;
+#ifdef MEM_MALLOC_FREE
+	pages->page = 0;
+	return -1;
+#else
+	pages->size  = (u64)total << page_bits;
+	pages->list  = (u32)~0U;
+	pages->avail = 0;
+	pages->total = total;
+	pages->buddy = 0;
+	pages->bitmap = NULL;
+#ifdef CONFIG_MEASURE
+	pages->measure = NULL;
+#endif
+
+	pages->page = mmap(NULL, pages->size, prot, mode, -1, 0);
+	if (pages->page == MAP_FAILED) {
+		pages->page = NULL;
+		return -1;
+	}
+	return 0;
+#endif
+}
+
 void
 pages_reset(struct pages *pages)
 {
@@ -49,10 +83,157 @@ pages_reset(struct pages *pages)
 #endif
 }
 
+#ifndef MEM_MALLOC_FREE
+static inline void
+__buddy_account(struct pages *vm)
+{
+	u32 largest = vm->areamap ? 1U << (31 - __builtin_clz(vm->areamap)) : 0;
+	measure_set(vm->measure, avail, vm->avail);
+	measure_set(vm->measure, largest, largest);
+	measure_set(vm->measure, frag,
+	            vm->avail ? 100ULL * (vm->avail - largest) / vm->avail : 0);
+	(void)largest;
+}
+
+/* Flip the pair bit of block @index at @order; returns the bit as it is now. */
+static inline int
+__buddy_toggle(struct pages *vm, u32 index, u32 order)
+{
+	u32 bit = vm->mapoff[order] + (index >> (order + 1));
+	u64 mask = 1ULL << (bit & 63);
+	return !!((vm->bitmap[bit >> 6] ^= mask) & mask);
+}
+
+static inline void
+__buddy_add(struct pages *vm, u32 index, u32 order)
+{
+	struct page *page = get_page(vm, index);
+	page->avail = vm->area[order];
+	page->prev = (u32)~0U;
+	if (page->avail != (u32)~0U)
+		get_page(vm, page->avail)->prev = index;
+	vm->area[order] = index;
+	vm->areamap |= 1U << order;
+}
+
+static inline void
+__buddy_del(struct pages *vm, u32 index, u32 order)
+{
+	struct page *page = get_page(vm, index);
+	if (page->prev != (u32)~0U)
+		get_page(vm, page->prev)->avail = page->avail;
+	else
+		vm->area[order] = page->avail;
+	if (page->avail != (u32)~0U)
+		get_page(vm, page->avail)->prev = page->prev;
+	if (vm->area[order] == (u32)~0U)
+		vm->areamap &= ~(1U << order);
+}
+
+static void
+__buddy_free(struct pages *vm, u32 index, u32 order)
+{
+	vm->avail += 1U << order;
+	/* a pair bit back at 0 means the buddy is free too: merge */
+	for (; order < vm->order; order++) {
+		if (__buddy_toggle(vm, index, order))
+			break;
+		__buddy_del(vm, index ^ (1U << order), order);
+		index &= ~(1U << order);
+		measure_inc(vm->measure, merge);
+	}
+	__buddy_add(vm, index, order);
+}
+#endif
+
+int
+pages_buddy(struct pages *vm, u32 order)
+{
+#ifndef MEM_MALLOC_FREE
+	u32 bits = 0, index = 0;
+
+	if (order > PAGES_MAX_ORDER)
+		return -1;
+	for (u32 k = 0; k < order; k++) {
+		vm->mapoff[k] = bits;
+		bits += (u32)(((u64)vm->total + (2ULL << k) - 1) >> (k + 1));
+	}
+	free(vm->bitmap);
+	vm->bitmap = NULL;
+	if (bits && !(vm->bitmap = (u64 *)calloc((bits + 63) / 64, 8)))
+		return -1;
+	vm->buddy = 1;
+	vm->order = order;
+	vm->list = (u32)~0U;
+	vm->avail = 0;
+	vm->areamap = 0;
+	for (u32 k = 0; k <= PAGES_MAX_ORDER; k++)
+		vm->area[k] = (u32)~0U;
+
+	/* every block starts allocated, pair bits 0; free the largest tiles */
+	while (index < vm->total) {
+		u32 k = order;
+		while (k && ((index & ((1U << k) - 1)) ||
+		             (u64)index + (1U << k) > vm->total))
+			k--;
+		__buddy_free(vm, index, k);
+		index += 1U << k;
+	}
+	__buddy_account(vm);
+#endif
+	return 0;
+}
+
+struct page *
+pages_alloc_order(struct pages *vm, u32 order)
+{
+#ifdef MEM_MALLOC_FREE
+	return (struct page *)malloc((size_t)1 << (vm->shift + order));
+#else
+	u32 mask = order <= vm->order ? vm->areamap & ~((1U << order) - 1) : 0;
+	u32 index, k;
+
+	if (!mask) {
+		measure_inc(vm->measure, fail);
+		return NULL;
+	}
+	k = __builtin_ctz(mask);
+	index = vm->area[k];
+	__buddy_del(vm, index, k);
+	if (k < vm->order)
+		__buddy_toggle(vm, index, k);
+	/* split down, the upper half of each split stays free */
+	while (k > order) {
+		k--;
+		__buddy_add(vm, index + (1U << k), k);
+		__buddy_toggle(vm, index, k);
+		measure_inc(vm->measure, split);
+	}
+	vm->avail -= 1U << order;
+	measure_inc(vm->measure, alloc);
+	__buddy_account(vm);
+	return get_page(vm, index);
+#endif
+}
+
+void
+pages_free_order(struct pages *vm, struct page *page, u32 order)
+{
+#ifdef MEM_MALLOC_FREE
+	free(page);
+#else
+	__buddy_free(vm, page_index(vm, page), order);
+	measure_inc(vm->measure, free);
+	__buddy_account(vm);
+#endif
+}
+
 int
 pages_free(struct pages *pages)
 {
 #ifndef MEM_MALLOC_FREE
+	free(pages->bitmap);
+	pages->bitmap = NULL;
 	return munmap(pages->page, pages->size);
 #else
 	return 0;
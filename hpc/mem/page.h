@@ -30,14 +30,47 @@
 #include <hpc/log.h>
 #include <sys/mman.h>
 #include <mem/alloc.h>
+#include <mem/measure.h>
 
 #define PAGE_HDR_SHIFT  9
 #define PAGE_HDR_MAGIC 0x40000000
 #define PAGE_HDR_FREE  0xffffffff
 #define PAGE_HDR_PART  0x80000000 /* bit mask for page parts */
 
+/* The largest block of the buddy mode: 1 << PAGES_MAX_ORDER pages. */
+#define PAGES_MAX_ORDER 20
+
 __BEGIN_DECLS
 
+/*
+ * Two modes over the same reservation of @total pages, addressed by index:
+ *
+ * Single pages  pages_alloc() threads a free list of pages through the pages
+ *               themselves, and page_alloc() / page_free() pop and push one.
+ *
+ * Buddy         pages_buddy() turns the reservation into binary-buddy blocks
+ *               of 1 << order contiguous pages, order 0 to @order, for runs
+ *               such as large I/O buffers that would otherwise each be an
+ *               mmap(). pages_alloc_order() takes the smallest free block of
+ *               at least the order asked for and splits it down, putting the
+ *               upper halves on the free lists of their orders;
+ *               pages_free_order() merges a block with its buddy for as long
+ *               as the buddy is free. A block's buddy is its index with bit
+ *               @order flipped, and one bit per buddy pair and order - free
+ *               XOR free, toggled on every alloc and free - tells whether the
+ *               buddy is free without reading it. The per-order free lists
+ *               are doubly linked through the first page of each free block,
+ *               so a merge unlinks the buddy in O(1). A block of the map that
+ *               is not a power of two is tiled with the largest aligned
+ *               blocks that fit, and a block at its end never merges.
+ *
+ * get_page() and page_index() work the same in both. In buddy mode
+ * page_alloc(), page_free() and page_avail() are not used; @avail counts the
+ * free pages and pages_alloc_order(pages, 0) takes a single one. With a
+ * struct pages_measure (<mem/measure.h>) attached as pages->measure the buddy
+ * mode counts splits and merges and keeps the free pages, the largest free
+ * block and the fragmentation of the rest as gauges.
+ */
 struct page;
 struct pages {
 	u32 magic;
@@ -47,6 +80,13 @@ struct pages {
 	u32 list;             /* list of free pages */
 	u32 avail;            /* number of free pages in list */
 	u32 total;            /* number of pages in map                    */
+	u32 order;            /* buddy mode: the largest block's order     */
+	u32 buddy;            /* buddy mode is on                          */
+	u32 areamap;          /* buddy mode: orders with a free block      */
+	u32 area[PAGES_MAX_ORDER + 1]; /* buddy mode: free blocks by order */
+	u32 mapoff[PAGES_MAX_ORDER];   /* buddy mode: first bit of an order */
+	u64 *bitmap;          /* buddy mode: free XOR free, per pair       */
+	measure_member(pages);
 #endif
 	u32 shift;            /* page size aligned to power of 2           */
 	struct page *page;
@@ -54,7 +94,7 @@ struct pages {
 
 struct page {
 	u32 avail;            /* linked list of available pages            */
-	u32 padding;
+	u32 prev;             /* buddy mode: previous free block           */
 } _align_max;
 
 #ifndef MEM_MALLOC_FREE
@@ -147,6 +187,36 @@ int
 pages_alloc(struct pages *pages, int prot, int mode,
             int vm_bits, int page_bits, int total);
 
+/*
+ * pages_buddy - switch a mapped reservation to buddy mode, every page free, in
+ * blocks of up to 1 << @order pages. Writes the first page of each block only.
+ * Returns 0, or -1 when @order is over PAGES_MAX_ORDER or the bitmap cannot
+ * be allocated.
+ */
+int
+pages_buddy(struct pages *pages, u32 order);
+
+/*
+ * pages_alloc_order - a block of 1 << @order contiguous pages, or NULL when no
+ * free block is large enough.
+ */
+struct page *
+pages_alloc_order(struct pages *pages, u32 order);
+
+/* pages_free_order - return a block; @order as it was allocated with. */
+void
+pages_free_order(struct pages *pages, struct page *page, u32 order);
+
+/*
+ * pages_map - map @total pages of 1 << @page_bits and leave them untouched.
+ *
+ * Unlike pages_alloc() the free list is not threaded through the pages, which
+ * would fault in every one of them: the list starts empty and the caller
+ * manages the pages itself, by index. pages_free() unmaps them as usual.
+ */
+int
+pages_map(struct pages *pages, int prot, int mode, int page_bits, u32 total);
+
 void
 pages_reset(struct pages *pages);
 
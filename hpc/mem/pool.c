@@ -3,52 +3,229 @@
 #include <hpc/slist.h>
 #include <mem/alloc.h>
 #include <mem/pool.h>
-	
-void *
-__pool_alloc_block(struct mm_pool *pool, size_t size)
+
+/* The chunk header, struct mm_vblock, rounded as vm_vblock_alloc() rounds it. */
+#define POOL_HDR align_addr(sizeof(struct mm_vblock))
+
+static inline void *
+__pool_data(struct mm_vblock *b)
 {
-	struct mm_vblock *block;
-	size_t aligned = align_to(size, CPU_ADDR_ALIGN);
+	return (u8 *)b - b->size;
+}
+
+/*
+ * Data bytes of the smallest chunk holding @size: its mapping rounded to base
+ * pages, or to huge pages under MM_HUGE_PAGE.
+ */
+static inline size_t
+__pool_round(size_t size, unsigned int flags)
+{
+	size_t page = flags & MM_HUGE_PAGE ? VM_HUGE_PAGE_SIZE : CPU_PAGE_SIZE;
+	return align_to(size + POOL_HDR, page) - POOL_HDR;
+}
+
+static inline size_t
+__pool_chunk_size(struct mm_pool *pool, size_t size)
+{
+	return __pool_round(size, pool->flags);
+}
+
+/* Where the first chunk's allocations start: past the pool itself. */
+static inline size_t
+__pool_first_avail(struct mm_pool *pool, struct mm_vblock *b)
+{
+	return b->size - align_to(sizeof(*pool), MM_POOL_ALIGN);
+}
+
+static inline void
+__pool_account(struct mm_pool *pool)
+{
+	measure_set(pool->measure, size, pool->save.size);
+	measure_set(pool->measure, total, pool->total_bytes);
+	measure_set(pool->measure, cached, pool->cached_bytes);
+	measure_set(pool->measure, backing, pool->backing);
+}
+
+/* Map a chunk of @size data bytes, on huge pages if the pool asked for them. */
+static struct mm_vblock *
+__pool_map(struct mm_pool *pool, size_t size)
+{
+	int backing;
+	struct mm_vblock *b;
+
+	if (!(pool->flags & MM_HUGE_PAGE))
+		return (struct mm_vblock *)vm_vblock_alloc(size);
+	b = (struct mm_vblock *)vm_vblock_alloc_huge(size, &backing);
+	measure_inc_if(pool->measure, backing == VM_BACKING_HUGETLB, hugetlb);
+	measure_inc_if(pool->measure, backing == VM_BACKING_THP, thp);
+	if ((unsigned int)backing < pool->backing)
+		pool->backing = (unsigned int)backing;
+	return b;
+}
+
+/* A chunk of at least @size data bytes: from the block cache, or mapped. */
+static struct mm_vblock *
+__pool_chunk(struct mm_pool *pool, size_t size)
+{
+	struct mm_vblock *b, **link;
+
+	/* regular chunks are all of @blocksize, large ones page rounded */
+	if (size <= pool->blocksize) {
+		size = pool->blocksize;
+		link = &pool->avail;
+	} else {
+		size = __pool_chunk_size(pool, size);
+		link = &pool->spare;
+	}
+	for (; (b = *link); link = (struct mm_vblock **)&b->node.next)
+		if (b->size >= size)
+			break;
+	if (b) {
+		*link = (struct mm_vblock *)b->node.next;
+		pool->cached_bytes -= b->size;
+		measure_inc(pool->measure, recycle);
+	} else {
+		b = __pool_map(pool, size);
+		measure_inc(pool->measure, chunk);
+	}
+	pool->total_bytes += b->size;
+	return b;
+}
+
+/* Hand a chunk the arena is done with to the block cache. */
+static void
+__pool_recycle(struct mm_pool *pool, struct mm_vblock *b)
+{
+	struct mm_vblock **list;
 
-	block = (struct mm_vblock *)vm_vblock_alloc(aligned);
-	slist_add((struct snode *)pool->save.final[1], &block->node);
+	list = b->size <= pool->blocksize ? &pool->avail : &pool->spare;
+	b->node.next = (struct snode *)*list;
+	*list = b;
+	pool->total_bytes -= b->size;
+	pool->cached_bytes += b->size;
+}
 
+/*
+ * Open a fresh chunk for a request of @size bytes, on the chain its size
+ * belongs to, and make its whole room the open allocation.
+ */
+static void *
+__pool_open(struct mm_pool *pool, size_t size)
+{
+	struct mm_vblock *b;
+
+	pool->last = NULL;
+	if (size <= pool->threshold) {
+		b = __pool_chunk(pool, pool->blocksize);
+		b->node.next = (struct snode *)pool->save.final[0];
+		pool->save.final[0] = b;
+		pool->save.avail[0] = b->size;
+		pool->index = 0;
+		return __pool_data(b);
+	}
+	b = __pool_chunk(pool, size);
+	b->node.next = (struct snode *)pool->save.final[1];
+	pool->save.final[1] = b;
+	pool->save.avail[1] = b->size;
 	pool->index = 1;
-	pool->save.final[1] = block;
-	pool->save.avail[1] = aligned - size;
-	return pool->final = (void *)((u8*)block - aligned);
+	measure_inc(pool->measure, large);
+	return pool->final = __pool_data(b);
 }
 
-void *
-__pool_alloc_avail(struct mm_pool *pool, size_t size, size_t avail)
+/*
+ * Resize the newest large chunk to hold @size, by mremap() where it can: the
+ * header is rewritten at the new end and the chain relinked to it. The chunk's
+ * contents move with it; its room is the caller's to set. A huge-page chunk is
+ * copied to a fresh one instead: mremap() neither keeps a THP range aligned nor
+ * moves hugetlbfs pages everywhere.
+ */
+static void *
+__pool_remap(struct mm_pool *pool, size_t size)
 {
-	pool->save.avail[0] = avail - size;
-	return (u8*)pool->save.final[0] - avail;
+	struct mm_vblock *b = (struct mm_vblock *)pool->save.final[1];
+	struct snode *next = b->node.next;
+	size_t osize = b->size, nsize = __pool_chunk_size(pool, size);
+	u8 *data;
+
+	if (pool->flags & MM_HUGE_PAGE) {
+		struct mm_vblock *old = b;
+		b = __pool_map(pool, nsize);
+		measure_inc(pool->measure, chunk);
+		data = (u8 *)__pool_data(b);
+		memcpy(data, __pool_data(old), osize);
+		vm_vblock_free(old);
+	} else {
+		data = (u8 *)vm_page_extend(__pool_data(b), osize + POOL_HDR,
+		                            nsize + POOL_HDR);
+		b = (struct mm_vblock *)(data + nsize);
+		b->size = nsize;
+	}
+	b->node.next = next;
+	pool->save.final[1] = b;
+	pool->total_bytes += nsize - osize;
+	return pool->final = data;
 }
 
 void *
-mm_pool_alloc(struct mm_pool *pool, size_t size)
+__mm_pool_alloc(struct mm_pool *pool, size_t size)
 {
-	if (size <= pool->save.avail[0]) {
-		void *p = (u8 *)pool->save.final[0] - pool->save.avail[0];
-		pool->save.avail[0] -= size;
-		return p;
-	} 
-	return __pool_alloc_block(pool, size);
+	void *p = __pool_open(pool, size);
+	pool->save.avail[pool->index] -= size;
+	pool->save.size += size;
+	pool->last = p;
+	measure_inc(pool->measure, alloc);
+	__pool_account(pool);
+	return p;
 }
 
 void
-mm_pool_free(void *addr)
+mm_pool_free(struct mm_pool *pool, void *addr)
 {
-}
+	struct mm_vblock *b = (struct mm_vblock *)pool->save.final[1];
 
-void *
-mm_pool_end(struct mm_pool *p, void *end);
+	if (!addr)
+		return;
+	if (addr != pool->last) {
+		measure_inc(pool->measure, defer);
+		return;
+	}
+	if (b && addr == __pool_data(b)) {
+		pool->save.size -= b->size - pool->save.avail[1];
+		pool->save.final[1] = b->node.next;
+		pool->save.avail[1] = 0;
+		__pool_recycle(pool, b);
+	} else {
+		u8 *top = (u8 *)pool->save.final[0] - pool->save.avail[0];
+		pool->save.size -= top - (u8 *)addr;
+		pool->save.avail[0] = (u8 *)pool->save.final[0] - (u8 *)addr;
+	}
+	pool->last = NULL;
+	measure_inc(pool->measure, rewind);
+	__pool_account(pool);
+}
 
 size_t
 mm_pool_size(struct mm_pool *p)
 {
-	return 0;
+	return p->save.size;
+}
+
+size_t
+mm_pool_total(struct mm_pool *p)
+{
+	return p->total_bytes;
+}
+
+size_t
+mm_pool_cached(struct mm_pool *p)
+{
+	return p->cached_bytes;
+}
+
+int
+mm_pool_backing(struct mm_pool *p)
+{
+	return (int)p->backing;
 }
 
 void *
@@ -59,110 +236,237 @@ mm_pool_zalloc(struct mm_pool *pool, size_t size)
 	return addr;
 }
 
+/*
+ * Bytes from @addr to the end of what its chunk has handed out: an object at
+ * @addr is no longer than that, and copying that much never leaves the chunk.
+ */
+static size_t
+__pool_extent(struct mm_pool *pool, void *addr)
+{
+	struct mm_vblock *b;
+	u8 *p = (u8 *)addr;
+
+	for (int i = 0; i < 2; i++) {
+		b = (struct mm_vblock *)pool->save.final[i];
+		if (b && p >= (u8 *)__pool_data(b) && p <= (u8 *)b)
+			return (size_t)((u8 *)b - pool->save.avail[i] - p);
+		for (; b; b = (struct mm_vblock *)b->node.next)
+			if (p >= (u8 *)__pool_data(b) && p <= (u8 *)b)
+				return (size_t)((u8 *)b - p);
+	}
+	return 0;
+}
+
+/*
+ * mm_pool_realloc - resize @addr to @size bytes.
+ *
+ * The last allocation is resized in place while its chunk has the room, a
+ * large one remapped when it has not. Anything else is copied to a new
+ * allocation and the old one left to the next restore or flush.
+ */
 void *
 mm_pool_realloc(struct mm_pool *pool, void *addr, size_t size)
 {
-	pool->index = addr == pool->final;
-	size_t avail = ((byte *)pool->save.final[pool->index] - (byte *)addr);
-	avail -= pool->save.avail[pool->index];
-	pool->save.avail[pool->index] += avail;
+	struct mm_vblock *b = (struct mm_vblock *)pool->save.final[1];
+	size_t old;
+	void *p;
+
+	if (!addr)
+		return mm_pool_alloc(pool, size);
+	if (addr == pool->last && b && addr == __pool_data(b)) {
+		old = b->size - pool->save.avail[1];
+		if (size > b->size)
+			addr = __pool_remap(pool, size);
+		b = (struct mm_vblock *)pool->save.final[1];
+		pool->save.avail[1] = b->size - size;
+		pool->save.size += size - old;
+		pool->last = addr;
+		__pool_account(pool);
+		return addr;
+	}
+	if (addr == pool->last) {
+		u8 *final = (u8 *)pool->save.final[0];
+		old = (size_t)(final - pool->save.avail[0] - (u8 *)addr);
+		if ((size_t)(final - (u8 *)addr) >= size) {
+			pool->save.avail[0] = (size_t)(final - (u8 *)addr) - size;
+			pool->save.size += size - old;
+			measure_set(pool->measure, size, pool->save.size);
+			return addr;
+		}
+	} else {
+		old = __pool_extent(pool, addr);
+	}
+	p = mm_pool_alloc(pool, size);
+	memcpy(p, addr, __min(old, size));
+	return p;
+}
 
-	addr = mm_pool_extend(pool, size);
-	mm_pool_end(pool, (byte *)addr + size);
-	return addr;
+void
+mm_pool_save(struct mm_pool *pool, struct mm_savep *sp)
+{
+	*sp = pool->save;
+	pool->last = NULL;
+	measure_inc(pool->measure, save);
 }
 
 void
-mm_pool_destroy(struct mm_pool *pool)
+mm_pool_restore(struct mm_pool *pool, struct mm_savep *sp)
 {
-	struct mm_vblock *it, *block;
-	debug4("mem pool %p destroyed", pool);
+	struct mm_savep save = *sp;   /* @sp may sit in a chunk given back */
+	struct mm_vblock *b, *next;
+
+	for (int i = 0; i < 2; i++) {
+		for (b = (struct mm_vblock *)pool->save.final[i];
+		     b != (struct mm_vblock *)save.final[i]; b = next) {
+			next = (struct mm_vblock *)b->node.next;
+			__pool_recycle(pool, b);
+		}
+	}
+	pool->save = save;
+	pool->last = NULL;
+	pool->index = 0;
+	measure_inc(pool->measure, restore);
+	__pool_account(pool);
+}
 
-	block = (struct mm_vblock *)pool->save.final[1];
-	slist_for_each_delsafe(block, node, it)
-		vm_vblock_free(block);
+struct mm_savep *
+mm_pool_push(struct mm_pool *pool)
+{
+	struct mm_savep save = pool->save;
+	struct mm_savep *sp = (struct mm_savep *)
+	                      mm_pool_alloc(pool, sizeof(*sp));
+	*sp = save;
+	pool->save.node.next = &sp->node;
+	pool->last = NULL;
+	measure_inc(pool->measure, save);
+	return sp;
+}
 
-	block = (struct mm_vblock *)pool->avail;
-	slist_for_each_delsafe(block, node, it)
-		vm_vblock_free(block);
+void
+mm_pool_pop(struct mm_pool *pool)
+{
+	struct snode *top = pool->save.node.next;
+	if (top)
+		mm_pool_restore(pool, __container_of(top, struct mm_savep, node));
+}
+
+void
+mm_pool_destroy(struct mm_pool *pool)
+{
+	struct mm_vblock *first;
+	debug4("mem pool %p destroyed", pool);
 
-	block = (struct mm_vblock *)pool->save.final[0];
-	slist_for_each_delsafe(block, node, it)
-		vm_vblock_free(block);
+	mm_pool_flush(pool);
+	mm_pool_trim(pool, 0);
+	first = (struct mm_vblock *)pool->save.final[0];
+	if (!(pool->flags & MM_POOL_OVERLAY))
+		vm_vblock_free(first);
 }
 
 void
 mm_pool_flush(struct mm_pool *pool)
 {
-	struct mm_vblock *it, *block;
+	struct mm_vblock *b, *next;
 
-	block = (struct mm_vblock *)pool->save.final[1];
-	slist_for_each_delsafe(block, node, it)
-		vm_vblock_free(block);
-
-	block = (struct mm_vblock *)pool->save.final[0];
-	slist_for_each_delsafe(block, node, it) {
-		if ((void *)((u8*)block - block->size) == pool)
-			break;
-		slist_add((struct snode *)pool->avail, &block->node);
-		pool->avail = block;
+	b = (struct mm_vblock *)pool->save.final[1];
+	for (; b; b = next) {
+		next = (struct mm_vblock *)b->node.next;
+		__pool_recycle(pool, b);
+	}
+	b = (struct mm_vblock *)pool->save.final[0];
+	for (; __pool_data(b) != (void *)pool; b = next) {
+		next = (struct mm_vblock *)b->node.next;
+		__pool_recycle(pool, b);
 	}
 
-	pool->save.final[0] = block;
-	pool->save.avail[0] = block ? block->size - sizeof(*pool) : 0;
+	pool->save.final[0] = b;
+	pool->save.avail[0] = __pool_first_avail(pool, b);
 	pool->save.final[1] = NULL;
 	pool->save.avail[1] = 0;
-	pool->final = &pool->final;
-
+	pool->save.size = 0;
 	snode_init(&pool->save.node);
+	pool->final = NULL;
+	pool->last = NULL;
+	pool->index = 0;
+	measure_inc(pool->measure, flush);
+	__pool_account(pool);
 }
 
-struct mm_pool *
-mm_pool_overlay(void *block, size_t blocksize)
+size_t
+mm_pool_trim(struct mm_pool *pool, size_t keep)
 {
-	size_t size, aligned = align_addr(sizeof(void *));
-	size = __max(blocksize, CPU_CACHE_LINE + aligned);
-	size = align_to(size, CPU_PAGE_SIZE) - aligned;
+	struct mm_vblock *b, **list[2] = { &pool->spare, &pool->avail };
+	size_t released = 0;
+
+	for (int i = 0; i < 2; i++) {
+		while (pool->cached_bytes > keep && (b = *list[i])) {
+			*list[i] = (struct mm_vblock *)b->node.next;
+			pool->cached_bytes -= b->size;
+			released += b->size;
+			vm_vblock_free(b);
+			measure_inc(pool->measure, release);
+		}
+	}
+	__pool_account(pool);
+	return released;
+}
 
-	struct mm_pool *pool = (struct mm_pool *)((u8 *)block - size);
+static void
+__pool_init(struct mm_pool *pool, struct mm_vblock *b, size_t blocksize,
+            int flags)
+{
+	memset(pool, 0, sizeof(*pool));
+	memcpy(&pool->mm, &mm_pool_ops, sizeof(mm_pool_ops));
+	pool->blocksize = blocksize;
+	pool->threshold = blocksize / 4;
+	pool->flags = flags;
+	pool->backing = VM_BACKING_PAGE;
+	pool->save.final[0] = b;
+	pool->save.avail[0] = __pool_first_avail(pool, b);
+	pool->total_bytes = b->size;
+}
 
-	debug4("mem pool %p attached with %llu bytes", 
-	             pool, (unsigned long long)blocksize);
+struct mm_pool *
+mm_pool_overlay(void *block, size_t blocksize)
+{
+	uintptr_t end = (uintptr_t)block + blocksize - POOL_HDR;
+	struct mm_pool *pool = (struct mm_pool *)block;
+	struct mm_vblock *b;
 
-	pool->save.avail[0] = size - sizeof(*pool);
-	pool->save.final[0] = block;
+	end &= ~(uintptr_t)(__max(MM_POOL_ALIGN, sizeof(void *)) - 1);
+	if (blocksize < POOL_HDR ||
+	    end < (uintptr_t)block + align_to(sizeof(*pool), MM_POOL_ALIGN))
+		return NULL;
 
-	pool->final = &pool->final;
-	pool->total_bytes  = blocksize + aligned;
-	pool->blocksize = size; 
-	//pool->flags |= (MM_NO_DIE | MM_NO_GROW);
+	b = (struct mm_vblock *)end;
+	b->size = (unsigned int)(end - (uintptr_t)block);
+	snode_init(&b->node);
+	__pool_init(pool, b, __pool_round(blocksize, 0), MM_POOL_OVERLAY);
 
+	debug4("mem pool %p attached with %llu bytes",
+	             pool, (unsigned long long)blocksize);
 	return pool;
 }
-	
+
 struct mm_pool *
 mm_pool_create(size_t blocksize, int flags)
 {
 	struct mm_vblock *block;
-	size_t size, aligned = align_addr(sizeof(*block));
-
-	size = __max(blocksize, CPU_CACHE_LINE + aligned);
-	size = align_to(size, CPU_PAGE_SIZE) - aligned;
-
-	block = (struct mm_vblock *)vm_vblock_alloc(size);
-	struct mm_pool *pool = (struct mm_pool *)((u8 *)block - size);
-
-	debug4("mem pool %p created with %llu bytes", 
+	int backing = VM_BACKING_PAGE;
+	size_t size;
+
+	size = __max(blocksize, sizeof(struct mm_pool) + CPU_CACHE_LINE);
+	size = __pool_round(size, flags);
+	if (flags & MM_HUGE_PAGE)
+		block = (struct mm_vblock *)vm_vblock_alloc_huge(size, &backing);
+	else
+		block = (struct mm_vblock *)vm_vblock_alloc(size);
+	struct mm_pool *pool = (struct mm_pool *)__pool_data(block);
+	__pool_init(pool, block, size, flags);
+	pool->backing = (unsigned int)backing;
+
+	debug4("mem pool %p created with %llu bytes",
 	        pool, (unsigned long long)blocksize);
-
-	pool->save.avail[0] = size - sizeof(*pool);
-	pool->save.final[0] = block;
-
-	pool->final = &pool->final;
-	pool->total_bytes  = block->size + aligned;
-	pool->blocksize = size;
-	memcpy(&pool->mm,  &mm_pool_ops, sizeof(mm_pool_ops));
-
 	return pool;
 }
 
@@ -171,9 +475,16 @@ mm_pool_addr(struct mm_pool *mp)
 {
 	return (u8 *)mp->save.final[mp->index] - mp->save.avail[mp->index];
 }
-                                                                                
+
 size_t
 mm_pool_avail(struct mm_pool *mp)
+{
+	return aligned_part(mp->save.avail[0], MM_POOL_ALIGN);
+}
+
+/* Room of the open allocation. */
+static inline size_t
+__pool_room(struct mm_pool *mp)
 {
 	return mp->save.avail[mp->index];
 }
@@ -181,60 +492,52 @@ mm_pool_avail(struct mm_pool *mp)
 void *
 mm_pool_start(struct mm_pool *pool, size_t size)
 {
-	size_t avail = aligned_part(pool->save.avail[0], CPU_ADDR_ALIGN);
+	size_t avail = aligned_part(pool->save.avail[0], MM_POOL_ALIGN);
 	if (size <= avail) {
 		pool->index = 0;
 		pool->save.avail[0] = avail;
 		return (byte *)pool->save.final[0] - avail;
-	} else {
-		void *ptr = mm_pool_alloc(pool, size);
-		pool->save.avail[pool->index] += size;
-		return ptr;
 	}
-} 
+	return __pool_open(pool, size);
+}
 
 void *
 mm_pool_end(struct mm_pool *mp, void *end)
 {
 	void *p = mm_pool_addr(mp);
-	mp->save.avail[mp->index] = (u8*)mp->save.avail[mp->index] - (u8*)end;
+	mp->save.avail[mp->index] = (u8 *)mp->save.final[mp->index] - (u8 *)end;
+	mp->save.size += (u8 *)end - (u8 *)p;
+	mp->last = p;
+	measure_inc(mp->measure, alloc);
+	measure_set(mp->measure, size, mp->save.size);
 	return p;
 }
 
 void *
 mm_pool_extend(struct mm_pool *mp, size_t size)
 {
-	size_t avail = mm_pool_avail(mp);
-	if (size <= avail)
-		return mm_pool_addr(mp);
-
+	size_t avail = __pool_room(mp);
 	void *ptr = mm_pool_addr(mp);
-	if (mp->index) {
-		size_t amortized = avail * 2;
-		amortized = __max(amortized, size);
-		amortized = align_to(amortized, CPU_ADDR_ALIGN);
-
-		struct mm_vblock *block = (struct mm_vblock *)mp->save.final[1];
-	        struct mm_vblock *next  = (struct mm_vblock *)block->node.next;
+	void *addr;
 
-		mp->total_bytes = mp->total_bytes - block->size + amortized;
-
-		size_t aligned = align_addr(sizeof(*block)) + amortized;
-		ptr = vm_vblock_extend(ptr, avail, aligned);
-		block = (struct mm_vblock *)(((u8*)ptr) + amortized);
+	if (size <= avail)
+		return ptr;
 
-		block->node.next = (struct snode *)next;
-		block->size = amortized;
+	size_t amortized = avail * 2;
+	amortized = __max(amortized, size);
+	amortized = align_to(amortized, MM_POOL_ALIGN);
 
-		mp->save.final[1] = block;
-		mp->save.avail[1] = amortized;
-		mp->final = ptr;
-		return ptr;
-	} 
+	/* an open large chunk of its own grows by remapping */
+	if (mp->index && ptr == mp->final) {
+		addr = __pool_remap(mp, amortized);
+		mp->save.avail[1] = ((struct mm_vblock *)mp->save.final[1])->size;
+		__pool_account(mp);
+		return addr;
+	}
 
-	void *addr = mm_pool_alloc(mp, size);
-	mp->save.avail[mp->index] += size;
+	addr = __pool_open(mp, amortized);
 	memcpy(addr, ptr, avail);
+	__pool_account(mp);
 	return addr;
 }
 
@@ -242,7 +545,7 @@ static char *
 mm_pool_vprintf_at(struct mm_pool *mp, size_t pos, const char *fmt, va_list args)
 {
 	char *b = (char *)mm_pool_extend(mp, pos + 1) + pos;
-	size_t avail = mm_pool_avail(mp);
+	size_t avail = __pool_room(mp);
 	size_t rest = avail - pos;
 
 	va_list args2;
@@ -250,7 +553,7 @@ mm_pool_vprintf_at(struct mm_pool *mp, size_t pos, const char *fmt, va_list args
 	int len = vsnprintf(b, rest, fmt, args2);
 	va_end(args2);
 
-	if (len >= rest) {
+	if ((size_t)len >= rest) {
 		b = (char *)mm_pool_extend(mp, pos + len + 1) + pos;
 		va_copy(args2, args);
 		vsnprintf(b, len + 1, fmt, args2);
@@ -325,12 +628,15 @@ pool_malloc(struct mm *mm, size_t size)
 void
 pool_free(struct mm *mm, void *addr)
 {
+	struct mm_pool *mp = __container_of(mm, struct mm_pool, mm);
+	mm_pool_free(mp, addr);
 }
 
 void *
 pool_realloc(struct mm *mm, void *addr, size_t size)
 {
-	return NULL;
+	struct mm_pool *mp = __container_of(mm, struct mm_pool, mm);
+	return mm_pool_realloc(mp, addr, size);
 }
 
 struct mm mm_pool_ops = {
@@ -33,39 +33,113 @@
 #include <mem/alloc.h>
 #include <mem/savep.h>
 #include <mem/block.h>
+#include <mem/measure.h>
 #include <hpc/list.h>
 #include <inttypes.h>
 #include <assert.h>
 #include <string.h>
 
-/* 
- * Allows deterministic behavior on real-time systems 
+/*
+ * A chunked arena: allocation is a pointer bump, and memory goes back in bulk,
+ * to a savepoint or all at once, never object by object. Meant for scratch
+ * memory with a scope - a request, a parse, a transaction - where malloc() and
+ * free() per object cost more than the work and the scope's end frees
+ * everything anyway.
+ *
+ * Chunks
+ * ------
+ * The arena carves allocations out of the chunk at the head of a chain, from
+ * the bottom up: @avail is the room left below the chunk's header (struct
+ * mm_vblock, at the chunk's end), and the next allocation starts @avail bytes
+ * short of it, so each one lands just above the last. A request that does not
+ * fit opens a fresh chunk of @blocksize and the rest of the old one is left
+ * unused. A request over @threshold, a quarter of @blocksize, gets a chunk of
+ * its own, page rounded, on a second chain - so a large buffer neither wastes
+ * the rest of a regular chunk nor splits one. The struct mm_pool itself sits at
+ * the start of the first chunk (or of the caller's memory, for
+ * mm_pool_overlay()). Allocations are aligned to MM_POOL_ALIGN.
+ *
+ * Savepoints
+ * ----------
+ * The whole state of the arena is struct mm_savep (<mem/savep.h>): the head of
+ * each chain, the room in it, the bytes handed out. mm_pool_save() copies it
+ * out, mm_pool_restore() puts it back and hands every chunk opened since to
+ * the block cache: O(1) when the scope stayed within its chunk, a pointer
+ * store per chunk otherwise, and never a syscall. Savepoints nest - restoring
+ * one discards those taken after it. mm_pool_push() and mm_pool_pop() keep
+ * the savepoint in the arena itself, linked through @node, for a scope that
+ * has nowhere else to put it.
+ *
+ * Free
+ * ----
+ * mm_pool_free() of the last allocation rewinds the arena over it; any other is
+ * left to the next restore or flush. The same holds for mm_pool_realloc(): the
+ * last allocation grows or shrinks in place - a large one by mremap() where its
+ * chunk runs out - and any other is copied.
+ *
+ * The block cache
+ * ---------------
+ * A chunk the arena is done with, on a restore or a flush, goes onto a free
+ * list instead of back to the OS: regular chunks onto @avail, large ones onto
+ * @spare, from which a large request takes the first that is big enough. A
+ * request loop that flushes or restores its arena settles into reusing the
+ * same chunks, with no mmap() or munmap() once the cache holds its peak.
+ * mm_pool_trim() gives the cache back, down to a limit; mm_pool_destroy()
+ * gives back everything.
+ *
+ * Huge pages
+ * ----------
+ * A large arena walked at random - a parser's tree, a batch's scratch - spends
+ * real time on dTLB misses with 4 KiB pages. mm_pool_create() with
+ * MM_HUGE_PAGE maps every chunk on 2 MiB pages instead: MAP_HUGETLB where the
+ * system has reserved pages, else an aligned range advised MADV_HUGEPAGE for
+ * THP, else base pages (vm_page_alloc_huge() in <mem/vm.h>). Chunk sizes are
+ * rounded to whole huge pages - @blocksize to 2 MiB less the chunk header, a
+ * large chunk to its multiple of 2 MiB - so no huge page is shared between
+ * chunks or split by a release. A large chunk that outgrows itself is copied
+ * rather than remapped. mm_pool_backing() reports the weakest backing any
+ * chunk got, one of VM_BACKING_*, and the measure counts the chunks mapped
+ * each way. None of it is an error: an arena that asked for huge pages and
+ * got base pages works as any other.
+ *
+ * Accounting
+ * ----------
+ * mm_pool_size()  bytes handed out and not rewound
+ * mm_pool_avail() room for the next allocation without a new chunk
+ * mm_pool_total() chunk memory the arena holds, cache excluded
+ * mm_pool_cached() chunk memory in the block cache
+ * mm_pool_backing() VM_BACKING_PAGE, _THP or _HUGETLB, as above
  *
- * Variable-size block memory pools do need to store allocation metadata for 
- * each allocation, describing characteristics like the size of the allocated
- * block.
+ * With a struct mm_pool_measure (<mem/measure.h>) attached as pool->measure,
+ * the arena counts its allocations, chunks mapped, recycled and released,
+ * savepoints and frees, and keeps the four figures above as gauges.
+ *
+ * An arena belongs to one thread at a time.
  */
 
+#ifndef MM_POOL_ALIGN
+#define MM_POOL_ALIGN CPU_STRUCT_ALIGN
+#endif
+
+/* The pool lives in memory it does not own (mm_pool_overlay()). */
+#define MM_POOL_OVERLAY (1 << 16)
+
 struct mm;
 struct mm_pool {
 	struct mm mm;
-	struct mm_savep save;
-	void *avail, *final;
-	unsigned int blocksize;
-	unsigned int index;
+	struct mm_savep save;         /* the state; see <mem/savep.h>         */
+	struct mm_vblock *avail;      /* block cache: regular chunks          */
+	struct mm_vblock *spare;      /* block cache: large chunks            */
+	void *final;                  /* data of the newest large chunk       */
+	void *last;                   /* the last allocation, for a rewind    */
+	unsigned int blocksize;       /* bytes of a regular chunk             */
+	unsigned int threshold;       /* larger requests get their own chunk  */
+	unsigned int index;           /* chain of the open allocation         */
 	unsigned int flags;
-	unsigned int aligned;
-	size_t total_bytes;
-	size_t useful_bytes;
-#ifdef CONFIG_DEBUG_MEMPOOL
-	size_t exhausted_bytes;
-	size_t amortized_bytes;
-	size_t frag_bytes;
-	size_t frag_count;
-	size_t blocks_total;
-	size_t blocks_used;
-	size_t blocks_free;
-#endif	
+	unsigned int backing;         /* weakest VM_BACKING_* of the chunks   */
+	size_t total_bytes;           /* chunk bytes in the chains            */
+	size_t cached_bytes;          /* chunk bytes in the block cache       */
+	measure_member(mm_pool)
 };
 
 extern struct mm mm_pool_ops;
@@ -74,44 +148,138 @@ __BEGIN_DECLS
 struct mm *mm_pool(struct mm_pool *);
 
 void *
-mm_pool_alloc(struct mm_pool *pool, size_t size);
+__mm_pool_alloc(struct mm_pool *pool, size_t size);
+
+/*
+ * mm_pool_alloc - @size bytes, aligned to MM_POOL_ALIGN.
+ *
+ * The room in the current chunk is aligned down first, which aligns the
+ * allocation: it starts that many bytes below the chunk's header, which is
+ * aligned, and the arena bumps upwards towards it.
+ */
+static inline void *
+mm_pool_alloc(struct mm_pool *pool, size_t size)
+{
+	size_t avail = aligned_part(pool->save.avail[0], MM_POOL_ALIGN);
+	if (likely(size <= avail)) {
+		void *p = (u8 *)pool->save.final[0] - avail;
+		pool->save.avail[0] = avail - size;
+		pool->save.size += size;
+		pool->last = p;
+		measure_inc(pool->measure, alloc);
+		measure_set(pool->measure, size, pool->save.size);
+		return p;
+	}
+	return __mm_pool_alloc(pool, size);
+}
 
 void *
 mm_pool_realloc(struct mm_pool *pool, void *addr, size_t size);
 
 void
-mm_pool_free(void *addr);
+mm_pool_free(struct mm_pool *pool, void *addr);
 
 void *
 mm_pool_zalloc(struct mm_pool *pool, size_t size);
 
+/*
+ * mm_pool_save - copy the arena's state into @sp.
+ *
+ * Nothing allocated before it can be rewound by mm_pool_free() after it. Not
+ * between mm_pool_start() and mm_pool_end().
+ */
+void
+mm_pool_save(struct mm_pool *pool, struct mm_savep *sp);
+
+/*
+ * mm_pool_restore - rewind the arena to @sp, taken by mm_pool_save() or
+ * mm_pool_push() on this arena and not discarded by an earlier restore.
+ *
+ * Everything allocated since is gone, and so are the savepoints taken since.
+ */
+void
+mm_pool_restore(struct mm_pool *pool, struct mm_savep *sp);
+
+/* mm_pool_push - a savepoint kept in the arena; mm_pool_pop() rewinds to it. */
+struct mm_savep *
+mm_pool_push(struct mm_pool *pool);
+
+void
+mm_pool_pop(struct mm_pool *pool);
+
 void
 mm_pool_destroy(struct mm_pool *pool);
 
+/* mm_pool_flush - rewind to empty; every chunk but the first is cached. */
 void
 mm_pool_flush(struct mm_pool *pool);
 
+/* mm_pool_trim - release cached chunks until at most @keep bytes are left. */
+size_t
+mm_pool_trim(struct mm_pool *pool, size_t keep);
+
+/*
+ * mm_pool_overlay - an arena in the caller's @blocksize bytes at @block, which
+ * must be pointer aligned. Further chunks are mapped as needed, @blocksize
+ * each; the caller's memory is never released. NULL if @blocksize cannot hold
+ * the arena.
+ */
 struct mm_pool *
 mm_pool_overlay(void *block, size_t blocksize);
-	
+
 struct mm_pool *
 mm_pool_create(size_t blocksize, int flags);
-  
+
 size_t
 mm_pool_avail(struct mm_pool *p);
 
 size_t
 mm_pool_size(struct mm_pool *p);
 
+size_t
+mm_pool_total(struct mm_pool *p);
+
+size_t
+mm_pool_cached(struct mm_pool *p);
+
+int
+mm_pool_backing(struct mm_pool *p);
+
+/*
+ * Open allocation: mm_pool_start() opens a buffer of at least @size bytes at
+ * the top of the arena without allocating it, mm_pool_extend() grows it to
+ * @size, moving it if it must, and mm_pool_end() allocates it up to @end.
+ */
+void *
+mm_pool_start(struct mm_pool *p, size_t size);
+
 void *
 mm_pool_extend(struct mm_pool *p, size_t size);
 
+void *
+mm_pool_end(struct mm_pool *p, void *end);
+
+void *
+mm_pool_addr(struct mm_pool *p);
+
 char *
 mm_pool_vprintf(struct mm_pool *p, const char *fmt, va_list args);
 
 char *
 mm_pool_printf(struct mm_pool *, const char *fmt, ...);
 
+char *
+mm_pool_strdup(struct mm_pool *p, const char *str);
+
+char *
+mm_pool_strndup(struct mm_pool *p, const char *str, size_t len);
+
+char *
+mm_pool_strmem(struct mm_pool *p, const char *str, size_t len);
+
+char *
+mm_pool_memdup(struct mm_pool *p, const char *ptr, size_t len);
+
 __END_DECLS
 
 #endif
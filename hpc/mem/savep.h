@@ -38,9 +38,17 @@ struct mm_savepoint {
 
 __BEGIN_DECLS
 
+/*
+ * The state of a chunked arena (struct mm_pool in <mem/pool.h>), and a
+ * savepoint of it. [0] is the chain of regular chunks, [1] the chain of large
+ * ones: @final is the header of the newest chunk of each chain, @avail the room
+ * left in it, counted down from @final. @size is the bytes handed out and not
+ * rewound; @node links the savepoints pushed into the arena itself.
+ */
 struct mm_savep {
 	size_t avail[2];
 	void  *final[2];
+	size_t size;
 	struct snode node;
 };
 
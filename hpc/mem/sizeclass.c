@@ -0,0 +1,496 @@
+/*
+ * Size-class allocator                          General purpose, slab backed
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* mremap() is a GNU extension, see <mem/vm.c>. Must precede every include. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <hpc/compiler.h>
+#include <hpc/cpu.h>
+#include <mem/vm.h>
+#include <mem/sizeclass.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/*
+ * The class slabs reserve nothing themselves: each one's SLAB_VM_ALLOC hands
+ * out the next slice of the arena, and their bitmaps come from the metadata
+ * slice after the last class. Nothing on either path may call malloc() - in
+ * libhpc-malloc.so that is this allocator, still initialising.
+ */
+static void *sizeclass_slice(size_t len);
+static void *sizeclass_meta(size_t n, size_t size);
+
+#define SLAB_VM_ALLOC(len)        sizeclass_slice((size_t)(len))
+#define SLAB_VM_FREE(ptr, len)    ((void)(ptr), (void)(len))
+#define SLAB_VM_RELEASE(ptr, len) madvise((ptr), (size_t)(len), MADV_DONTNEED)
+#define SLAB_VM_FAILED            NULL
+#define SLAB_VM_RELEASES          1
+#define SLAB_MEM_CALLOC(n, size)  sizeclass_meta((n), (size))
+#define SLAB_MEM_FREE(ptr)        ((void)(ptr))
+
+#include <mem/slab.h>
+
+/* Object indices count 16 byte units from the class's slice base. */
+#define SIZECLASS_UNIT_SHIFT 4
+#define SIZECLASS_SLICE      ((size_t)1 << SIZECLASS_SLICE_SHIFT)
+#define SIZECLASS_ARENA      (SIZECLASS_SLICE * (SIZECLASS_COUNT + 1))
+#define SIZECLASS_SPAN_MIN   (64u * 1024)
+#define SIZECLASS_SPAN_OBJS  16
+
+_Static_assert(SIZECLASS_SLICE_SHIFT - SIZECLASS_UNIT_SHIFT <= 32,
+	"a slice must be addressable with u32 object indices");
+
+struct sizeclass {
+	u64 free;             /* union slab_head: object index + ABA tag      */
+	u32 size;             /* object size                                  */
+	u32 per_span;         /* objects per span                             */
+	u8 *base;             /* this class's slice of the arena              */
+	struct slab spans;    /* the slice as a slab of spans                 */
+} _align(CPU_CACHE_LINE);
+
+/* The large-allocation header, just below the pointer handed out. */
+struct sizeclass_large {
+	void *base;           /* the mapping                                  */
+	size_t length;        /* its length                                   */
+};
+
+_Static_assert(sizeof(struct sizeclass_large) == SIZECLASS_MIN,
+	"the large header must keep the pointer after it 16 byte aligned");
+
+static struct sizeclass classes[SIZECLASS_COUNT];
+static u8 *arena;
+static unsigned sliced;
+static size_t meta_used;
+static u32 state;                 /* 0 none, 1 initialising, 2 ready, 3 failed */
+static u64 large_live, large_bytes;
+
+static void *
+sizeclass_slice(size_t len)
+{
+	if (len > SIZECLASS_SLICE || sliced >= SIZECLASS_COUNT)
+		return NULL;
+	return arena + ((size_t)sliced++ << SIZECLASS_SLICE_SHIFT);
+}
+
+/* Bump allocation from the metadata slice; fresh mapping, so already zero. */
+static void *
+sizeclass_meta(size_t n, size_t size)
+{
+	u8 *meta = arena + ((size_t)SIZECLASS_COUNT << SIZECLASS_SLICE_SHIFT);
+	size_t len = align_to(n * size, (size_t)SIZECLASS_MIN);
+	void *p;
+	if (meta_used + len > SIZECLASS_SLICE)
+		return NULL;
+	p = meta + meta_used;
+	meta_used += len;
+	return p;
+}
+
+/* A power of two of at least 64 KiB holding at least 16 objects. */
+static u32
+sizeclass_span(u32 size)
+{
+	u32 span = SIZECLASS_SPAN_MIN;
+	while (span < size * SIZECLASS_SPAN_OBJS)
+		span <<= 1;
+	return span;
+}
+
+static int
+sizeclass_setup(void)
+{
+	unsigned i;
+
+	arena = (u8 *)mmap(NULL, SIZECLASS_ARENA, PROT_READ | PROT_WRITE,
+	                   MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+	if (arena == (u8 *)MAP_FAILED) {
+		arena = NULL;
+		return -1;
+	}
+	for (i = 0; i < SIZECLASS_COUNT; i++) {
+		struct sizeclass *c = &classes[i];
+		u32 span = sizeclass_span(sizeclass_size(i));
+		struct slab_policy pol = {
+			.min = 0,
+			.max = (u32)(SIZECLASS_SLICE / span),
+			.grow_step = 1,
+		};
+		union slab_head head = { .list = SLAB_NIL, .tag = 0 };
+
+		c->size = sizeclass_size(i);
+		c->per_span = span / c->size;
+		c->free = head.word;
+		c->base = arena + ((size_t)i << SIZECLASS_SLICE_SHIFT);
+		if (slab_init(&c->spans, span, &pol))
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * First use initialises, once, from whichever thread gets here first; the
+ * rest wait for it. Spinning is fine: setup is one mmap() and forty slab_init()
+ * calls that touch no memory.
+ */
+static inline int
+sizeclass_ready(void)
+{
+	u32 s = __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+	if (likely(s == 2))
+		return 1;
+	if (s == 0 && __atomic_compare_exchange_n(&state, &s, 1, false,
+	                                          __ATOMIC_ACQUIRE,
+	                                          __ATOMIC_ACQUIRE)) {
+		s = sizeclass_setup() ? 3 : 2;
+		__atomic_store_n(&state, s, __ATOMIC_RELEASE);
+		return s == 2;
+	}
+	while ((s = __atomic_load_n(&state, __ATOMIC_ACQUIRE)) == 1)
+		;
+	return s == 2;
+}
+
+/* ---- small objects ------------------------------------------------------- */
+
+static inline u8 *
+sizeclass_obj(struct sizeclass *c, u32 idx)
+{
+	return c->base + ((size_t)idx << SIZECLASS_UNIT_SHIFT);
+}
+
+static inline u32
+sizeclass_idx(struct sizeclass *c, void *p)
+{
+	return (u32)(((u8 *)p - c->base) >> SIZECLASS_UNIT_SHIFT);
+}
+
+/*
+ * The class ran dry: cut a fresh span, keep its first object and publish the
+ * rest as one chain. Two threads refilling at once each cut a span of their
+ * own, which costs a span, not correctness.
+ */
+static _noinline void *
+sizeclass_refill(struct sizeclass *c)
+{
+	u8 *span = (u8 *)slab_alloc_lockfree(&c->spans);
+	u32 i, n = c->per_span;
+
+	if (!span)
+		return NULL;
+	for (i = 1; i + 1 < n; i++)
+		*(u32 *)(span + (size_t)i * c->size) =
+			sizeclass_idx(c, span + (size_t)(i + 1) * c->size);
+	if (n > 1)
+		__slab_lf_push(&c->free, c->base, SIZECLASS_UNIT_SHIFT,
+		               sizeclass_idx(c, span + c->size),
+		               sizeclass_idx(c, span + (size_t)(n - 1) * c->size));
+	return span;
+}
+
+static inline void *
+sizeclass_alloc(struct sizeclass *c)
+{
+	u32 idx = __slab_lf_pop(&c->free, c->base, SIZECLASS_UNIT_SHIFT);
+	if (likely(idx != SLAB_NIL))
+		return sizeclass_obj(c, idx);
+	return sizeclass_refill(c);
+}
+
+/* The class owning @p, or NULL for a pointer outside the arena (large). */
+static inline struct sizeclass *
+sizeclass_owner(void *p)
+{
+	uintptr_t off = (uintptr_t)p - (uintptr_t)arena;
+	if (off >= ((uintptr_t)SIZECLASS_COUNT << SIZECLASS_SLICE_SHIFT))
+		return NULL;
+	return &classes[off >> SIZECLASS_SLICE_SHIFT];
+}
+
+/* ---- large objects ------------------------------------------------------- */
+
+static inline struct sizeclass_large *
+sizeclass_large_hdr(void *p)
+{
+	return (struct sizeclass_large *)p - 1;
+}
+
+/*
+ * One mapping per allocation, the header right below the pointer. With an
+ * alignment above 16 the pointer is moved up to the boundary and the header
+ * with it. The mappings are made here rather than with vm_page_alloc(), which
+ * dies when mmap fails: behind malloc() an allocation too big for the machine
+ * is an ordinary NULL with ENOMEM, not the end of the host program.
+ */
+static void *
+sizeclass_large_alloc(size_t size, size_t align)
+{
+	size_t hdr = sizeof(struct sizeclass_large);
+	size_t pad = align > hdr ? align : 0;
+	size_t length;
+	struct sizeclass_large *h;
+	u8 *base, *p;
+
+	if (size > SIZE_MAX - hdr - pad - CPU_PAGE_SIZE) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	length = align_page(size + hdr + pad);
+	base = (u8 *)mmap(NULL, length, PROT_READ | PROT_WRITE,
+	                  MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (base == (u8 *)MAP_FAILED) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	p = (u8 *)align_to((uintptr_t)base + hdr, (uintptr_t)__max(align, hdr));
+	h = sizeclass_large_hdr(p);
+	h->base = base;
+	h->length = length;
+	__atomic_fetch_add(&large_live, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&large_bytes, length, __ATOMIC_RELAXED);
+	return p;
+}
+
+static void
+sizeclass_large_free(void *p)
+{
+	struct sizeclass_large *h = sizeclass_large_hdr(p);
+	__atomic_fetch_sub(&large_live, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_sub(&large_bytes, h->length, __ATOMIC_RELAXED);
+	vm_page_free(h->base, h->length);
+}
+
+static size_t
+sizeclass_large_usable(void *p)
+{
+	struct sizeclass_large *h = sizeclass_large_hdr(p);
+	return (size_t)((u8 *)h->base + h->length - (u8 *)p);
+}
+
+/* ---- the malloc-shaped interface ----------------------------------------- */
+
+void *
+mm_sizeclass_alloc(size_t size)
+{
+	void *p;
+	if (unlikely(!sizeclass_ready())) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (size > SIZECLASS_MAX)
+		return sizeclass_large_alloc(size, 0);
+	if (!(p = sizeclass_alloc(&classes[sizeclass_of(size)])))
+		errno = ENOMEM;
+	return p;
+}
+
+void
+mm_sizeclass_free(void *addr)
+{
+	struct sizeclass *c;
+	if (!addr)
+		return;
+	if (!(c = sizeclass_owner(addr))) {
+		sizeclass_large_free(addr);
+		return;
+	}
+	__slab_lf_push(&c->free, c->base, SIZECLASS_UNIT_SHIFT,
+	               sizeclass_idx(c, addr), sizeclass_idx(c, addr));
+}
+
+size_t
+mm_sizeclass_usable(void *addr)
+{
+	struct sizeclass *c;
+	if (!addr)
+		return 0;
+	if (!(c = sizeclass_owner(addr)))
+		return sizeclass_large_usable(addr);
+	return c->size;
+}
+
+/*
+ * A recycled object is dirty, a fresh large mapping is not: only the former is
+ * cleared.
+ */
+void *
+mm_sizeclass_calloc(size_t n, size_t size)
+{
+	size_t bytes;
+	void *p;
+	if (__builtin_mul_overflow(n, size, &bytes)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (!(p = mm_sizeclass_alloc(bytes)))
+		return NULL;
+	if (bytes <= SIZECLASS_MAX)
+		memset(p, 0, bytes);
+	return p;
+}
+
+/*
+ * In place where the new size still rounds to the same class, or to one at
+ * most a doubling smaller (shrinking further moves the data to stop a small
+ * buffer from pinning a big object). A large allocation with no extra
+ * alignment is resized with mremap(), which moves page table entries rather
+ * than copying; when it fails the old block is left as it was and the caller
+ * gets NULL with ENOMEM, as realloc() promises.
+ */
+void *
+mm_sizeclass_realloc(void *addr, size_t size)
+{
+	struct sizeclass *c;
+	size_t old;
+	void *p;
+
+	if (!addr)
+		return mm_sizeclass_alloc(size);
+	if (!size) {
+		mm_sizeclass_free(addr);
+		return NULL;
+	}
+
+	if ((c = sizeclass_owner(addr))) {
+		unsigned idx = (unsigned)(c - classes);
+		if (size <= c->size && sizeclass_of(size) + 4 >= idx)
+			return addr;
+		old = c->size;
+	} else {
+		struct sizeclass_large *h = sizeclass_large_hdr(addr);
+		old = sizeclass_large_usable(addr);
+		if (size > SIZECLASS_MAX &&
+		    (u8 *)addr == (u8 *)h->base + sizeof(*h)) {
+			size_t length, was = h->length;
+			u8 *base;
+			if (size > SIZE_MAX - sizeof(*h) - CPU_PAGE_SIZE) {
+				errno = ENOMEM;
+				return NULL;
+			}
+			length = align_page(size + sizeof(*h));
+			if (length == was)
+				return addr;
+			base = (u8 *)mremap(h->base, was, length,
+			                    MREMAP_MAYMOVE);
+			if (base == (u8 *)MAP_FAILED) {
+				errno = ENOMEM;
+				return NULL;
+			}
+			h = (struct sizeclass_large *)base;
+			h->base = base;
+			h->length = length;
+			__atomic_fetch_add(&large_bytes, length - was,
+			                   __ATOMIC_RELAXED);
+			return base + sizeof(*h);
+		}
+	}
+
+	if (!(p = mm_sizeclass_alloc(size)))
+		return NULL;
+	memcpy(p, addr, __min(old, size));
+	mm_sizeclass_free(addr);
+	return p;
+}
+
+void *
+mm_sizeclass_memalign(size_t align, size_t size)
+{
+	size_t need;
+	if (align <= SIZECLASS_MIN)
+		return mm_sizeclass_alloc(size);
+	if (unlikely(!sizeclass_ready())) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	need = __max(size, align);
+	if (align <= CPU_PAGE_SIZE && need <= SIZECLASS_MAX) {
+		/* a power-of-two class is aligned to its own size */
+		size_t pow2 = (size_t)1 << (64 - __builtin_clzll((u64)need - 1));
+		void *p = sizeclass_alloc(&classes[sizeclass_of(pow2)]);
+		if (!p)
+			errno = ENOMEM;
+		return p;
+	}
+	return sizeclass_large_alloc(size, align);
+}
+
+int
+mm_sizeclass_stat(unsigned idx, struct mm_sizeclass_stat *stat)
+{
+	struct sizeclass *c;
+	if (idx >= SIZECLASS_COUNT || !sizeclass_ready())
+		return -1;
+	c = &classes[idx];
+	stat->size = c->size;
+	stat->per_span = c->per_span;
+	stat->span_size = slab_block_size(&c->spans);
+	stat->spans = __atomic_load_n(&c->spans.committed, __ATOMIC_RELAXED);
+	stat->large = __atomic_load_n(&large_live, __ATOMIC_RELAXED);
+	stat->large_bytes = __atomic_load_n(&large_bytes, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* ---- struct mm ----------------------------------------------------------- */
+
+static void *
+sizeclass_mm_alloc(struct mm *mm, size_t size)
+{
+	void *addr = mm_sizeclass_alloc(size);
+	if (!addr)
+		die("Can not allocate memory size=%jd", (intmax_t)size);
+	return addr;
+}
+
+static void
+sizeclass_mm_free(struct mm *mm, void *addr)
+{
+	mm_sizeclass_free(addr);
+}
+
+static void *
+sizeclass_mm_realloc(struct mm *mm, void *addr, size_t size)
+{
+	void *p = mm_sizeclass_realloc(addr, size);
+	if (!p && size)
+		die("Can not extend memory");
+	return p;
+}
+
+static struct mm mm_sizeclass_ops = {
+	.alloc   = sizeclass_mm_alloc,
+	.free    = sizeclass_mm_free,
+	.realloc = sizeclass_mm_realloc
+};
+
+struct mm *
+mm_sizeclass(void)
+{
+	return &mm_sizeclass_ops;
+}
@@ -0,0 +1,172 @@
+/*
+ * Size-class allocator                          General purpose, slab backed
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A general-purpose allocator: any size, any thread, free from any thread.
+ *
+ * Small requests - up to SIZECLASS_MAX bytes - are rounded up to one of
+ * SIZECLASS_COUNT size classes and served from that class's free list. Larger
+ * ones go straight to vm_page_alloc(), one mapping each.
+ *
+ * The classes
+ * -----------
+ * 16 to 128 bytes in steps of 16, then four classes per doubling - 160, 192,
+ * 224, 256, 320, ... 28672, 32768 - which is 40 classes and bounds the space
+ * lost to rounding at 25% (12.5% on average) from 128 bytes up. Every class is
+ * a multiple of 16, so every object is aligned the way malloc() promises, and a
+ * power-of-two class is aligned to its own size, which is what posix_memalign()
+ * up to a page is served from. sizeclass_of() maps a size to its class with a
+ * count-leading-zeros and two shifts, no table.
+ *
+ * Where the memory comes from
+ * ---------------------------
+ * Each class is a struct slab whose blocks are spans - 64 KiB or more, a power
+ * of two holding at least 16 objects - which the class cuts into objects. The
+ * spans of all classes come out of one address-space reservation, a fixed
+ * SIZECLASS_SLICE_SHIFT-sized slice per class (the slab's SLAB_VM_ALLOC hook is
+ * pointed at it; see <mem/slab_vm.h>). That layout is what makes free() cheap:
+ * which class a pointer belongs to is its offset into the reservation shifted
+ * down, an object's index is its offset into the slice divided by 16, and a
+ * pointer outside the reservation is a large allocation. No header in front of
+ * a small object, no lookup.
+ *
+ * The free list of each class is the same tagged-index Treiber stack the slab's
+ * lock-free mode uses (<mem/slab_lockfree.h>), over those 16-byte-unit indices;
+ * a class that runs dry takes a fresh span with slab_alloc_lockfree() - whose
+ * grow is itself a CAS - and pushes the span's objects in one chain. No lock
+ * anywhere on the small path.
+ *
+ * What it does not do (yet): give small-object memory back. A span, once cut,
+ * stays with its class; freed objects are reused but their pages stay resident.
+ * Large allocations are unmapped on free.
+ *
+ * Two ways in
+ * -----------
+ * mm_sizeclass() is a struct mm for anything that takes one (conf_ctx and the
+ * mm_* string helpers in <mem/alloc.h>); like mm_libc() it dies on exhaustion.
+ * The mm_sizeclass_*() functions below are the malloc-shaped interface, which
+ * return NULL instead, and what libhpc-malloc.so (sizeclass_preload.c,
+ * CONFIG_MEM_SIZECLASS_PRELOAD) exports as malloc(), free() and the rest for
+ * LD_PRELOAD.
+ *
+ * The allocator initialises itself on first use, from whichever thread gets
+ * there first; there is no init or fini to call.
+ */
+
+#ifndef __HPC_MEM_SIZECLASS_H__
+#define __HPC_MEM_SIZECLASS_H__
+
+#include <hpc/compiler.h>
+#include <hpc/cpu.h>
+#include <mem/alloc.h>
+
+__BEGIN_DECLS
+
+#define SIZECLASS_COUNT       40
+#define SIZECLASS_MIN         16u        /* smallest class, and the alignment */
+#define SIZECLASS_MAX         32768u     /* largest class; above is large    */
+#define SIZECLASS_SMALL_STEPS 8          /* 16..128 in steps of 16           */
+
+/* Address space reserved per class: 4 GiB of spans, never all resident. */
+#ifndef SIZECLASS_SLICE_SHIFT
+#define SIZECLASS_SLICE_SHIFT 32
+#endif
+
+/*
+ * sizeclass_of - the class serving @size bytes, 0 .. SIZECLASS_COUNT - 1.
+ *
+ * @size must be 1 .. SIZECLASS_MAX. Up to 128 bytes the class is the size in
+ * 16 byte steps; above, k is the doubling (2^k < size <= 2^(k+1)) and the two
+ * bits under its top bit pick the quarter.
+ */
+static inline unsigned
+sizeclass_of(size_t size)
+{
+	unsigned k;
+	if (size <= 128)
+		return size ? (unsigned)((size - 1) >> 4) : 0;
+	k = 63u - (unsigned)__builtin_clzll((u64)size - 1);
+	return SIZECLASS_SMALL_STEPS + (k - 7) * 4 +
+	       (unsigned)(((size - 1) >> (k - 2)) & 3);
+}
+
+/* sizeclass_size - the object size of class @idx; the inverse of the above. */
+static inline u32
+sizeclass_size(unsigned idx)
+{
+	unsigned k, q;
+	if (idx < SIZECLASS_SMALL_STEPS)
+		return (u32)(idx + 1) << 4;
+	k = 7 + (idx - SIZECLASS_SMALL_STEPS) / 4;
+	q = (idx - SIZECLASS_SMALL_STEPS) % 4;
+	return (1u << k) + ((q + 1) << (k - 2));
+}
+
+struct mm_sizeclass_stat {
+	u32 size;             /* object size of the class                     */
+	u32 per_span;         /* objects cut from one span                    */
+	u32 span_size;        /* bytes per span                               */
+	u32 spans;            /* spans cut so far                             */
+	u64 large;            /* live large allocations (all classes)         */
+	u64 large_bytes;      /* bytes mapped for them                        */
+};
+
+/* The allocator as a struct mm; dies on exhaustion, like mm_libc(). */
+struct mm *
+mm_sizeclass(void);
+
+void *
+mm_sizeclass_alloc(size_t size);
+
+void *
+mm_sizeclass_calloc(size_t n, size_t size);
+
+void *
+mm_sizeclass_realloc(void *addr, size_t size);
+
+/*
+ * mm_sizeclass_memalign - @size bytes aligned to @align, a power of two.
+ *
+ * Up to a page of alignment is a power-of-two class; beyond, or above
+ * SIZECLASS_MAX, a large mapping with the pointer placed on the boundary.
+ */
+void *
+mm_sizeclass_memalign(size_t align, size_t size);
+
+void
+mm_sizeclass_free(void *addr);
+
+/* Bytes usable at @addr: the class size, or what the large mapping holds. */
+size_t
+mm_sizeclass_usable(void *addr);
+
+/* Counters of class @idx; returns -1 for an index out of range. */
+int
+mm_sizeclass_stat(unsigned idx, struct mm_sizeclass_stat *stat);
+
+__END_DECLS
+
+#endif/*__HPC_MEM_SIZECLASS_H__*/
@@ -0,0 +1,137 @@
+/*
+ * Size-class allocator                        LD_PRELOAD malloc() interposer
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * libhpc-malloc.so: the libc allocation entry points, answered by
+ * <mem/sizeclass.h>. Run a whole service on the size-class allocator with
+ *
+ *     LD_PRELOAD=libhpc-malloc.so ./service
+ *
+ * Every function here is a thin shim; the errno and NULL conventions are the
+ * C library's, which the mm_sizeclass_*() functions already follow, and what
+ * is left to check here is argument validation the C standard puts on the
+ * caller side (posix_memalign()'s alignment, aligned_alloc()'s multiple).
+ *
+ * Built only as the shared object (CONFIG_MEM_SIZECLASS_PRELOAD), never into
+ * built-in.o: a program that links hpc keeps the malloc() it was linked with.
+ */
+
+#include <hpc/compiler.h>
+#include <hpc/cpu.h>
+#include <mem/sizeclass.h>
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define __export __attribute__((visibility("default")))
+
+static inline int
+preload_pow2(size_t align)
+{
+	return align && !(align & (align - 1));
+}
+
+__export void *
+malloc(size_t size)
+{
+	return mm_sizeclass_alloc(size);
+}
+
+__export void
+free(void *addr)
+{
+	mm_sizeclass_free(addr);
+}
+
+__export void *
+calloc(size_t n, size_t size)
+{
+	return mm_sizeclass_calloc(n, size);
+}
+
+__export void *
+realloc(void *addr, size_t size)
+{
+	return mm_sizeclass_realloc(addr, size);
+}
+
+__export int
+posix_memalign(void **out, size_t align, size_t size)
+{
+	void *p;
+	if (!preload_pow2(align) || align % sizeof(void *))
+		return EINVAL;
+	if (!(p = mm_sizeclass_memalign(align, size)))
+		return ENOMEM;
+	*out = p;
+	return 0;
+}
+
+__export void *
+aligned_alloc(size_t align, size_t size)
+{
+	if (!preload_pow2(align)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return mm_sizeclass_memalign(align, size);
+}
+
+__export void *
+memalign(size_t align, size_t size)
+{
+	if (!preload_pow2(align)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return mm_sizeclass_memalign(align, size);
+}
+
+__export void *
+valloc(size_t size)
+{
+	return mm_sizeclass_memalign(CPU_PAGE_SIZE, size);
+}
+
+/* valloc() of whole pages, one at least: glibc's, deprecated but exported */
+__export void *
+pvalloc(size_t size)
+{
+	if (size > SIZE_MAX - CPU_PAGE_SIZE) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return mm_sizeclass_memalign(CPU_PAGE_SIZE,
+	                             size ? align_page(size) : CPU_PAGE_SIZE);
+}
+
+__export size_t
+malloc_usable_size(void *addr)
+{
+	return mm_sizeclass_usable(addr);
+}
@@ -59,7 +59,10 @@
  * veto either direction. slab_gc() applies the policy; slab_grow()/slab_shrink()
  * are the unconditional primitives. Shrink returns resident memory to the OS
  * with madvise(MADV_DONTNEED) over the fully-covered pages of the reclaimed
- * tail.
+ * tail; slab_compact() moves the live blocks that pin it, with the owner's help.
+ * <mem/slab_pressure.h> feeds the policy from outside: PSI and cgroup v2
+ * memory events make a shrink harder under pressure and veto growth near
+ * memory.high.
  *
  * Reservation backend
  * -------------------
@@ -67,6 +70,89 @@
  * mmap()/munmap()/madvise(), -DSLAB_MALLOC_FREE routes it through the libc heap,
  * and the SLAB_VM_* hooks plug in any custom allocator. See <mem/slab_vm.h>,
  * which also carries the CONFIG_MEM_HUGEPAGE / CONFIG_MEM_POPULATE hints.
+ *
+ * Concurrency
+ * -----------
+ * The slab is single-writer by default. slab_alloc_lockfree(),
+ * slab_free_lockfree() and slab_grow_lockfree() are the opt-in concurrent mode:
+ * callable from any number of threads at once, lock-free, over the same free
+ * list. Everything else (shrink, gc, set_policy) stays exclusive. See
+ * <mem/slab_lockfree.h>.
+ *
+ * Allocation order
+ * ----------------
+ * The free list is LIFO: the block freed last is handed out next, still warm in
+ * the cache. slab_set_ordered() switches a slab to handing out the lowest free
+ * index instead, which packs the live set toward the front so that a shrink
+ * finds free grains at the tail again after a spike - at the price of a bitmap
+ * search per allocation. See <mem/slab_order.h>.
+ *
+ * A grow links its fresh blocks lowest index first, as the lock-free grow does,
+ * so a slab consumes a freshly committed range front to back.
+ *
+ * Free-list link
+ * --------------
+ * A free block carries the index of the next one in a u32 of its own, by
+ * default its first four bytes - whatever the owner left there is overwritten
+ * on free, and whatever it finds there on alloc is a link. slab_set_link()
+ * moves that word to another offset, so that an owner who keeps objects
+ * constructed while they are free (the object cache of <mem/slab_obj.h>) can
+ * give up a field of its own, or the slack past the object, and keep the rest
+ * intact across a free and the next alloc.
+ *
+ * Grow-ahead
+ * ----------
+ * Committing is a pointer bump, but the memory behind it is not there yet: the
+ * first touch of each page is a minor fault, taken by whichever allocation
+ * grows the slab or first writes a fresh block - inside the latency-critical
+ * path. SLAB_VM_POPULATE hints a grow's range, synchronously, in that same
+ * path. slab_prefault() takes the work out of it: called from an idle loop,
+ * with a budget of pages, it populates the pages ahead of the slab's
+ * allocations (MADV_POPULATE_WRITE, or a touch of each page where that is not
+ * available) and grows into them, until policy.prefault grains of free
+ * blocks are committed and resident. The slab remembers how far it has
+ * populated (@faulted), forgets it when a shrink releases the pages, and
+ * counts every page populated ahead in the prefault measure - each one a
+ * first-touch fault the allocations no longer take.
+ *
+ * Tiered reclaim
+ * --------------
+ * A shrink normally ends in MADV_DONTNEED: the pages are gone at once, and a
+ * grow after a short dip faults every one of them back in. Under bursty load
+ * that is shrink/grow thrash. policy.reclaim = SLAB_RECLAIM_FREE releases in
+ * stages instead. A shrink advises the tail MADV_FREE - the pages stay mapped
+ * and are reclaimed only if the host runs short, and a grow that comes back
+ * in time writes into them with no fault at all. Once the tail has been
+ * released that way for policy.cold_after, slab_gc() advises it MADV_COLD
+ * (MADV_PAGEOUT under SLAB_RECLAIM_PAGEOUT), and at policy.release_after
+ * MADV_DONTNEED, as a shrink would have done in the first place. The lazy
+ * tail is one range above the committed prefix, [committed, @lazy_end); a
+ * shrink that extends it restarts its age, a grow into it takes its blocks
+ * back (counted as rewarm). Each tier counts its blocks in the measure:
+ * lazy, cold, zap.
+ *
+ * The zero mark stays where it is over a lazy release: the kernel may hand a
+ * MADV_FREE page back zeroed or as it was. Blocks above the mark were zero
+ * either way and stay exempt from clearing; blocks below it are cleared by
+ * slab_zalloc() as any recycled block is, until a final release lowers the
+ * mark. Backends with no MADV_FREE - the heap, an old kernel, a shared file
+ * mapping - release at once.
+ *
+ * Zeroed blocks
+ * -------------
+ * slab_zalloc() hands out a block that reads as zeroes without clearing one that
+ * already does. A fresh anonymous mapping is zero, and so is a range once
+ * MADV_DONTNEED has released it; what spoils a block is handing it out. The slab
+ * keeps the mark below which that may have happened (@virgin): every block from
+ * the mark up has not been handed out since its memory was last zero, bar the
+ * free-list link a grow writes into it. Handing out a block at or
+ * above the mark raises it past the block, a release of the whole tail from the
+ * mark down lowers it again. slab_zalloc() clears the link of a block above the
+ * mark and the whole of any other - the recycled ones - which spares a
+ * consumer of fresh blocks both the memset and the faults it would take on the
+ * pages of a large block the link does not touch. Under a backend that cannot
+ * promise zeroes (SLAB_VM_ZEROES in <mem/slab_vm.h>, 0 for -DSLAB_MALLOC_FREE)
+ * the mark stays at the top and every block is cleared.
  */
 
 #ifndef __HPC_MEM_SLAB_H__
@@ -79,6 +165,8 @@
 #include <mem/measure.h>
 /* SLAB_VM_* / SLAB_MEM_* reservation backend, VM_PAGE_*, SLAB_NIL. */
 #include <mem/slab_vm.h>
+#include <mem/slab_lockfree.h>
+#include <mem/slab_order.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -123,7 +211,23 @@ struct slab;
  *             then-free blocks is returned per @shrink_after interval.
  * @check      optional gate; grow==1 for grow, 0 for shrink; return true to
  *             allow the operation, false to veto it
- * @arg        opaque argument passed to check()
+ * @relocate   optional owner callback that lets a shrink move live blocks out
+ *             of the tail first; see slab_compact(). NULL never moves a block
+ * @release    optional owner callback run on the free blocks [from, to) a
+ *             shrink takes out of the committed prefix, before their pages go
+ *             back (after the grace period, in <mem/slab_rcu.h>)
+ * @compact_budget
+ *             blocks slab_gc() may move per shrink round (0 disables it)
+ * @prefault   grains of free blocks slab_prefault() keeps committed and
+ *             populated ahead of the allocations (0 disables grow-ahead)
+ * @reclaim    how a shrink hands pages back, SLAB_RECLAIM_*; see "Tiered
+ *             reclaim" below. 0 (SLAB_RECLAIM_DONTNEED) releases at once
+ * @cold_after age of a lazily released tail at which slab_gc() advises it
+ *             cold (or pages it out); 0 skips the tier
+ * @release_after
+ *             age at which slab_gc() releases the lazy tail for good; 0 leaves
+ *             it to the kernel's memory pressure
+ * @arg        opaque argument passed to check(), relocate() and release()
  */
 struct slab_policy {
 	u32 min;
@@ -134,9 +238,23 @@ struct slab_policy {
 	u16 shrink_release_pct;
 	timestamp_t shrink_after;
 	bool (*check)(struct slab *slab, int grow, void *arg);
+	bool (*relocate)(void *from, void *to, void *arg);
+	void (*release)(struct slab *slab, u32 from, u32 to, void *arg);
+	u32 compact_budget;
+	u32 prefault;
+	u8 reclaim;
+	timestamp_t cold_after;
+	timestamp_t release_after;
 	void *arg;
 };
 
+/* Release tiers of a shrink, struct slab_policy.reclaim. */
+enum slab_reclaim {
+	SLAB_RECLAIM_DONTNEED = 0, /* MADV_DONTNEED at once                    */
+	SLAB_RECLAIM_FREE     = 1, /* MADV_FREE, then MADV_COLD, then DONTNEED */
+	SLAB_RECLAIM_PAGEOUT  = 2, /* MADV_FREE, then MADV_PAGEOUT, then ...   */
+};
+
 /*
  * Event measurement. The slab keeps a pointer to a caller-owned
  * struct slab_measure (declared by measure_member(slab), defined in
@@ -148,24 +266,48 @@ struct slab_policy {
  * inside slab_init() is never counted because no measure is attached yet.
  */
 
+/* What of a slab belongs to the caller (struct slab.borrowed). */
+#define SLAB_BORROW_PAGE   1  /* the reservation: never freed             */
+#define SLAB_BORROW_MAP    2  /* the occupancy bitmap: never freed        */
+#define SLAB_BORROW_SHARED 4  /* a shared file mapping: release punches   */
+
 /* Dynamic slab allocator handle. */
 struct slab {
 	u64 length;           /* reserved region length in bytes              */
-	u32 list;             /* head index of the free list (SLAB_NIL end)   */
+	union {               /* free-list head; layout of union slab_head    */
+		struct {
+			u32 list;     /* head index of the free list (SLAB_NIL end) */
+			u32 tag;      /* ABA tag of the lock-free mode              */
+		};
+		u64 head;     /* list + tag, swapped whole by the CAS        */
+	};
 	u32 avail;            /* number of free blocks on the list            */
 	u32 committed;        /* blocks currently committed [0, committed)     */
 	u32 total;            /* reserved (maximum) blocks                    */
 	u32 shift;            /* block size aligned to power of 2 (log2)       */
 	u32 grain;            /* blocks per release unit; see <mem/slab_vm.h>  */
+	u32 link;             /* byte offset of the free-list link in a block */
+	u32 virgin;           /* blocks from here up read as zero, bar links  */
+	u32 faulted;          /* blocks below here are committed or populated */
+	u32 lazy_end;         /* [committed, lazy_end) is released lazily      */
+	u8 lazy_tier;         /* how far that tail has been escalated          */
+	u8 lazy_fresh;        /* ... and its age is yet to be stamped          */
+	timestamp_t lazy_since; /* when the tail was last extended             */
 	timestamp_t idle_since; /* when usage first dropped to the low mark    */
 	u8 idle;              /* idle-shrink timer armed                       */
+	u8 borrowed;          /* SLAB_BORROW_*: what the caller owns          */
 	struct slab_policy policy;
 	measure_member(slab)  /* caller-owned event counters (CONFIG_MEASURE)   */
 	u8 *map;              /* occupancy bitmap, one bit per reserved block */
+	u64 *order;           /* free-word summary, NULL unless ordered mode  */
+	u32 order_low;        /* summary words below this are all zero        */
 	void *page;           /* base of the reservation                      */
 };
 
-/* Free-list node overlay: valid only while the block sits on the free list. */
+/*
+ * Free-list node overlay: valid only while the block sits on the free list, at
+ * @link bytes into the block (0 unless slab_set_link() moved it).
+ */
 struct slab_node {
 	u32 avail;            /* next free block index, or SLAB_NIL           */
 };
@@ -210,6 +352,27 @@ __slab_index(struct slab *slab, unsigned shift, void *p)
 	return (u32)(((u8 *)p - (u8 *)slab->page) >> shift);
 }
 
+/* The free-list node of block @index, or of the block at @p. */
+static inline struct slab_node *
+__slab_node(struct slab *slab, unsigned shift, u32 index)
+{
+	return (struct slab_node *)((u8 *)slab->page + slab->link +
+	                            ((size_t)index << shift));
+}
+
+static inline struct slab_node *
+__slab_node_of(struct slab *slab, void *p)
+{
+	return (struct slab_node *)((u8 *)p + slab->link);
+}
+
+/* Where the lock-free primitives find block 0's next-index word. */
+static inline void *
+__slab_link_base(struct slab *slab)
+{
+	return (u8 *)slab->page + slab->link;
+}
+
 /*
  * Round the policy to whole grains: max (and so the reservation) and min up, and
  * grow_step up to at least one grain. A min that rounds past max is clamped to
@@ -229,8 +392,17 @@ __slab_round_policy(struct slab *slab)
 		slab->policy.grow_step = grain;
 }
 
+/*
+ * Release the pages of [@from, @to) for good: the last tier of a shrink.
+ *
+ * Only whole pages go. A block at or above the zero mark whose link word sits
+ * in a page that stays - the range's edges, or all of it when a shared hole
+ * could not be punched - has that word cleared here, so that every block past
+ * the committed prefix and the lazy tail reads as zero whole, whatever link
+ * offset it is committed with next (see slab_set_link()).
+ */
 static inline void
-__slab_madvise_tail(struct slab *slab, unsigned shift, u32 from, u32 to)
+__slab_zap(struct slab *slab, unsigned shift, u32 from, u32 to)
 {
 	uintptr_t pg = CPU_PAGE_SIZE;
 	uintptr_t base = (uintptr_t)slab->page;
@@ -238,8 +410,117 @@ __slab_madvise_tail(struct slab *slab, unsigned shift, u32 from, u32 to)
 	uintptr_t end = base + ((size_t)to << shift);
 	uintptr_t a = align_to(start, pg);      /* first whole page in range   */
 	uintptr_t b = end & ~(pg - 1);          /* last whole page in range    */
-	if (b > a)
+	int zeroes = SLAB_VM_ZEROES;
+	u32 lo, hi;
+	if (b > a && (slab->borrowed & SLAB_BORROW_SHARED))
+		/* a hole reads zero on any backend - once it has been punched */
+		zeroes = !SLAB_VM_RELEASE_SHARED((void *)a, (size_t)(b - a));
+	else if (b > a)
 		SLAB_VM_RELEASE((void *)a, (size_t)(b - a));
+	lo = __max(from, slab->virgin);
+	hi = to;
+	if (zeroes && b > a) {                  /* just the two edges          */
+		for (; lo < hi && (uintptr_t)__slab_node(slab, shift, lo) < a;
+		     lo++)
+			memset(__slab_node(slab, shift, lo), 0,
+			       sizeof(struct slab_node));
+		for (; hi > lo &&
+		       (uintptr_t)__slab_node(slab, shift, hi - 1) >= b; hi--)
+			memset(__slab_node(slab, shift, hi - 1), 0,
+			       sizeof(struct slab_node));
+	} else
+		for (; lo < hi; lo++)
+			memset(__slab_node(slab, shift, lo), 0,
+			       sizeof(struct slab_node));
+	if (slab->faulted > from)               /* the pages are gone again    */
+		slab->faulted = from;
+	measure_add(slab->measure, zap, to - from);
+	/* zero again, and contiguous with the zero blocks above: lower the mark */
+	if (zeroes && a == start && b == end && slab->virgin <= to)
+		slab->virgin = from;
+}
+
+/* Apply @advice to the whole pages of [@from, @to); 0 when it took. */
+static inline int
+__slab_advise(struct slab *slab, unsigned shift, u32 from, u32 to, int advice)
+{
+	uintptr_t pg = CPU_PAGE_SIZE;
+	uintptr_t base = (uintptr_t)slab->page;
+	uintptr_t a = align_to(base + ((size_t)from << shift), pg);
+	uintptr_t b = (base + ((size_t)to << shift)) & ~(pg - 1);
+	if (b <= a)
+		return 0;
+	return SLAB_VM_ADVISE((void *)a, (size_t)(b - a), advice);
+}
+
+/*
+ * The pages of a shrunk tail [@from, @to) go back: lazily, under a tiered
+ * policy and a backend that can, for good otherwise. See "Tiered reclaim".
+ * The owner hears of it first, while the blocks still hold what it left.
+ */
+static inline void
+__slab_madvise_tail(struct slab *slab, unsigned shift, u32 from, u32 to)
+{
+	if (slab->policy.release)
+		slab->policy.release(slab, from, to, slab->policy.arg);
+	if (slab->policy.reclaim != SLAB_RECLAIM_DONTNEED &&
+	    !(slab->borrowed & SLAB_BORROW_SHARED) &&
+	    !__slab_advise(slab, shift, from, to, SLAB_VM_ADVICE_FREE)) {
+		if (slab->lazy_end < to)
+			slab->lazy_end = to;
+		slab->lazy_tier = SLAB_RECLAIM_FREE;
+		slab->lazy_fresh = 1;
+		if (slab->faulted > from)
+			slab->faulted = from;
+		measure_add(slab->measure, lazy, to - from);
+		return;
+	}
+	__slab_zap(slab, shift, from, to);
+}
+
+/*
+ * Escalate the lazy tail by its age at @now: cold after policy.cold_after,
+ * released for good after policy.release_after. Called by slab_gc().
+ */
+static inline void
+__slab_reclaim_tick(struct slab *slab, unsigned shift, timestamp_t now)
+{
+	u32 from = slab->committed, to = slab->lazy_end;
+	timestamp_t age;
+
+	if (to <= from) {
+		slab->lazy_end = 0;
+		return;
+	}
+	if (slab->lazy_fresh || now < slab->lazy_since) {
+		slab->lazy_fresh = 0;
+		slab->lazy_since = now;
+	}
+	age = now - slab->lazy_since;
+	if (slab->policy.release_after && age >= slab->policy.release_after) {
+		__slab_zap(slab, shift, from, to);
+		slab->lazy_end = 0;
+		slab->lazy_tier = 0;
+		trace1("slab_reclaim (zap %u blocks)", to - from);
+	} else if (slab->policy.cold_after && age >= slab->policy.cold_after &&
+	           slab->lazy_tier == SLAB_RECLAIM_FREE) {
+		int pageout = slab->policy.reclaim == SLAB_RECLAIM_PAGEOUT;
+		/* advisory: a kernel without it keeps the tail as it was */
+		__slab_advise(slab, shift, from, to, pageout ?
+		              SLAB_VM_ADVICE_PAGEOUT : SLAB_VM_ADVICE_COLD);
+		slab->lazy_tier = (u8)slab->policy.reclaim + 1;
+		measure_add(slab->measure, cold, to - from);
+		trace1("slab_reclaim (%s %u blocks)", pageout ? "pageout" : "cold",
+			to - from);
+	}
+}
+
+/* Block @idx is being handed out: it is no longer known zero. */
+static inline void
+__slab_spoil(struct slab *slab, u32 idx)
+{
+	if (idx >= slab->virgin)
+		slab->virgin = idx + 1;
 }
 
 /*
@@ -263,6 +544,29 @@ __slab_populate(struct slab *slab, unsigned shift, u32 from, u32 to)
 			 (size_t)(to - from) << shift);
 }
 
+/*
+ * Populate the pages of blocks [@from, @to) for slab_prefault(): ask the
+ * backend first, and where it cannot, touch every page with an atomic add of
+ * zero - a write that changes nothing, so a block past the zero mark stays
+ * zero and a live neighbour sharing the first page loses no concurrent store.
+ * Returns the pages populated.
+ */
+static inline u32
+__slab_prefault(struct slab *slab, unsigned shift, u32 from, u32 to)
+{
+	uintptr_t pg = CPU_PAGE_SIZE;
+	uintptr_t a = ((uintptr_t)slab->page + ((size_t)from << shift)) & ~(pg - 1);
+	uintptr_t b = align_to((uintptr_t)slab->page + ((size_t)to << shift), pg);
+	uintptr_t p;
+
+	if (b <= a)
+		return 0;
+	if (SLAB_VM_PREFAULT((void *)a, (size_t)(b - a)))
+		for (p = a; p < b; p += pg)
+			__atomic_fetch_add((u8 *)p, 0, __ATOMIC_RELAXED);
+	return (u32)((b - a) / pg);
+}
+
 static inline u32
 __slab_grow(struct slab *slab, unsigned shift, u32 n)
 {
@@ -287,16 +591,30 @@ __slab_grow(struct slab *slab, unsigned shift, u32 n)
 		__slab_populate(slab, shift, slab->committed,
 		                slab->committed + plan);
 
-	while (grew < n && slab->committed < slab->policy.max &&
-	       slab->committed < slab->total) {
-		u32 idx = slab->committed++;
-		struct slab_node *node = (struct slab_node *)
-			__slab_at(slab, shift, idx);
-		node->avail = slab->list;
-		slab->list = idx;
-		slab->avail++;
-		grew++;
+	/*
+	 * Link the plan top down, so the lowest fresh block ends up at the head.
+	 * Ordered mode keeps no list: the map is the free set and a grown block
+	 * is already clear in it.
+	 */
+	grew = plan;
+	if (!slab->order) {
+		u32 idx = slab->committed + grew;
+		while (idx-- > slab->committed) {
+			struct slab_node *node = __slab_node(slab, shift, idx);
+			node->avail = slab->list;
+			slab->list = idx;
+		}
 	}
+	if (slab->lazy_end > slab->committed)     /* a lazy tail taken back */
+		measure_add(slab->measure, rewarm,
+		            slab->lazy_end - slab->committed < grew ?
+		            slab->lazy_end - slab->committed : grew);
+	slab->committed += grew;
+	slab->avail += grew;
+	if (slab->faulted < slab->committed)      /* nothing to fault ahead here */
+		slab->faulted = slab->committed;
+	if (slab->lazy_end && slab->lazy_end <= slab->committed)
+		slab->lazy_end = 0;               /* all of it taken back       */
 	if (grew) {
 		measure_inc(slab->measure, grow);
 		measure_add(slab->measure, commit, grew);
@@ -368,10 +686,13 @@ __slab_retire(struct slab *slab, unsigned shift, u32 n, u32 *from, u32 *to)
 	if (!reclaimed)
 		return 0;
 
-	/* Rebuild the free list, dropping the reclaimed tail indices. */
+	/*
+	 * Rebuild the free list, dropping the reclaimed tail indices. Ordered mode
+	 * keeps no list: the tail was free in the map and stays clear there.
+	 */
+	cnt = slab->order ? slab->avail - reclaimed : 0;
 	for (i = slab->list; i != SLAB_NIL; ) {
-		struct slab_node *node = (struct slab_node *)
-			__slab_at(slab, shift, i);
+		struct slab_node *node = __slab_node(slab, shift, i);
 		u32 next = node->avail;
 		if (i < slab->committed) {
 			node->avail = head;
@@ -403,6 +724,29 @@ __slab_shrink(struct slab *slab, unsigned shift, u32 n)
 	return reclaimed;
 }
 
+/* Rebuild the LIFO free list from the map, lowest free block at the head. */
+static inline void
+__slab_relink(struct slab *slab, unsigned shift)
+{
+	u32 w = (slab->committed + 63) >> 6;
+
+	slab->list = SLAB_NIL;
+	while (w-- > 0) {
+		/* free blocks of word w below committed, pushed highest first */
+		u64 v = ~__slab_order_word(slab->map, w);
+		if (((w + 1) << 6) > slab->committed)
+			v &= ~0ull >> (((w + 1) << 6) - slab->committed);
+		while (v) {
+			unsigned b = 63 - (unsigned)__builtin_clzll(v);
+			u32 idx = (w << 6) + b;
+			struct slab_node *node = __slab_node(slab, shift, idx);
+			node->avail = slab->list;
+			slab->list = idx;
+			v &= ~(1ull << b);
+		}
+	}
+}
+
 static inline bool
 __slab_should_grow(struct slab *slab)
 {
@@ -427,38 +771,73 @@ __slab_should_shrink(struct slab *slab)
 	return (u32)used * 100u <= (u32)slab->policy.shrink_usage_pct * c;
 }
 
+/* Ordered mode: the lowest free index, growing when the prefix is full. */
 static inline void *
-__slab_alloc(struct slab *slab, unsigned shift)
+__slab_alloc_ordered(struct slab *slab, unsigned shift)
 {
-	struct slab_node *node = (struct slab_node *)
-		__slab_at(slab, shift, slab->list);
-	u32 idx;
-	if (!node) {
-		/* exhausted - try to grow within policy and the check() gate */
-		if (!__slab_grow_policy(slab, shift)) {
+	u32 nsum = slab_order_sum_words(slab->total);
+	u32 idx = __slab_order_first(slab->map, slab->order, nsum,
+	                             &slab->order_low);
+	if (idx >= slab->committed) {
+		/* full prefix (or SLAB_NIL): the first grown block is the lowest */
+		if (!__slab_grow_policy(slab, shift) || idx >= slab->committed) {
 			measure_inc(slab->measure, fail);
 			return NULL;
 		}
-		node = (struct slab_node *)__slab_at(slab, shift, slab->list);
-		if (!node) {
+	}
+	slab->avail--;
+	BITSET_SET(slab->map, idx);
+	__slab_order_set(slab->map, slab->order, idx);
+	__slab_spoil(slab, idx);
+	measure_inc(slab->measure, alloc);
+	measure_inc(slab->measure, used);              /* gauge up */
+	return __slab_at(slab, shift, idx);
+}
+
+static inline void
+__slab_free_ordered(struct slab *slab, unsigned shift, void *p)
+{
+	u32 idx = __slab_index(slab, shift, p);
+	BITSET_CLR(slab->map, idx);
+	__slab_order_clr(slab->order, &slab->order_low, idx);
+	slab->avail++;
+	measure_inc(slab->measure, free);
+	measure_dec(slab->measure, used);              /* gauge down */
+}
+
+static inline void *
+__slab_alloc(struct slab *slab, unsigned shift)
+{
+	u32 idx;
+	if (unlikely(slab->order != NULL))
+		return __slab_alloc_ordered(slab, shift);
+	idx = slab->list;
+	if (idx == SLAB_NIL) {
+		/* exhausted - try to grow within policy and the check() gate */
+		if (!__slab_grow_policy(slab, shift) ||
+		    (idx = slab->list) == SLAB_NIL) {
 			measure_inc(slab->measure, fail);
 			return NULL;
 		}
 	}
-	slab->list = node->avail;
+	slab->list = __slab_node(slab, shift, idx)->avail;
 	slab->avail--;
-	idx = __slab_index(slab, shift, node);
 	BITSET_SET(slab->map, idx);
+	__slab_spoil(slab, idx);
 	measure_inc(slab->measure, alloc);
 	measure_inc(slab->measure, used);              /* gauge up */
-	return node;
+	return __slab_at(slab, shift, idx);
 }
 
 static inline void
 __slab_free(struct slab *slab, unsigned shift, void *p)
 {
 	u32 idx = __slab_index(slab, shift, p);
-	struct slab_node *node = (struct slab_node *)p;
+	struct slab_node *node = __slab_node_of(slab, p);
+	if (unlikely(slab->order != NULL)) {
+		__slab_free_ordered(slab, shift, p);
+		return;
+	}
 	BITSET_CLR(slab->map, idx);
 	node->avail = slab->list;
 	slab->list = idx;
@@ -467,11 +846,270 @@ __slab_free(struct slab *slab, unsigned shift, void *p)
 	measure_dec(slab->measure, used);              /* gauge down */
 }
 
+/*
+ * Bulk paths. A batch pops (or pushes) one run of the free list in a single
+ * pass, gathers the occupancy bits of consecutive indices into one map word
+ * before writing it - the list hands out runs of neighbours, since a grow
+ * links its blocks in index order - and counts the batch with one measure
+ * update. The ordered mode takes all the clear bits of a map word at once.
+ */
+static inline u32
+__slab_alloc_bulk_ordered(struct slab *slab, unsigned shift, void **out, u32 n)
+{
+	u32 nsum = slab_order_sum_words(slab->total), k = 0;
+
+	while (k < n) {
+		u32 idx = __slab_order_first(slab->map, slab->order, nsum,
+		                             &slab->order_low);
+		u32 w, end, took = 0;
+		u64 v, bits = 0;
+
+		if (idx >= slab->committed) {
+			if (!__slab_grow_policy(slab, shift) ||
+			    idx >= slab->committed)
+				break;
+		}
+		/* every clear bit of the word is at or above idx, the lowest */
+		w = idx >> 6;
+		v = ~__slab_order_word(slab->map, w);
+		end = (w + 1) << 6;
+		if (end > slab->committed)
+			v &= ~0ull >> (end - slab->committed);
+		while (v && k < n) {
+			unsigned b = (unsigned)__builtin_ctzll(v);
+			v &= v - 1;
+			bits |= 1ull << b;
+			out[k++] = __slab_at(slab, shift, (w << 6) + b);
+			took++;
+		}
+		__slab_map_or(slab->map, w, bits);
+		__slab_order_set(slab->map, slab->order, idx);
+		__slab_spoil(slab, (w << 6) + 63 - (u32)__builtin_clzll(bits));
+		slab->avail -= took;
+	}
+	return k;
+}
+
+static inline u32
+__slab_alloc_bulk(struct slab *slab, unsigned shift, void **out, u32 n)
+{
+	u32 k = 0, t = 0, idx, cw = SLAB_NIL, hi = 0;
+	u64 bits = 0;
+
+	if (unlikely(slab->order != NULL)) {
+		k = __slab_alloc_bulk_ordered(slab, shift, out, n);
+		goto count;
+	}
+	idx = slab->list;
+	while (k < n) {
+		struct slab_node *node;
+		if (idx == SLAB_NIL) {
+			/* exhausted mid-batch: settle the list, grow, go on */
+			slab->list = SLAB_NIL;
+			slab->avail -= t;
+			t = 0;
+			if (!__slab_grow_policy(slab, shift))
+				break;
+			idx = slab->list;
+		}
+		node = __slab_node(slab, shift, idx);
+		if (idx >> 6 != cw) {
+			if (bits)
+				__slab_map_or(slab->map, cw, bits);
+			cw = idx >> 6;
+			bits = 0;
+		}
+		bits |= 1ull << (idx & 63);
+		hi = idx > hi ? idx : hi;
+		out[k++] = __slab_at(slab, shift, idx);
+		t++;
+		idx = node->avail;
+	}
+	if (bits)
+		__slab_map_or(slab->map, cw, bits);
+	if (k)
+		__slab_spoil(slab, hi);
+	slab->list = idx;
+	slab->avail -= t;
+count:
+	if (k < n)
+		measure_inc(slab->measure, fail);
+	measure_add(slab->measure, alloc, k);
+	measure_add(slab->measure, used, k);           /* gauge up */
+	return k;
+}
+
+static inline void
+__slab_free_bulk(struct slab *slab, unsigned shift, void **in, u32 n)
+{
+	u32 head = slab->list, cw = SLAB_NIL, i;
+	u64 bits = 0;
+
+	for (i = 0; i < n; i++) {
+		u32 idx = __slab_index(slab, shift, in[i]);
+		if (idx >> 6 != cw) {
+			if (bits) {
+				__slab_map_andnot(slab->map, cw, bits);
+				if (slab->order)
+					__slab_order_clr(slab->order,
+					                 &slab->order_low, cw << 6);
+			}
+			cw = idx >> 6;
+			bits = 0;
+		}
+		bits |= 1ull << (idx & 63);
+		if (!slab->order) {
+			__slab_node_of(slab, in[i])->avail = head;
+			head = idx;
+		}
+	}
+	if (bits) {
+		__slab_map_andnot(slab->map, cw, bits);
+		if (slab->order)
+			__slab_order_clr(slab->order, &slab->order_low, cw << 6);
+	}
+	if (!slab->order)
+		slab->list = head;
+	slab->avail += n;
+	measure_add(slab->measure, free, n);
+	measure_sub(slab->measure, used, n);           /* gauge down */
+}
+
+/*
+ * Zeroed allocation. The mark is read before the allocation moves it: a block
+ * at or above it carries nothing but a free-list link (see "Zeroed blocks").
+ */
+static inline void
+__slab_zero(struct slab *slab, unsigned shift, void *p, u32 mark, u32 *fresh)
+{
+	if (__slab_index(slab, shift, p) >= mark) {
+		memset(__slab_node_of(slab, p), 0, sizeof(struct slab_node));
+		(*fresh)++;
+	} else {
+		memset(p, 0, (size_t)1 << shift);
+	}
+}
+
+static inline void *
+__slab_zalloc(struct slab *slab, unsigned shift)
+{
+	u32 mark = slab->virgin, fresh = 0;
+	void *p = __slab_alloc(slab, shift);
+	if (!p)
+		return NULL;
+	__slab_zero(slab, shift, p, mark, &fresh);
+	measure_add(slab->measure, virgin, fresh);
+	return p;
+}
+
+static inline u32
+__slab_zalloc_bulk(struct slab *slab, unsigned shift, void **out, u32 n)
+{
+	u32 mark = slab->virgin, fresh = 0, k, i;
+	k = __slab_alloc_bulk(slab, shift, out, n);
+	for (i = 0; i < k; i++)
+		__slab_zero(slab, shift, out[i], mark, &fresh);
+	measure_add(slab->measure, virgin, fresh);
+	return k;
+}
+
+/*
+ * __slab_compact - move live blocks from [@target, committed) down into free
+ * slots below @target, highest block first, at most @budget attempts.
+ *
+ * Each move copies the block and then asks @relocate to repoint its owner; a
+ * false return pins the block where it is (the copy landed in a free slot and
+ * is simply forgotten). With @vacated NULL the old slot is freed on the spot.
+ * Otherwise it stays allocated and its index is stored in @vacated, which holds
+ * @budget entries, for the caller to hand back with __slab_compact_release()
+ * once nobody can be reading it - the RCU variant in <mem/slab_rcu.h>.
+ */
+static inline u32
+__slab_compact(struct slab *slab, unsigned shift, u32 target, u32 budget,
+               bool (*relocate)(void *from, void *to, void *arg), void *arg,
+               u32 *vacated)
+{
+	u32 used = slab->committed - slab->avail;
+	u32 lo = 0, hi = slab->committed, moved = 0, tried = 0;
+
+	if (!relocate)
+		return 0;
+	if (target < used)                 /* the live set has to fit below it */
+		target = slab_grain_round(used, slab->grain);
+	while (tried < budget) {
+		u32 src = __slab_map_last_set(slab->map, target, hi);
+		u32 dst = src == SLAB_NIL ? SLAB_NIL :
+		          __slab_map_first_clear(slab->map, lo, target);
+		void *from, *to;
+
+		if (dst == SLAB_NIL)
+			break;
+		tried++;
+		hi = src;                  /* moved or pinned, never looked at again */
+		from = __slab_at(slab, shift, src);
+		to = __slab_at(slab, shift, dst);
+		memcpy(to, from, (size_t)1 << shift);
+		if (!relocate(from, to, arg))
+			continue;
+		lo = dst + 1;
+		BITSET_SET(slab->map, dst);
+		if (slab->order)
+			__slab_order_set(slab->map, slab->order, dst);
+		if (vacated) {
+			vacated[moved] = src;
+		} else {
+			BITSET_CLR(slab->map, src);
+			if (slab->order)
+				__slab_order_clr(slab->order, &slab->order_low, src);
+		}
+		moved++;
+	}
+	if (!tried)
+		return 0;
+
+	/* the copies may have landed on list nodes: the LIFO list is rebuilt */
+	if (vacated)
+		slab->avail -= moved;
+	if (!slab->order)
+		__slab_relink(slab, shift);
+	if (moved) {
+		measure_add(slab->measure, compact, moved);
+		if (vacated)
+			measure_add(slab->measure, used, moved);
+		trace1("slab_compact (%u moved, %u pinned, below %u)",
+			moved, tried - moved, target);
+	}
+	return moved;
+}
+
+/* Free the @n slots a __slab_compact() with @vacated left allocated. */
+static inline void
+__slab_compact_release(struct slab *slab, unsigned shift, const u32 *vacated,
+                       u32 n)
+{
+	u32 i;
+
+	for (i = 0; i < n; i++) {
+		BITSET_CLR(slab->map, vacated[i]);
+		if (slab->order) {
+			__slab_order_clr(slab->order, &slab->order_low, vacated[i]);
+		} else {
+			struct slab_node *node = __slab_node(slab, shift, vacated[i]);
+			node->avail = slab->list;
+			slab->list = vacated[i];
+		}
+	}
+	slab->avail += n;
+	measure_sub(slab->measure, used, n);
+}
+
 static inline int
 __slab_gc(struct slab *slab, unsigned shift, timestamp_t now)
 {
-	u32 want;
+	u32 want, shrunk;
 
+	if (slab->lazy_end)
+		__slab_reclaim_tick(slab, shift, now);
 	if (__slab_should_grow(slab)) {
 		slab->idle = 0;                   /* not idle - cancel the timer */
 		return (int)__slab_grow_policy(slab, shift);
@@ -507,11 +1145,30 @@ __slab_gc(struct slab *slab, unsigned shift, timestamp_t now)
 		return 0;                         /* gate vetoes; stay armed    */
 
 	slab->idle_since = now;                   /* rate-limit the next round */
-	return -(int)__slab_shrink(slab, shift, want);
+	/* stragglers in the tail to be released move down first, if allowed */
+	if (slab->policy.compact_budget)
+		__slab_compact(slab, shift, slab->committed - want,
+		               slab->policy.compact_budget, slab->policy.relocate,
+		               slab->policy.arg, NULL);
+	shrunk = __slab_shrink(slab, shift, want);
+	if (slab->lazy_fresh) {                   /* its age starts now        */
+		slab->lazy_fresh = 0;
+		slab->lazy_since = now;
+	}
+	return -(int)shrunk;
 }
 
+/*
+ * @page, when not NULL, is a reservation of the caller's covering the rounded
+ * policy.max blocks, which the slab then uses and never frees: the segments of
+ * <mem/slab_seg.h> are reserved that way, aligned to their size. @map likewise
+ * is a caller's occupancy bitmap of slab_order_map_bytes(max) bytes, taken as
+ * it is - the persistent slab of <mem/slab_file.h> keeps both in a file and
+ * hands them back here on re-attach.
+ */
 static inline int
-__slab_init(struct slab *slab, unsigned shift, const struct slab_policy *policy)
+__slab_init_in(struct slab *slab, unsigned shift,
+               const struct slab_policy *policy, void *page, u8 *map)
 {
 	memset(slab, 0, sizeof(*slab));
 	slab->shift = shift;
@@ -520,19 +1177,25 @@ __slab_init(struct slab *slab, unsigned shift, const struct slab_policy *policy)
 	__slab_round_policy(slab);
 	slab->total = slab->policy.max;
 	slab->list = SLAB_NIL;
+	slab->virgin = SLAB_VM_ZEROES ? 0 : slab->total;
 	slab->length = (u64)slab->total << shift;
 
-	slab->page = SLAB_VM_ALLOC(slab->length);
+	slab->borrowed = (page ? SLAB_BORROW_PAGE : 0) | (map ? SLAB_BORROW_MAP : 0);
+	slab->page = page ? page : SLAB_VM_ALLOC(slab->length);
 	if (slab->page == SLAB_VM_FAILED) {
 		slab->page = NULL;
 		trace4("slab_init: reserving %lu bytes failed",
 			(unsigned long)slab->length);
 		return -1;
 	}
-	SLAB_VM_HUGEPAGE(slab->page, slab->length);
-	slab->map = (u8 *)SLAB_MEM_CALLOC(BITSET_SIZE(slab->total), 1);
+	if (!page)
+		SLAB_VM_HUGEPAGE(slab->page, slab->length);
+	/* whole 64-bit words, so that the ordered mode can read it by word */
+	slab->map = map ? map :
+		(u8 *)SLAB_MEM_CALLOC(slab_order_map_bytes(slab->total), 1);
 	if (!slab->map) {
-		SLAB_VM_FREE(slab->page, slab->length);
+		if (!page)
+			SLAB_VM_FREE(slab->page, slab->length);
 		slab->page = NULL;
 		return -1;
 	}
@@ -550,17 +1213,94 @@ __slab_init(struct slab *slab, unsigned shift, const struct slab_policy *policy)
 	return 0;
 }
 
+static inline int
+__slab_init(struct slab *slab, unsigned shift, const struct slab_policy *policy)
+{
+	return __slab_init_in(slab, shift, policy, NULL, NULL);
+}
+
 static inline void
 __slab_fini(struct slab *slab)
 {
 	trace4("slab_fini (shift: %u, total: %u, length: %lu): %p",
 		slab->shift, slab->total, (unsigned long)slab->length,
 		slab->page);
-	if (slab->page)
+	if (slab->page && !(slab->borrowed & SLAB_BORROW_PAGE))
 		SLAB_VM_FREE(slab->page, slab->length);
-	SLAB_MEM_FREE(slab->map);
+	if (!(slab->borrowed & SLAB_BORROW_MAP))
+		SLAB_MEM_FREE(slab->map);
+	SLAB_MEM_FREE(slab->order);
 	slab->page = NULL;
 	slab->map = NULL;
+	slab->order = NULL;
+}
+
+/* ---- lock-free mode, see <mem/slab_lockfree.h> --------------------------- */
+
+static inline u32
+__slab_grow_lockfree(struct slab *slab, unsigned shift, u32 n)
+{
+	u32 room = slab->policy.max < slab->total ? slab->policy.max : slab->total;
+	u32 from = 0, grew;
+
+	grew = __slab_lf_reserve(&slab->committed, room,
+	                         slab_grain_round(n, slab->grain), &from);
+	if (!grew)
+		return 0;
+	__slab_populate(slab, shift, from, from + grew);
+	__slab_lf_link(__slab_link_base(slab), shift, from, from + grew);
+	/* count before publishing, so avail never reads below the list */
+	__atomic_fetch_add(&slab->avail, grew, __ATOMIC_RELAXED);
+	__slab_lf_push(&slab->head, __slab_link_base(slab), shift, from,
+	               from + grew - 1);
+
+	measure_add_atomic(slab->measure, grow, 1);
+	measure_add_atomic(slab->measure, commit, grew);
+	measure_add_atomic(slab->measure, committed, grew);
+	return grew;
+}
+
+static inline void *
+__slab_alloc_lockfree(struct slab *slab, unsigned shift)
+{
+	u32 idx, v;
+
+	while ((idx = __slab_lf_pop(&slab->head, __slab_link_base(slab),
+	                            shift)) == SLAB_NIL) {
+		/* exhausted: grow a step; a racing grower's blocks count too */
+		if (slab->policy.check &&
+		    !slab->policy.check(slab, 1, slab->policy.arg)) {
+			measure_add_atomic(slab->measure, fail, 1);
+			return NULL;
+		}
+		if (!__slab_grow_lockfree(slab, shift, slab->policy.grow_step) &&
+		    __atomic_load_n(&slab->list, __ATOMIC_RELAXED) == SLAB_NIL) {
+			measure_add_atomic(slab->measure, fail, 1);
+			return NULL;
+		}
+	}
+	__atomic_fetch_sub(&slab->avail, 1, __ATOMIC_RELAXED);
+	__slab_lf_bit_set(slab->map, idx);
+	/* __slab_spoil(), racing other allocators: the mark only ever rises */
+	v = __atomic_load_n(&slab->virgin, __ATOMIC_RELAXED);
+	while (idx >= v &&
+	       !__atomic_compare_exchange_n(&slab->virgin, &v, idx + 1, true,
+	                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	measure_add_atomic(slab->measure, alloc, 1);
+	measure_add_atomic(slab->measure, used, 1);
+	return __slab_at(slab, shift, idx);
+}
+
+static inline void
+__slab_free_lockfree(struct slab *slab, unsigned shift, void *p)
+{
+	u32 idx = __slab_index(slab, shift, p);
+	__slab_lf_bit_clr(slab->map, idx);
+	__atomic_fetch_add(&slab->avail, 1, __ATOMIC_RELAXED);
+	__slab_lf_push(&slab->head, __slab_link_base(slab), shift, idx, idx);
+	measure_add_atomic(slab->measure, free, 1);
+	measure_sub_atomic(slab->measure, used, 1);
 }
 
 /* ---- public API (block size read from the slab) -------------------------- */
@@ -597,6 +1337,53 @@ slab_free(struct slab *slab, void *p)
 	__slab_free(slab, slab->shift, p);
 }
 
+/*
+ * slab_alloc_bulk / slab_free_bulk - a batch of blocks in one call.
+ *
+ * slab_alloc_bulk() fills @out with up to @n blocks and returns how many it
+ * got: all @n unless the slab ran out and the policy would not grow it, in
+ * which case the batch is short (counted as one fail) and the blocks it did
+ * get are valid. It grows mid-batch as slab_alloc() would. slab_free_bulk()
+ * returns the @n blocks of @in.
+ *
+ * Either is the loop of slab_alloc()/slab_free() it replaces - the same blocks
+ * in the same order, in the ordered mode too - only the list is walked once,
+ * the bitmap is written a word at a time and the measure is counted once per
+ * batch. Exclusive, like every plain call: the lock-free mode has no bulk form.
+ */
+static inline u32
+slab_alloc_bulk(struct slab *slab, void **out, u32 n)
+{
+	return __slab_alloc_bulk(slab, slab->shift, out, n);
+}
+
+static inline void
+slab_free_bulk(struct slab *slab, void **in, u32 n)
+{
+	__slab_free_bulk(slab, slab->shift, in, n);
+}
+
+/*
+ * slab_zalloc / slab_zalloc_bulk - slab_alloc() / slab_alloc_bulk() for blocks
+ * that read as zeroes.
+ *
+ * Only a block that may have been written is cleared in full; one the slab
+ * knows is still zero gets its free-list link cleared and nothing else, so its
+ * untouched pages stay unfaulted. See "Zeroed blocks" above. Exclusive, like
+ * the plain calls.
+ */
+static inline void *
+slab_zalloc(struct slab *slab)
+{
+	return __slab_zalloc(slab, slab->shift);
+}
+
+static inline u32
+slab_zalloc_bulk(struct slab *slab, void **out, u32 n)
+{
+	return __slab_zalloc_bulk(slab, slab->shift, out, n);
+}
+
 /* Unconditional grow/shrink primitives; return blocks actually changed. */
 static inline u32
 slab_grow(struct slab *slab, u32 n)
@@ -610,12 +1397,211 @@ slab_shrink(struct slab *slab, u32 n)
 	return __slab_shrink(slab, slab->shift, n);
 }
 
+/*
+ * slab_compact - move live blocks out of the tail so a shrink can release it.
+ *
+ * Placement alone does not always do it: a handful of long-lived blocks left in
+ * the top grains keeps slab_shrink() from releasing anything above them. This
+ * moves live blocks at index @target and up into the lowest free slots below
+ * @target, highest first, so the tail empties from the top down. Every move is
+ * a copy of the whole block followed by @relocate(@from, @to, @arg), in which
+ * the owner repoints whatever refers to the block - intrusive list and tree
+ * links (qnode, rbnode), hash chains, its own tables. Returning false pins the
+ * block: it stays where it is and the copy is forgotten. @from stays intact
+ * until relocate() returns; after that it is a free block.
+ *
+ * At most @budget blocks are considered per call, which keeps a call bounded
+ * and lets the work be spread: slab_gc() runs it with policy.compact_budget
+ * before each shrink round, against the tail that round means to release, when
+ * policy.relocate is set. A @target below the live count is raised to it,
+ * rounded to a grain. Returns the blocks moved; follow with slab_shrink() to
+ * get the memory back.
+ *
+ * Moving is only ever safe for the owner to allow: a block whose address has
+ * escaped somewhere relocate() cannot reach must be pinned. For readers that
+ * run concurrently under RCU see slab_rcu_compact() in <mem/slab_rcu.h>.
+ */
+static inline u32
+slab_compact(struct slab *slab, u32 target, u32 budget,
+             bool (*relocate)(void *from, void *to, void *arg), void *arg)
+{
+	return __slab_compact(slab, slab->shift, target, budget, relocate, arg,
+	                      NULL);
+}
+
+/*
+ * slab_alloc_lockfree / slab_free_lockfree - the concurrent mode.
+ *
+ * Safe from any number of threads at once, on one slab, with no lock: the free
+ * list is a tagged-index Treiber stack (see <mem/slab_lockfree.h>). An exhausted
+ * list grows by policy.grow_step through slab_grow_lockfree(), with the check()
+ * gate called from whichever thread hit the exhaustion. A block may be freed by
+ * a thread other than the one that allocated it.
+ *
+ * Everything that is not one of these three - slab_shrink(), slab_gc(),
+ * slab_set_policy(), slab_fini() - must run with no lock-free call in flight.
+ * The measure, if attached, is counted with atomic adds.
+ */
+static inline void *
+slab_alloc_lockfree(struct slab *slab)
+{
+	return __slab_alloc_lockfree(slab, slab->shift);
+}
+
+static inline void
+slab_free_lockfree(struct slab *slab, void *p)
+{
+	__slab_free_lockfree(slab, slab->shift, p);
+}
+
+/* Lock-free grow: claims up to @n blocks (grain-rounded) with a CAS. */
+static inline u32
+slab_grow_lockfree(struct slab *slab, u32 n)
+{
+	return __slab_grow_lockfree(slab, slab->shift, n);
+}
+
+/*
+ * slab_set_ordered - switch between LIFO and address-ordered allocation.
+ *
+ * With @on, slab_alloc() hands out the lowest free index from then on, found
+ * through a summary bitmap over the occupancy map (see <mem/slab_order.h>); the
+ * LIFO free list is dropped. Without it the list is rebuilt from the map in
+ * ascending order, so the LIFO mode resumes from the lowest free block. Held
+ * blocks, their contents and the committed set are untouched either way, so a
+ * slab may be switched at any point between other operations on it - say,
+ * ordered while draining after a spike, LIFO again once it is back to size.
+ *
+ * Ordered is the choice for a slab whose occupancy swings: live blocks migrate
+ * toward the front as they are replaced, so the tail empties and slab_gc() can
+ * release it, where a LIFO slab keeps its high-water mark until every block
+ * near the top happens to die at once. It costs a bitmap search per allocation
+ * and gives up the LIFO reuse of a cache-hot block.
+ *
+ * The lock-free mode needs the free list and does not combine with this one.
+ * Returns 0 on success, -1 if the summary could not be allocated (the slab then
+ * stays in LIFO mode).
+ */
+static inline int
+slab_set_ordered(struct slab *slab, bool on)
+{
+	if (on && !slab->order) {
+		slab->order = (u64 *)SLAB_MEM_CALLOC(
+			slab_order_sum_words(slab->total), sizeof(u64));
+		if (!slab->order)
+			return -1;
+		__slab_order_build(slab->map, slab->total, slab->order,
+		                   &slab->order_low);
+		slab->list = SLAB_NIL;
+	} else if (!on && slab->order) {
+		SLAB_MEM_FREE(slab->order);
+		slab->order = NULL;
+		__slab_relink(slab, slab->shift);
+	}
+	return 0;
+}
+
+static inline bool
+slab_ordered(struct slab *slab)
+{
+	return slab->order != NULL;
+}
+
+/*
+ * slab_set_link - keep the free-list link @offset bytes into the block.
+ *
+ * @offset must leave room for the u32 link within the block and be aligned to
+ * it, which the lock-free mode needs. The free list is rebuilt from the map at
+ * the new offset, in ascending order as after slab_set_ordered(), and the old
+ * link word of a block that still reads as zero is cleared - committed or in
+ * the lazy tail; past both __slab_zap() has left none - so slab_zalloc()
+ * keeps its promise. Like slab_set_policy(), exclusive with every other call
+ * on the slab. Returns 0, or -1 for an offset that does not fit.
+ */
+static inline int
+slab_set_link(struct slab *slab, u32 offset)
+{
+	u32 i;
+
+	if (offset & (sizeof(struct slab_node) - 1) ||
+	    offset + sizeof(struct slab_node) > (1u << slab->shift))
+		return -1;
+	/* the lazy tail was committed too: its blocks still hold their links */
+	for (i = slab->virgin; i < __max(slab->committed, slab->lazy_end); i++)
+		memset(__slab_node(slab, slab->shift, i), 0,
+		       sizeof(struct slab_node));
+	slab->link = offset;
+	if (!slab->order)
+		__slab_relink(slab, slab->shift);
+	return 0;
+}
+
+/* Byte offset of the free-list link in a block; see slab_set_link(). */
+static inline u32
+slab_link(struct slab *slab)
+{
+	return slab->link;
+}
+
+/*
+ * slab_prefault - populate and commit ahead of the allocations, a budget at a
+ * time; see "Grow-ahead" above.
+ *
+ * Populates at most @budget pages, lowest first, of the blocks from the
+ * populated mark - never below the committed prefix, which the allocations
+ * fault in themselves - up to policy.prefault grains of free blocks past the
+ * allocations, then commits what it populated in whole grains (check() may
+ * veto that, as for any grow). A budget that runs out mid-block still
+ * populates the whole block. Returns the pages populated,
+ * 0 once the slab is as far ahead as policy.prefault asks or grow-ahead is off.
+ *
+ * Single-writer, like slab_gc(): call it from the thread that owns the slab,
+ * between allocations.
+ */
+static inline u32
+slab_prefault(struct slab *slab, u32 budget)
+{
+	unsigned shift = slab->shift;
+	u64 want = (u64)slab->policy.prefault * slab->grain;
+	u32 end, from, to, pages;
+
+	if (!want || !budget)
+		return 0;
+	if (want > slab->total)
+		want = slab->total;
+	/* free blocks short of @want, as blocks past the committed prefix */
+	end = slab->committed + (slab->avail < want ? (u32)want - slab->avail : 0);
+	end = slab_grain_round(end, slab->grain);
+	if (end > slab->policy.max)
+		end = slab->policy.max;
+	from = __max(slab->faulted, slab->committed);
+	if (from >= end)
+		return 0;
+	to = from + (u32)(((u64)budget * CPU_PAGE_SIZE + ((1u << shift) - 1)) >> shift);
+	if (to > end || to < from)
+		to = end;
+
+	pages = __slab_prefault(slab, shift, from, to);
+	slab->faulted = to;
+	measure_add(slab->measure, prefault, pages);
+
+	/* commit the populated range, the whole grains of it */
+	if (to > slab->committed) {
+		u32 n = (to - slab->committed) / slab->grain * slab->grain;
+		if (n && (!slab->policy.check ||
+		          slab->policy.check(slab, 1, slab->policy.arg)))
+			__slab_grow(slab, shift, n);
+	}
+	return pages;
+}
+
 /*
  * slab_gc - apply the grow/shrink policy once.
  *
  * @now is the current monotonic time in the same unit as policy.shrink_after
- * (milliseconds); it drives the idle-shrink dwell. Callers that do not use a
- * time-based shrink (policy.shrink_after == 0) may pass any value.
+ * (milliseconds); it drives the idle-shrink dwell and the tiers of a lazily
+ * released tail. Callers that use neither (policy.shrink_after == 0, no
+ * policy.reclaim) may pass any value.
  *
  * Returns the signed change in committed blocks: positive if grown, negative
  * if shrunk, zero if the watermarks, the dwell timer or the check() gate left
@@ -39,6 +39,21 @@
  * usable as payload. All times are in the same unit (milliseconds) as the @now
  * passed in, matching slab_gc(). For a build-time block size use struct
  * slab_cache_class in <mem/slab_cache_class.h>.
+ *
+ * Reaping
+ * -------
+ * By default a reap tests the entry of every committed block, which is the
+ * right thing for a few thousand blocks and the wrong one for a few million on
+ * a one-second gc cadence. slab_cache_set_wheel() adds an expiry index - a
+ * hierarchical timing wheel keyed by each block's deadline, see
+ * <mem/slab_cache_wheel.h> - after which a reap visits only the blocks that
+ * are due. Alloc and free file and unfile in O(1); touch stays a single store
+ * and the wheel catches up lazily when the touched block's old bucket comes
+ * due. What is reaped is the same either way. The scan pays per committed
+ * block and the wheel per expiring one, so the wheel wins while a reap frees
+ * a small share of the cache - ten times over at 1/600th per reap - and loses
+ * once that share is more than a few percent; tools/testing/selftests/perf/
+ * slab_cache_reap measures both.
  */
 
 #ifndef __HPC_MEM_SLAB_CACHE_H__
@@ -83,6 +98,9 @@ slab_cache_entry_expired(const struct slab_cache_entry *e, timestamp_t now)
 }
 #endif /* HPC_SLAB_CACHE_ENTRY_DEFINED */
 
+/* The optional expiry index over the entries; see slab_cache_set_wheel(). */
+#include <mem/slab_cache_wheel.h>
+
 struct slab_cache {
 	struct slab slab;              /* backing block allocator            */
 	struct slab_cache_entry *ent;  /* per-block metadata [slab.total]    */
@@ -90,6 +108,7 @@ struct slab_cache {
 	u32 idle;                      /* default idle timeout (ms), 0 = none */
 	u32 live;                      /* live (unexpired) cache blocks       */
 	u64 reaps;                     /* blocks expired and reclaimed        */
+	struct slab_wheel wheel;       /* expiry index, when set_wheel()ed    */
 };
 
 /*
@@ -119,6 +138,7 @@ slab_cache_init(struct slab_cache *c, unsigned block_size,
 static inline void
 slab_cache_fini(struct slab_cache *c)
 {
+	slab_wheel_fini(&c->wheel);
 	SLAB_MEM_FREE(c->ent);
 	c->ent = NULL;
 	slab_fini(&c->slab);
@@ -142,6 +162,7 @@ slab_cache_alloc_ex(struct slab_cache *c, timestamp_t now, u32 ttl, u32 idle)
 	e->atime = now;
 	e->idle = idle;
 	e->used = 1;
+	slab_wheel_add(&c->wheel, c->ent, (u32)(e - c->ent), now);
 	c->live++;
 	return p;
 }
@@ -153,11 +174,52 @@ slab_cache_alloc(struct slab_cache *c, timestamp_t now)
 	return slab_cache_alloc_ex(c, now, c->ttl, c->idle);
 }
 
+/*
+ * slab_cache_alloc_bulk / slab_cache_free_bulk - a batch of blocks in one call.
+ *
+ * The blocks come from slab_alloc_bulk() with the cache's default TTL / idle
+ * timeout and go back through slab_free_bulk(); see there. Returns how many
+ * of the @n blocks were allocated.
+ */
+static inline u32
+slab_cache_alloc_bulk(struct slab_cache *c, timestamp_t now, void **out, u32 n)
+{
+	u32 k = slab_alloc_bulk(&c->slab, out, n), i;
+	for (i = 0; i < k; i++) {
+		u32 idx = slab_index(&c->slab, out[i]);
+		struct slab_cache_entry *e = &c->ent[idx];
+		e->ttl_at = c->ttl ? now + c->ttl : 0;
+		e->atime = now;
+		e->idle = c->idle;
+		e->used = 1;
+		slab_wheel_add(&c->wheel, c->ent, idx, now);
+	}
+	c->live += k;
+	return k;
+}
+
+static inline void
+slab_cache_free_bulk(struct slab_cache *c, void **in, u32 n)
+{
+	u32 i;
+	for (i = 0; i < n; i++) {
+		u32 idx = slab_index(&c->slab, in[i]);
+		struct slab_cache_entry *e = &c->ent[idx];
+		if (e->used) {
+			slab_wheel_del(&c->wheel, c->ent, idx);
+			e->used = 0;
+			c->live--;
+		}
+	}
+	slab_free_bulk(&c->slab, in, n);
+}
+
 /*
  * slab_cache_touch - mark a block used at @now, resetting its idle window.
  *
  * Returns false if the block has already expired (the caller should treat it
- * as gone and let the next reap collect it); true if it is still live.
+ * as gone and let the next reap collect it); true if it is still live. With
+ * the wheel set the block is not re-filed here; see slab_cache_set_wheel().
  */
 static inline bool
 slab_cache_touch(struct slab_cache *c, void *p, timestamp_t now)
@@ -180,23 +242,59 @@ slab_cache_expired(struct slab_cache *c, void *p, timestamp_t now)
 static inline void
 slab_cache_free(struct slab_cache *c, void *p)
 {
-	struct slab_cache_entry *e = &c->ent[slab_index(&c->slab, p)];
+	u32 idx = slab_index(&c->slab, p);
+	struct slab_cache_entry *e = &c->ent[idx];
 	if (e->used) {
+		slab_wheel_del(&c->wheel, c->ent, idx);
 		e->used = 0;
 		c->live--;
 	}
 	slab_free(&c->slab, p);
 }
 
+/*
+ * slab_cache_set_wheel - index block expiry, so reaps stop scanning.
+ *
+ * May be called at any time: blocks already live are filed under their
+ * deadlines, with the wheel's clock at @now. Returns 0, or -1 when the index
+ * cannot be allocated (the cache then keeps scanning). The index costs about 16
+ * bytes per block of the slab's reservation, allocated through SLAB_MEM_CALLOC
+ * here and never again.
+ */
+static inline int
+slab_cache_set_wheel(struct slab_cache *c, timestamp_t now)
+{
+	u32 i, committed = slab_committed(&c->slab);
+	if (slab_wheel_enabled(&c->wheel))
+		return 0;
+	if (slab_wheel_init(&c->wheel, c->slab.total, now))
+		return -1;
+	for (i = 0; i < committed; i++)
+		if (c->ent[i].used)
+			slab_wheel_add(&c->wheel, c->ent, i, now);
+	return 0;
+}
+
 /*
  * slab_cache_reap - free every block that has expired at @now.
  *
  * Reclaimed blocks return to the slab free list. Returns the number reaped.
+ * Walks the wheel when one is set, every committed entry otherwise.
  */
 static inline u32
 slab_cache_reap(struct slab_cache *c, timestamp_t now)
 {
 	u32 reaped = 0, i, committed = slab_committed(&c->slab);
+	if (slab_wheel_enabled(&c->wheel)) {
+		reaped = slab_wheel_expire(&c->wheel, c->ent, now);
+		while ((i = slab_wheel_pop(&c->wheel)) != SLAB_NIL) {
+			c->ent[i].used = 0;
+			c->live--;
+			slab_free(&c->slab, slab_at(&c->slab, i));
+		}
+		c->reaps += reaped;
+		return reaped;
+	}
 	for (i = 0; i < committed; i++) {
 		struct slab_cache_entry *e = &c->ent[i];
 		if (!e->used || !slab_cache_entry_expired(e, now))
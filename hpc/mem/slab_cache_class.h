@@ -34,6 +34,9 @@
  *
  *     #define SLAB_CLASS_BLOCK_SIZE 2048
  *     #include <mem/slab_cache_class.h>
+ *
+ * slab_cache_class_set_wheel() adds the same optional expiry index as
+ * slab_cache_set_wheel(), with the same lazy touch.
  */
 
 #ifndef __HPC_MEM_SLAB_CACHE_CLASS_H__
@@ -55,6 +58,7 @@ struct slab_cache_class {
 	u32 idle;                      /* default idle timeout (ms), 0 = none */
 	u32 live;                      /* live (unexpired) cache blocks       */
 	u64 reaps;                     /* blocks expired and reclaimed        */
+	struct slab_wheel wheel;       /* expiry index, when set_wheel()ed    */
 };
 
 static inline int
@@ -79,6 +83,7 @@ slab_cache_class_init(struct slab_cache_class *c,
 static inline void
 slab_cache_class_fini(struct slab_cache_class *c)
 {
+	slab_wheel_fini(&c->wheel);
 	SLAB_MEM_FREE(c->ent);
 	c->ent = NULL;
 	slab_class_fini(&c->cls);
@@ -97,6 +102,7 @@ slab_cache_class_alloc_ex(struct slab_cache_class *c, timestamp_t now,
 	e->atime = now;
 	e->idle = idle;
 	e->used = 1;
+	slab_wheel_add(&c->wheel, c->ent, (u32)(e - c->ent), now);
 	c->live++;
 	return p;
 }
@@ -107,6 +113,40 @@ slab_cache_class_alloc(struct slab_cache_class *c, timestamp_t now)
 	return slab_cache_class_alloc_ex(c, now, c->ttl, c->idle);
 }
 
+static inline u32
+slab_cache_class_alloc_bulk(struct slab_cache_class *c, timestamp_t now,
+                            void **out, u32 n)
+{
+	u32 k = slab_class_alloc_bulk(&c->cls, out, n), i;
+	for (i = 0; i < k; i++) {
+		u32 idx = slab_class_index(&c->cls, out[i]);
+		struct slab_cache_entry *e = &c->ent[idx];
+		e->ttl_at = c->ttl ? now + c->ttl : 0;
+		e->atime = now;
+		e->idle = c->idle;
+		e->used = 1;
+		slab_wheel_add(&c->wheel, c->ent, idx, now);
+	}
+	c->live += k;
+	return k;
+}
+
+static inline void
+slab_cache_class_free_bulk(struct slab_cache_class *c, void **in, u32 n)
+{
+	u32 i;
+	for (i = 0; i < n; i++) {
+		u32 idx = slab_class_index(&c->cls, in[i]);
+		struct slab_cache_entry *e = &c->ent[idx];
+		if (e->used) {
+			slab_wheel_del(&c->wheel, c->ent, idx);
+			e->used = 0;
+			c->live--;
+		}
+	}
+	slab_class_free_bulk(&c->cls, in, n);
+}
+
 static inline bool
 slab_cache_class_touch(struct slab_cache_class *c, void *p, timestamp_t now)
 {
@@ -127,18 +167,44 @@ slab_cache_class_expired(struct slab_cache_class *c, void *p, timestamp_t now)
 static inline void
 slab_cache_class_free(struct slab_cache_class *c, void *p)
 {
-	struct slab_cache_entry *e = &c->ent[slab_class_index(&c->cls, p)];
+	u32 idx = slab_class_index(&c->cls, p);
+	struct slab_cache_entry *e = &c->ent[idx];
 	if (e->used) {
+		slab_wheel_del(&c->wheel, c->ent, idx);
 		e->used = 0;
 		c->live--;
 	}
 	slab_class_free(&c->cls, p);
 }
 
+static inline int
+slab_cache_class_set_wheel(struct slab_cache_class *c, timestamp_t now)
+{
+	u32 i, committed = slab_class_committed(&c->cls);
+	if (slab_wheel_enabled(&c->wheel))
+		return 0;
+	if (slab_wheel_init(&c->wheel, c->cls.total, now))
+		return -1;
+	for (i = 0; i < committed; i++)
+		if (c->ent[i].used)
+			slab_wheel_add(&c->wheel, c->ent, i, now);
+	return 0;
+}
+
 static inline u32
 slab_cache_class_reap(struct slab_cache_class *c, timestamp_t now)
 {
 	u32 reaped = 0, i, committed = slab_class_committed(&c->cls);
+	if (slab_wheel_enabled(&c->wheel)) {
+		reaped = slab_wheel_expire(&c->wheel, c->ent, now);
+		while ((i = slab_wheel_pop(&c->wheel)) != SLAB_NIL) {
+			c->ent[i].used = 0;
+			c->live--;
+			slab_class_free(&c->cls, slab_class_at(&c->cls, i));
+		}
+		c->reaps += reaped;
+		return reaped;
+	}
 	for (i = 0; i < committed; i++) {
 		struct slab_cache_entry *e = &c->ent[i];
 		if (!e->used || !slab_cache_entry_expired(e, now))
@@ -0,0 +1,487 @@
+/*
+ * Expiry index for the slab caches                   Hierarchical timing wheel
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The optional expiry index of struct slab_cache and struct slab_cache_class
+ * (slab_cache_set_wheel() / slab_cache_class_set_wheel()). Without it a reap
+ * tests every committed block; with it a reap visits only the blocks whose
+ * deadline has come, plus the few that were touched since they were filed.
+ * Included by <mem/slab_cache.h> after struct slab_cache_entry, which it
+ * indexes; not meant to be included on its own.
+ *
+ * The wheel
+ * ---------
+ * SLAB_WHEEL_LEVELS levels of SLAB_WHEEL_SLOTS buckets each, the classic
+ * hierarchical timing wheel: level 0 buckets are one tick wide, level 1
+ * buckets one level 0 revolution wide, and so on. A block is filed by its
+ * deadline - the earlier of ttl_at and atime + idle - in the lowest level whose
+ * span still reaches it. When the clock crosses a level 0 revolution, the next
+ * level 1 bucket is emptied down into level 0 (a cascade), and likewise up the
+ * levels. A deadline beyond the top level's reach is filed at the far end and
+ * re-filed when it gets there.
+ *
+ * A tick is 1 << SLAB_WHEEL_TICK_SHIFT ms. At the default 1 ms a bucket holds
+ * one deadline and a reap is exact - it frees what the full scan would, no
+ * more, no less. Four levels of 64 then reach 2^24 ms, about 4.6 hours, past
+ * which a block is re-filed once per 4.6 hours of its life; a coarser tick
+ * trades cascades for reach and is never early either, only re-checks blocks
+ * due within the current tick on the next reap.
+ *
+ * Finding the next busy bucket does not step through every tick: each level
+ * keeps a 64-bit occupancy word, and the walk jumps with a count-trailing-zeros
+ * straight to the next bucket or cascade that has anything in it. A reap after
+ * an idle hour costs the same as one after an idle second.
+ *
+ * Lazy touch
+ * ----------
+ * A touch only ever pushes a deadline later (the TTL is absolute, the idle
+ * window restarts). So a touch leaves the block where it is - it stays O(1) and
+ * writes nothing but atime - and the block is simply filed too early. When its
+ * bucket comes due, the reap re-tests it against the real deadline and re-files
+ * what has not expired. A block touched a thousand times between reaps moves
+ * once.
+ *
+ * Storage
+ * -------
+ * A bucket is a list of chunks, each an array of SLAB_WHEEL_CHUNK records -
+ * block index and deadline tick - and every block records where it sits -
+ * bucket, chunk and position - in a u32 pair out-of-band next to the entry
+ * array. Filing appends to the bucket's head chunk; unfiling moves the head
+ * chunk's last index into the hole: both O(1). Chunked arrays rather than a
+ * linked list of blocks because a reap is bound by memory latency, not by
+ * instructions: walking a bucket is a sequential read with the entries it
+ * points at prefetched a few ahead, where a list through the blocks would take
+ * one dependent cache miss each. And the deadline in the record lets a cascade
+ * move a block without reading its entry at all.
+ *
+ * Only a list's head chunk is ever partly full, so chunks for every block of
+ * the slab's reservation plus one per bucket (and a few) always suffice, and
+ * the wheel takes them all in one allocation when it is set. Nothing on the
+ * alloc, free or reap path allocates, and so nothing there can fail. All in,
+ * the wheel costs about 16 bytes per block.
+ *
+ * A block is in the wheel exactly when its entry is used and has a deadline;
+ * blocks with neither a TTL nor an idle timeout are never filed.
+ */
+
+#ifndef __HPC_MEM_SLAB_CACHE_WHEEL_H__
+#define __HPC_MEM_SLAB_CACHE_WHEEL_H__
+
+#include <hpc/compiler.h>
+#include <hpc/cpu.h>
+#include <mem/slab_vm.h>
+
+#include <string.h>
+
+__BEGIN_DECLS
+
+#define SLAB_WHEEL_BITS    6
+#define SLAB_WHEEL_SLOTS   (1u << SLAB_WHEEL_BITS)
+#define SLAB_WHEEL_MASK    (SLAB_WHEEL_SLOTS - 1)
+#define SLAB_WHEEL_LEVELS  4
+#define SLAB_WHEEL_BUCKETS (SLAB_WHEEL_LEVELS * SLAB_WHEEL_SLOTS)
+#define SLAB_WHEEL_RANGE   ((u64)1 << (SLAB_WHEEL_LEVELS * SLAB_WHEEL_BITS))
+#define SLAB_WHEEL_CHUNK   31        /* records per chunk: 256 byte chunks */
+#define SLAB_WHEEL_AHEAD   8         /* entries prefetched ahead of a walk */
+
+#ifndef SLAB_WHEEL_TICK_SHIFT
+#define SLAB_WHEEL_TICK_SHIFT 0
+#endif
+
+/* A filed block: its index, and the tick it was filed for (low 32 bits). */
+struct slab_wheel_rec {
+	u32 idx;
+	u32 due;
+};
+
+struct slab_wheel_chunk {
+	u32 next;                      /* next chunk of the bucket, SLAB_NIL  */
+	u32 n;                         /* records used                        */
+	struct slab_wheel_rec rec[SLAB_WHEEL_CHUNK];
+};
+
+struct slab_wheel_where {
+	u32 bucket;
+	u32 pos;                       /* chunk * SLAB_WHEEL_CHUNK + position */
+};
+
+struct slab_wheel {
+	struct slab_wheel_where *where;  /* [total]; NULL = no wheel          */
+	struct slab_wheel_chunk *chunk;  /* the chunk pool                    */
+	u32 spare;                       /* free chunks, through next         */
+	u32 count;                       /* blocks filed                      */
+	u64 tick;                        /* next tick to process              */
+	u64 occupied[SLAB_WHEEL_LEVELS]; /* non-empty buckets, per level      */
+	u32 head[SLAB_WHEEL_BUCKETS];    /* head chunk per bucket, SLAB_NIL   */
+	u32 expired;                     /* chunks of expired blocks to pop   */
+	u64 visits;                      /* blocks examined by expiry         */
+	u64 refiles;                     /* of those, filed again (not due)   */
+	u64 cascades;                    /* blocks moved down a level         */
+};
+
+/*
+ * slab_cache_entry_deadline - when this entry expires, or 0 for never.
+ *
+ * The earlier of the enabled deadlines; slab_cache_entry_expired() is exactly
+ * `now >= slab_cache_entry_deadline()` for a used entry with a deadline.
+ */
+static inline timestamp_t
+slab_cache_entry_deadline(const struct slab_cache_entry *e)
+{
+	timestamp_t idle_at = e->idle ? e->atime + e->idle : 0;
+	if (!e->ttl_at)
+		return idle_at;
+	if (!idle_at)
+		return e->ttl_at;
+	return __min(e->ttl_at, idle_at);
+}
+
+static inline bool
+slab_wheel_enabled(const struct slab_wheel *w)
+{
+	return w->where != NULL;
+}
+
+/* slab_wheel_init - an empty wheel for @total blocks, clock at @now. */
+static inline int
+slab_wheel_init(struct slab_wheel *w, u32 total, timestamp_t now)
+{
+	/* every block in a full chunk, plus a partial head per bucket, for the
+	 * expired list and for the bucket being walked, plus the chunk of that
+	 * walk whose blocks are already filed again elsewhere */
+	u32 chunks = (total + SLAB_WHEEL_CHUNK - 1) / SLAB_WHEEL_CHUNK +
+	             SLAB_WHEEL_BUCKETS + 3, i;
+
+	memset(w, 0, sizeof(*w));
+	w->where = (struct slab_wheel_where *)
+		SLAB_MEM_CALLOC(total ? total : 1,
+		                sizeof(struct slab_wheel_where));
+	w->chunk = (struct slab_wheel_chunk *)
+		SLAB_MEM_CALLOC(chunks, sizeof(struct slab_wheel_chunk));
+	if (!w->where || !w->chunk) {
+		SLAB_MEM_FREE(w->where);
+		SLAB_MEM_FREE(w->chunk);
+		w->where = NULL;
+		return -1;
+	}
+	for (i = 0; i < chunks; i++)
+		w->chunk[i].next = i + 1 < chunks ? i + 1 : SLAB_NIL;
+	for (i = 0; i < SLAB_WHEEL_BUCKETS; i++)
+		w->head[i] = SLAB_NIL;
+	w->expired = SLAB_NIL;
+	w->tick = now >> SLAB_WHEEL_TICK_SHIFT;
+	return 0;
+}
+
+static inline void
+slab_wheel_fini(struct slab_wheel *w)
+{
+	SLAB_MEM_FREE(w->chunk);
+	SLAB_MEM_FREE(w->where);
+	w->chunk = NULL;
+	w->where = NULL;
+}
+
+static inline void
+__slab_wheel_release(struct slab_wheel *w, u32 c)
+{
+	w->chunk[c].next = w->spare;
+	w->spare = c;
+}
+
+/* Append @idx, due at tick @due, to the list at *@head; returns its slot. */
+static inline u32
+__slab_wheel_push(struct slab_wheel *w, u32 *head, u32 idx, u64 due)
+{
+	u32 c = *head;
+	struct slab_wheel_chunk *h;
+
+	if (c == SLAB_NIL || w->chunk[c].n == SLAB_WHEEL_CHUNK) {
+		u32 fresh = w->spare;             /* never runs out, see above */
+		w->spare = w->chunk[fresh].next;
+		w->chunk[fresh].next = c;
+		w->chunk[fresh].n = 0;
+		*head = c = fresh;
+	}
+	h = &w->chunk[c];
+	h->rec[h->n].idx = idx;
+	h->rec[h->n].due = (u32)due;
+	return c * SLAB_WHEEL_CHUNK + h->n++;
+}
+
+/*
+ * File block @idx under deadline @due (in ticks): in the lowest level whose
+ * span, counted from the clock, still reaches it. A deadline already passed is
+ * filed for the current tick, one out of reach at the far end.
+ */
+static inline void
+__slab_wheel_file(struct slab_wheel *w, u32 idx, u64 due)
+{
+	unsigned level, slot;
+	u64 delta;
+
+	if (due < w->tick)
+		due = w->tick;
+	delta = due - w->tick;
+	if (delta >= SLAB_WHEEL_RANGE) {
+		due = w->tick + SLAB_WHEEL_RANGE - 1;
+		delta = SLAB_WHEEL_RANGE - 1;
+	}
+	for (level = 0; level < SLAB_WHEEL_LEVELS - 1; level++)
+		if (delta < (u64)1 << ((level + 1) * SLAB_WHEEL_BITS))
+			break;
+	slot = level * SLAB_WHEEL_SLOTS +
+	       (unsigned)((due >> (level * SLAB_WHEEL_BITS)) & SLAB_WHEEL_MASK);
+
+	w->where[idx].bucket = slot;
+	w->where[idx].pos = __slab_wheel_push(w, &w->head[slot], idx, due);
+	w->occupied[level] |= (u64)1 << (slot % SLAB_WHEEL_SLOTS);
+}
+
+static inline void
+__slab_wheel_unfile(struct slab_wheel *w, u32 idx)
+{
+	unsigned slot = w->where[idx].bucket;
+	u32 pos = w->where[idx].pos, c = w->head[slot];
+	struct slab_wheel_chunk *h = &w->chunk[c];
+	struct slab_wheel_rec last = h->rec[--h->n];
+
+	if (last.idx != idx) {
+		w->chunk[pos / SLAB_WHEEL_CHUNK].rec[pos % SLAB_WHEEL_CHUNK] =
+			last;
+		w->where[last.idx].pos = pos;
+	}
+	if (h->n)
+		return;
+	w->head[slot] = h->next;
+	__slab_wheel_release(w, c);
+	if (w->head[slot] == SLAB_NIL)
+		w->occupied[slot / SLAB_WHEEL_SLOTS] &=
+			~((u64)1 << (slot % SLAB_WHEEL_SLOTS));
+}
+
+/* Take a whole bucket out of the wheel, to be walked with the below. */
+static inline u32
+__slab_wheel_take(struct slab_wheel *w, unsigned slot)
+{
+	u32 c = w->head[slot];
+	w->head[slot] = SLAB_NIL;
+	w->occupied[slot / SLAB_WHEEL_SLOTS] &=
+		~((u64)1 << (slot % SLAB_WHEEL_SLOTS));
+	return c;
+}
+
+/* Prefetch @addr[] of the record @k ahead in chunk @h. */
+#define __slab_wheel_prefetch(h, k, addr, how) do { \
+	if ((k) + SLAB_WHEEL_AHEAD < (h)->n) \
+		cpu_prefetch_##how((void *)&(addr)[(h)->rec[(k) + \
+		                   SLAB_WHEEL_AHEAD].idx]); \
+} while (0)
+
+static inline u64
+__slab_wheel_due(const struct slab_cache_entry *e)
+{
+	return slab_cache_entry_deadline(e) >> SLAB_WHEEL_TICK_SHIFT;
+}
+
+/*
+ * slab_wheel_add - file block @idx, whose entry has just been set at @now.
+ *
+ * A block without a deadline is not filed. An empty wheel takes @now as its
+ * clock, so a cache that sat empty does not walk the time in between.
+ */
+static inline void
+slab_wheel_add(struct slab_wheel *w, const struct slab_cache_entry *ent,
+               u32 idx, timestamp_t now)
+{
+	if (!w->where || !slab_cache_entry_deadline(&ent[idx]))
+		return;
+	if (!w->count)
+		w->tick = now >> SLAB_WHEEL_TICK_SHIFT;
+	__slab_wheel_file(w, idx, __slab_wheel_due(&ent[idx]));
+	w->count++;
+}
+
+/* slab_wheel_del - unfile block @idx; call while its entry is still used. */
+static inline void
+slab_wheel_del(struct slab_wheel *w, const struct slab_cache_entry *ent,
+               u32 idx)
+{
+	if (!w->where || !ent[idx].used || !slab_cache_entry_deadline(&ent[idx]))
+		return;
+	__slab_wheel_unfile(w, idx);
+	w->count--;
+}
+
+/*
+ * Empty the buckets that come due at revolution boundary @t one level down.
+ * A cascaded bucket is never refilled by its own walk: what it held is due
+ * within its span, which is below its level from @t on. Each chunk goes back
+ * to the pool as soon as it is walked, which is what keeps the pool's bound.
+ *
+ * The deadline a block moves under is the one in its record, not in its entry:
+ * a cascade touches nothing but the chunks and where[], and a block touched
+ * since is put right when it reaches level 0, the one place an entry is read.
+ * The record keeps 32 bits of the tick, plenty for deadlines that are never
+ * more than SLAB_WHEEL_RANGE ahead of the clock.
+ */
+static inline void
+__slab_wheel_cascade(struct slab_wheel *w, u64 t)
+{
+	unsigned level;
+	for (level = 1; level < SLAB_WHEEL_LEVELS; level++) {
+		unsigned slot = (unsigned)(t >> (level * SLAB_WHEEL_BITS)) &
+		                SLAB_WHEEL_MASK;
+		u32 c = __slab_wheel_take(w, level * SLAB_WHEEL_SLOTS + slot);
+		while (c != SLAB_NIL) {
+			struct slab_wheel_chunk *h = &w->chunk[c];
+			u32 next = h->next, k;
+			for (k = 0; k < h->n; k++) {
+				__slab_wheel_prefetch(h, k, w->where, write);
+				__slab_wheel_file(w, h->rec[k].idx, t +
+				                  (u32)(h->rec[k].due - (u32)t));
+			}
+			w->cascades += h->n;
+			__slab_wheel_release(w, c);
+			c = next;
+		}
+		if (slot)
+			break;
+	}
+}
+
+/*
+ * The first tick from @t on with work to do: a level 0 bucket to drain or a
+ * cascade to run. Each level is only consulted when all below it are empty,
+ * which is what lets an idle stretch be crossed in one jump.
+ */
+static inline u64
+__slab_wheel_next(struct slab_wheel *w, u64 t)
+{
+	unsigned level;
+
+	if (!(t & SLAB_WHEEL_MASK)) {
+		for (level = 1; level < SLAB_WHEEL_LEVELS; level++) {
+			unsigned slot = (unsigned)(t >> (level * SLAB_WHEEL_BITS)) &
+			                SLAB_WHEEL_MASK;
+			if (w->occupied[level] & ((u64)1 << slot))
+				return t;
+			if (slot)
+				break;
+		}
+	}
+
+	for (level = 0; level < SLAB_WHEEL_LEVELS; level++) {
+		unsigned shift = level * SLAB_WHEEL_BITS;
+		unsigned slot = (unsigned)(t >> shift) & SLAB_WHEEL_MASK;
+		u64 period = (u64)1 << (shift + SLAB_WHEEL_BITS);
+		u64 m = w->occupied[level];
+		if (!m)
+			continue;
+		/* level 0: the bucket at @t is still to drain; above it, the
+		 * bucket holding @t was cascaded on the way in */
+		if (!level)
+			m &= ~(u64)0 << slot;
+		else
+			m &= slot == SLAB_WHEEL_MASK ? 0 : ~(u64)0 << (slot + 1);
+		if (m)
+			return (t & ~(period - 1)) +
+			       ((u64)__builtin_ctzll(m) << shift);
+		/* only buckets of the next revolution are left */
+		return (t | (period - 1)) + 1;
+	}
+	return ~(u64)0;
+}
+
+/*
+ * slab_wheel_expire - unfile every block expired at @now.
+ *
+ * Returns how many; take them with slab_wheel_pop() and free them. Blocks
+ * found in a due bucket but not yet expired (touched since they were filed)
+ * are filed again under their real deadline - past this reap's last tick, so
+ * not looked at twice even with a coarse tick.
+ */
+static inline u32
+slab_wheel_expire(struct slab_wheel *w, const struct slab_cache_entry *ent,
+                  timestamp_t now)
+{
+	u64 limit = now >> SLAB_WHEEL_TICK_SHIFT;
+	u32 expired = 0;
+
+	while (w->tick <= limit) {
+		u64 t = w->tick;
+		u32 c;
+
+		if (!(t & SLAB_WHEEL_MASK))
+			__slab_wheel_cascade(w, t);
+		c = __slab_wheel_take(w, (unsigned)(t & SLAB_WHEEL_MASK));
+		while (c != SLAB_NIL) {
+			struct slab_wheel_chunk *h = &w->chunk[c];
+			u32 next = h->next, k;
+			for (k = 0; k < h->n; k++) {
+				u32 i = h->rec[k].idx;
+				__slab_wheel_prefetch(h, k, ent, read);
+				if (slab_cache_entry_expired(&ent[i], now)) {
+					__slab_wheel_push(w, &w->expired, i, 0);
+					expired++;
+					continue;
+				}
+				__slab_wheel_file(w, i,
+				                  __max(__slab_wheel_due(&ent[i]),
+				                        limit + 1));
+				w->refiles++;
+			}
+			w->visits += h->n;
+			__slab_wheel_release(w, c);
+			c = next;
+		}
+		w->tick = __min(__slab_wheel_next(w, t + 1), limit + 1);
+	}
+	w->count -= expired;
+	return expired;
+}
+
+/* slab_wheel_pop - the next block slab_wheel_expire() found, or SLAB_NIL. */
+static inline u32
+slab_wheel_pop(struct slab_wheel *w)
+{
+	u32 c = w->expired, idx;
+	struct slab_wheel_chunk *h;
+
+	if (c == SLAB_NIL)
+		return SLAB_NIL;
+	h = &w->chunk[c];
+	idx = h->rec[--h->n].idx;
+	if (!h->n) {
+		w->expired = h->next;
+		__slab_wheel_release(w, c);
+	}
+	return idx;
+}
+
+__END_DECLS
+
+#endif/*__HPC_MEM_SLAB_CACHE_WHEEL_H__*/
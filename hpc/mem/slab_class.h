@@ -50,7 +50,10 @@
  * struct slab_class_policy. That includes the reservation backend - the
  * SLAB_VM_* / SLAB_MEM_* hooks in <mem/slab_vm.h>, shared with the dynamic
  * variant, so a custom allocator or CONFIG_MEM_HUGEPAGE / CONFIG_MEM_POPULATE is
- * configured once and applies to both.
+ * configured once and applies to both. So does the opt-in lock-free mode:
+ * slab_class_alloc_lockfree(), slab_class_free_lockfree() and
+ * slab_class_grow_lockfree() may run from many threads at once, everything else
+ * stays exclusive (see <mem/slab_lockfree.h>).
  */
 
 #ifndef __HPC_MEM_SLAB_CLASS_H__
@@ -62,6 +65,9 @@
 #include <hpc/bitset.h>
 /* SLAB_VM_* / SLAB_MEM_* reservation backend, VM_PAGE_*, SLAB_NIL. */
 #include <mem/slab_vm.h>
+#include <mem/slab_lockfree.h>
+/* word-wise map access for the bulk calls */
+#include <mem/slab_order.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -125,7 +131,13 @@ struct slab_class_stat {
 
 struct slab_class {
 	u64 length;           /* reserved region length in bytes              */
-	u32 list;             /* head index of the free list                  */
+	union {               /* free-list head; layout of union slab_head    */
+		struct {
+			u32 list;     /* head index of the free list              */
+			u32 tag;      /* ABA tag of the lock-free mode            */
+		};
+		u64 head;     /* list + tag, swapped whole by the CAS        */
+	};
 	u32 avail;            /* free blocks on the list                      */
 	u32 committed;        /* committed blocks [0, committed)               */
 	u32 total;            /* reserved (maximum) blocks                    */
@@ -365,6 +377,136 @@ slab_class_free(struct slab_class *sc, void *p)
 	sc->stat.used--;
 }
 
+/*
+ * slab_class_alloc_bulk / slab_class_free_bulk - a batch in one call; see
+ * slab_alloc_bulk() in <mem/slab.h>. One pass over the list, the map written a
+ * word at a time, and one stat update per batch.
+ */
+static inline u32
+slab_class_alloc_bulk(struct slab_class *sc, void **out, u32 n)
+{
+	u32 k = 0, t = 0, idx = sc->list, cw = SLAB_NIL;
+	u64 bits = 0;
+
+	while (k < n) {
+		struct slab_class_node *node;
+		if (idx == SLAB_NIL) {
+			sc->list = SLAB_NIL;
+			sc->avail -= t;
+			t = 0;
+			if (!slab_class_grow_policy(sc))
+				break;
+			idx = sc->list;
+		}
+		node = (struct slab_class_node *)slab_class_at(sc, idx);
+		if (idx >> 6 != cw) {
+			if (bits)
+				__slab_map_or(sc->map, cw, bits);
+			cw = idx >> 6;
+			bits = 0;
+		}
+		bits |= 1ull << (idx & 63);
+		out[k++] = node;
+		t++;
+		idx = node->avail;
+	}
+	if (bits)
+		__slab_map_or(sc->map, cw, bits);
+	sc->list = idx;
+	sc->avail -= t;
+	if (k < n)
+		sc->stat.fails++;
+	sc->stat.used += k;
+	if (sc->stat.used > sc->stat.peak)
+		sc->stat.peak = sc->stat.used;
+	return k;
+}
+
+static inline void
+slab_class_free_bulk(struct slab_class *sc, void **in, u32 n)
+{
+	u32 head = sc->list, cw = SLAB_NIL, i;
+	u64 bits = 0;
+
+	for (i = 0; i < n; i++) {
+		u32 idx = slab_class_index(sc, in[i]);
+		if (idx >> 6 != cw) {
+			if (bits)
+				__slab_map_andnot(sc->map, cw, bits);
+			cw = idx >> 6;
+			bits = 0;
+		}
+		bits |= 1ull << (idx & 63);
+		((struct slab_class_node *)in[i])->avail = head;
+		head = idx;
+	}
+	if (bits)
+		__slab_map_andnot(sc->map, cw, bits);
+	sc->list = head;
+	sc->avail += n;
+	sc->stat.used -= n;
+}
+
+/* ---- lock-free mode, see <mem/slab_lockfree.h> --------------------------- */
+
+static inline u32
+slab_class_grow_lockfree(struct slab_class *sc, u32 n)
+{
+	u32 room = sc->policy.max < sc->total ? sc->policy.max : sc->total;
+	u32 from = 0, grew;
+
+	grew = __slab_lf_reserve(&sc->committed, room,
+	                         slab_grain_round(n, SLAB_CLASS_GRAIN), &from);
+	if (!grew)
+		return 0;
+	slab_class_populate(sc, from, from + grew);
+	__slab_lf_link(sc->page, SLAB_CLASS_SHIFT, from, from + grew);
+	__atomic_fetch_add(&sc->avail, grew, __ATOMIC_RELAXED);
+	__slab_lf_push(&sc->head, sc->page, SLAB_CLASS_SHIFT, from, from + grew - 1);
+	__atomic_fetch_add(&sc->stat.grows, 1, __ATOMIC_RELAXED);
+	return grew;
+}
+
+/*
+ * slab_class_alloc_lockfree / slab_class_free_lockfree - the concurrent mode;
+ * see slab_alloc_lockfree() in <mem/slab.h>. The stat counters are updated
+ * atomically, and the peak with a CAS so that a racing update cannot lower it.
+ */
+static inline void *
+slab_class_alloc_lockfree(struct slab_class *sc)
+{
+	u32 idx, used, peak;
+
+	while ((idx = __slab_lf_pop(&sc->head, sc->page, SLAB_CLASS_SHIFT))
+	       == SLAB_NIL) {
+		if ((sc->policy.check && !sc->policy.check(sc, 1, sc->policy.arg)) ||
+		    (!slab_class_grow_lockfree(sc, sc->policy.grow_step) &&
+		     __atomic_load_n(&sc->list, __ATOMIC_RELAXED) == SLAB_NIL)) {
+			__atomic_fetch_add(&sc->stat.fails, 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+	}
+	__atomic_fetch_sub(&sc->avail, 1, __ATOMIC_RELAXED);
+	__slab_lf_bit_set(sc->map, idx);
+	used = __atomic_add_fetch(&sc->stat.used, 1, __ATOMIC_RELAXED);
+	peak = __atomic_load_n(&sc->stat.peak, __ATOMIC_RELAXED);
+	while (used > peak &&
+	       !__atomic_compare_exchange_n(&sc->stat.peak, &peak, used, true,
+	                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	return slab_class_at(sc, idx);
+}
+
+static inline void
+slab_class_free_lockfree(struct slab_class *sc, void *p)
+{
+	u32 idx = slab_class_index(sc, p);
+	__slab_lf_bit_clr(sc->map, idx);
+	__atomic_fetch_add(&sc->avail, 1, __ATOMIC_RELAXED);
+	__slab_lf_push(&sc->head, sc->page, SLAB_CLASS_SHIFT, idx, idx);
+	__atomic_fetch_sub(&sc->stat.used, 1, __ATOMIC_RELAXED);
+}
+
 /*
  * slab_class_gc - apply the grow/shrink policy once.
  *
@@ -452,7 +594,7 @@ slab_class_init(struct slab_class *sc, const struct slab_class_policy *policy)
 		return -1;
 	}
 	SLAB_VM_HUGEPAGE(sc->page, sc->length);
-	sc->map = (u8 *)SLAB_MEM_CALLOC(BITSET_SIZE(sc->total), 1);
+	sc->map = (u8 *)SLAB_MEM_CALLOC(slab_order_map_bytes(sc->total), 1);
 	if (!sc->map) {
 		SLAB_VM_FREE(sc->page, sc->length);
 		sc->page = NULL;
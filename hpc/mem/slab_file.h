@@ -0,0 +1,477 @@
+/*
+ * Expiring block cache in a file or memfd                 Persistent slab
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A struct slab_cache (<mem/slab_cache.h>) whose whole state lives in a file or
+ * a memfd, so that a restarted process re-attaches to its cached blocks
+ * instead of rebuilding them.
+ *
+ * Layout
+ * ------
+ * One shared mapping of the file holds, in order:
+ *
+ *   header   one page: magic, version, geometry, and the slab's state as of
+ *            the last clean detach (struct slab_file_hdr)
+ *   map      the occupancy bitmap, slab_order_map_bytes(total) bytes
+ *   entries  the struct slab_cache_entry array, total of them
+ *   blocks   the reservation itself, total << shift bytes, starting on a
+ *            grain boundary of the file
+ *
+ * The file is sized once, sparse, to the whole reservation - the same "reserve
+ * once, commit a prefix" contract as an anonymous slab, so nothing is resized
+ * and no block ever moves within the file. The slab runs over the mapping as a
+ * borrowed reservation and bitmap (SLAB_BORROW_* in <mem/slab.h>); a shrink
+ * punches holes in the file (SLAB_VM_RELEASE_SHARED in <mem/slab_vm.h>), so
+ * released blocks stop costing page cache or tmpfs memory.
+ *
+ * Across a restart
+ * ----------------
+ * The mapping lands at a different address every time, so nothing persistent
+ * may hold a pointer. The slab itself holds none - its free list links blocks
+ * by index - and neither should the blocks: refer to a block by its index,
+ * slab_file_ref(), and turn it back into a pointer after attaching with
+ * slab_file_get(). Cache entry deadlines are stored as given, so an expiry
+ * that should survive a restart needs a @now from a clock that does too
+ * (wall-clock milliseconds, not CLOCK_MONOTONIC across a reboot). The timing
+ * wheel and the ordered mode are in-process indexes: set them up again after
+ * attaching.
+ *
+ * A memfd outlives its creator only while some process holds it: hand it to
+ * the successor across exec() or over a unix socket, detach with
+ * slab_file_detach() (which keeps the descriptor) and attach it there with
+ * slab_file_attach(). A path needs nothing of the sort.
+ *
+ * Unclean shutdown
+ * ----------------
+ * Attaching marks the header dirty; only slab_file_detach() and
+ * slab_file_close() mark it clean again, after writing back the list head,
+ * the counts and the zero mark. A clean attach restores those and costs a
+ * mapping and a header read. A dirty one - the previous owner died attached
+ * - runs slab_file_check(), which trusts nothing but the bitmap and the
+ * entries:
+ *
+ *   - the committed prefix is the recorded one, extended to cover the
+ *     highest allocated block (a grow after the last clean detach),
+ *   - a block is live when both its map bit and its entry say so, a half-done
+ *     alloc or free is completed as a free, and an entry past the committed
+ *     prefix is cleared,
+ *   - the free list is relinked from the bitmap, the counts recomputed, and
+ *     no block is assumed zero any more.
+ *
+ * That is one pass over the bitmap and the entries. slab_file_check() may be
+ * called on a live slab too; it returns the number of repairs. Durability is
+ * the page cache's: a process crash loses nothing written to a block, a
+ * machine crash may lose anything not written back, and nothing here calls
+ * msync().
+ *
+ * Geometry (block shift, block count, entry size) is recorded in the header
+ * and must match on attach; a file of another geometry or version is refused,
+ * never reinterpreted.
+ */
+
+#ifndef __HPC_MEM_SLAB_FILE_H__
+#define __HPC_MEM_SLAB_FILE_H__
+
+#include <hpc/compiler.h>
+#include <mem/slab_cache.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+__BEGIN_DECLS
+
+#define SLAB_FILE_MAGIC   0x31424c5346435048ull  /* "HPCFSLB1", little end */
+#define SLAB_FILE_VERSION 1
+
+enum slab_file_state {
+	SLAB_FILE_CLEAN = 1,      /* detached cleanly; the state below is good */
+	SLAB_FILE_DIRTY = 2,      /* attached, or its owner died attached     */
+};
+
+/* How slab_file_attach() found the file. */
+enum slab_file_how {
+	SLAB_FILE_CREATED   = 1,  /* empty: laid out afresh                   */
+	SLAB_FILE_ATTACHED  = 2,  /* clean: state restored from the header     */
+	SLAB_FILE_RECOVERED = 3,  /* dirty: rebuilt by slab_file_check()       */
+};
+
+struct slab_file_hdr {
+	u64 magic;
+	u32 version;
+	u32 state;                /* enum slab_file_state                      */
+	u32 shift;
+	u32 total;
+	u32 ent_size;             /* sizeof(struct slab_cache_entry)           */
+	u32 hdr_size;
+	u64 map_off;
+	u64 ent_off;
+	u64 page_off;
+	u64 length;               /* of the whole file                         */
+	/* the slab as of the last clean detach */
+	u32 committed;
+	u32 list;
+	u32 avail;
+	u32 virgin;
+	u32 live;
+	u32 unused;
+	u64 reaps;
+	/* history */
+	u64 attaches;
+	u64 recoveries;
+};
+
+_Static_assert(sizeof(struct slab_file_hdr) <= CPU_PAGE_SIZE,
+	"the header fits its page");
+
+struct slab_file {
+	struct slab_cache cache;  /* use through the slab_cache_*() calls     */
+	struct slab_file_hdr *hdr;
+	u8 *base;                 /* the mapping                              */
+	u64 length;
+	int fd;
+	bool own_fd;              /* opened here, closed by slab_file_close() */
+	u8 how;                   /* enum slab_file_how of the last attach    */
+	u32 repaired;             /* by the last slab_file_check()            */
+};
+
+/* The file layout for @total blocks of 1 << @shift bytes. */
+static inline void
+__slab_file_layout(struct slab_file_hdr *h, u32 shift, u32 total)
+{
+	u64 grain = SLAB_GRAIN_BYTES > CPU_PAGE_SIZE ? SLAB_GRAIN_BYTES
+	                                             : CPU_PAGE_SIZE;
+	h->shift = shift;
+	h->total = total;
+	h->ent_size = (u32)sizeof(struct slab_cache_entry);
+	h->hdr_size = (u32)sizeof(*h);
+	h->map_off = CPU_PAGE_SIZE;
+	h->ent_off = align_to(h->map_off + slab_order_map_bytes(total), 64);
+	h->page_off = align_to(h->ent_off + (u64)total * h->ent_size, grain);
+	h->length = h->page_off + ((u64)total << shift);
+}
+
+/* Does the header describe the geometry @want, under this build? */
+static inline bool
+__slab_file_valid(const struct slab_file_hdr *h, const struct slab_file_hdr *want)
+{
+	return h->magic == SLAB_FILE_MAGIC && h->version == SLAB_FILE_VERSION &&
+	       h->shift == want->shift && h->total == want->total &&
+	       h->ent_size == want->ent_size && h->hdr_size == want->hdr_size &&
+	       h->map_off == want->map_off && h->ent_off == want->ent_off &&
+	       h->page_off == want->page_off && h->length == want->length;
+}
+
+/* Is the recorded state one a clean attach can take as it is? */
+static inline bool
+__slab_file_sane(const struct slab_file_hdr *h)
+{
+	return h->committed <= h->total && h->avail <= h->committed &&
+	       h->live == h->committed - h->avail && h->virgin <= h->total &&
+	       (h->list == SLAB_NIL ? h->avail == 0 : h->list < h->committed);
+}
+
+/*
+ * slab_file_check - rebuild the slab's state from the bitmap and the entries.
+ *
+ * What a dirty attach runs; see "Unclean shutdown" above. Returns the number of
+ * blocks and entries repaired, also kept in @f->repaired.
+ */
+static inline u32
+slab_file_check(struct slab_file *f)
+{
+	struct slab_cache *c = &f->cache;
+	struct slab *slab = &c->slab;
+	u32 committed = f->hdr->committed, last, live = 0, fixed = 0, i;
+
+	if (committed > slab->total)
+		committed = slab->total;
+	if (committed < slab->committed)
+		committed = slab->committed;
+	last = __slab_map_last_set(slab->map, 0, slab->total);
+	if (last != SLAB_NIL && last >= committed)
+		committed = slab_grain_round(last + 1, slab->grain);
+	if (committed > slab->total)
+		committed = slab->total;
+
+	for (i = 0; i < slab->total; i++) {
+		struct slab_cache_entry *e = &c->ent[i];
+		bool set = i < committed && BITSET_TEST(slab->map, i);
+		if (set && e->used) {
+			live++;
+			continue;
+		}
+		if (set) {
+			BITSET_CLR(slab->map, i);
+			fixed++;
+		}
+		if (e->used) {
+			slab_wheel_del(&c->wheel, c->ent, i);
+			e->used = 0;
+			fixed++;
+		}
+	}
+
+	slab->committed = committed;
+	__slab_relink(slab, slab->shift);
+	slab->avail = committed - live;
+	slab->virgin = slab->total;
+	if (slab->order)
+		__slab_order_build(slab->map, slab->total, slab->order,
+		                   &slab->order_low);
+	c->live = live;
+	f->repaired = fixed;
+	trace4("slab_file_check (committed %u, live %u): %u repaired",
+		committed, live, fixed);
+	return fixed;
+}
+
+/* Write the slab's state to the header, marked @state. */
+static inline void
+__slab_file_save(struct slab_file *f, u32 state)
+{
+	struct slab_file_hdr *h = f->hdr;
+	struct slab *slab = &f->cache.slab;
+
+	h->committed = slab->committed;
+	h->list = slab->list;
+	h->avail = slab->avail;
+	h->virgin = slab->virgin;
+	h->live = f->cache.live;
+	h->reaps = f->cache.reaps;
+	__atomic_store_n(&h->state, state, __ATOMIC_RELEASE);
+}
+
+/*
+ * slab_file_attach - run an expiring cache over the file behind @fd.
+ *
+ * An empty file is laid out for @block_size and @policy and committed to
+ * policy->min, like slab_cache_init(); a file laid out before must match both
+ * and keeps what it holds. @ttl / @idle are the defaults of this attach, as in
+ * slab_cache_init(). Returns 0 with @f->how saying which it was, or -1 with
+ * errno set - EINVAL for a file of another geometry or version. @fd stays the
+ * caller's.
+ */
+static inline int
+slab_file_attach(struct slab_file *f, int fd, unsigned block_size,
+                 const struct slab_policy *policy, u32 ttl, u32 idle)
+{
+	unsigned shift = slab_shift_for(block_size);
+	u32 total = slab_grain_round(policy->max, slab_grain_for(shift));
+	struct slab_policy pol = *policy;
+	struct slab_cache *c = &f->cache;
+	struct slab_file_hdr want;
+	struct stat st;
+	bool fresh;
+	void *base;
+
+	memset(f, 0, sizeof(*f));
+	memset(&want, 0, sizeof(want));
+	f->fd = fd;
+	__slab_file_layout(&want, shift, total);
+	if (fstat(fd, &st))
+		return -1;
+	fresh = st.st_size == 0;
+	if (fresh && ftruncate(fd, (off_t)want.length))
+		return -1;
+	if (!fresh && (u64)st.st_size < want.length) {
+		errno = EINVAL;
+		return -1;
+	}
+	base = SLAB_VM_FILE_MAP(fd, want.length);
+	if (base == SLAB_VM_FAILED)
+		return -1;
+	f->base = (u8 *)base;
+	f->length = want.length;
+	f->hdr = (struct slab_file_hdr *)base;
+
+	if (fresh) {
+		*f->hdr = want;
+		f->hdr->magic = SLAB_FILE_MAGIC;
+		f->hdr->version = SLAB_FILE_VERSION;
+		f->hdr->state = SLAB_FILE_DIRTY;
+	} else if (!__slab_file_valid(f->hdr, &want)) {
+		trace4("slab_file_attach: fd %d has another layout", fd);
+		SLAB_VM_FILE_UNMAP(base, want.length);
+		memset(f, 0, sizeof(*f));
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* the initial commit is the empty file's only: a kept one is restored */
+	if (!fresh)
+		pol.min = 0;
+	if (__slab_init_in(&c->slab, shift, &pol, f->base + want.page_off,
+	                   f->base + want.map_off)) {
+		SLAB_VM_FILE_UNMAP(base, want.length);
+		memset(f, 0, sizeof(*f));
+		return -1;
+	}
+	c->slab.borrowed |= SLAB_BORROW_SHARED;
+	c->slab.policy.min = slab_grain_round(policy->min, c->slab.grain);
+	if (c->slab.policy.min > c->slab.policy.max)
+		c->slab.policy.min = c->slab.policy.max;
+	c->ent = (struct slab_cache_entry *)(f->base + want.ent_off);
+	c->ttl = ttl;
+	c->idle = idle;
+
+	if (fresh) {
+		f->how = SLAB_FILE_CREATED;
+	} else if (f->hdr->state == SLAB_FILE_CLEAN && __slab_file_sane(f->hdr)) {
+		c->slab.committed = f->hdr->committed;
+		c->slab.list = f->hdr->list;
+		c->slab.avail = f->hdr->avail;
+		c->slab.virgin = f->hdr->virgin;
+		c->live = f->hdr->live;
+		c->reaps = f->hdr->reaps;
+		f->how = SLAB_FILE_ATTACHED;
+	} else {
+		c->reaps = f->hdr->reaps;
+		slab_file_check(f);
+		f->hdr->recoveries++;
+		f->how = SLAB_FILE_RECOVERED;
+	}
+	f->hdr->attaches++;
+	__atomic_store_n(&f->hdr->state, SLAB_FILE_DIRTY, __ATOMIC_RELEASE);
+	trace4("slab_file_attach (fd %d, how %u, committed %u, live %u): %p",
+		fd, f->how, c->slab.committed, c->live, f->base);
+	return 0;
+}
+
+/*
+ * slab_file_open - attach to the file at @path, creating it empty if need be.
+ * The descriptor is the slab's, closed by slab_file_close().
+ */
+static inline int
+slab_file_open(struct slab_file *f, const char *path, unsigned block_size,
+               const struct slab_policy *policy, u32 ttl, u32 idle)
+{
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -1;
+	if (slab_file_attach(f, fd, block_size, policy, ttl, idle)) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	f->own_fd = true;
+	return 0;
+}
+
+/*
+ * slab_file_memfd - create an anonymous file named @name and attach to it.
+ *
+ * The memfd is inherited across exec(), which is how it reaches a successor;
+ * see slab_file_fd().
+ */
+static inline int
+slab_file_memfd(struct slab_file *f, const char *name, unsigned block_size,
+                const struct slab_policy *policy, u32 ttl, u32 idle)
+{
+#ifdef MFD_CLOEXEC
+	int fd = memfd_create(name, 0);
+	if (fd < 0)
+		return -1;
+	if (slab_file_attach(f, fd, block_size, policy, ttl, idle)) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	f->own_fd = true;
+	return 0;
+#else
+	(void)f; (void)name; (void)block_size; (void)policy; (void)ttl;
+	(void)idle;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+ * slab_file_detach - save the slab's state, mark the file clean and unmap it.
+ *
+ * Every block pointer is void afterwards. Returns the descriptor, which stays
+ * open for a later slab_file_attach() - here or in a successor - and is the
+ * caller's to close from now on.
+ */
+static inline int
+slab_file_detach(struct slab_file *f)
+{
+	int fd = f->fd;
+
+	slab_wheel_fini(&f->cache.wheel);
+	__slab_file_save(f, SLAB_FILE_CLEAN);
+	__slab_fini(&f->cache.slab);
+	SLAB_VM_FILE_UNMAP(f->base, f->length);
+	trace4("slab_file_detach (fd %d)", fd);
+	memset(f, 0, sizeof(*f));
+	f->fd = -1;
+	return fd;
+}
+
+/* slab_file_close - detach, and close the descriptor if the slab opened it. */
+static inline void
+slab_file_close(struct slab_file *f)
+{
+	bool own = f->own_fd;
+	int fd = slab_file_detach(f);
+	if (own)
+		close(fd);
+}
+
+static inline int
+slab_file_fd(struct slab_file *f)
+{
+	return f->fd;
+}
+
+/* A reference to block @p that stays valid across detach and attach. */
+static inline u32
+slab_file_ref(struct slab_file *f, void *p)
+{
+	return slab_index(&f->cache.slab, p);
+}
+
+/* The live block behind @ref, or NULL when it is free, out of range or gone. */
+static inline void *
+slab_file_get(struct slab_file *f, u32 ref)
+{
+	struct slab *slab = &f->cache.slab;
+	if (ref >= slab->committed || !BITSET_TEST(slab->map, ref) ||
+	    !f->cache.ent[ref].used)
+		return NULL;
+	return slab_at(slab, ref);
+}
+
+__END_DECLS
+
+#endif/*__HPC_MEM_SLAB_FILE_H__*/
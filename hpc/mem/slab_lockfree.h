@@ -0,0 +1,193 @@
+/*
+ * Lock-free slab free list                       Tagged-index Treiber stack
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The primitives behind the lock-free mode of struct slab and struct slab_class
+ * (slab_alloc_lockfree() and friends in <mem/slab.h> and <mem/slab_class.h>).
+ * Both keep their free list the same way - a u32 head index, each free block's
+ * link word the index of the next - so the stack operations are written once
+ * here, over the fields rather than over either struct. @page is where block
+ * 0's link word is: the base of the blocks, moved up by the link offset of a
+ * slab that has one (slab_set_link()).
+ *
+ * ABA and the tag
+ * ---------------
+ * A Treiber stack pops by reading the head, reading head->next, and swinging
+ * the head to next with a CAS. If, between the two reads and the CAS, other
+ * threads pop that block, pop more, and push the first one back, the head is
+ * the same index again and a plain CAS succeeds - installing a next that is
+ * long stale. The fix used here is the classic one: the head is a u32 index and
+ * a u32 tag side by side in one 64-bit word, every successful pop or push bumps
+ * the tag, and the CAS compares both. A stale head now fails unless exactly
+ * 2^32 operations have hit this one list between a thread's read and its CAS.
+ * Indices are what make the pair fit a single-word CAS: a pointer and a tag
+ * would need a double-word one.
+ *
+ * Why reading a popped block is safe
+ * ----------------------------------
+ * A pop reads the next index out of a block that another thread may already
+ * have popped and started writing to. The value read is then garbage, but the
+ * tag makes the CAS fail and the loop retries, so the garbage is never used.
+ * What has to hold is that the read itself cannot fault - and it cannot: the
+ * slab's reservation is never remapped and the committed prefix never shrinks
+ * while lock-free calls are running (a shrink is exclusive, see below), so
+ * every index ever seen on the list addresses mapped memory.
+ *
+ * Grow, shrink and the rest
+ * -------------------------
+ * A grow is lock-free too: the new blocks are claimed by a CAS that advances
+ * `committed`, linked among themselves privately and pushed onto the list as
+ * one chain with a single CAS. Shrink, gc, set_policy and fini are not: they
+ * rebuild the list and release the committed tail, so they need the slab to
+ * themselves - run them with no lock-free call in flight (a stop-the-world
+ * point, or under a rwlock whose readers are the lock-free callers). The plain
+ * slab_alloc()/slab_free() may be used in the same exclusive windows; they do
+ * not bump the tag, which is harmless when nothing can be holding a stale head.
+ *
+ * The block count (`avail`) is kept with separate atomic adds, ordered so that
+ * it never reads below the true length of the list; used = committed - avail is
+ * a snapshot that can be off by the operations in flight, exact once quiesced.
+ */
+
+#ifndef __HPC_MEM_SLAB_LOCKFREE_H__
+#define __HPC_MEM_SLAB_LOCKFREE_H__
+
+#include <hpc/compiler.h>
+/* SLAB_NIL */
+#include <mem/slab_vm.h>
+
+__BEGIN_DECLS
+
+/*
+ * The free-list head as one CAS word. The slab structs embed the same layout as
+ * an anonymous union, so `list` stays an ordinary member for the exclusive
+ * paths and `head` is what the lock-free ones swap.
+ */
+union slab_head {
+	struct {
+		u32 list;     /* head index, SLAB_NIL when empty */
+		u32 tag;      /* bumped by every lock-free pop and push */
+	};
+	u64 word;
+};
+
+/* The next-index word of free block @idx. */
+static inline u32 *
+__slab_lf_next(void *page, unsigned shift, u32 idx)
+{
+	return (u32 *)((u8 *)page + ((size_t)idx << shift));
+}
+
+/* Pop one block; returns its index or SLAB_NIL when the list is empty. */
+static inline u32
+__slab_lf_pop(u64 *head, void *page, unsigned shift)
+{
+	union slab_head old, new;
+	old.word = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+	do {
+		if (old.list == SLAB_NIL)
+			return SLAB_NIL;
+		/* may read a block another thread owns by now; see above */
+		new.list = __atomic_load_n(__slab_lf_next(page, shift, old.list),
+		                           __ATOMIC_RELAXED);
+		new.tag = old.tag + 1;
+	} while (!__atomic_compare_exchange_n(head, &old.word, new.word, true,
+	                                      __ATOMIC_ACQUIRE,
+	                                      __ATOMIC_ACQUIRE));
+	return old.list;
+}
+
+/*
+ * Push the chain @first .. @last, already linked through their next words, in
+ * one CAS. A single block is the chain @first == @last.
+ */
+static inline void
+__slab_lf_push(u64 *head, void *page, unsigned shift, u32 first, u32 last)
+{
+	u32 *tail = __slab_lf_next(page, shift, last);
+	union slab_head old, new;
+	old.word = __atomic_load_n(head, __ATOMIC_RELAXED);
+	new.list = first;
+	do {
+		__atomic_store_n(tail, old.list, __ATOMIC_RELAXED);
+		new.tag = old.tag + 1;
+	} while (!__atomic_compare_exchange_n(head, &old.word, new.word, true,
+	                                      __ATOMIC_RELEASE,
+	                                      __ATOMIC_RELAXED));
+}
+
+/*
+ * Claim up to @n blocks past *@committed, never beyond @room, with a CAS on
+ * the count. Returns the first claimed index in *@first and the number claimed
+ * (0 once at @room). @room and the committed prefix are grain-aligned, so a
+ * claim stays whole-grain as long as the caller rounds @n.
+ */
+static inline u32
+__slab_lf_reserve(u32 *committed, u32 room, u32 n, u32 *first)
+{
+	u32 c = __atomic_load_n(committed, __ATOMIC_RELAXED);
+	u32 take;
+	do {
+		if (c >= room)
+			return 0;
+		take = room - c < n ? room - c : n;
+	} while (!__atomic_compare_exchange_n(committed, &c, c + take, true,
+	                                      __ATOMIC_RELAXED,
+	                                      __ATOMIC_RELAXED));
+	*first = c;
+	return take;
+}
+
+/*
+ * Link a freshly claimed range [@from, @to) into a chain, ascending, so that
+ * __slab_lf_push(from, to - 1) publishes it. Nobody else can see these blocks
+ * yet, so plain stores do.
+ */
+static inline void
+__slab_lf_link(void *page, unsigned shift, u32 from, u32 to)
+{
+	u32 i;
+	for (i = from; i + 1 < to; i++)
+		*__slab_lf_next(page, shift, i) = i + 1;
+}
+
+/* Occupancy bits share a byte with seven neighbours: update them atomically. */
+static inline void
+__slab_lf_bit_set(u8 *map, u32 idx)
+{
+	__atomic_fetch_or(&map[idx >> 3], (u8)(1u << (idx & 7)), __ATOMIC_RELAXED);
+}
+
+static inline void
+__slab_lf_bit_clr(u8 *map, u32 idx)
+{
+	__atomic_fetch_and(&map[idx >> 3], (u8)~(1u << (idx & 7)),
+	                   __ATOMIC_RELAXED);
+}
+
+__END_DECLS
+
+#endif/*__HPC_MEM_SLAB_LOCKFREE_H__*/
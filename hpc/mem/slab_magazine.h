@@ -0,0 +1,536 @@
+/*
+ * Magazine front-end for the dynamic slab                 Per-thread caches
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Many threads allocating from one slab without a global lock.
+ *
+ * struct slab is single-writer: its free list and occupancy bitmap are plain
+ * memory, so threads that share one have to serialise every slab_alloc() and
+ * slab_free() behind a lock of their own. This header puts Bonwick's magazine
+ * layer in front of it (Bonwick & Adams, "Magazines and Vmem", USENIX 2001):
+ *
+ *   magazine  a small array of block indices, SLAB_MAGAZINE_ROUNDS deep. An
+ *             index is a u32, so a magazine of 64 rounds is 264 bytes and the
+ *             blocks themselves are never touched to cache them.
+ *   per-thread two magazines, @loaded and @prev, in a caller-owned
+ *             struct slab_magazine_cpu. slab_magazine_alloc() pops a round off
+ *             @loaded, slab_magazine_free() pushes one on; when @loaded is
+ *             empty (or full) the two are swapped. Both paths are thread-local
+ *             loads and stores - no atomic, no lock, no shared cache line.
+ *   depot     the shared struct slab_depot: the slab itself, plus a list of
+ *             full and a list of empty magazines, behind one spinlock. A thread
+ *             only goes there once both its magazines are exhausted (or both
+ *             are full), and then trades a whole magazine at once - so the lock
+ *             is taken at most once per SLAB_MAGAZINE_ROUNDS operations.
+ *
+ * The per-thread struct is the caller's, like a measure struct: one per thread
+ * (or one per CPU, for a caller pinning threads), attached to the depot with
+ * slab_magazine_attach() and handed back with slab_magazine_detach(). Nothing
+ * here uses thread-local storage, so which thread owns which cache is the
+ * caller's decision and shows at the call site.
+ *
+ * The slab underneath
+ * -------------------
+ * A block sitting in a magazine is allocated as far as the slab is concerned:
+ * its bit is set and it is not on the free list. That is what keeps the slab's
+ * own accounting, its grow/shrink policy and the committed-prefix invariant
+ * exactly as they are - the slab sees a user that allocates and frees in
+ * batches, and every slab call is made under the depot lock, so the slab stays
+ * single-writer. It also means cached blocks hold the committed prefix up until
+ * they are given back, which is what slab_depot_gc() does: it returns the full
+ * magazines the depot did not need during the last interval (Bonwick's working
+ * set: the lowest the full list fell since the previous gc) to the slab, frees
+ * the empty magazines nobody used, and then runs slab_gc() so that the memory
+ * behind them can actually be released.
+ *
+ * Blocks cached in a thread's own two magazines are out of the depot's reach
+ * by design; a thread going idle gives them back with slab_magazine_flush().
+ *
+ * The slab's counters (struct slab_measure) keep counting what crosses into the
+ * slab, which is batches; what the magazines served without it is counted per
+ * thread in struct slab_magazine_stat, owned by the thread that counts it.
+ */
+
+#ifndef __HPC_MEM_SLAB_MAGAZINE_H__
+#define __HPC_MEM_SLAB_MAGAZINE_H__
+
+#include <hpc/compiler.h>
+#include <hpc/cpu.h>
+#include <hpc/spinlock.h>
+#include <mem/slab.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+__BEGIN_DECLS
+
+/* Rounds per magazine: how many operations a thread runs between depot visits. */
+#ifndef SLAB_MAGAZINE_ROUNDS
+#define SLAB_MAGAZINE_ROUNDS 64
+#endif
+
+/*
+ * Blocks taken from the slab at once when the depot has no full magazine to
+ * give. Half a magazine: enough to amortise the lock, and it leaves room for
+ * the frees that usually follow a burst of allocations without an exchange.
+ */
+#ifndef SLAB_MAGAZINE_BATCH
+#define SLAB_MAGAZINE_BATCH (SLAB_MAGAZINE_ROUNDS / 2)
+#endif
+
+_Static_assert(SLAB_MAGAZINE_BATCH > 0 &&
+               SLAB_MAGAZINE_BATCH <= SLAB_MAGAZINE_ROUNDS,
+	"SLAB_MAGAZINE_BATCH must be within 1..SLAB_MAGAZINE_ROUNDS");
+
+struct slab_magazine {
+	struct slab_magazine *next;   /* depot list link                      */
+	u32 rounds;                   /* indices held, [0, rounds)             */
+	u32 round[SLAB_MAGAZINE_ROUNDS];
+};
+
+/* Per-thread counters; plain u64s, only ever written by the owning thread. */
+struct slab_magazine_stat {
+	u64 alloc;            /* blocks handed out                            */
+	u64 free;             /* blocks taken back                            */
+	u64 swaps;            /* loaded <-> prev exchanges, no depot visit    */
+	u64 full;             /* full magazines taken from the depot          */
+	u64 empty;            /* empty magazines taken from the depot         */
+	u64 fills;            /* magazines filled straight from the slab      */
+	u64 spills;           /* frees that bypassed the magazines (no memory) */
+	u64 fails;            /* allocations that returned NULL               */
+};
+
+struct slab_depot {
+	struct spinlock lock;         /* guards everything below              */
+	struct slab slab;             /* the backing slab, single-writer      */
+	struct slab_magazine *full;   /* magazines with every round loaded    */
+	struct slab_magazine *empty;  /* magazines with none                  */
+	u32 nfull;
+	u32 nempty;
+	u32 full_min;                 /* lowest nfull since the last gc       */
+	u32 empty_min;                /* lowest nempty since the last gc      */
+	u32 magazines;                /* magazines allocated, depot + threads */
+};
+
+struct slab_magazine_cpu {
+	struct slab_magazine *loaded; /* the one rounds come from and go to   */
+	struct slab_magazine *prev;   /* full or empty, the swap partner      */
+	struct slab_depot *depot;
+	struct slab_magazine_stat stat;
+} _align(CPU_CACHE_LINE);
+
+/* ---- internals, all called with the depot lock held ---------------------- */
+
+static inline struct slab_magazine *
+__slab_depot_new(struct slab_depot *d)
+{
+	struct slab_magazine *m = (struct slab_magazine *)
+		SLAB_MEM_CALLOC(1, sizeof(*m));
+	if (m)
+		d->magazines++;
+	return m;
+}
+
+static inline void
+__slab_depot_put_full(struct slab_depot *d, struct slab_magazine *m)
+{
+	m->next = d->full;
+	d->full = m;
+	d->nfull++;
+}
+
+static inline void
+__slab_depot_put_empty(struct slab_depot *d, struct slab_magazine *m)
+{
+	m->next = d->empty;
+	d->empty = m;
+	d->nempty++;
+}
+
+static inline struct slab_magazine *
+__slab_depot_get_full(struct slab_depot *d)
+{
+	struct slab_magazine *m = d->full;
+	if (!m)
+		return NULL;
+	d->full = m->next;
+	if (--d->nfull < d->full_min)
+		d->full_min = d->nfull;
+	return m;
+}
+
+static inline struct slab_magazine *
+__slab_depot_get_empty(struct slab_depot *d)
+{
+	struct slab_magazine *m = d->empty;
+	if (!m)
+		return __slab_depot_new(d);
+	d->empty = m->next;
+	if (--d->nempty < d->empty_min)
+		d->empty_min = d->nempty;
+	return m;
+}
+
+/* Hand every round of @m back to the slab; @m is empty afterwards. */
+static inline void
+__slab_depot_drain(struct slab_depot *d, struct slab_magazine *m)
+{
+	while (m->rounds)
+		slab_free(&d->slab, slab_at(&d->slab, m->round[--m->rounds]));
+}
+
+/* Load up to @n rounds into @m straight from the slab. */
+static inline u32
+__slab_depot_fill(struct slab_depot *d, struct slab_magazine *m, u32 n)
+{
+	while (m->rounds < n) {
+		void *p = slab_alloc(&d->slab);
+		if (!p)
+			break;
+		m->round[m->rounds++] = slab_index(&d->slab, p);
+	}
+	return m->rounds;
+}
+
+/* ---- depot lifetime ------------------------------------------------------ */
+
+/*
+ * slab_depot_init - the shared slab and its magazine depot.
+ *
+ * @block_size and @policy go to slab_init() unchanged. Returns 0 on success,
+ * -1 on failure.
+ */
+static inline int
+slab_depot_init(struct slab_depot *d, unsigned block_size,
+                const struct slab_policy *policy)
+{
+	memset(d, 0, sizeof(*d));
+	spin_lock_init(&d->lock);
+	return slab_init(&d->slab, block_size, policy);
+}
+
+/*
+ * slab_depot_fini - release the magazines and the slab.
+ *
+ * Every thread must have detached first: a magazine still loaded in a
+ * slab_magazine_cpu is not the depot's to free.
+ */
+static inline void
+slab_depot_fini(struct slab_depot *d)
+{
+	struct slab_magazine *m, *next;
+	for (m = d->full; m; m = next) {
+		next = m->next;
+		SLAB_MEM_FREE(m);
+	}
+	for (m = d->empty; m; m = next) {
+		next = m->next;
+		SLAB_MEM_FREE(m);
+	}
+	d->full = d->empty = NULL;
+	d->nfull = d->nempty = d->magazines = 0;
+	slab_fini(&d->slab);
+}
+
+/* ---- per-thread attach / detach ------------------------------------------ */
+
+/*
+ * slab_magazine_attach - bind a thread's cache to @d.
+ *
+ * Takes two empty magazines from the depot, allocating them if it has none.
+ * Returns 0, or -1 if the magazines could not be allocated.
+ */
+static inline int
+slab_magazine_attach(struct slab_magazine_cpu *cpu, struct slab_depot *d)
+{
+	memset(cpu, 0, sizeof(*cpu));
+	cpu->depot = d;
+	spin_lock(&d->lock);
+	cpu->loaded = __slab_depot_get_empty(d);
+	cpu->prev = __slab_depot_get_empty(d);
+	if (!cpu->loaded || !cpu->prev) {
+		if (cpu->loaded)
+			__slab_depot_put_empty(d, cpu->loaded);
+		if (cpu->prev)
+			__slab_depot_put_empty(d, cpu->prev);
+		spin_unlock(&d->lock);
+		cpu->loaded = cpu->prev = NULL;
+		return -1;
+	}
+	spin_unlock(&d->lock);
+	return 0;
+}
+
+/*
+ * slab_magazine_flush - give back every block this thread has cached.
+ *
+ * A full magazine goes to the depot as it is, for another thread to take; a
+ * partial one is drained into the slab. The thread stays attached with two
+ * empty magazines. For a thread about to go idle, so what it cached does not
+ * pin the slab's committed prefix until it wakes up.
+ */
+static inline void
+slab_magazine_flush(struct slab_magazine_cpu *cpu)
+{
+	struct slab_depot *d = cpu->depot;
+	struct slab_magazine **mag[2] = { &cpu->loaded, &cpu->prev };
+	unsigned i;
+
+	spin_lock(&d->lock);
+	for (i = 0; i < 2; i++) {
+		struct slab_magazine *m = *mag[i];
+		if (m->rounds == SLAB_MAGAZINE_ROUNDS) {
+			struct slab_magazine *e = __slab_depot_get_empty(d);
+			if (e) {
+				__slab_depot_put_full(d, m);
+				*mag[i] = e;
+				continue;
+			}
+		}
+		__slab_depot_drain(d, m);
+	}
+	spin_unlock(&d->lock);
+}
+
+/* slab_magazine_detach - flush, and return both magazines to the depot. */
+static inline void
+slab_magazine_detach(struct slab_magazine_cpu *cpu)
+{
+	struct slab_depot *d = cpu->depot;
+	if (!d || !cpu->loaded)
+		return;
+	slab_magazine_flush(cpu);
+	spin_lock(&d->lock);
+	__slab_depot_put_empty(d, cpu->loaded);
+	__slab_depot_put_empty(d, cpu->prev);
+	spin_unlock(&d->lock);
+	cpu->loaded = cpu->prev = NULL;
+	cpu->depot = NULL;
+}
+
+/* ---- the hot paths ------------------------------------------------------- */
+
+/* Both magazines are empty: trade for a full one, or fill from the slab. */
+static _noinline void *
+__slab_magazine_alloc_slow(struct slab_magazine_cpu *cpu)
+{
+	struct slab_depot *d = cpu->depot;
+	struct slab_magazine *m;
+
+	spin_lock(&d->lock);
+	if ((m = __slab_depot_get_full(d))) {
+		/* the empty prev goes back, loaded becomes prev, full is loaded */
+		__slab_depot_put_empty(d, cpu->prev);
+		cpu->prev = cpu->loaded;
+		cpu->loaded = m;
+		cpu->stat.full++;
+	} else if (__slab_depot_fill(d, cpu->loaded, SLAB_MAGAZINE_BATCH)) {
+		cpu->stat.fills++;
+	} else {
+		spin_unlock(&d->lock);
+		cpu->stat.fails++;
+		return NULL;
+	}
+	spin_unlock(&d->lock);
+
+	m = cpu->loaded;
+	cpu->stat.alloc++;
+	return slab_at(&d->slab, m->round[--m->rounds]);
+}
+
+/* Both magazines are full: trade for an empty one, or spill to the slab. */
+static _noinline void
+__slab_magazine_free_slow(struct slab_magazine_cpu *cpu, u32 idx)
+{
+	struct slab_depot *d = cpu->depot;
+	struct slab_magazine *m;
+
+	spin_lock(&d->lock);
+	if (d->empty)
+		cpu->stat.empty++;
+	if (!(m = __slab_depot_get_empty(d))) {
+		/* no memory for a magazine: the block goes straight back */
+		slab_free(&d->slab, slab_at(&d->slab, idx));
+		spin_unlock(&d->lock);
+		cpu->stat.spills++;
+		return;
+	}
+	__slab_depot_put_full(d, cpu->prev);
+	cpu->prev = cpu->loaded;
+	cpu->loaded = m;
+	spin_unlock(&d->lock);
+
+	m->round[m->rounds++] = idx;
+	cpu->stat.free++;
+}
+
+/*
+ * slab_magazine_alloc - allocate a block through this thread's cache.
+ *
+ * Thread-local unless both magazines are empty. Returns NULL once the slab is
+ * exhausted and its policy will not grow.
+ */
+static inline void *
+slab_magazine_alloc(struct slab_magazine_cpu *cpu)
+{
+	struct slab_magazine *m = cpu->loaded;
+	if (unlikely(!m->rounds)) {
+		if (!cpu->prev->rounds)
+			return __slab_magazine_alloc_slow(cpu);
+		cpu->loaded = cpu->prev;
+		cpu->prev = m;
+		m = cpu->loaded;
+		cpu->stat.swaps++;
+	}
+	cpu->stat.alloc++;
+	return slab_at(&cpu->depot->slab, m->round[--m->rounds]);
+}
+
+/*
+ * slab_magazine_free - return a block through this thread's cache.
+ *
+ * Any thread may free any block of the depot's slab, whichever thread
+ * allocated it; thread-local unless both magazines are full.
+ */
+static inline void
+slab_magazine_free(struct slab_magazine_cpu *cpu, void *p)
+{
+	struct slab_magazine *m = cpu->loaded;
+	u32 idx = slab_index(&cpu->depot->slab, p);
+	if (unlikely(m->rounds == SLAB_MAGAZINE_ROUNDS)) {
+		if (cpu->prev->rounds) {
+			__slab_magazine_free_slow(cpu, idx);
+			return;
+		}
+		cpu->loaded = cpu->prev;
+		cpu->prev = m;
+		m = cpu->loaded;
+		cpu->stat.swaps++;
+	}
+	m->round[m->rounds++] = idx;
+	cpu->stat.free++;
+}
+
+/* ---- policy -------------------------------------------------------------- */
+
+/*
+ * slab_depot_reap - return every full magazine in the depot to the slab.
+ *
+ * Unconditional: for teardown, a memory-pressure signal, or a test. The empty
+ * magazines stay, for the next free to find. Returns the blocks given back.
+ */
+static inline u32
+slab_depot_reap(struct slab_depot *d)
+{
+	struct slab_magazine *m;
+	u32 blocks = 0;
+	spin_lock(&d->lock);
+	while ((m = __slab_depot_get_full(d))) {
+		blocks += m->rounds;
+		__slab_depot_drain(d, m);
+		__slab_depot_put_empty(d, m);
+	}
+	d->full_min = d->empty_min = 0;
+	spin_unlock(&d->lock);
+	return blocks;
+}
+
+/*
+ * slab_depot_gc - trim the depot to its working set, then run slab_gc().
+ *
+ * Full magazines that sat in the depot for the whole interval since the last
+ * call - as many as the full list never fell below - were not needed; their
+ * blocks go back to the slab. Empty magazines that went unused the same way
+ * are freed. Then slab_gc() applies the policy to a slab that now sees those
+ * blocks as free, so the grow/shrink decision (and the memory a shrink
+ * releases) follows the threads' real demand rather than what they happened to
+ * cache. Call it at the cadence slab_gc() would be called at; @now is passed to
+ * it unchanged.
+ *
+ * Returns slab_gc()'s signed change in committed blocks.
+ */
+static inline int
+slab_depot_gc(struct slab_depot *d, timestamp_t now)
+{
+	struct slab_magazine *m;
+	u32 trim;
+	int r;
+
+	spin_lock(&d->lock);
+	for (trim = d->full_min; trim && (m = __slab_depot_get_full(d)); trim--) {
+		__slab_depot_drain(d, m);
+		__slab_depot_put_empty(d, m);
+	}
+	for (trim = d->empty_min; trim && d->empty; trim--) {
+		m = d->empty;
+		d->empty = m->next;
+		d->nempty--;
+		d->magazines--;
+		SLAB_MEM_FREE(m);
+	}
+	d->full_min = d->nfull;                   /* re-arm the interval */
+	d->empty_min = d->nempty;
+	r = slab_gc(&d->slab, now);
+	spin_unlock(&d->lock);
+	return r;
+}
+
+/* ---- introspection ------------------------------------------------------- */
+
+/*
+ * The backing slab. Reading its counters from another thread is a racy
+ * snapshot; anything that changes it has to hold the depot lock, which is why
+ * there is no accessor that hands the lock out.
+ */
+static inline struct slab *
+slab_depot_slab(struct slab_depot *d)
+{
+	return &d->slab;
+}
+
+/* Blocks held in the depot's full magazines, available to any thread. */
+static inline u32
+slab_depot_cached(struct slab_depot *d)
+{
+	return __atomic_load_n(&d->nfull, __ATOMIC_RELAXED) * SLAB_MAGAZINE_ROUNDS;
+}
+
+/* Blocks cached by this thread, in its two magazines. */
+static inline u32
+slab_magazine_cached(struct slab_magazine_cpu *cpu)
+{
+	return cpu->loaded->rounds + cpu->prev->rounds;
+}
+
+static inline const struct slab_magazine_stat *
+slab_magazine_stat(struct slab_magazine_cpu *cpu)
+{
+	return &cpu->stat;
+}
+
+__END_DECLS
+
+#endif/*__HPC_MEM_SLAB_MAGAZINE_H__*/
@@ -0,0 +1,299 @@
+/*
+ * Object cache with constructors over a slab                  Object cache
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A typed object cache in the manner of Bonwick's kmem_cache (Bonwick, "The
+ * Slab Allocator: An Object-Caching Kernel Memory Allocator", USENIX 1994):
+ * objects stay constructed while they sit on the free list.
+ *
+ * An object that embeds list or tree links, a lock, a preallocated buffer,
+ * has an initialised state that costs more to set up than the allocation
+ * itself - and most of it is the same state every object is freed in. So the
+ * constructor runs once per block, when the grain holding it is committed, and
+ * the destructor once, when the grain is released; in between the object cycles
+ * through alloc and free in its constructed state. The contract, as in the
+ * kernel: free an object only in its constructed state (lists empty, lock
+ * unlocked, buffer attached), and an alloc hands it back the way it was freed.
+ *
+ * The link
+ * --------
+ * A free block carries the slab's free-list link, a u32 that would overwrite
+ * whatever the constructor put there. The cache moves it (slab_set_link() in
+ * <mem/slab.h>) to where it hurts nothing:
+ *
+ *   SLAB_OBJ_LINK_AUTO  past the object, rounded up to a u32 - the block is a
+ *                       power of two, so there is slack behind most objects;
+ *                       where there is none the block doubles
+ *   an offset           a u32 field of the object's own that means nothing
+ *                       while the object is free (a "next" the owner sets on
+ *                       every use, say); its content does not survive a free
+ *
+ * The constructor may write the whole object either way: the link word is
+ * saved and restored around it.
+ *
+ * Grow and shrink
+ * ---------------
+ * Blocks [0, @constructed) hold constructed objects. Every path that can
+ * commit blocks - an alloc that grows, slab_obj_gc(), slab_obj_grow() -
+ * constructs up to the committed prefix before it returns, so one compare is
+ * all an alloc that did not grow pays. A shrink calls the destructor on each
+ * block of the released tail (the slab's policy.release hook) before its pages
+ * go back, and a grow into it constructs them afresh, whether or not MADV_FREE
+ * left the old contents in place. Compaction would move constructed objects
+ * with memcpy(), which an object with self-pointers does not survive, so the
+ * cache runs without policy.relocate.
+ *
+ * A slab_obj_grow() from an idle loop takes the constructors - and the first
+ * touch of the pages - out of the allocation path entirely.
+ */
+
+#ifndef __HPC_MEM_SLAB_OBJ_H__
+#define __HPC_MEM_SLAB_OBJ_H__
+
+#include <hpc/compiler.h>
+#include <hpc/bitset.h>
+#include <mem/slab.h>
+
+#include <string.h>
+
+__BEGIN_DECLS
+
+#define SLAB_OBJ_LINK_AUTO ((u32)~0u)
+
+struct slab_obj_stat {
+	u64 ctors;            /* constructor calls                            */
+	u64 dtors;            /* destructor calls                             */
+};
+
+struct slab_obj {
+	struct slab slab;             /* the blocks, its link moved           */
+	u32 size;                     /* object size                          */
+	u32 constructed;              /* blocks [0, constructed) constructed  */
+	void (*ctor)(void *obj, void *arg);
+	void (*dtor)(void *obj, void *arg);
+	void *arg;                    /* passed to ctor, dtor and check        */
+	bool (*check)(struct slab *slab, int grow, void *arg);
+	struct slab_obj_stat stat;
+};
+
+static inline void *
+__slab_obj_at(struct slab_obj *c, u32 idx)
+{
+	return __slab_at(&c->slab, c->slab.shift, idx);
+}
+
+/* Construct up to the committed prefix, keeping each block's link intact. */
+static inline void
+__slab_obj_construct(struct slab_obj *c)
+{
+	struct slab *s = &c->slab;
+	u32 end = s->committed;
+
+	if (c->ctor && end > c->constructed) {  /* else no end - 1 to spoil */
+		for (u32 i = c->constructed; i < end; i++) {
+			struct slab_node *node = __slab_node(s, s->shift, i);
+			u32 link = node->avail;
+			c->ctor(__slab_obj_at(c, i), c->arg);
+			node->avail = link;
+		}
+		c->stat.ctors += end - c->constructed;
+		__slab_spoil(s, end - 1);     /* not zero any more */
+	}
+	c->constructed = end;
+}
+
+/* policy.release: the tail [from, to) is leaving the committed prefix. */
+static inline void
+__slab_obj_release(struct slab *slab, u32 from, u32 to, void *arg)
+{
+	struct slab_obj *c = (struct slab_obj *)arg;
+	(void)slab;
+
+	if (to > c->constructed)
+		to = c->constructed;
+	if (c->dtor) {
+		for (u32 i = from; i < to; i++)
+			c->dtor(__slab_obj_at(c, i), c->arg);
+		if (to > from)
+			c->stat.dtors += to - from;
+	}
+	if (c->constructed > from)
+		c->constructed = from;
+}
+
+/* policy.check: the owner's gate, with the owner's argument. */
+static inline bool
+__slab_obj_check(struct slab *slab, int grow, void *arg)
+{
+	struct slab_obj *c = (struct slab_obj *)arg;
+	return c->check(slab, grow, c->arg);
+}
+
+/*
+ * slab_obj_init - an object cache of @size byte objects.
+ *
+ * @link is SLAB_OBJ_LINK_AUTO or the offset of a u32 field of the object that
+ * may be overwritten while it is free (u32-aligned, within @size). @policy is
+ * the slab's, as for slab_init(); its check() gate is called with @arg, and
+ * its relocate, release and arg are the cache's. @ctor and @dtor may be NULL.
+ * policy.min blocks are committed and constructed here. Returns 0, or -1 if
+ * @link does not fit or the reservation failed.
+ */
+static inline int
+slab_obj_init(struct slab_obj *c, u32 size, u32 link,
+              const struct slab_policy *policy,
+              void (*ctor)(void *obj, void *arg),
+              void (*dtor)(void *obj, void *arg), void *arg)
+{
+	struct slab_policy pol = *policy;
+	unsigned shift;
+
+	memset(c, 0, sizeof(*c));
+	if (link == SLAB_OBJ_LINK_AUTO) {
+		link = align_to(size, (u32)sizeof(struct slab_node));
+		shift = slab_shift_for(link + (u32)sizeof(struct slab_node));
+	} else {
+		if (link & (sizeof(struct slab_node) - 1) ||
+		    link + sizeof(struct slab_node) > size)
+			return -1;
+		shift = slab_shift_for(size);
+	}
+	c->size = size;
+	c->ctor = ctor;
+	c->dtor = dtor;
+	c->arg = arg;
+	c->check = pol.check;
+	pol.check = c->check ? __slab_obj_check : NULL;
+	pol.relocate = NULL;
+	pol.compact_budget = 0;
+	pol.release = __slab_obj_release;
+	pol.arg = c;
+	if (__slab_init(&c->slab, shift, &pol))
+		return -1;
+	if (slab_set_link(&c->slab, link)) {
+		__slab_fini(&c->slab);
+		return -1;
+	}
+	__slab_obj_construct(c);
+	return 0;
+}
+
+/*
+ * slab_obj_fini - destruct every free object and release the cache.
+ *
+ * Objects still allocated are neither destructed nor valid afterwards.
+ */
+static inline void
+slab_obj_fini(struct slab_obj *c)
+{
+	if (c->dtor) {
+		for (u32 i = 0; i < c->constructed; i++) {
+			if (BITSET_TEST(c->slab.map, i))
+				continue;
+			c->dtor(__slab_obj_at(c, i), c->arg);
+			c->stat.dtors++;
+		}
+	}
+	c->constructed = 0;
+	__slab_fini(&c->slab);
+}
+
+/* A constructed object, or NULL. */
+static inline void *
+slab_obj_alloc(struct slab_obj *c)
+{
+	void *p = __slab_alloc(&c->slab, c->slab.shift);
+	if (unlikely(c->constructed < c->slab.committed))
+		__slab_obj_construct(c);
+	return p;
+}
+
+/* Give @p back, in its constructed state. */
+static inline void
+slab_obj_free(struct slab_obj *c, void *p)
+{
+	__slab_free(&c->slab, c->slab.shift, p);
+}
+
+static inline u32
+slab_obj_alloc_bulk(struct slab_obj *c, void **out, u32 n)
+{
+	u32 k = __slab_alloc_bulk(&c->slab, c->slab.shift, out, n);
+	if (unlikely(c->constructed < c->slab.committed))
+		__slab_obj_construct(c);
+	return k;
+}
+
+static inline void
+slab_obj_free_bulk(struct slab_obj *c, void **in, u32 n)
+{
+	__slab_free_bulk(&c->slab, c->slab.shift, in, n);
+}
+
+/*
+ * slab_obj_grow - commit and construct @n more blocks ahead of the allocations.
+ * Returns the blocks committed.
+ */
+static inline u32
+slab_obj_grow(struct slab_obj *c, u32 n)
+{
+	u32 grew = slab_grow(&c->slab, n);
+	__slab_obj_construct(c);
+	return grew;
+}
+
+/* slab_gc() for the cache: a release destructs, a grow constructs. */
+static inline int
+slab_obj_gc(struct slab_obj *c, timestamp_t now)
+{
+	int r = slab_gc(&c->slab, now);
+	if (r > 0)
+		__slab_obj_construct(c);
+	return r;
+}
+
+/* slab_shrink() for the cache: the released blocks are destructed first. */
+static inline u32
+slab_obj_shrink(struct slab_obj *c, u32 n)
+{
+	return slab_shrink(&c->slab, n);
+}
+
+static inline struct slab *
+slab_obj_slab(struct slab_obj *c)
+{
+	return &c->slab;
+}
+
+static inline u32
+slab_obj_size(struct slab_obj *c)
+{
+	return c->size;
+}
+
+__END_DECLS
+
+#endif/*__HPC_MEM_SLAB_OBJ_H__*/
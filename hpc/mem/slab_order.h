@@ -0,0 +1,225 @@
+/*
+ * High performance slab allocator                   Address-ordered free set
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The primitives behind the address-ordered mode of struct slab
+ * (slab_set_ordered() in <mem/slab.h>): find the lowest free block index fast.
+ *
+ * Why
+ * ---
+ * The default free list is LIFO: a freed block is the next one handed out. That
+ * is the cache-friendly choice, but it has no sense of place - after a spike the
+ * survivors sit wherever the spike put them, and the blocks that replace them
+ * come from wherever the last free happened to be. A shrink can only release a
+ * wholly free tail grain, so one long-lived block near the top pins the whole
+ * high-water mark. Handing out the lowest free index instead packs the live set
+ * toward the front: every replacement moves down, the tail drains as its blocks
+ * die, and slab_gc() gets whole grains back.
+ *
+ * The index
+ * ---------
+ * The occupancy bitmap (slab->map, a set bit per allocated block) already is the
+ * free set; what it lacks is a fast way to its first clear bit. That is one more
+ * level on top of it: a summary with a bit per 64-bit map word, set while that
+ * word has at least one clear bit. The lowest free index is then two
+ * find-first-set operations - the first set summary bit, the first clear bit of
+ * the map word it names - plus a cursor below which the summary is known to be
+ * all zero, so the summary itself is not rescanned from the start. A free only
+ * ever lowers the cursor; an allocation advances it past words it has filled.
+ *
+ * The summary deliberately does not know about `committed`. Bits past the
+ * committed prefix are clear, so they look free; the lowest free index is then
+ * at or past `committed` exactly when the committed prefix is full, and that is
+ * the caller's signal to grow. It also means grow and shrink leave the summary
+ * alone - a grown block is clear in the map already, a retired one was clear.
+ *
+ * The map is byte-addressed (BITSET_* in <hpc/bitset.h>) and is read here 64
+ * bits at a time in little-endian order, so map byte k holds bits 8k..8k+7 of
+ * the word on either byte order. The slab sizes its map to whole words.
+ *
+ * The same word reads serve slab_compact(), which walks the map from both ends
+ * at once - live blocks down from the top, free slots up from the bottom - and
+ * works with or without the summary, and the bulk calls, which set and clear
+ * the bits of a batch a word at a time.
+ */
+
+#ifndef __HPC_MEM_SLAB_ORDER_H__
+#define __HPC_MEM_SLAB_ORDER_H__
+
+#include <hpc/compiler.h>
+/* SLAB_NIL, SLAB_MEM_CALLOC */
+#include <mem/slab_vm.h>
+
+#include <string.h>
+
+__BEGIN_DECLS
+
+/* Map bytes for @total blocks, rounded to the whole 64-bit words read here. */
+static inline size_t
+slab_order_map_bytes(u32 total)
+{
+	return (((size_t)total + 64) >> 6) << 3;
+}
+
+/* Summary words for @total blocks: one bit per map word. */
+static inline u32
+slab_order_sum_words(u32 total)
+{
+	u32 words = (u32)(slab_order_map_bytes(total) >> 3);
+	return (words + 63) >> 6;
+}
+
+/* Map word @w, bit i being block 64 * @w + i. */
+static inline u64
+__slab_order_word(const u8 *map, u32 w)
+{
+	u64 v;
+	memcpy(&v, map + ((size_t)w << 3), sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+/* Set / clear the @bits of map word @w in one read-modify-write. */
+static inline void
+__slab_map_or(u8 *map, u32 w, u64 bits)
+{
+	u64 v = __slab_order_word(map, w) | bits;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	memcpy(map + ((size_t)w << 3), &v, sizeof(v));
+}
+
+static inline void
+__slab_map_andnot(u8 *map, u32 w, u64 bits)
+{
+	u64 v = __slab_order_word(map, w) & ~bits;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	memcpy(map + ((size_t)w << 3), &v, sizeof(v));
+}
+
+/* The lowest clear bit of @map in [@from, @to), or SLAB_NIL. */
+static inline u32
+__slab_map_first_clear(const u8 *map, u32 from, u32 to)
+{
+	u32 w = from >> 6;
+	u64 v;
+
+	if (from >= to)
+		return SLAB_NIL;
+	v = ~__slab_order_word(map, w) & (~0ull << (from & 63));
+	for (;;) {
+		if (v) {
+			u32 idx = (w << 6) + (u32)__builtin_ctzll(v);
+			return idx < to ? idx : SLAB_NIL;
+		}
+		if (((u64)++w << 6) >= to)
+			return SLAB_NIL;
+		v = ~__slab_order_word(map, w);
+	}
+}
+
+/* The highest set bit of @map in [@from, @to), or SLAB_NIL. */
+static inline u32
+__slab_map_last_set(const u8 *map, u32 from, u32 to)
+{
+	u32 w = (to - 1) >> 6;
+	u64 v;
+
+	if (from >= to)
+		return SLAB_NIL;
+	v = __slab_order_word(map, w) & (~0ull >> (63 - ((to - 1) & 63)));
+	for (;;) {
+		if (v) {
+			u32 idx = (w << 6) + 63 - (u32)__builtin_clzll(v);
+			return idx >= from ? idx : SLAB_NIL;
+		}
+		if ((w << 6) <= from)
+			return SLAB_NIL;
+		v = __slab_order_word(map, --w);
+	}
+}
+
+/*
+ * Build the summary over @map for @total blocks. @sum holds
+ * slab_order_sum_words(@total) words; bits past the last map word stay clear.
+ */
+static inline void
+__slab_order_build(const u8 *map, u32 total, u64 *sum, u32 *low)
+{
+	u32 words = (u32)(slab_order_map_bytes(total) >> 3), w;
+
+	memset(sum, 0, (size_t)slab_order_sum_words(total) * sizeof(*sum));
+	for (w = 0; w < words; w++)
+		if (~__slab_order_word(map, w))
+			sum[w >> 6] |= 1ull << (w & 63);
+	*low = 0;
+}
+
+/*
+ * The lowest clear bit of @map, or SLAB_NIL when every block is set. May be at
+ * or past the committed prefix; see above.
+ */
+static inline u32
+__slab_order_first(const u8 *map, const u64 *sum, u32 nsum, u32 *low)
+{
+	u32 s = *low, w;
+
+	while (s < nsum && !sum[s])
+		s++;
+	*low = s;
+	if (s == nsum)
+		return SLAB_NIL;
+	w = (s << 6) + (u32)__builtin_ctzll(sum[s]);
+	return (w << 6) + (u32)__builtin_ctzll(~__slab_order_word(map, w));
+}
+
+/* Block @idx was just set in @map: retire its word from the summary if full. */
+static inline void
+__slab_order_set(const u8 *map, u64 *sum, u32 idx)
+{
+	u32 w = idx >> 6;
+	if (!~__slab_order_word(map, w))
+		sum[w >> 6] &= ~(1ull << (w & 63));
+}
+
+/* Block @idx was just cleared in @map. */
+static inline void
+__slab_order_clr(u64 *sum, u32 *low, u32 idx)
+{
+	u32 w = idx >> 6;
+	sum[w >> 6] |= 1ull << (w & 63);
+	if ((w >> 6) < *low)
+		*low = w >> 6;
+}
+
+__END_DECLS
+
+#endif/*__HPC_MEM_SLAB_ORDER_H__*/
@@ -0,0 +1,556 @@
+/*
+ * Memory pressure source for slab_gc()                    Slab pressure
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A built-in outside signal for the slab's grow/shrink policy: how much the
+ * system, and the cgroup the process runs in, is short of memory.
+ *
+ * A slab's policy only sees the slab. Whether the memory it holds on to is
+ * wanted elsewhere is an outside question, and the check() gate of
+ * struct slab_policy was the only place to answer it. struct slab_pressure is
+ * that answer, read from the kernel:
+ *
+ *   /proc/pressure/memory   PSI - the share of wall time some (or all) tasks
+ *                           stalled on memory over the last 10 seconds
+ *   memory.events           cgroup v2 - how often the cgroup ran into
+ *                           memory.high (throttled), memory.max and the OOM
+ *                           killer
+ *   memory.current          cgroup v2 - what the cgroup is charged now
+ *   memory.high             cgroup v2 - where it starts being throttled
+ *
+ * Every file is opened once and re-read with pread() at offset 0 - the kernel
+ * regenerates these on every read from the start - so a poll is four
+ * syscalls and no open(), path walk or allocation. A poll runs at most once
+ * per gc tick: slab_pressure_poll() keeps its reading for the same @now (or
+ * until @interval has passed), so one source may serve any number of slabs
+ * gc'ed on the same tick. A missing file - a kernel without PSI, a process
+ * outside a cgroup v2 hierarchy - is not an error: that source simply reads
+ * as no pressure.
+ *
+ * Levels
+ * ------
+ * A poll condenses the readings into a level:
+ *
+ *   SLAB_PRESSURE_NONE  nothing below applies
+ *   SLAB_PRESSURE_SOME  some avg10 at or above @some_pct, or the cgroup hit
+ *                       memory.high since the previous poll
+ *   SLAB_PRESSURE_FULL  full avg10 at or above @full_pct, the cgroup hit
+ *                       memory.max or the OOM killer since the previous poll,
+ *                       or it is charged at or above memory.high
+ *
+ * and, separately, whether the cgroup is within @headroom_pct of memory.high
+ * (@near_high). Event counts are compared between polls, so the first poll
+ * only takes their baseline.
+ *
+ * Feeding the slab
+ * ----------------
+ * slab_pressure_gc() runs slab_gc() - and, with CONFIG_RCU,
+ * slab_pressure_plan_gc() runs slab_rcu_plan_gc() - under a policy adjusted
+ * to the level, restored afterwards:
+ *
+ *   SOME  the idle dwell is a quarter, the shrink watermark halfway to 100%
+ *         (kept under the grow watermark), twice the free blocks released
+ *   FULL  no dwell, any free block counts, all of them released at once with
+ *         MADV_DONTNEED, and no watermark growth
+ *
+ * A policy with shrinking disabled (shrink_release_pct 0) stays disabled.
+ * Near memory.high the watermark growth of gc is off too. Growth an allocation
+ * needs on an exhausted slab is not gc's to veto: install slab_pressure_check()
+ * as the policy's check() gate (with the source as its @arg), or call
+ * slab_pressure_allow_grow() from your own gate, and allocations fail rather
+ * than push the cgroup over memory.high. The gate does not poll - it runs in
+ * the allocation path - it answers from the last tick's reading.
+ *
+ * The source is plain data and single-threaded like slab_gc(): poll it from
+ * the thread that runs the ticks.
+ */
+
+#ifndef __HPC_MEM_SLAB_PRESSURE_H__
+#define __HPC_MEM_SLAB_PRESSURE_H__
+
+#include <hpc/compiler.h>
+#include <mem/slab.h>
+#include <mem/slab_rcu.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+__BEGIN_DECLS
+
+#ifndef SLAB_PRESSURE_PSI
+#define SLAB_PRESSURE_PSI "/proc/pressure/memory"
+#endif
+#ifndef SLAB_PRESSURE_CGROUP_ROOT
+#define SLAB_PRESSURE_CGROUP_ROOT "/sys/fs/cgroup"
+#endif
+
+/* Defaults of the thresholds, in percent. */
+#ifndef SLAB_PRESSURE_SOME_PCT
+#define SLAB_PRESSURE_SOME_PCT 10
+#endif
+#ifndef SLAB_PRESSURE_FULL_PCT
+#define SLAB_PRESSURE_FULL_PCT 5
+#endif
+#ifndef SLAB_PRESSURE_HEADROOM_PCT
+#define SLAB_PRESSURE_HEADROOM_PCT 5
+#endif
+
+#define SLAB_PRESSURE_NOLIMIT ((u64)~0ull)  /* memory.high reads "max"    */
+
+enum slab_pressure_level {
+	SLAB_PRESSURE_NONE = 0,
+	SLAB_PRESSURE_SOME = 1,
+	SLAB_PRESSURE_FULL = 2,
+};
+
+/*
+ * @some_pct, @full_pct
+ *             PSI avg10 thresholds of the SOME and FULL levels, in hundredths
+ *             of a percent as the kernel prints them (1000 is 10.00%)
+ * @headroom_pct
+ *             how close to memory.high, in percent of it, counts as near
+ * @interval   a poll is reused for this long, in the unit of @now; 0 reuses it
+ *             for the same @now only
+ *
+ * The thresholds are set by slab_pressure_open() and may be changed at will.
+ * Everything below them is the last reading.
+ */
+struct slab_pressure {
+	int fd_psi;           /* /proc/pressure/memory, or -1                 */
+	int fd_events;        /* memory.events, or -1                         */
+	int fd_current;       /* memory.current, or -1                        */
+	int fd_high;          /* memory.high, or -1                           */
+	u16 some_pct;
+	u16 full_pct;
+	u16 headroom_pct;
+	u8 level;             /* enum slab_pressure_level                     */
+	u8 near_high;         /* within @headroom_pct of memory.high          */
+	timestamp_t interval;
+	timestamp_t last;     /* @now of the last poll                        */
+	u32 some;             /* PSI some avg10, hundredths of a percent      */
+	u32 full;             /* PSI full avg10, hundredths of a percent      */
+	u64 current;          /* memory.current, bytes                        */
+	u64 high;             /* memory.high, bytes, or SLAB_PRESSURE_NOLIMIT */
+	u64 ev_high;          /* memory.events counts as of the last poll     */
+	u64 ev_max;
+	u64 ev_oom;
+	struct {
+		u64 polls;    /* polls that read the files                    */
+		u64 errors;   /* reads that failed or did not parse           */
+		u64 boosts;   /* gc rounds run under an adjusted policy       */
+		u64 vetoes;   /* grows refused by slab_pressure_check()       */
+	} stat;
+};
+
+/* ---- reading ------------------------------------------------------------- */
+
+static inline int
+__slab_pressure_open_at(const char *dir, const char *name)
+{
+	char path[512];
+	if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path))
+		return -1;
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/* The whole file into @buf, NUL terminated; its length, or -1. */
+static inline int
+__slab_pressure_read(int fd, char *buf, size_t size)
+{
+	ssize_t n = pread(fd, buf, size - 1, 0);
+	if (n < 0)
+		return -1;
+	buf[n] = 0;
+	return (int)n;
+}
+
+/* The line starting with @key and a blank, past that blank; or NULL. */
+static inline const char *
+__slab_pressure_line(const char *buf, const char *key)
+{
+	size_t len = strlen(key);
+	const char *s = buf;
+
+	while (s) {
+		if (!strncmp(s, key, len) && s[len] == ' ')
+			return s + len + 1;
+		if ((s = strchr(s, '\n')))
+			s++;
+	}
+	return NULL;
+}
+
+/* "avg10=12.34" of a PSI line as 1234; -1 if it is not there. */
+static inline long
+__slab_pressure_avg10(const char *line)
+{
+	const char *s = line ? strstr(line, "avg10=") : NULL;
+	char *end;
+	long whole, frac = 0;
+
+	if (!s)
+		return -1;
+	whole = strtol(s + 6, &end, 10);
+	if (end == s + 6 || whole < 0)
+		return -1;
+	if (*end == '.' && end[1] >= '0' && end[1] <= '9') {
+		frac = (end[1] - '0') * 10;
+		if (end[2] >= '0' && end[2] <= '9')
+			frac += end[2] - '0';
+	}
+	return whole * 100 + frac;
+}
+
+/* A decimal u64, or "max"; false if it is neither. */
+static inline bool
+__slab_pressure_u64(const char *s, u64 *v)
+{
+	char *end;
+	if (!s)
+		return false;
+	if (!strncmp(s, "max", 3)) {
+		*v = SLAB_PRESSURE_NOLIMIT;
+		return true;
+	}
+	*v = strtoull(s, &end, 10);
+	return end != s;
+}
+
+static inline void
+__slab_pressure_psi(struct slab_pressure *p)
+{
+	char buf[256];
+	long some, full;
+
+	p->some = p->full = 0;
+	if (p->fd_psi < 0)
+		return;
+	if (__slab_pressure_read(p->fd_psi, buf, sizeof(buf)) < 0) {
+		p->stat.errors++;
+		return;
+	}
+	some = __slab_pressure_avg10(__slab_pressure_line(buf, "some"));
+	full = __slab_pressure_avg10(__slab_pressure_line(buf, "full"));
+	if (some < 0)
+		p->stat.errors++;
+	p->some = some > 0 ? (u32)some : 0;
+	p->full = full > 0 ? (u32)full : 0;   /* no "full" line before 5.13 */
+}
+
+/*
+ * The memory.events counts; the level the events since the last poll call
+ * for. @first only takes the baseline.
+ */
+static inline u8
+__slab_pressure_events(struct slab_pressure *p, bool first)
+{
+	char buf[512];
+	u64 high = 0, max = 0, oom = 0;
+	u8 level = SLAB_PRESSURE_NONE;
+
+	if (p->fd_events < 0)
+		return level;
+	if (__slab_pressure_read(p->fd_events, buf, sizeof(buf)) < 0 ||
+	    !__slab_pressure_u64(__slab_pressure_line(buf, "high"), &high)) {
+		p->stat.errors++;
+		return level;
+	}
+	__slab_pressure_u64(__slab_pressure_line(buf, "max"), &max);
+	__slab_pressure_u64(__slab_pressure_line(buf, "oom"), &oom);
+	if (!first && high > p->ev_high)
+		level = SLAB_PRESSURE_SOME;
+	if (!first && (max > p->ev_max || oom > p->ev_oom))
+		level = SLAB_PRESSURE_FULL;
+	p->ev_high = high;
+	p->ev_max = max;
+	p->ev_oom = oom;
+	return level;
+}
+
+static inline void
+__slab_pressure_usage(struct slab_pressure *p)
+{
+	char buf[64];
+
+	p->current = 0;
+	p->high = SLAB_PRESSURE_NOLIMIT;
+	if (p->fd_current >= 0 &&
+	    (__slab_pressure_read(p->fd_current, buf, sizeof(buf)) < 0 ||
+	     !__slab_pressure_u64(buf, &p->current))) {
+		p->current = 0;
+		p->stat.errors++;
+	}
+	if (p->fd_high >= 0 &&
+	    (__slab_pressure_read(p->fd_high, buf, sizeof(buf)) < 0 ||
+	     !__slab_pressure_u64(buf, &p->high))) {
+		p->high = SLAB_PRESSURE_NOLIMIT;
+		p->stat.errors++;
+	}
+}
+
+/* ---- setup --------------------------------------------------------------- */
+
+/*
+ * The cgroup v2 directory of this process: the "0::" line of
+ * /proc/self/cgroup under SLAB_PRESSURE_CGROUP_ROOT.
+ */
+static inline int
+__slab_pressure_own_cgroup(char *dir, size_t size)
+{
+	char buf[1024], *nl;
+	const char *s = NULL;
+	int fd = open("/proc/self/cgroup", O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+	if (__slab_pressure_read(fd, buf, sizeof(buf)) >= 0)
+		s = !strncmp(buf, "0::", 3) ? buf + 3 : strstr(buf, "\n0::");
+	close(fd);
+	if (!s)
+		return -1;
+	if (*s == '\n')
+		s += 4;
+	if ((nl = strchr(s, '\n')))
+		*nl = 0;
+	if (snprintf(dir, size, "%s%s", SLAB_PRESSURE_CGROUP_ROOT, s) >= (int)size)
+		return -1;
+	return 0;
+}
+
+/*
+ * slab_pressure_open - open the pressure files.
+ *
+ * @psi is the PSI file, NULL for SLAB_PRESSURE_PSI; @cgroup the cgroup v2
+ * directory holding memory.events, memory.current and memory.high, NULL for
+ * the cgroup of this process. "" leaves a source out. Tests point both at
+ * files of their own.
+ *
+ * Returns 0 when at least one file opened, -1 with errno ENOENT when none did.
+ * The thresholds are set to the SLAB_PRESSURE_*_PCT defaults; nothing has been
+ * read yet, and the level is SLAB_PRESSURE_NONE until the first poll.
+ */
+static inline int
+slab_pressure_open(struct slab_pressure *p, const char *psi, const char *cgroup)
+{
+	char dir[512];
+
+	memset(p, 0, sizeof(*p));
+	p->fd_psi = p->fd_events = p->fd_current = p->fd_high = -1;
+	p->some_pct = SLAB_PRESSURE_SOME_PCT * 100;
+	p->full_pct = SLAB_PRESSURE_FULL_PCT * 100;
+	p->headroom_pct = SLAB_PRESSURE_HEADROOM_PCT;
+	p->high = SLAB_PRESSURE_NOLIMIT;
+
+	if (!psi)
+		psi = SLAB_PRESSURE_PSI;
+	if (*psi)
+		p->fd_psi = open(psi, O_RDONLY | O_CLOEXEC);
+	if (!cgroup && !__slab_pressure_own_cgroup(dir, sizeof(dir)))
+		cgroup = dir;
+	if (cgroup && *cgroup) {
+		p->fd_events  = __slab_pressure_open_at(cgroup, "memory.events");
+		p->fd_current = __slab_pressure_open_at(cgroup, "memory.current");
+		p->fd_high    = __slab_pressure_open_at(cgroup, "memory.high");
+	}
+	if (p->fd_psi < 0 && p->fd_events < 0 && p->fd_current < 0 &&
+	    p->fd_high < 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
+
+static inline void
+slab_pressure_close(struct slab_pressure *p)
+{
+	int *fd[] = { &p->fd_psi, &p->fd_events, &p->fd_current, &p->fd_high };
+	for (unsigned i = 0; i < array_size(fd); i++) {
+		if (*fd[i] >= 0)
+			close(*fd[i]);
+		*fd[i] = -1;
+	}
+}
+
+/* ---- polling ------------------------------------------------------------- */
+
+/*
+ * slab_pressure_poll - read the files, at most once per tick.
+ *
+ * A call with the @now of the last poll - or within @interval of it - returns
+ * the level read then and touches no file. Otherwise all the files are read
+ * again and the level and @near_high recomputed. Returns the level.
+ */
+static inline int
+slab_pressure_poll(struct slab_pressure *p, timestamp_t now)
+{
+	timestamp_t every = p->interval ? p->interval : 1;
+	bool first = !p->stat.polls;
+	u8 level;
+
+	if (!first && now >= p->last && now - p->last < every)
+		return p->level;
+	p->last = now;
+	p->stat.polls++;
+
+	__slab_pressure_psi(p);
+	level = __slab_pressure_events(p, first);
+	__slab_pressure_usage(p);
+
+	if (p->some >= p->some_pct && level < SLAB_PRESSURE_SOME)
+		level = SLAB_PRESSURE_SOME;
+	if (p->full >= p->full_pct)
+		level = SLAB_PRESSURE_FULL;
+	p->near_high = 0;
+	if (p->high != SLAB_PRESSURE_NOLIMIT) {
+		if (p->current >= p->high)
+			level = SLAB_PRESSURE_FULL;
+		p->near_high = p->current >=
+		               p->high - p->high / 100u * p->headroom_pct;
+	}
+	p->level = level;
+	return level;
+}
+
+static inline int
+slab_pressure_level(struct slab_pressure *p)
+{
+	return p->level;
+}
+
+static inline bool
+slab_pressure_allow_grow(struct slab_pressure *p)
+{
+	return !p->near_high;
+}
+
+/*
+ * slab_pressure_check - a struct slab_policy check() gate, @arg the source.
+ *
+ * Vetoes every grow while the cgroup is near memory.high, as of the last poll;
+ * never vetoes a shrink.
+ */
+static inline bool
+slab_pressure_check(struct slab *slab, int grow, void *arg)
+{
+	struct slab_pressure *p = (struct slab_pressure *)arg;
+	(void)slab;
+	if (!grow || slab_pressure_allow_grow(p))
+		return true;
+	p->stat.vetoes++;
+	return false;
+}
+
+/* ---- feeding the policy -------------------------------------------------- */
+
+/*
+ * slab_pressure_policy - adjust @pol to the level of the last poll.
+ *
+ * What slab_pressure_gc() runs slab_gc() under; see "Feeding the slab" above.
+ * Returns false, leaving @pol as it was, when there is nothing to adjust.
+ */
+static inline bool
+slab_pressure_policy(const struct slab_pressure *p, struct slab_policy *pol)
+{
+	if (p->level == SLAB_PRESSURE_NONE && !p->near_high)
+		return false;
+	if (p->near_high)
+		pol->grow_usage_pct = 0;
+	if (!pol->shrink_release_pct)             /* shrinking disabled: stays */
+		return true;
+
+	switch (p->level) {
+	case SLAB_PRESSURE_FULL:
+		pol->shrink_after = 0;
+		pol->shrink_usage_pct = 100;
+		pol->shrink_release_pct = 100;
+		pol->grow_usage_pct = 0;
+		pol->reclaim = SLAB_RECLAIM_DONTNEED;
+		break;
+	case SLAB_PRESSURE_SOME:
+		pol->shrink_after /= 4;
+		if (pol->shrink_usage_pct < 100)
+			pol->shrink_usage_pct += (100 - pol->shrink_usage_pct) / 2;
+		if (pol->grow_usage_pct && pol->shrink_usage_pct >= pol->grow_usage_pct)
+			pol->shrink_usage_pct = pol->grow_usage_pct - 1;
+		pol->shrink_release_pct = pol->shrink_release_pct < 50 ?
+		                          pol->shrink_release_pct * 2 : 100;
+		break;
+	}
+	return true;
+}
+
+/*
+ * slab_pressure_gc - slab_gc() fed by the pressure source.
+ *
+ * Polls @p (once per tick) and runs slab_gc() under the adjusted policy; the
+ * slab's own policy is back in place on return. Returns what slab_gc() does.
+ */
+static inline int
+slab_pressure_gc(struct slab_pressure *p, struct slab *slab, timestamp_t now)
+{
+	struct slab_policy saved = slab->policy;
+	int r;
+
+	slab_pressure_poll(p, now);
+	if (!slab_pressure_policy(p, &slab->policy))
+		return slab_gc(slab, now);
+	p->stat.boosts++;
+	r = slab_gc(slab, now);
+	slab->policy = saved;
+	return r;
+}
+
+#ifdef CONFIG_RCU
+/*
+ * slab_pressure_plan_gc - slab_rcu_plan_gc() fed by the pressure source.
+ *
+ * The plan is made under the adjusted policy; the tick that carries it out
+ * runs under the slab's own, as a plan is a block count, not a policy.
+ */
+static inline int
+slab_pressure_plan_gc(struct slab_pressure *p, struct slab_rcu *r,
+                      timestamp_t now)
+{
+	struct slab_policy saved = r->slab.policy;
+	int planned;
+
+	slab_pressure_poll(p, now);
+	if (!slab_pressure_policy(p, &r->slab.policy))
+		return slab_rcu_plan_gc(r, now);
+	p->stat.boosts++;
+	planned = slab_rcu_plan_gc(r, now);
+	r->slab.policy = saved;
+	return planned;
+}
+#endif/*CONFIG_RCU*/
+
+__END_DECLS
+
+#endif/*__HPC_MEM_SLAB_PRESSURE_H__*/
@@ -72,6 +72,18 @@
  * of the object with its own call_rcu(). This header protects the memory, not the
  * identity of what is in it.
  *
+ * Compaction
+ * ----------
+ * slab_rcu_compact() is slab_compact() for a slab with readers in flight. A
+ * moved block is copied and its owner repoints the references in relocate() -
+ * with rcu_assign_pointer(), so a reader that starts afterwards follows the new
+ * copy - but a reader that started before may still be on the old one. So the
+ * old slot is not freed by the move: it stays allocated, intact, until a grace
+ * period has passed, and only a later tick hands it back to the free list,
+ * where the next retire can take it out of the tail. A reader therefore never
+ * sees a block it reached change under it or disappear; it sees the old copy
+ * or the new one.
+ *
  * Which liburcu flavour supplies the grace period, and what each one asks of a
  * read-side thread, is <hpc/rcu.h>'s business and set by CONFIG_RCU_*.
  *
@@ -139,6 +151,8 @@ struct slab_rcu_stat {
 	u64 cancels;          /* retires abandoned because the slab grew      */
 	u64 blocks_grown;
 	u64 blocks_released;
+	u64 compactions;      /* compactions that moved blocks               */
+	u64 blocks_moved;     /* blocks moved, their old slots since freed    */
 };
 
 struct slab_rcu {
@@ -153,6 +167,10 @@ struct slab_rcu {
 	timestamp_t interval;     /* tick period; 0 runs every call           */
 	timestamp_t last_tick;
 	u8 ticked;                /* last_tick is valid                       */
+	struct rcu_head compact_head; /* grace period for vacated slots       */
+	unsigned long compacted;  /* set by its callback, read by the tick    */
+	u32 *vacated;             /* old slots of moved blocks, still held    */
+	u32 nvacated;
 	struct slab_rcu_stat stat;
 };
 
@@ -180,8 +198,30 @@ __slab_rcu_gp_done(struct slab_rcu *r)
 	return uatomic_read(&r->drained) != 0;
 }
 
+/* The same, for the slots a compaction vacated. */
+static inline void
+__slab_rcu_compact_cb(struct rcu_head *head)
+{
+	struct slab_rcu *r = caa_container_of(head, struct slab_rcu, compact_head);
+	uatomic_set(&r->compacted, 1);
+}
+
 /* ---- internals ----------------------------------------------------------- */
 
+/* Free the slots vacated by a compaction. Only once its grace period is in. */
+static inline u32
+__slab_rcu_compact_release(struct slab_rcu *r)
+{
+	u32 n = r->nvacated;
+	__slab_compact_release(&r->slab, r->slab.shift, r->vacated, n);
+	SLAB_MEM_FREE(r->vacated);
+	r->vacated = NULL;
+	r->nvacated = 0;
+	r->stat.blocks_moved += n;
+	trace1("slab_rcu_compact_release (%u slots free)", n);
+	return n;
+}
+
 /* Hand the retired range back. Only ever called once the grace period is in. */
 static inline u32
 __slab_rcu_release(struct slab_rcu *r)
@@ -258,6 +298,9 @@ slab_rcu_fini(struct slab_rcu *r)
 {
 	rcu_barrier();
 	r->state = SLAB_RCU_IDLE;
+	SLAB_MEM_FREE(r->vacated);
+	r->vacated = NULL;
+	r->nvacated = 0;
 	slab_fini(&r->slab);
 }
 
@@ -293,6 +336,74 @@ slab_rcu_free(struct slab_rcu *r, void *p)
 	slab_free(&r->slab, p);
 }
 
+/*
+ * slab_rcu_alloc_bulk / slab_rcu_free_bulk - the batch forms of the two above.
+ *
+ * A batch that needs more than the free list holds will grow, so the pending
+ * retire is abandoned first, as for a single allocation.
+ */
+static inline u32
+slab_rcu_alloc_bulk(struct slab_rcu *r, void **out, u32 n)
+{
+	if (slab_avail(&r->slab) < n)
+		slab_rcu_cancel(r);
+	return slab_alloc_bulk(&r->slab, out, n);
+}
+
+static inline void
+slab_rcu_free_bulk(struct slab_rcu *r, void **in, u32 n)
+{
+	slab_free_bulk(&r->slab, in, n);
+}
+
+/*
+ * slab_rcu_compact - slab_compact(), with the vacated slots held back.
+ *
+ * Moves up to @budget live blocks from @target and up into free slots below it,
+ * calling @relocate(@from, @to, @arg) for each as slab_compact() does; the owner
+ * publishes @to there with rcu_assign_pointer(). The old slots stay allocated
+ * and intact until a grace period has passed, and a later slab_rcu_tick() (or
+ * slab_rcu_sync()) frees them - see "Compaction" at the top of this header.
+ *
+ * One compaction is in flight at a time: while its slots are held this returns
+ * 0. Also returns 0, moving nothing, if the slot list cannot be allocated.
+ * Returns the blocks moved.
+ */
+static inline u32
+slab_rcu_compact(struct slab_rcu *r, u32 target, u32 budget,
+                 bool (*relocate)(void *from, void *to, void *arg), void *arg)
+{
+	struct slab *s = &r->slab;
+	u32 moved;
+
+	if (r->vacated || !budget || !relocate)
+		return 0;
+	r->vacated = (u32 *)SLAB_MEM_CALLOC(budget, sizeof(u32));
+	if (!r->vacated)
+		return 0;
+	moved = __slab_compact(s, s->shift, target, budget, relocate, arg,
+	                       r->vacated);
+	if (!moved) {
+		SLAB_MEM_FREE(r->vacated);
+		r->vacated = NULL;
+		return 0;
+	}
+	r->nvacated = moved;
+	r->stat.compactions++;
+	uatomic_set(&r->compacted, 0);
+	call_rcu(&r->compact_head, __slab_rcu_compact_cb);
+	trace1("slab_rcu_compact (%u moved, old slots awaiting a grace period)",
+		moved);
+	return moved;
+}
+
+/* Blocks moved whose old slots still wait for their grace period. */
+static inline u32
+slab_rcu_compacting(struct slab_rcu *r)
+{
+	return r->nvacated;
+}
+
 /* ---- planning ------------------------------------------------------------ */
 
 /*
@@ -390,8 +501,12 @@ slab_rcu_plan_gc(struct slab_rcu *r, timestamp_t now)
  *   2. otherwise finishes a retire whose grace period has elapsed, releasing the
  *      pages - and if the grace period has not elapsed, leaves it for the next
  *      tick (counted in stat.deferred) rather than waiting;
- *   3. otherwise applies a planned shrink: retires grains and starts a grace
- *      period, for a later tick to release.
+ *   3. frees the slots of a compaction whose grace period is in;
+ *   4. otherwise applies a planned shrink: retires grains and starts a grace
+ *      period, for a later tick to release. With policy.relocate and
+ *      policy.compact_budget set it first runs slab_rcu_compact() against the
+ *      tail the plan means to release, so stragglers move out of the way of a
+ *      later round.
  *
  * Returns the signed change in committed blocks: positive grown, negative
  * retired, zero if nothing was due. Note a release is not a change in committed
@@ -434,12 +549,21 @@ slab_rcu_tick(struct slab_rcu *r, timestamp_t now)
 		__slab_rcu_release(r);
 	}
 
-	/* 3. start a new retire */
+	/* 3. free what a compaction vacated, once its readers are gone */
+	if (r->nvacated && uatomic_read(&r->compacted))
+		__slab_rcu_compact_release(r);
+
+	/* 4. start a new retire */
 	if (r->plan_shrink) {
+		struct slab *s = &r->slab;
 		u32 n = r->plan_shrink, from = 0, to = 0, retired;
 		r->plan_shrink = 0;
 		if (r->state != SLAB_RCU_IDLE)
 			return delta;             /* one retire at a time */
+		if (s->policy.compact_budget && n < s->committed)
+			slab_rcu_compact(r, s->committed - n,
+			                 s->policy.compact_budget,
+			                 s->policy.relocate, s->policy.arg);
 		retired = __slab_retire(&r->slab, r->slab.shift, n, &from, &to);
 		if (retired) {
 			r->retire_from = from;
@@ -462,11 +586,18 @@ slab_rcu_tick(struct slab_rcu *r, timestamp_t now)
  * releasable when the tick that follows runs. For teardown paths and tests -
  * anywhere the deferral itself is what is in the way. The interval is bypassed.
  *
+ * A compaction in flight is finished the same way, its vacated slots freed (and
+ * not counted in the return value, as they are not released memory).
+ *
  * Returns the blocks released.
  */
 static inline u32
 slab_rcu_sync(struct slab_rcu *r)
 {
+	if (r->nvacated) {
+		rcu_barrier();
+		__slab_rcu_compact_release(r);
+	}
 	if (r->state != SLAB_RCU_RETIRED)
 		return 0;
 	rcu_barrier();
@@ -0,0 +1,463 @@
+/*
+ * Slab allocator over chained reservations                   Segmented slab
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A slab that grows past its reservation by adding more of them.
+ *
+ * struct slab reserves policy.max blocks once, so the peak has to be guessed
+ * at init: too high wastes address space and page tables, too low fails the
+ * allocation at the peak. struct slab_seg chains reservations instead. Each
+ * segment is a struct slab of its own over a reservation of 1 << @bits blocks
+ * (policy.max rounded up to a power of two), and when every segment is full the
+ * slab adds another - up to @max_seg of them - rather than failing. Blocks never
+ * move: a segment is reserved once and released whole, so the stable-address
+ * guarantee of <mem/slab.h> holds across segments.
+ *
+ * The block index
+ * ---------------
+ * A block index is still one u32: the segment slot in the high bits, the
+ * block's index within its segment in the low @bits. Both translations stay
+ * free of branches and searches:
+ *
+ *   index -> block   base[index >> bits] + ((index & mask) << shift), one load
+ *                    from the segment table
+ *   block -> index   every segment is reserved aligned to its own size, so
+ *                    the block's offset in it is its address masked, and the
+ *                    slot is a hash of the address above that - the segment
+ *                    frame. No table lookup at all.
+ *
+ * The second one is what decides the slot: a new segment goes in the slot its
+ * frame hashes to. When that slot is taken the reservation is kept aside, so
+ * the next one lands elsewhere, and retried (counted in stat.retries); with
+ * SLAB_SEG_SLOTS slots and a handful of segments that is rare, and the rejects
+ * are released once a segment has found its slot. The top bit of an index is
+ * never used, so SLAB_NIL is never a valid one.
+ *
+ * Aligning costs address space only: the default mmap backend reserves twice
+ * the segment and unmaps the slack on either side. A backend without partial
+ * unmapping (the libc heap, a custom one) keeps the whole double reservation,
+ * which for a large malloc() is untouched address space as well.
+ *
+ * Growing and releasing
+ * ---------------------
+ * Allocation takes from the current segment and, when that is full, from any
+ * segment with room - a free block or an uncommitted one - before it adds a new
+ * one. Each segment carries the slab's policy with its max set to the segment
+ * size, so it grows, shrinks and consults check() exactly as a struct slab
+ * does; the policy min applies to the home segment, the one slab_seg_init()
+ * creates, which is never released. slab_seg_gc() runs each segment's gc and
+ * then releases every other segment whose gc has shrunk it to nothing - the
+ * policy's idle dwell therefore applies to whole segments too.
+ * slab_seg_trim() releases the empty ones right away.
+ *
+ * A segment's struct slab is reachable (slab_seg_segment()) for anything this
+ * header does not wrap. The slab is single-writer, like struct slab.
+ */
+
+#ifndef __HPC_MEM_SLAB_SEG_H__
+#define __HPC_MEM_SLAB_SEG_H__
+
+#include <hpc/compiler.h>
+#include <mem/slab.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+__BEGIN_DECLS
+
+/* Segment slots, a power of two: the bound on segments, and the hash range. */
+#ifndef SLAB_SEG_SLOTS
+#define SLAB_SEG_SLOTS 64
+#endif
+
+/* Reservations tried for a free slot before adding a segment fails. */
+#ifndef SLAB_SEG_RETRY
+#define SLAB_SEG_RETRY 8
+#endif
+
+#define SLAB_SEG_SLOT_BITS ((unsigned)__builtin_ctz(SLAB_SEG_SLOTS))
+/* Widest segment: slot and local index leave the top bit of a u32 clear. */
+#define SLAB_SEG_BITS_MAX  (31u - SLAB_SEG_SLOT_BITS)
+
+_Static_assert(SLAB_SEG_SLOTS >= 2 && SLAB_SEG_SLOTS <= 256 &&
+               (SLAB_SEG_SLOTS & (SLAB_SEG_SLOTS - 1)) == 0,
+	"SLAB_SEG_SLOTS must be a power of two within 2..256");
+
+struct slab_seg_stat {
+	u64 adds;             /* segments added                               */
+	u64 releases;         /* segments released                            */
+	u64 retries;          /* reservations rejected for a taken slot       */
+};
+
+/* A segment's reservation as the backend handed it out. */
+struct slab_seg_res {
+	void *raw;
+	u64 len;
+};
+
+struct slab_seg {
+	u8 *base[SLAB_SEG_SLOTS];     /* block 0 of each slot, NULL when none  */
+	struct slab *seg[SLAB_SEG_SLOTS];
+	struct slab_seg_res res[SLAB_SEG_SLOTS];
+	unsigned shift;               /* block size, log2                      */
+	unsigned bits;                /* blocks per segment, log2              */
+	unsigned seg_log;             /* segment bytes, log2: bits + shift     */
+	u32 cur;                      /* slot allocations come from            */
+	u32 home;                     /* slot of the segment never released    */
+	u32 nseg;                     /* segments in the table                 */
+	u32 max_seg;                  /* bound on nseg                         */
+	struct slab_policy policy;    /* per segment; max is the segment size  */
+	struct slab_seg_stat stat;
+	measure_member(slab)          /* shared by every segment               */
+};
+
+/* The slot a segment frame hashes to; see "The block index" above. */
+static inline u32
+__slab_seg_slot(const struct slab_seg *s, const void *p)
+{
+	u64 frame = (u64)(uintptr_t)p >> s->seg_log;
+	return (u32)((frame * 0x9e3779b97f4a7c15ull) >> (64 - SLAB_SEG_SLOT_BITS));
+}
+
+/* Reserve @len bytes aligned to @len; @res is what to free afterwards. */
+static inline void *
+__slab_seg_reserve(u64 len, struct slab_seg_res *res)
+{
+	u8 *raw = (u8 *)SLAB_VM_ALLOC(2 * len);
+	u8 *page;
+
+	if ((void *)raw == SLAB_VM_FAILED)
+		return NULL;
+	page = (u8 *)align_to((uintptr_t)raw, (uintptr_t)len);
+#ifdef SLAB_VM_MMAP
+	/* only address space: trim the slack on either side */
+	if (page > raw)
+		SLAB_VM_FREE(raw, (size_t)(page - raw));
+	if (raw + 2 * len > page + len)
+		SLAB_VM_FREE(page + len, (size_t)(raw + 2 * len - (page + len)));
+	res->raw = page;
+	res->len = len;
+#else
+	res->raw = raw;
+	res->len = 2 * len;
+#endif
+	SLAB_VM_HUGEPAGE(page, len);
+	return page;
+}
+
+/* Add a segment; returns its slot, or SLAB_NIL. */
+static inline u32
+__slab_seg_add(struct slab_seg *s, u32 min)
+{
+	struct slab_seg_res reject[SLAB_SEG_RETRY], res = { 0 };
+	struct slab_policy pol = s->policy;
+	u64 len = (u64)1 << s->seg_log;
+	u32 slot = SLAB_NIL, n = 0, i;
+	struct slab *seg;
+	void *page = NULL;
+
+	if (s->nseg >= s->max_seg)
+		return SLAB_NIL;
+	while (n < SLAB_SEG_RETRY) {
+		if (!(page = __slab_seg_reserve(len, &res)))
+			break;
+		slot = __slab_seg_slot(s, page);
+		if (!s->seg[slot])
+			break;
+		/* taken: hold on to it, so the next reservation lands elsewhere */
+		reject[n++] = res;
+		s->stat.retries++;
+		page = NULL;
+	}
+	for (i = 0; i < n; i++)
+		SLAB_VM_FREE(reject[i].raw, reject[i].len);
+	if (!page)
+		return SLAB_NIL;
+
+	pol.min = min;
+	seg = (struct slab *)SLAB_MEM_CALLOC(1, sizeof(*seg));
+	if (!seg || __slab_init_in(seg, s->shift, &pol, page, NULL)) {
+		SLAB_MEM_FREE(seg);
+		SLAB_VM_FREE(res.raw, res.len);
+		return SLAB_NIL;
+	}
+#ifdef CONFIG_MEASURE
+	seg->measure = s->measure;
+#endif
+	s->seg[slot] = seg;
+	s->base[slot] = (u8 *)page;
+	s->res[slot] = res;
+	s->nseg++;
+	s->stat.adds++;
+	trace4("slab_seg_add (slot %u, %u segments): %p", slot, s->nseg, page);
+	return slot;
+}
+
+static inline void
+__slab_seg_release(struct slab_seg *s, u32 slot)
+{
+	struct slab *seg = s->seg[slot];
+
+	__slab_fini(seg);
+	SLAB_MEM_FREE(seg);
+	SLAB_VM_FREE(s->res[slot].raw, s->res[slot].len);
+	s->seg[slot] = NULL;
+	s->base[slot] = NULL;
+	s->nseg--;
+	s->stat.releases++;
+	if (s->cur == slot)
+		s->cur = s->home;
+	trace4("slab_seg_release (slot %u, %u segments)", slot, s->nseg);
+}
+
+/*
+ * slab_seg_init - build a segmented slab of @block_size blocks.
+ *
+ * Segments hold policy->max blocks rounded up to a power of two (and to at
+ * most 1 << SLAB_SEG_BITS_MAX); there may be up to @max_seg of them, 0 meaning
+ * SLAB_SEG_SLOTS. The home segment is added here with policy->min committed.
+ * Returns 0 on success, -1 on failure.
+ */
+static inline int
+slab_seg_init(struct slab_seg *s, unsigned block_size,
+              const struct slab_policy *policy, u32 max_seg)
+{
+	u32 blocks = policy->max ? policy->max : 1;
+
+	memset(s, 0, sizeof(*s));
+	s->shift = slab_shift_for(block_size);
+	s->bits = blocks > 1 ? 32u - (unsigned)__builtin_clz(blocks - 1) : 0;
+	/* at least a grain, so each segment grows and shrinks in whole ones */
+	while (((u32)1 << s->bits) < slab_grain_for(s->shift))
+		s->bits++;
+	if (s->bits > SLAB_SEG_BITS_MAX)
+		s->bits = SLAB_SEG_BITS_MAX;
+	s->seg_log = s->bits + s->shift;
+	s->max_seg = max_seg && max_seg < SLAB_SEG_SLOTS ? max_seg : SLAB_SEG_SLOTS;
+	s->policy = *policy;
+	s->policy.max = (u32)1 << s->bits;
+	if (s->policy.min > s->policy.max)
+		s->policy.min = s->policy.max;
+
+	s->home = __slab_seg_add(s, s->policy.min);
+	if (s->home == SLAB_NIL)
+		return -1;
+	s->cur = s->home;
+	/* the initial segment is not an event, as the initial commit is not */
+	s->stat.adds = 0;
+	return 0;
+}
+
+static inline void
+slab_seg_fini(struct slab_seg *s)
+{
+	u32 slot;
+	for (slot = 0; slot < SLAB_SEG_SLOTS; slot++)
+		if (s->seg[slot])
+			__slab_seg_release(s, slot);
+}
+
+/* Attach one measure to every segment, present and future. */
+static inline void
+slab_seg_set_measure(struct slab_seg *s, struct slab_measure *m)
+{
+#ifdef CONFIG_MEASURE
+	u32 slot;
+	s->measure = m;
+	for (slot = 0; slot < SLAB_SEG_SLOTS; slot++)
+		if (s->seg[slot])
+			s->seg[slot]->measure = m;
+#else
+	(void)s;
+	(void)m;
+#endif
+}
+
+/* ---- translation --------------------------------------------------------- */
+
+static inline void *
+slab_seg_at(struct slab_seg *s, u32 index)
+{
+	return s->base[index >> s->bits] +
+	       ((size_t)(index & (((u32)1 << s->bits) - 1)) << s->shift);
+}
+
+static inline u32
+slab_seg_index(struct slab_seg *s, void *p)
+{
+	uintptr_t off = (uintptr_t)p & (((uintptr_t)1 << s->seg_log) - 1);
+	return (__slab_seg_slot(s, p) << s->bits) | (u32)(off >> s->shift);
+}
+
+/* The segment @p lives in. */
+static inline struct slab *
+slab_seg_segment(struct slab_seg *s, void *p)
+{
+	return s->seg[__slab_seg_slot(s, p)];
+}
+
+/* ---- allocation ---------------------------------------------------------- */
+
+/* Has segment @seg a block to give without adding a segment? */
+static inline bool
+__slab_seg_room(struct slab *seg)
+{
+	return seg->avail || seg->committed < seg->policy.max;
+}
+
+static inline void *
+__slab_seg_alloc_slow(struct slab_seg *s)
+{
+	struct slab *seg = s->seg[s->cur];
+	u32 slot;
+	void *p;
+
+	if (__slab_seg_room(seg) && (p = __slab_alloc(seg, s->shift)))
+		return p;
+	for (slot = 0; slot < SLAB_SEG_SLOTS; slot++) {
+		seg = s->seg[slot];
+		if (slot == s->cur || !seg || !__slab_seg_room(seg))
+			continue;
+		if ((p = __slab_alloc(seg, s->shift))) {
+			s->cur = slot;
+			return p;
+		}
+	}
+	slot = __slab_seg_add(s, 0);
+	if (slot == SLAB_NIL) {
+		measure_inc(s->measure, fail);
+		return NULL;
+	}
+	s->cur = slot;
+	return __slab_alloc(s->seg[slot], s->shift);
+}
+
+/*
+ * slab_seg_alloc - allocate a block, adding a segment when every one is full.
+ *
+ * NULL only once @max_seg segments are full, a reservation fails, or check()
+ * vetoes every grow.
+ */
+static inline void *
+slab_seg_alloc(struct slab_seg *s)
+{
+	struct slab *seg = s->seg[s->cur];
+	if (likely(seg->list != SLAB_NIL))
+		return __slab_alloc(seg, s->shift);
+	return __slab_seg_alloc_slow(s);
+}
+
+static inline void
+slab_seg_free(struct slab_seg *s, void *p)
+{
+	__slab_free(s->seg[__slab_seg_slot(s, p)], s->shift, p);
+}
+
+/* ---- grow / shrink ------------------------------------------------------- */
+
+/*
+ * slab_seg_gc - apply the policy to every segment, then release the segments
+ * it left with nothing committed. Returns the signed change in committed
+ * blocks, released segments included.
+ */
+static inline int
+slab_seg_gc(struct slab_seg *s, timestamp_t now)
+{
+	int delta = 0;
+	u32 slot;
+
+	for (slot = 0; slot < SLAB_SEG_SLOTS; slot++) {
+		struct slab *seg = s->seg[slot];
+		if (!seg)
+			continue;
+		delta += __slab_gc(seg, s->shift, now);
+		if (slot != s->home && !seg->committed)
+			__slab_seg_release(s, slot);
+	}
+	return delta;
+}
+
+/* Release every segment but the home one that holds no live block. */
+static inline u32
+slab_seg_trim(struct slab_seg *s)
+{
+	u32 slot, n = 0;
+
+	for (slot = 0; slot < SLAB_SEG_SLOTS; slot++) {
+		struct slab *seg = s->seg[slot];
+		if (!seg || slot == s->home || seg->committed != seg->avail)
+			continue;
+		measure_sub(seg->measure, committed, seg->committed);
+		__slab_seg_release(s, slot);
+		n++;
+	}
+	return n;
+}
+
+/* ---- accessors ----------------------------------------------------------- */
+
+static inline u32
+slab_seg_count(struct slab_seg *s)
+{
+	return s->nseg;
+}
+
+/* Blocks per segment. */
+static inline u32
+slab_seg_blocks(struct slab_seg *s)
+{
+	return (u32)1 << s->bits;
+}
+
+static inline u32
+slab_seg_committed(struct slab_seg *s)
+{
+	u32 slot, n = 0;
+	for (slot = 0; slot < SLAB_SEG_SLOTS; slot++)
+		if (s->seg[slot])
+			n += s->seg[slot]->committed;
+	return n;
+}
+
+static inline u32
+slab_seg_avail(struct slab_seg *s)
+{
+	u32 slot, n = 0;
+	for (slot = 0; slot < SLAB_SEG_SLOTS; slot++)
+		if (s->seg[slot])
+			n += s->seg[slot]->avail;
+	return n;
+}
+
+static inline u32
+slab_seg_used(struct slab_seg *s)
+{
+	return slab_seg_committed(s) - slab_seg_avail(s);
+}
+
+__END_DECLS
+
+#endif/*__HPC_MEM_SLAB_SEG_H__*/
@@ -0,0 +1,577 @@
+/*
+ * Cross-process slab on a memfd                                  Shared slab
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A slab whose reservation, free list and occupancy bitmap all live in one
+ * memfd, mapped by several processes at once, with a ring of block indices
+ * in the same file to hand blocks from one process to another. A producer
+ * allocates a block, writes the payload in place and sends the index; the
+ * consumer reads it where it lies and frees the block. The payload is
+ * written once and never copied, where a socket would copy it twice.
+ *
+ * Layout
+ * ------
+ * One shared mapping of the file holds, in order:
+ *
+ *   header   one page: geometry, and the shared state - the free list head,
+ *            the counts, the ring positions and the futex words - each group
+ *            on a cache line of its own (struct slab_shm_hdr)
+ *   map      the occupancy bitmap, slab_order_map_bytes(total) bytes
+ *   ring     @ring slots of struct slab_shm_slot
+ *   blocks   the reservation, total << shift bytes, on a grain boundary
+ *
+ * Every process maps the file at an address of its own, so nothing in it is
+ * a pointer: blocks are named by index, slab_shm_index() and slab_shm_at()
+ * convert, and the free list links blocks by index as the slab's does.
+ *
+ * Allocation
+ * ----------
+ * The free list is the lock-free mode of <mem/slab_lockfree.h> over the
+ * header's fields: a tagged-index Treiber stack, its head a 64-bit word a CAS
+ * swaps whole, which works the same between processes as between threads. An
+ * empty list grows the committed prefix by a grain, claimed with a CAS on the
+ * shared count and pushed as one chain; a fresh file commits nothing and its
+ * pages fault in as the prefix grows. The prefix never shrinks - a block
+ * index one process sees must stay mapped in all of them - so there is no gc
+ * and no release here. slab_shm_alloc() fails once all @total blocks are out;
+ * slab_shm_alloc_wait() sleeps instead, on a futex in the header, until some
+ * process frees one.
+ *
+ * Hand-off
+ * --------
+ * The ring is a bounded multi-producer multi-consumer queue of u32 indices
+ * (a sequence number per slot, positions advanced by CAS), so any number of
+ * processes may send and receive. It has a slot for every block, rounded up
+ * to a power of two, and a block is in it at most once, so a send never finds
+ * it full. slab_shm_recv() takes the next index, waiting on a second futex
+ * when the ring is empty; the futexes are shared ones, keyed by the file
+ * page, and cost a syscall only when someone is asleep.
+ *
+ * Ownership
+ * ---------
+ * A block belongs to whoever allocated or received it, and the protocol is
+ * the caller's: send it and forget it, or free it. The slab knows which blocks
+ * are out (the bitmap) but not who holds them, so a process that dies with
+ * blocks in hand leaks them for the life of the file.
+ *
+ * With a struct slab_measure attached as sh->measure, a process counts its
+ * own allocations, frees, failures and grows.
+ */
+
+#ifndef __HPC_MEM_SLAB_SHM_H__
+#define __HPC_MEM_SLAB_SHM_H__
+
+#include <hpc/compiler.h>
+#include <hpc/spinlock.h>
+#include <mem/slab.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+__BEGIN_DECLS
+
+#define SLAB_SHM_MAGIC   0x314d4853424c5048ull  /* "HPLBSHM1", little end */
+#define SLAB_SHM_VERSION 1
+
+/*
+ * Tries a waiter spins before it sleeps: a hand-off is often that close. Not
+ * on a single CPU, where the spinner only keeps the other side off it.
+ */
+#ifndef SLAB_SHM_SPIN
+#define SLAB_SHM_SPIN 256
+#endif
+
+/* One ring slot: the index, and the lap it belongs to. */
+struct slab_shm_slot {
+	u32 seq;
+	u32 index;
+};
+
+struct slab_shm_hdr {
+	u64 magic;
+	u32 version;
+	u32 shift;
+	u32 total;
+	u32 grain;
+	u32 ring;                 /* slots, a power of two                    */
+	u32 hdr_size;
+	u64 map_off;
+	u64 ring_off;
+	u64 page_off;
+	u64 length;               /* of the whole file                        */
+	u32 attaches;
+	/* the free list */
+	union slab_head head _align(CPU_CACHE_LINE);
+	u32 avail;                /* blocks on the list                       */
+	u32 committed;            /* blocks [0, committed) in use or listed   */
+	u32 free_seq;             /* futex: bumped by a free with sleepers    */
+	u32 free_waiters;
+	/* the ring */
+	u32 enq _align(CPU_CACHE_LINE);
+	u32 deq _align(CPU_CACHE_LINE);
+	u32 ring_seq;             /* futex: bumped by a send with sleepers    */
+	u32 ring_waiters;
+};
+
+_Static_assert(sizeof(struct slab_shm_hdr) <= CPU_PAGE_SIZE,
+	"the header fits its page");
+
+struct slab_shm {
+	struct slab_shm_hdr *hdr;
+	u8 *map;
+	struct slab_shm_slot *ring;
+	u8 *page;                 /* block 0, in this process                 */
+	u8 *base;                 /* the mapping                              */
+	u64 length;
+	u32 shift;
+	int fd;
+	bool own_fd;              /* created here, closed by slab_shm_close() */
+	measure_member(slab)
+};
+
+/* The file layout for @total blocks of 1 << @shift bytes and @ring slots. */
+static inline void
+__slab_shm_layout(struct slab_shm_hdr *h, u32 shift, u32 total, u32 ring)
+{
+	u64 grain = SLAB_GRAIN_BYTES > CPU_PAGE_SIZE ? SLAB_GRAIN_BYTES
+	                                             : CPU_PAGE_SIZE;
+	h->shift = shift;
+	h->total = total;
+	h->grain = slab_grain_for(shift);
+	h->ring = ring;
+	h->hdr_size = (u32)sizeof(*h);
+	h->map_off = CPU_PAGE_SIZE;
+	h->ring_off = align_to(h->map_off + slab_order_map_bytes(total), 64);
+	h->page_off = align_to(h->ring_off + (u64)ring * sizeof(struct slab_shm_slot),
+	                       grain);
+	h->length = h->page_off + ((u64)total << shift);
+}
+
+static inline int
+__slab_shm_futex_wait(u32 *word, u32 val, int timeout_ms)
+{
+	struct timespec ts = {
+		.tv_sec = timeout_ms / 1000,
+		.tv_nsec = (long)(timeout_ms % 1000) * 1000000L,
+	};
+	return (int)syscall(SYS_futex, word, FUTEX_WAIT, val,
+	                    timeout_ms < 0 ? NULL : &ts, NULL, 0);
+}
+
+static inline void
+__slab_shm_futex_wake(u32 *word, int n)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE, n, NULL, NULL, 0);
+}
+
+static inline u64
+__slab_shm_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000 + (u64)ts.tv_nsec / 1000000;
+}
+
+static inline unsigned
+__slab_shm_spins(void)
+{
+	static int spins = -1;
+	if (spins < 0)
+		spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SLAB_SHM_SPIN : 0;
+	return (unsigned)spins;
+}
+
+/* Wake sleepers on @seq, if any; the caller has just published something. */
+static inline void
+__slab_shm_signal(u32 *seq, u32 *waiters)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiters, __ATOMIC_RELAXED)) {
+		__atomic_fetch_add(seq, 1, __ATOMIC_RELEASE);
+		__slab_shm_futex_wake(seq, INT_MAX);
+	}
+}
+
+/* Map @length bytes of @fd; the rest is read from the header, see below. */
+static inline int
+__slab_shm_map(struct slab_shm *sh, int fd, u64 length)
+{
+	void *base = SLAB_VM_FILE_MAP(fd, length);
+
+	if (base == SLAB_VM_FAILED)
+		return -1;
+	sh->base = (u8 *)base;
+	sh->length = length;
+	sh->hdr = (struct slab_shm_hdr *)base;
+	sh->fd = fd;
+	return 0;
+}
+
+static inline void
+__slab_shm_bind(struct slab_shm *sh)
+{
+	struct slab_shm_hdr *h = sh->hdr;
+
+	sh->map = sh->base + h->map_off;
+	sh->ring = (struct slab_shm_slot *)(sh->base + h->ring_off);
+	sh->page = sh->base + h->page_off;
+	sh->shift = h->shift;
+}
+
+/*
+ * slab_shm_create - lay out a shared slab of @total blocks of @block_size in
+ * a new memfd named @name, and map it.
+ *
+ * @block_size is rounded up to a power of two as slab_init() rounds it, and
+ * @total to the release grain. Returns 0, or -1 with errno set. The
+ * descriptor is the slab's, closed by slab_shm_close(); hand it to the other
+ * processes across fork() or exec(), or over a unix socket, and have them
+ * slab_shm_attach() it.
+ */
+static inline int
+slab_shm_create(struct slab_shm *sh, const char *name, unsigned block_size,
+                u32 total)
+{
+	unsigned shift = slab_shift_for(block_size);
+	struct slab_shm_hdr want;
+	u32 ring = 1;
+	int fd;
+
+	memset(sh, 0, sizeof(*sh));
+	memset(&want, 0, sizeof(want));
+	total = slab_grain_round(total, slab_grain_for(shift));
+	while (ring < total)
+		ring <<= 1;
+	__slab_shm_layout(&want, shift, total, ring);
+
+#ifdef MFD_CLOEXEC
+	fd = memfd_create(name, 0);
+#else
+	(void)name;
+	fd = -1;
+	errno = ENOSYS;
+#endif
+	if (fd < 0)
+		return -1;
+	/* sparse: nothing is written but the header and the ring */
+	if (ftruncate(fd, (off_t)want.length) || __slab_shm_map(sh, fd, want.length)) {
+		int err = errno;
+		close(fd);
+		memset(sh, 0, sizeof(*sh));
+		errno = err;
+		return -1;
+	}
+	*sh->hdr = want;
+	__slab_shm_bind(sh);
+	sh->hdr->head.list = SLAB_NIL;
+	for (u32 i = 0; i < ring; i++)
+		sh->ring[i].seq = i;
+	sh->hdr->version = SLAB_SHM_VERSION;
+	sh->hdr->attaches = 1;
+	__atomic_store_n(&sh->hdr->magic, SLAB_SHM_MAGIC, __ATOMIC_RELEASE);
+	sh->own_fd = true;
+	return 0;
+}
+
+/*
+ * slab_shm_attach - map the shared slab behind @fd, laid out by
+ * slab_shm_create() in this or another process. The geometry is the file's.
+ * Returns 0, or -1 with errno set - EINVAL for a file that is not one. @fd
+ * stays the caller's.
+ */
+static inline int
+slab_shm_attach(struct slab_shm *sh, int fd)
+{
+	struct slab_shm_hdr h, want;
+	struct stat st;
+
+	memset(sh, 0, sizeof(*sh));
+	if (fstat(fd, &st))
+		return -1;
+	if ((u64)st.st_size < sizeof(h) ||
+	    pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h))
+		goto invalid;
+	if (h.magic != SLAB_SHM_MAGIC || h.shift > 30 ||
+	    !h.total || !h.ring)
+		goto invalid;
+	memset(&want, 0, sizeof(want));
+	__slab_shm_layout(&want, h.shift, h.total, h.ring);
+	if (h.magic != SLAB_SHM_MAGIC || h.version != SLAB_SHM_VERSION ||
+	    h.hdr_size != want.hdr_size || h.length != want.length ||
+	    h.page_off != want.page_off || h.ring & (h.ring - 1) ||
+	    (u64)st.st_size < h.length)
+		goto invalid;
+	if (__slab_shm_map(sh, fd, h.length))
+		return -1;
+	__slab_shm_bind(sh);
+	__atomic_fetch_add(&sh->hdr->attaches, 1, __ATOMIC_RELAXED);
+	return 0;
+invalid:
+	errno = EINVAL;
+	return -1;
+}
+
+/*
+ * slab_shm_detach - unmap; every block pointer of this process is void after.
+ * Returns the descriptor, which stays open and is the caller's from now on.
+ */
+static inline int
+slab_shm_detach(struct slab_shm *sh)
+{
+	int fd = sh->fd;
+	__atomic_fetch_sub(&sh->hdr->attaches, 1, __ATOMIC_RELAXED);
+	SLAB_VM_FILE_UNMAP(sh->base, sh->length);
+	memset(sh, 0, sizeof(*sh));
+	sh->fd = -1;
+	return fd;
+}
+
+/* slab_shm_close - detach, and close the descriptor if the slab created it. */
+static inline void
+slab_shm_close(struct slab_shm *sh)
+{
+	bool own = sh->own_fd;
+	int fd = slab_shm_detach(sh);
+	if (own)
+		close(fd);
+}
+
+static inline int
+slab_shm_fd(struct slab_shm *sh)
+{
+	return sh->fd;
+}
+
+static inline u32
+slab_shm_index(struct slab_shm *sh, void *p)
+{
+	return (u32)(((u8 *)p - sh->page) >> sh->shift);
+}
+
+static inline void *
+slab_shm_at(struct slab_shm *sh, u32 index)
+{
+	return sh->page + ((size_t)index << sh->shift);
+}
+
+static inline unsigned
+slab_shm_block_size(struct slab_shm *sh)
+{
+	return 1U << sh->shift;
+}
+
+/* Blocks free right now, in the list or never committed; a snapshot. */
+static inline u32
+slab_shm_avail(struct slab_shm *sh)
+{
+	struct slab_shm_hdr *h = sh->hdr;
+	return __atomic_load_n(&h->avail, __ATOMIC_RELAXED) + h->total -
+	       __atomic_load_n(&h->committed, __ATOMIC_RELAXED);
+}
+
+/* Commit the next grain and push it; returns the blocks added, 0 at the end. */
+static inline u32
+__slab_shm_grow(struct slab_shm *sh)
+{
+	struct slab_shm_hdr *h = sh->hdr;
+	u32 from = 0, grew;
+
+	grew = __slab_lf_reserve(&h->committed, h->total, h->grain, &from);
+	if (!grew)
+		return 0;
+	__slab_lf_link(sh->page, sh->shift, from, from + grew);
+	__atomic_fetch_add(&h->avail, grew, __ATOMIC_RELAXED);
+	__slab_lf_push(&h->head.word, sh->page, sh->shift, from, from + grew - 1);
+	measure_add_atomic(sh->measure, grow, 1);
+	measure_add_atomic(sh->measure, commit, grew);
+	return grew;
+}
+
+/* slab_shm_alloc - a block, or NULL when all of them are out. Lock-free. */
+static inline void *
+slab_shm_alloc(struct slab_shm *sh)
+{
+	struct slab_shm_hdr *h = sh->hdr;
+	u32 idx;
+
+	while ((idx = __slab_lf_pop(&h->head.word, sh->page, sh->shift)) ==
+	       SLAB_NIL) {
+		/* a racing grower's blocks count too */
+		if (!__slab_shm_grow(sh) &&
+		    __atomic_load_n(&h->head.list, __ATOMIC_RELAXED) == SLAB_NIL) {
+			measure_add_atomic(sh->measure, fail, 1);
+			return NULL;
+		}
+	}
+	__atomic_fetch_sub(&h->avail, 1, __ATOMIC_RELAXED);
+	__slab_lf_bit_set(sh->map, idx);
+	measure_add_atomic(sh->measure, alloc, 1);
+	return slab_shm_at(sh, idx);
+}
+
+/* slab_shm_free - return a block, from whichever process holds it. */
+static inline void
+slab_shm_free(struct slab_shm *sh, void *p)
+{
+	struct slab_shm_hdr *h = sh->hdr;
+	u32 idx = slab_shm_index(sh, p);
+
+	__slab_lf_bit_clr(sh->map, idx);
+	__atomic_fetch_add(&h->avail, 1, __ATOMIC_RELAXED);
+	__slab_lf_push(&h->head.word, sh->page, sh->shift, idx, idx);
+	measure_add_atomic(sh->measure, free, 1);
+	__slab_shm_signal(&h->free_seq, &h->free_waiters);
+}
+
+/*
+ * Sleep on @seq until @try succeeds or @timeout_ms passes (-1: no limit),
+ * after SLAB_SHM_SPIN tries on the CPU. @try runs once more after the sleeper
+ * is counted, so a publish between the last try and the sleep is never missed.
+ */
+#define __slab_shm_wait(_seq, _waiters, _timeout_ms, _try) ({                 \
+	u64 __end = __slab_shm_now_ms() + (u64)((_timeout_ms) < 0 ? 0 : (_timeout_ms)); \
+	__typeof__(_try) __v;                                                 \
+	unsigned __spin = (_timeout_ms) ? __slab_shm_spins() : 0;             \
+	for (;;) {                                                            \
+		u32 __s;                                                      \
+		int __left = -1;                                              \
+		if ((__v = (_try)))                                           \
+			break;                                                \
+		if (__spin) {                                                 \
+			__spin--;                                             \
+			cpu_relax();                                          \
+			continue;                                             \
+		}                                                             \
+		if ((_timeout_ms) >= 0) {                                     \
+			u64 __now = __slab_shm_now_ms();                      \
+			if (__now >= __end)                                   \
+				break;                                        \
+			__left = (int)(__end - __now);                        \
+		}                                                             \
+		__atomic_fetch_add((_waiters), 1, __ATOMIC_SEQ_CST);          \
+		__s = __atomic_load_n((_seq), __ATOMIC_ACQUIRE);              \
+		if (!(__v = (_try)))                                          \
+			__slab_shm_futex_wait((_seq), __s, __left);           \
+		__atomic_fetch_sub((_waiters), 1, __ATOMIC_RELAXED);          \
+		if (__v)                                                      \
+			break;                                                \
+	}                                                                     \
+	__v;                                                                  \
+})
+
+/*
+ * slab_shm_alloc_wait - a block, sleeping until some process frees one when
+ * all are out; NULL once @timeout_ms passes (-1: no limit).
+ */
+static inline void *
+slab_shm_alloc_wait(struct slab_shm *sh, int timeout_ms)
+{
+	struct slab_shm_hdr *h = sh->hdr;
+	return __slab_shm_wait(&h->free_seq, &h->free_waiters, timeout_ms,
+	                       slab_shm_alloc(sh));
+}
+
+/*
+ * slab_shm_send - put block @p on the ring for a receiver, in this or any
+ * process. The block is the receiver's from here on. Never blocks: the ring
+ * has room for every block.
+ */
+static inline void
+slab_shm_send(struct slab_shm *sh, void *p)
+{
+	struct slab_shm_hdr *h = sh->hdr;
+	u32 idx = slab_shm_index(sh, p), mask = h->ring - 1;
+	u32 pos = __atomic_load_n(&h->enq, __ATOMIC_RELAXED);
+	struct slab_shm_slot *slot;
+
+	for (;;) {
+		slot = &sh->ring[pos & mask];
+		u32 seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		int diff = (int)(seq - pos);
+		if (diff == 0 &&
+		    __atomic_compare_exchange_n(&h->enq, &pos, pos + 1, true,
+		                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+		if (diff != 0)
+			pos = __atomic_load_n(&h->enq, __ATOMIC_RELAXED);
+	}
+	slot->index = idx;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	__slab_shm_signal(&h->ring_seq, &h->ring_waiters);
+}
+
+/* Take the next block off the ring, or NULL when it is empty. */
+static inline void *
+slab_shm_recv_nowait(struct slab_shm *sh)
+{
+	struct slab_shm_hdr *h = sh->hdr;
+	u32 mask = h->ring - 1, idx;
+	u32 pos = __atomic_load_n(&h->deq, __ATOMIC_RELAXED);
+	struct slab_shm_slot *slot;
+
+	for (;;) {
+		slot = &sh->ring[pos & mask];
+		u32 seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		int diff = (int)(seq - (pos + 1));
+		if (diff < 0)
+			return NULL;
+		if (diff == 0 &&
+		    __atomic_compare_exchange_n(&h->deq, &pos, pos + 1, true,
+		                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+		if (diff > 0)
+			pos = __atomic_load_n(&h->deq, __ATOMIC_RELAXED);
+	}
+	idx = slot->index;
+	/* the slot is free for the send one lap on */
+	__atomic_store_n(&slot->seq, pos + mask + 1, __ATOMIC_RELEASE);
+	return slab_shm_at(sh, idx);
+}
+
+/*
+ * slab_shm_recv - the next block sent, sleeping while the ring is empty; NULL
+ * once @timeout_ms passes (-1: no limit, 0: do not sleep).
+ */
+static inline void *
+slab_shm_recv(struct slab_shm *sh, int timeout_ms)
+{
+	struct slab_shm_hdr *h = sh->hdr;
+	return __slab_shm_wait(&h->ring_seq, &h->ring_waiters, timeout_ms,
+	                       slab_shm_recv_nowait(sh));
+}
+
+__END_DECLS
+
+#endif/*__HPC_MEM_SLAB_SHM_H__*/
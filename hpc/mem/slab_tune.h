@@ -0,0 +1,280 @@
+/*
+ * Adaptive slab policy from measure history                Slab auto-tuning
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A controller that tunes two knobs of a live slab's policy - grow_step and
+ * shrink_after - from what the slab's measure history recorded, instead of
+ * leaving them to a per-deployment guess.
+ *
+ * The two knobs are the ones that are wrong at both ends of the load range. A
+ * grow_step sized for the quiet hours makes a busy slab grow a grain at a time,
+ * many times a second, and fail allocations whenever the check() gate is
+ * slower than the burst; one sized for the peak overshoots at night. A
+ * shrink_after short enough to hand memory back promptly makes a bursty slab
+ * shrink in every dip and fault it all back in on the next burst - grow/shrink
+ * oscillation; one long enough to ride out the bursts sits on memory all night.
+ *
+ * Input
+ * -----
+ * The rows of a struct slab_history (<hpc/measure.h>) the slab counts through.
+ * Each decision looks at the last @window rows: the grow, shrink and fail
+ * counts between the oldest and the newest, the peak of the committed gauge,
+ * and how often the direction changed - a row that grew after a row that
+ * shrank, or a row that did both, is one flip. The controller reads no clock
+ * and takes no sample of its own; it decides once per new row, so it runs at
+ * the history's interval however often slab_tune_step() is called.
+ *
+ * Rules, in order
+ * ---------------
+ *   1. over budget  the committed peak exceeded @budget: halve shrink_after and
+ *                   grow_step, so memory goes back sooner and comes in smaller
+ *   2. oscillation  a flip in the window: double shrink_after, to ride out the
+ *                   dips instead of paying for them
+ *   3. idle memory  no grow, no shrink, and at least a grain free at the
+ *                   shrink watermark: shorten shrink_after by a quarter
+ *   4. growth       a failure, or more grows than rows in the window: double
+ *                   grow_step, to take a burst in fewer, larger steps
+ *   5. settled      no grow in the window: lower grow_step by a quarter
+ *
+ * Rules 2 and 3 exclude each other, as do 4 and 5; rule 1 overrides the rest.
+ * Each knob stays within [@step_min, @step_max] and [@after_min, @after_max],
+ * grow_step in whole grains, and a raised grow_step never exceeds the room
+ * left under the budget. The objective this approximates is the fewest
+ * round trips - grow steps and shrink steps - for committed memory within the
+ * budget.
+ *
+ * Output
+ * ------
+ * The knobs are written to slab->policy in place, without slab_set_policy(): the
+ * idle dwell in progress keeps running under the new shrink_after. Every
+ * decision is counted in a struct slab_tune_measure (<mem/measure.h>) attached
+ * as tune->measure, with the knobs in force as gauges - the controller's own
+ * history can be kept the same way as the slab's, and a report shows why a
+ * slab holds what it holds. slab_tune_step() returns a mask of the
+ * SLAB_TUNE_* decisions taken.
+ *
+ * A build without a history (CONFIG_MEASURE_HISTORY 0, the default without
+ * CONFIG_MEASURE) has no rows to decide on: slab_tune_step() is a no-op there
+ * and the slab runs on its fixed policy.
+ */
+
+#ifndef __HPC_MEM_SLAB_TUNE_H__
+#define __HPC_MEM_SLAB_TUNE_H__
+
+#include <hpc/compiler.h>
+#include <mem/slab.h>
+#include <mem/measure.h>
+
+__BEGIN_DECLS
+
+/* Defaults of the bounds, set by slab_tune_init(). */
+#ifndef SLAB_TUNE_WINDOW
+#define SLAB_TUNE_WINDOW    8         /* rows                               */
+#endif
+#ifndef SLAB_TUNE_AFTER_MIN
+#define SLAB_TUNE_AFTER_MIN 100       /* ms                                 */
+#endif
+#ifndef SLAB_TUNE_AFTER_MAX
+#define SLAB_TUNE_AFTER_MAX 60000     /* ms                                 */
+#endif
+
+/* Decisions, as returned by slab_tune_step(). */
+#define SLAB_TUNE_STEP_UP    1
+#define SLAB_TUNE_STEP_DOWN  2
+#define SLAB_TUNE_DWELL_UP   4
+#define SLAB_TUNE_DWELL_DOWN 8
+#define SLAB_TUNE_OVER       16
+
+/*
+ * @budget     RSS budget: committed blocks the slab should stay within
+ *             (0: none)
+ * @step_min, @step_max
+ *             bounds of grow_step, blocks
+ * @after_min, @after_max
+ *             bounds of shrink_after, ms
+ * @window     history rows each decision looks back over (at least 2)
+ *
+ * All set by slab_tune_init(), all the caller's to change.
+ */
+struct slab_tune {
+	u32 budget;
+	u32 step_min;
+	u32 step_max;
+	timestamp_t after_min;
+	timestamp_t after_max;
+	unsigned window;
+	timestamp_t seen;     /* stamp of the newest row decided on           */
+	measure_member(slab_tune)
+};
+
+/*
+ * slab_tune_init - bounds from the slab's policy as it stands.
+ *
+ * grow_step ranges from a grain to an eighth of policy.max (at least the step
+ * the policy started with), shrink_after from SLAB_TUNE_AFTER_MIN to
+ * SLAB_TUNE_AFTER_MAX (widened to include the starting dwell).
+ */
+static inline void
+slab_tune_init(struct slab_tune *t, struct slab *slab, u32 budget)
+{
+	u32 grain = slab_grain(slab);
+	u32 step = slab->policy.grow_step;
+	timestamp_t after = slab->policy.shrink_after;
+
+	memset(t, 0, sizeof(*t));
+	t->budget = budget;
+	t->step_min = grain;
+	t->step_max = slab_grain_round(slab->policy.max / 8, grain);
+	if (t->step_max < step)
+		t->step_max = step;
+	t->after_min = SLAB_TUNE_AFTER_MIN < after ? SLAB_TUNE_AFTER_MIN : after;
+	t->after_max = SLAB_TUNE_AFTER_MAX > after ? SLAB_TUNE_AFTER_MAX : after;
+	t->window = SLAB_TUNE_WINDOW;
+}
+
+static inline u32
+__slab_tune_step_clamp(struct slab_tune *t, struct slab *slab, u64 step)
+{
+	u32 grain = slab_grain(slab);
+	if (step > t->step_max)
+		step = t->step_max;
+	if (step < t->step_min)
+		step = t->step_min;
+	step = slab_grain_round((u32)step, grain);
+	return step < grain ? grain : (u32)step;
+}
+
+static inline timestamp_t
+__slab_tune_after_clamp(struct slab_tune *t, timestamp_t after)
+{
+	if (after > t->after_max)
+		after = t->after_max;
+	if (after < t->after_min)
+		after = t->after_min;
+	return after;
+}
+
+/*
+ * slab_tune_step - decide on the newest row of @hist, once.
+ *
+ * Call it after measure_history_tick() - from the same loop that runs
+ * slab_gc() - with the history @slab counts through. Does nothing until the
+ * history holds two rows, and nothing for a row already decided on. Returns
+ * the SLAB_TUNE_* decisions taken, 0 if none.
+ */
+static inline int
+slab_tune_step(struct slab_tune *t, struct slab *slab, struct slab_history *hist)
+{
+	unsigned rows = measure_history_count(hist);
+	unsigned from, i, nflip = 0;
+	struct slab_measure *old, *new_;
+	struct slab_policy *pol = &slab->policy;
+	u64 grows, shrinks, fails, peak = 0;
+	u32 step = pol->grow_step;
+	timestamp_t after = pol->shrink_after;
+	int dir = 0, grew, shrank, decided = 0;
+
+	if (rows < 2 || measure_history_time(hist, rows - 1) == t->seen)
+		return 0;
+	t->seen = measure_history_time(hist, rows - 1);
+	from = t->window >= 2 && rows > t->window ? rows - t->window : 0;
+
+	for (i = from; i < rows; i++) {
+		struct slab_measure *r = measure_history_at(hist, i);
+		if (r->committed > peak)
+			peak = r->committed;
+		if (i == from)
+			continue;
+		old = measure_history_at(hist, i - 1);
+		grew = r->grow > old->grow;
+		shrank = r->shrink > old->shrink;
+		if (grew && shrank)
+			nflip++;
+		if (grew != shrank) {
+			if (dir && dir != (grew ? 1 : -1))
+				nflip++;
+			dir = grew ? 1 : -1;
+		}
+	}
+	old = measure_history_at(hist, from);
+	new_ = measure_history_at(hist, rows - 1);
+	grows = new_->grow - old->grow;
+	shrinks = new_->shrink - old->shrink;
+	fails = new_->fail - old->fail;
+
+	if (t->budget && peak > t->budget) {
+		after = __slab_tune_after_clamp(t, after / 2);
+		step = __slab_tune_step_clamp(t, slab, step / 2);
+		decided |= SLAB_TUNE_OVER;
+	} else {
+		u32 free_ = slab->avail;
+		if (nflip)
+			after = __slab_tune_after_clamp(t, after ? after * 2
+			                                   : SLAB_TUNE_AFTER_MIN);
+		else if (!grows && !shrinks && free_ >= slab_grain(slab) &&
+		         __slab_should_shrink(slab))
+			after = __slab_tune_after_clamp(t, after - after / 4);
+
+		if (fails || grows > rows - from) {
+			u64 up = (u64)step * 2;
+			if (t->budget && slab->committed < t->budget &&
+			    up > t->budget - slab->committed)
+				up = t->budget - slab->committed;
+			if (up > step)
+				step = __slab_tune_step_clamp(t, slab, up);
+		} else if (!grows) {
+			step = __slab_tune_step_clamp(t, slab, step - step / 4);
+		}
+	}
+
+	if (step > pol->grow_step)
+		decided |= SLAB_TUNE_STEP_UP;
+	else if (step < pol->grow_step)
+		decided |= SLAB_TUNE_STEP_DOWN;
+	if (after > pol->shrink_after)
+		decided |= SLAB_TUNE_DWELL_UP;
+	else if (after < pol->shrink_after)
+		decided |= SLAB_TUNE_DWELL_DOWN;
+	pol->grow_step = step;
+	pol->shrink_after = after;
+
+	measure_inc(t->measure, decide);
+	measure_inc_if(t->measure, decided & SLAB_TUNE_STEP_UP, step_up);
+	measure_inc_if(t->measure, decided & SLAB_TUNE_STEP_DOWN, step_down);
+	measure_inc_if(t->measure, decided & SLAB_TUNE_DWELL_UP, dwell_up);
+	measure_inc_if(t->measure, decided & SLAB_TUNE_DWELL_DOWN, dwell_down);
+	measure_inc_if(t->measure, decided & SLAB_TUNE_OVER, over);
+	measure_add(t->measure, flips, nflip);
+	measure_set(t->measure, grow_step, step);
+	measure_set(t->measure, shrink_after, after);
+	measure_set(t->measure, peak, peak);
+	measure_set(t->measure, budget, t->budget);
+	return decided;
+}
+
+__END_DECLS
+
+#endif/*__HPC_MEM_SLAB_TUNE_H__*/
@@ -48,6 +48,11 @@
  * custom             define SLAB_VM_ALLOC/FREE/RELEASE/FAILED yourself - a
  *                    static arena, a freestanding target with no mmap(), a
  *                    shared-memory or hugetlbfs segment
+ * file               a shared mapping of a file or memfd, chosen per slab at
+ *                    run time rather than here: SLAB_VM_FILE_MAP /
+ *                    SLAB_VM_FILE_UNMAP map it, SLAB_VM_RELEASE_SHARED hands
+ *                    pages back; see <mem/slab_file.h>, and
+ *                    <mem/slab_shm.h> for one slab several processes share
  *
  * Know what a backend with no working SLAB_VM_RELEASE costs before choosing
  * one: shrink still drops blocks from the committed prefix and rebuilds the
@@ -56,10 +61,11 @@
  *
  * One other difference between backends is worth knowing: a fresh anonymous
  * mapping reads as zeroes, the libc heap and a recycled arena do not. The slab
- * itself never relies on that - its bitmap and cache entries come zeroed from
- * SLAB_MEM_CALLOC, and a block is payload the caller initialises - but code that
- * grew up on the mmap backend and quietly assumed a zeroed block will not
- * survive the switch.
+ * relies on that in one place only, slab_zalloc(), and only where the backend
+ * says so with SLAB_VM_ZEROES; its bitmap and cache entries come zeroed from
+ * SLAB_MEM_CALLOC, and a block from slab_alloc() is payload the caller
+ * initialises. Code that grew up on the mmap backend and quietly assumed a
+ * zeroed block from slab_alloc() will not survive the switch.
  *
  * Note that realloc() has no place among these hooks. The whole design rests on
  * the reservation never moving; realloc() may move it, and a move invalidates
@@ -67,6 +73,16 @@
  * different data structure with a different contract (index-only access, no raw
  * pointers held across a grow).
  *
+ * Shared file mappings
+ * --------------------
+ * MADV_DONTNEED on a shared file mapping only drops this process's view of the
+ * pages - the page cache, or the tmpfs pages behind a memfd, keep them. A slab
+ * over such a mapping (SLAB_BORROW_SHARED) releases with
+ * SLAB_VM_RELEASE_SHARED instead, MADV_REMOVE by default: it punches a hole in
+ * the file, which frees the pages and makes the range read as zeroes again. A
+ * filesystem without hole punching fails it, and the pages stay; it returns
+ * 0 only once they are gone.
+ *
  * Hints
  * -----
  * SLAB_VM_HUGEPAGE (over the whole reservation at init) and SLAB_VM_POPULATE
@@ -127,6 +143,7 @@ __BEGIN_DECLS
 #  define SLAB_VM_RELEASE(ptr, len) ((void)(ptr), (void)(len))
 #  define SLAB_VM_FAILED            NULL
 #  define SLAB_VM_RELEASES          0  /* the heap keeps what it was given */
+#  define SLAB_VM_ZEROES            0  /* nor is any of it known zero      */
 # else
 #  define SLAB_VM_ALLOC(len) \
 	mmap(NULL, (size_t)(len), VM_PAGE_PROT, VM_PAGE_MODE, -1, 0)
@@ -135,6 +152,7 @@ __BEGIN_DECLS
 #  define SLAB_VM_FAILED            ((void *)MAP_FAILED)
 #  define SLAB_VM_MMAP              1  /* the madvise() hints below apply */
 #  define SLAB_VM_RELEASES          1  /* MADV_DONTNEED really hands pages back */
+#  define SLAB_VM_ZEROES            1  /* ... and they come back as zeroes  */
 # endif
 #endif
 #ifndef SLAB_VM_FAILED
@@ -158,6 +176,19 @@ __BEGIN_DECLS
 #define SLAB_VM_RELEASES 0
 #endif
 
+/*
+ * Does a fresh reservation read as zeroes, and does a range read as zeroes
+ * again once SLAB_VM_RELEASE has handed it back?
+ *
+ * Both have to hold for slab_zalloc() to skip clearing a block it knows was
+ * never written since. An anonymous mapping answers yes to both; the heap, and
+ * a custom backend unless it says otherwise, answer no, and slab_zalloc() then
+ * clears every block it hands out.
+ */
+#ifndef SLAB_VM_ZEROES
+#define SLAB_VM_ZEROES 0
+#endif
+
 #ifndef SLAB_MEM_CALLOC
 #define SLAB_MEM_CALLOC(n, size) calloc((n), (size))
 #define SLAB_MEM_FREE(ptr)       free(ptr)
@@ -192,6 +223,79 @@ __BEGIN_DECLS
 #define SLAB_VM_POPULATE(ptr, len) ((void)(ptr), (void)(len))
 #endif
 
+/*
+ * SLAB_VM_ADVISE gives a range one of the SLAB_VM_ADVICE_* hints of a tiered
+ * release (policy.reclaim in <mem/slab.h>) and returns 0 when it took. Off the
+ * mmap backend it never does, and the slab falls back to SLAB_VM_RELEASE. The
+ * numbers are the kernel's, for libc headers that predate them (MADV_FREE
+ * 4.5, MADV_COLD / MADV_PAGEOUT 5.4).
+ */
+#ifndef SLAB_VM_ADVISE
+# ifdef SLAB_VM_MMAP
+#  ifndef MADV_FREE
+#   define MADV_FREE 8
+#  endif
+#  ifndef MADV_COLD
+#   define MADV_COLD 20
+#  endif
+#  ifndef MADV_PAGEOUT
+#   define MADV_PAGEOUT 21
+#  endif
+#  define SLAB_VM_ADVICE_FREE    MADV_FREE
+#  define SLAB_VM_ADVICE_COLD    MADV_COLD
+#  define SLAB_VM_ADVICE_PAGEOUT MADV_PAGEOUT
+#  define SLAB_VM_ADVISE(ptr, len, advice) \
+	madvise((ptr), (size_t)(len), (advice))
+# else
+#  define SLAB_VM_ADVICE_FREE    1
+#  define SLAB_VM_ADVICE_COLD    2
+#  define SLAB_VM_ADVICE_PAGEOUT 3
+#  define SLAB_VM_ADVISE(ptr, len, advice) \
+	((void)(ptr), (void)(len), (void)(advice), -1)
+# endif
+#endif
+
+/*
+ * SLAB_VM_PREFAULT populates a range on request - slab_prefault() in
+ * <mem/slab.h> - whatever CONFIG_MEM_POPULATE says, and returns 0 once the
+ * pages are there. Anything else (-1 off the mmap backend, an old kernel's
+ * EINVAL) leaves it to slab_prefault() to touch them.
+ */
+#ifndef SLAB_VM_PREFAULT
+# ifdef SLAB_VM_MMAP
+#  ifndef MADV_POPULATE_WRITE
+#   define MADV_POPULATE_WRITE 23
+#  endif
+#  define SLAB_VM_PREFAULT(ptr, len) \
+	madvise((ptr), (size_t)(len), MADV_POPULATE_WRITE)
+# else
+#  define SLAB_VM_PREFAULT(ptr, len) ((void)(ptr), (void)(len), -1)
+# endif
+#endif
+
+/*
+ * A file is always mapped with mmap(), whatever the anonymous backend, but
+ * fails the way the backend does: SLAB_VM_FAILED, so that one test serves
+ * both. A custom SLAB_VM_FILE_MAP keeps that contract.
+ */
+#ifndef SLAB_VM_FILE_MAP
+static inline void *
+__slab_vm_file_map(int fd, size_t len)
+{
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	return p == MAP_FAILED ? SLAB_VM_FAILED : p;
+}
+# define SLAB_VM_FILE_MAP(fd, len) __slab_vm_file_map((fd), (size_t)(len))
+# define SLAB_VM_FILE_UNMAP(ptr, len) munmap((ptr), (size_t)(len))
+#endif
+#ifndef SLAB_VM_RELEASE_SHARED
+# ifndef MADV_REMOVE
+#  define MADV_REMOVE 9
+# endif
+# define SLAB_VM_RELEASE_SHARED(ptr, len) \
+	madvise((ptr), (size_t)(len), MADV_REMOVE)
+#endif
+
 /*
  * Release granularity - the "grain".
  *
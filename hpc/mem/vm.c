@@ -10,9 +10,13 @@
 #include <sys/mman.h>
 #include <hpc/list.h>
 #include <mem/alloc.h>
+#include <mem/vm.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 
 #define VM_PAGE_PROT (PROT_READ | PROT_WRITE)
 #define VM_PAGE_MODE (MAP_PRIVATE | MAP_ANON)
@@ -36,6 +40,62 @@ vm_page_alloc(size_t size)
 	return page;
 }
 
+/* Whether THP is anything but off; read once, "never" is the only no. */
+static int
+vm_thp_enabled(void)
+{
+	static int enabled = -1;
+	char buf[64];
+	int fd, n;
+
+	if (enabled >= 0)
+		return enabled;
+	enabled = 1;
+	fd = open("/sys/kernel/mm/transparent_hugepage/enabled", O_RDONLY);
+	if (fd < 0)
+		return enabled;
+	n = (int)read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n > 0) {
+		buf[n] = 0;
+		enabled = !strstr(buf, "[never]");
+	}
+	return enabled;
+}
+
+void *
+vm_page_alloc_huge(size_t size, int *backing)
+{
+	size_t huge = VM_HUGE_PAGE_SIZE, slop;
+	u8 *map, *page;
+
+#ifdef MAP_HUGETLB
+	map = mmap(NULL, size, VM_PAGE_PROT, VM_PAGE_MODE | MAP_HUGETLB, -1, 0);
+	if (map != (void *)MAP_FAILED) {
+		*backing = VM_BACKING_HUGETLB;
+		return map;
+	}
+#endif
+	/* over-map by a huge page and trim both ends to an aligned @size */
+	map = mmap(NULL, size + huge, VM_PAGE_PROT, VM_PAGE_MODE, -1, 0);
+	if (map == (void *)MAP_FAILED) {
+		*backing = VM_BACKING_PAGE;
+		return vm_page_alloc(size);
+	}
+	page = (u8 *)align_to((uintptr_t)map, huge);
+	slop = (size_t)(page - map);
+	if (slop)
+		munmap(map, slop);
+	munmap(page + size, huge - slop);
+
+	*backing = VM_BACKING_PAGE;
+#ifdef MADV_HUGEPAGE
+	if (vm_thp_enabled() && !madvise(page, size, MADV_HUGEPAGE))
+		*backing = VM_BACKING_THP;
+#endif
+	return page;
+}
+
 void
 vm_page_free(void *page, size_t size)
 {
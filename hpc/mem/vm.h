@@ -47,6 +47,31 @@ vm_page_reserve(void);
 void *
 vm_page_alloc(size_t size);
 
+/* Huge page size vm_page_alloc_huge() maps in: the x86/arm64 pmd size. */
+#ifndef VM_HUGE_PAGE_SIZE
+#define VM_HUGE_PAGE_SIZE (1UL << 21)
+#endif
+
+/* What a vm_page_alloc_huge() mapping ended up backed with, weakest first. */
+#define VM_BACKING_PAGE    0      /* base pages                               */
+#define VM_BACKING_THP     1      /* transparent huge pages, MADV_HUGEPAGE    */
+#define VM_BACKING_HUGETLB 2      /* hugetlbfs pages, MAP_HUGETLB             */
+
+/*
+ * vm_page_alloc_huge - map @size bytes, a multiple of VM_HUGE_PAGE_SIZE, on
+ * huge pages where the system has them.
+ *
+ * MAP_HUGETLB first: reserved pages, no fault-time compaction, but only as
+ * many as the administrator set aside (nr_hugepages), and usually none. Then
+ * a huge-page aligned anonymous mapping advised MADV_HUGEPAGE, which the
+ * kernel backs with transparent huge pages as it faults it in - unless THP is
+ * off ("never"), or not built. Then base pages. Stores the backing in
+ * @backing and, like vm_page_alloc(), dies if even the last one fails. The
+ * mapping is released with vm_page_free(@page, @size).
+ */
+void *
+vm_page_alloc_huge(size_t size, int *backing);
+
 void
 vm_page_free(void *page, size_t size);
 
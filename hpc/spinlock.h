@@ -0,0 +1,107 @@
+/*
+ * Spinlock                                        Test-and-test-and-set lock
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2012-2026                          Daniel Kubec <niel@rtfm.cz>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"),to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A spinlock for the short critical sections of the shared slow paths - a
+ * magazine depot exchange, a stripe of a concurrent table - where a sleeping
+ * lock would cost more in the syscall than the section it protects.
+ *
+ * Test-and-test-and-set: a waiter spins on a plain load, which stays in its own
+ * cache, and only tries the atomic exchange once the lock reads free, so a
+ * contended lock does not turn every waiter's spin into a cache-line transfer.
+ * Acquire on lock and release on unlock are the whole memory-ordering contract;
+ * the builtins are the compiler's __atomic family, so nothing here links
+ * against pthreads and the lock works as well in a shared mapping as in a
+ * private one.
+ *
+ * What it is not: fair, or suitable for a section that can block. Use it where
+ * the holder is guaranteed to leave in a few hundred cycles.
+ */
+
+#ifndef __HPC_SPINLOCK_H__
+#define __HPC_SPINLOCK_H__
+
+#include <hpc/compiler.h>
+#include <hpc/cpu.h>
+#include <stdbool.h>
+
+__BEGIN_DECLS
+
+struct spinlock {
+	u32 locked;
+};
+
+#define SPINLOCK_INIT        { .locked = 0 }
+#define DEFINE_SPINLOCK(x)   struct spinlock x = SPINLOCK_INIT
+
+/* Tell the core this is a spin-wait loop: cheaper for a hyperthread sibling. */
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static inline void
+spin_lock_init(struct spinlock *lock)
+{
+	__atomic_store_n(&lock->locked, 0, __ATOMIC_RELAXED);
+}
+
+static inline bool
+spin_trylock(struct spinlock *lock)
+{
+	return !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+spin_lock(struct spinlock *lock)
+{
+	while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE))
+		while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED))
+			cpu_relax();
+}
+
+static inline void
+spin_unlock(struct spinlock *lock)
+{
+	__atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline bool
+spin_is_locked(struct spinlock *lock)
+{
+	return __atomic_load_n(&lock->locked, __ATOMIC_RELAXED) != 0;
+}
+
+__END_DECLS
+
+#endif/*__HPC_SPINLOCK_H__*/
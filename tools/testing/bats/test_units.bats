@@ -96,6 +96,62 @@ run_unit() {
     run_unit test_slab_cache
 }
 
+@test "units: slab_magazine cmocka group" {
+    run_unit test_slab_magazine
+}
+
+@test "units: sizeclass cmocka group" {
+    run_unit test_sizeclass
+}
+
+@test "units: slab_seg cmocka group" {
+    run_unit test_slab_seg
+}
+
+@test "units: slab_file cmocka group" {
+    run_unit test_slab_file
+}
+
+@test "units: slab_pressure cmocka group" {
+    run_unit test_slab_pressure
+}
+
+@test "units: slab_tune cmocka group" {
+    run_unit test_slab_tune
+}
+
+@test "units: slab_obj cmocka group" {
+    run_unit test_slab_obj
+}
+
+@test "units: pool cmocka group" {
+    run_unit test_pool
+}
+
+@test "units: cache cmocka group" {
+    run_unit test_cache
+}
+
+@test "units: pages cmocka group" {
+    run_unit test_pages
+}
+
+@test "units: slab_shm cmocka group" {
+    run_unit test_slab_shm
+}
+
+@test "units: hashtable_swiss cmocka group" {
+    run_unit test_hashtable_swiss
+}
+
+@test "units: htable cmocka group" {
+    run_unit test_htable
+}
+
+@test "units: hash_fn cmocka group" {
+    run_unit test_hash_fn
+}
+
 # The lockless container variants only exist in an RCU build; see the
 # rcutest-$(CONFIG_RCU) gate in selftests/units/Kbuild.
 
@@ -114,3 +170,7 @@ run_unit() {
 @test "units: slab_rcu cmocka group" {
     run_unit test_slab_rcu "requires CONFIG_RCU=y"
 }
+
+@test "units: htable_mt cmocka group" {
+    run_unit test_htable_mt "requires CONFIG_RCU=y"
+}
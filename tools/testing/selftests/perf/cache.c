@@ -0,0 +1,226 @@
+/*
+ * Benchmark for the expiring page cache of hpc/mem/cache.h as a response cache
+ *
+ * A cache of L response bodies, sizes drawn as a web cache sees them - mostly
+ * a few KiB, a quarter tens of KiB, one in twenty hundreds of KiB - where each
+ * step stores a new body and drops the oldest. Each body is written as it is
+ * stored, a cache line per page, so the step pays for the page faults of
+ * memory the allocator did not keep resident. Three ways:
+ *
+ *   1. malloc  malloc() per body, free() of the oldest
+ *   2. free    mm_cache_alloc() per body, mm_cache_free() of the oldest,
+ *              mm_cache_gc() every 1000 steps
+ *   3. ttl     mm_cache_alloc() with a TTL of L steps of the simulated clock
+ *              (1 ms a step), nothing freed by hand: mm_cache_gc() every 1000
+ *              steps reaps what expired
+ *
+ * The cache runs keep @keep dirty pages over a gc - a quarter of the array
+ * unless given - and report the page faults a step took, the pages they hold
+ * resident at the end and what they gave back. A @keep below what one gc
+ * period churns shows as faults: the ttl run reaps a thousand bodies at once,
+ * gives back all but @keep of them and faults them in again. All three draw
+ * the same sizes. Each body is stamped and the stamp checked when the body is
+ * dropped, which is the self-check.
+ *
+ *   cache                     200000 steps, 2048 bodies live
+ *   cache <steps> <live> [keep MiB]
+ */
+
+#include <hpc/compiler.h>
+#include <mem/cache.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+#define PAGE_BITS 12
+#define GC_EVERY  1000
+
+enum { MALLOC, FREE, TTL };
+static const char *mode_name[] = { "malloc", "free", "ttl" };
+
+static inline u64
+ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static u64 rng_state = 0x9e3779b97f4a7c15ull;
+
+static inline u64
+xrand(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static u32
+body_size(void)
+{
+	u32 r = (u32)(xrand() % 100);
+	if (r < 70)
+		return 512 + (u32)(xrand() % 16384);          /* pages, json   */
+	if (r < 95)
+		return 16384 + (u32)(xrand() % 49152);        /* images        */
+	return 65536 + (u32)(xrand() % 458752);               /* the big ones  */
+}
+
+/* A cache line at the start of every page of the body, and its last byte. */
+static void
+body_write(u8 *p, u32 size, u8 stamp)
+{
+	for (u32 off = 0; off < size; off += 1U << PAGE_BITS)
+		memset(p + off, stamp, __min(64U, size - off));
+	p[size - 1] = stamp;
+}
+
+static int
+body_check(const u8 *p, u32 size, u8 stamp)
+{
+	return p[0] != stamp || p[size - 1] != stamp;
+}
+
+static u64
+minflt(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return (u64)ru.ru_minflt;
+}
+
+struct stats {
+	u64 ns, faults;
+	u32 resident, released;
+	int fail;
+};
+
+static void
+run(const u32 *size, u32 steps, u32 live, u32 pages, u32 keep, int mode,
+    struct stats *st)
+{
+	struct mm_cache_measure m = { 0 };
+	struct mm_cache_policy pol = { .keep = keep };
+	struct mm_cache c;
+	void **body = (void **)calloc(live, sizeof(*body));
+	u32 *bsize = (u32 *)calloc(live, sizeof(*bsize));
+	u64 t0;
+
+	memset(st, 0, sizeof(*st));
+	if (mode != MALLOC && mm_cache_init(&c, PAGE_BITS, pages, &pol)) {
+		st->fail = 1;
+		goto out;
+	}
+#ifdef CONFIG_MEASURE
+	if (mode != MALLOC)
+		c.measure = &m;
+#endif
+	(void)m;
+
+	st->faults = minflt();
+	t0 = ns_now();
+	for (u32 s = 0; s < steps; s++) {
+		u32 slot = s % live;
+		u8 stamp = (u8)s;
+
+		/* drop the oldest: by hand, or let it expire */
+		if (body[slot]) {
+			st->fail |= body_check(body[slot], bsize[slot],
+			                       (u8)(s - live));
+			if (mode == MALLOC)
+				free(body[slot]);
+			else if (mode == FREE)
+				mm_cache_free(&c, (struct page *)body[slot]);
+		}
+		if (mode != MALLOC && s % GC_EVERY == 0)
+			mm_cache_gc(&c, s);
+
+		bsize[slot] = size[s];
+		if (mode == MALLOC)
+			body[slot] = malloc(size[s]);
+		else if (mode == FREE)
+			body[slot] = mm_cache_alloc_ex(&c, size[s], s, 0, 0);
+		else
+			body[slot] = mm_cache_alloc_ex(&c, size[s], s, live, 0);
+		if (!body[slot]) {
+			st->fail = 1;
+			break;
+		}
+		body_write(body[slot], size[s], stamp);
+	}
+	st->ns = ns_now() - t0;
+	st->faults = minflt() - st->faults;
+
+	if (mode != MALLOC) {
+		st->resident = mm_cache_used(&c) + mm_cache_dirty(&c);
+#ifdef CONFIG_MEASURE
+		st->released = (u32)m.release;
+#endif
+		mm_cache_fini(&c);
+	} else {
+		for (u32 i = 0; i < live; i++)
+			free(body[i]);
+	}
+out:
+	free(body);
+	free(bsize);
+}
+
+int
+main(int argc, char **argv)
+{
+	u32 steps = argc > 1 ? (u32)strtoul(argv[1], NULL, 0) : 200000;
+	u32 live = argc > 2 ? (u32)strtoul(argv[2], NULL, 0) : 2048;
+	u64 bytes = 0;
+	u32 *size, pages, keep;
+	double base = 0;
+
+	if (!steps || !live || steps <= live)
+		return 2;
+	size = (u32 *)malloc((size_t)steps * sizeof(*size));
+	if (!size) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (u32 i = 0; i < steps; i++)
+		bytes += size[i] = body_size();
+
+	/* four times the mean live set: room to fragment in */
+	pages = (u32)(4 * (bytes / steps) * live >> PAGE_BITS);
+	keep = argc > 3 ? (u32)strtoul(argv[3], NULL, 0) << (20 - PAGE_BITS)
+	                : pages / 4;
+	printf("%u steps, %u bodies live, %.1f KiB a body on average, "
+	       "%u MiB array, %u MiB kept\n\n", steps, live,
+	       (double)bytes / steps / 1024, pages >> (20 - PAGE_BITS),
+	       keep >> (20 - PAGE_BITS));
+
+	printf("%-8s %10s %8s %12s %14s\n", "mode", "ns/step", "ratio",
+	       "faults/step", "resident MiB");
+	for (int mode = MALLOC; mode <= TTL; mode++) {
+		struct stats st;
+		run(size, steps, live, pages, keep, mode, &st);
+		if (st.fail) {
+			fprintf(stderr, "%s self-check FAIL\n", mode_name[mode]);
+			return 1;
+		}
+		double ns = (double)st.ns / steps;
+		if (mode == MALLOC)
+			base = ns;
+		printf("%-8s %10.1f %7.2fx %12.2f", mode_name[mode], ns, base / ns,
+		       (double)st.faults / steps);
+		if (mode != MALLOC)
+			printf(" %14.1f", (double)st.resident / (1 << (20 - PAGE_BITS)));
+		if (mode != MALLOC && measure_available)
+			printf("   %.1f MiB released",
+			       (double)st.released / (1 << (20 - PAGE_BITS)));
+		printf("\n");
+	}
+	free(size);
+	return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * Benchmark for the buffer hash backends of hpc/hash/fn.h
+ *
+ * Every backend hash_buffer() can run - xxhash, crc32c and clhash, marked
+ * "sw" where this CPU lacks the instructions and the software fallback runs -
+ * over keys of 8 bytes to 4 KiB:
+ *
+ *   speed   hash_buffer() over consecutive keys of a 1 MiB random arena for
+ *           a fixed time, each hash folded into the next key's offset so the
+ *           calls cannot overlap more than a table's lookups would: ns per
+ *           key and GB/s
+ *   spread  2^bits keys into a chained table of 2^bits buckets
+ *           (hpc/hash/table.h), bucket hash_buffer_u32(). Two key sets, both
+ *           zero but for a counter: "head" has it in the first four bytes,
+ *           "tail" in the last four. Reported: the collisions as a ratio of
+ *           what random bucket numbers would give, and the longest chain
+ *
+ * The collisions are the hash_measure collision counter of the table when
+ * built with CONFIG_MEASURE, and counted by hand as the same event (an add to
+ * a non-empty bucket) otherwise; with both, they must agree - the self-check,
+ * with a ratio within 10% of 1.0 for every backend and key set.
+ *
+ *   hash_fn                   2^16 keys for spread, 200 ms a speed run
+ *   hash_fn <bits> [<ms>]
+ */
+
+#include <hpc/compiler.h>
+#include <hpc/hash/fn.h>
+#include <hpc/hash/table.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ARENA     (1u << 20)
+#define MAX_LEN   4096u
+
+struct item {
+	struct qnode q;
+};
+
+static inline u64
+ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static inline u64
+xrand(u64 *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+/* ns per hash of @len bytes over @ms. */
+static double
+speed(const u8 *arena, u32 len, unsigned ms)
+{
+	u64 t0 = ns_now(), t, n = 0, h = 0, end = t0 + (u64)ms * 1000000;
+	u64 span = ARENA / 2 - 1;          /* a mask: the key stays in the arena */
+
+	do {
+		for (unsigned i = 0; i < 256; i++) {
+			h = hash_buffer(arena + ((h + n * len) & span), len);
+			n++;
+		}
+	} while ((t = ns_now()) < end);
+	__asm__ __volatile__("" :: "r"(h));
+	return (double)(t - t0) / (double)n;
+}
+
+struct spread {
+	double ratio;              /* collisions over the random expectation */
+	u32 longest;               /* elements in the fullest bucket         */
+	int fail;
+};
+
+static void
+spread(struct queue *table, u32 bits, struct item *item, u8 *key, u32 len,
+       bool tail, struct spread *res)
+{
+	double n = (double)(1U << bits);
+	double expect = n - n * (1 - pow(1 - 1 / n, n));
+	struct hash_measure m = { 0 };
+	u64 seen = 0;
+	u32 at = tail ? len - 4 : 0;
+
+	hash_init_table(table, bits);
+#ifdef CONFIG_MEASURE
+	hash_measure = &m;
+#endif
+	memset(key, 0, len);
+	for (u32 i = 0; i < 1U << bits; i++) {
+		u32 b;
+
+		memcpy(key + at, &i, sizeof(i));
+		b = hash_buffer_u32(key, len, bits);
+		seen += !hash_empty(table, b);
+		hash_add(table, &item[i].q, b);
+	}
+#ifdef CONFIG_MEASURE
+	hash_measure = NULL;
+#endif
+	res->fail = measure_available && m.collision != seen;
+	res->ratio = (double)seen / expect;
+	res->fail |= res->ratio < 0.9 || res->ratio > 1.1;
+	res->longest = 0;
+	for (u32 i = 0; i < 1U << bits; i++) {
+		u32 c = 0;
+		hash_for_each(table, i, it, struct item, q)
+			c++;
+		res->longest = __max(res->longest, c);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	static const u32 lens[] = { 8, 16, 32, 64, 128, 256, 1024, 4096 };
+	u32 bits = argc > 1 ? (u32)strtoul(argv[1], NULL, 0) : 16;
+	unsigned ms = argc > 2 ? (unsigned)strtoul(argv[2], NULL, 0) : 200;
+	enum hash_backend was = hash_backend();
+	struct queue *table;
+	struct item *item;
+	u8 *arena, *key;
+	u64 seed = 0x2545f4914f6cdd1dull;
+	int fail = 0;
+
+	if (bits < 8 || bits > 24 || !ms)
+		return 2;
+	arena = (u8 *)malloc(ARENA);
+	key = (u8 *)malloc(MAX_LEN);
+	item = (struct item *)calloc(1U << bits, sizeof(*item));
+	table = (struct queue *)calloc(1U << bits, sizeof(*table));
+	if (!arena || !key || !item || !table) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (u32 i = 0; i < ARENA; i += 8) {
+		u64 x = xrand(&seed);
+		memcpy(arena + i, &x, sizeof(x));
+	}
+
+	printf("hash_buffer() runs %s; spread of 2^%u keys over 2^%u buckets, "
+	       "%u ms a speed run\n\n", hash_backend_name(was), bits, bits, ms);
+	printf("%-9s %5s %9s %8s %10s %8s %10s %8s\n", "backend", "len",
+	       "ns/key", "GB/s", "head coll", "longest", "tail coll",
+	       "longest");
+	for (int b = 0; b < HASH_BACKEND_COUNT; b++) {
+		char name[16];
+
+		hash_backend_set((enum hash_backend)b);
+		snprintf(name, sizeof(name), "%s%s",
+		         hash_backend_name((enum hash_backend)b),
+		         hash_backend_hw((enum hash_backend)b) ? "" : " sw");
+		for (u32 l = 0; l < ARRAY_SIZE(lens); l++) {
+			struct spread s[2];
+			double ns = speed(arena, lens[l], ms);
+
+			spread(table, bits, item, key, lens[l], false, &s[0]);
+			spread(table, bits, item, key, lens[l], true, &s[1]);
+			printf("%-9s %5u %9.2f %8.2f %10.3f %8u %10.3f %8u\n",
+			       name, lens[l], ns, lens[l] / ns, s[0].ratio,
+			       s[0].longest, s[1].ratio, s[1].longest);
+			if (s[0].fail || s[1].fail) {
+				fprintf(stderr, "%s at %u bytes self-check FAIL\n",
+				        name, lens[l]);
+				fail = 1;
+			}
+		}
+	}
+	hash_backend_set(was);
+	free(table);
+	free(item);
+	free(key);
+	free(arena);
+	return fail;
+}
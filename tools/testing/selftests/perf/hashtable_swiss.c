@@ -0,0 +1,264 @@
+/*
+ * Benchmark for the Swiss table of hpc/hash/swiss.h against the chained table
+ * of hpc/hash/table.h
+ *
+ * The same keys, random u64s, in both engines at load factors from 0.5 to
+ * 0.9, a table of 2^bits slots or buckets sized once so neither resizes:
+ *
+ *   1. chain  a struct queue bucket array, each key in an object of its own
+ *             (key, value, qnode) allocated up front in one array and added
+ *             in random order, so a chain walk goes where the objects lie
+ *   2. swiss  DEFINE_SWISS_TABLE(u64 -> u32), max_load lifted to 95 so that
+ *             0.9 fits without a grow
+ *
+ * and for each, in ns per operation:
+ *
+ *   hit    lookups of keys present, in an order unrelated to insertion
+ *   miss   lookups of keys absent
+ *   churn  a delete of a present key and an insert of an absent one, so the
+ *          load stays where it is
+ *
+ * Each hit checks the value, and the hit count must come out exact: that is
+ * the self-check. Built with CONFIG_MEASURE it also prints the hash_measure
+ * collision count of each fill, as a percent of the keys added.
+ *
+ *   hashtable_swiss           2^20 slots
+ *   hashtable_swiss <bits>
+ */
+
+#include <hpc/compiler.h>
+#include <hpc/hash/fn.h>
+#include <hpc/hash/table.h>
+#include <hpc/hash/swiss.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define mix(k)     hash_u64(k, 64)
+#define same(a, b) ((a) == (b))
+
+DEFINE_SWISS_TABLE(swiss, u64, u32, mix, same)
+
+struct obj {
+	u64 key;
+	u32 value;
+	struct qnode q;
+};
+
+static inline u64
+ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static u64 rng_state = 0x9e3779b97f4a7c15ull;
+
+static inline u64
+xrand(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+struct result {
+	double hit, miss, churn;
+	u64 collision;
+	int fail;
+};
+
+static inline struct obj *
+chain_find(struct queue *table, u32 mask, u64 key)
+{
+	hash_for_each(table, mix(key) & mask, it, struct obj, q)
+		if (it->key == key)
+			return it;
+	return NULL;
+}
+
+/*
+ * @key[0, n) are present, @key[n, 2n) absent; @order is a permutation of
+ * [0, n) for the lookups. Churn swaps key[i] out for key[n + i].
+ */
+static void
+run_chain(u32 bits, const u64 *key, const u32 *order, u32 n, struct result *r)
+{
+	struct hash_measure m = { 0 };
+	struct queue *table = (struct queue *)calloc(1U << bits, sizeof(*table));
+	struct obj *obj = (struct obj *)calloc(2 * (size_t)n, sizeof(*obj));
+	u32 mask = (1U << bits) - 1, hits = 0;
+	u64 t0;
+
+	memset(r, 0, sizeof(*r));
+#ifdef CONFIG_MEASURE
+	hash_measure = &m;
+#endif
+	(void)m;
+	for (u32 i = 0; i < n; i++) {
+		struct obj *o = &obj[order[i]];
+		o->key = key[order[i]];
+		o->value = order[i];
+		hash_add(table, &o->q, mix(o->key) & mask);
+	}
+	r->collision = m.collision;
+#ifdef CONFIG_MEASURE
+	hash_measure = NULL;
+#endif
+
+	t0 = ns_now();
+	for (u32 i = 0; i < n; i++) {
+		struct obj *o = chain_find(table, mask, key[i]);
+		hits += o && o->value == i;
+	}
+	r->hit = (double)(ns_now() - t0) / n;
+	r->fail |= hits != n;
+
+	t0 = ns_now();
+	for (u32 i = 0; i < n; i++)
+		hits += chain_find(table, mask, key[n + i]) != NULL;
+	r->miss = (double)(ns_now() - t0) / n;
+	r->fail |= hits != n;
+
+	t0 = ns_now();
+	for (u32 i = 0; i < n; i++) {
+		struct obj *o = chain_find(table, mask, key[order[i]]), *in;
+		if (!o) {
+			r->fail = 1;
+			break;
+		}
+		hash_del(&o->q);
+		in = &obj[n + order[i]];
+		in->key = key[n + order[i]];
+		hash_add(table, &in->q, mix(in->key) & mask);
+	}
+	r->churn = (double)(ns_now() - t0) / n;
+	free(table);
+	free(obj);
+}
+
+static void
+run_swiss(u32 bits, const u64 *key, const u32 *order, u32 n, struct result *r)
+{
+	struct hash_measure m = { 0 };
+	struct swiss t;
+	u32 hits = 0;
+	u64 t0;
+
+	memset(r, 0, sizeof(*r));
+	if (swiss_init(&t, 0)) {
+		r->fail = 1;
+		return;
+	}
+	t.max_load = 95;
+	if (swiss_rehash(&t, 1U << bits)) {
+		r->fail = 1;
+		swiss_fini(&t);
+		return;
+	}
+#ifdef CONFIG_MEASURE
+	t.measure = &m;
+#endif
+	for (u32 i = 0; i < n; i++)
+		r->fail |= swiss_put(&t, key[order[i]], order[i]);
+	r->collision = m.collision;
+#ifdef CONFIG_MEASURE
+	t.measure = NULL;
+#endif
+	r->fail |= t.mask + 1 != 1U << bits;
+
+	t0 = ns_now();
+	for (u32 i = 0; i < n; i++) {
+		u32 *v = swiss_find(&t, key[i]);
+		hits += v && *v == i;
+	}
+	r->hit = (double)(ns_now() - t0) / n;
+	r->fail |= hits != n;
+
+	t0 = ns_now();
+	for (u32 i = 0; i < n; i++)
+		hits += swiss_find(&t, key[n + i]) != NULL;
+	r->miss = (double)(ns_now() - t0) / n;
+	r->fail |= hits != n;
+
+	t0 = ns_now();
+	for (u32 i = 0; i < n; i++) {
+		if (!swiss_del(&t, key[order[i]])) {
+			r->fail = 1;
+			break;
+		}
+		r->fail |= swiss_put(&t, key[n + order[i]], n + order[i]);
+	}
+	r->churn = (double)(ns_now() - t0) / n;
+	swiss_fini(&t);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const u32 load[] = { 50, 60, 70, 80, 90 };
+	u32 bits = argc > 1 ? (u32)strtoul(argv[1], NULL, 0) : 20;
+	u32 slots, max;
+	u64 *key;
+	u32 *order;
+
+	if (bits < 8 || bits > 28)
+		return 2;
+	slots = 1U << bits;
+	max = (u32)((u64)slots * 90 / 100);
+	key = (u64 *)malloc(2 * (size_t)max * sizeof(*key));
+	order = (u32 *)malloc((size_t)max * sizeof(*order));
+	if (!key || !order) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	printf("%u slots, u64 keys, group of %u control bytes\n\n", slots,
+	       SWISS_GROUP);
+	printf("%-5s %-6s %9s %9s %9s", "load", "engine", "hit ns", "miss ns",
+	       "churn ns");
+	if (measure_available)
+		printf(" %10s", "collision");
+	printf("\n");
+
+	for (u32 l = 0; l < ARRAY_SIZE(load); l++) {
+		u32 n = (u32)((u64)slots * load[l] / 100);
+		struct result r[2];
+
+		/* distinct keys: low bit set present, clear absent */
+		for (u32 i = 0; i < n; i++) {
+			u64 k = xrand() & ~1ull;
+			key[i] = k | 1;
+			key[n + i] = k;
+			order[i] = i;
+		}
+		for (u32 i = n - 1; i > 0; i--) {
+			u32 j = (u32)(xrand() % (i + 1)), t = order[i];
+			order[i] = order[j];
+			order[j] = t;
+		}
+		run_chain(bits, key, order, n, &r[0]);
+		run_swiss(bits, key, order, n, &r[1]);
+
+		for (int e = 0; e < 2; e++) {
+			if (r[e].fail) {
+				fprintf(stderr, "%s at %u%% self-check FAIL\n",
+				        e ? "swiss" : "chain", load[l]);
+				return 1;
+			}
+			printf("%-5.2f %-6s %9.1f %9.1f %9.1f", load[l] / 100.0,
+			       e ? "swiss" : "chain", r[e].hit, r[e].miss,
+			       r[e].churn);
+			if (measure_available)
+				printf(" %9.1f%%", 100.0 * r[e].collision / n);
+			printf("\n");
+		}
+	}
+	free(key);
+	free(order);
+	return 0;
+}
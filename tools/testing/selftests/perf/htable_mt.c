@@ -0,0 +1,264 @@
+/*
+ * Benchmark for the striped multi-writer table of hpc/hash/htable_mt.h
+ *
+ * A table of 2^bits buckets over a key space as large, half of it present,
+ * and T threads each running a mix of operations on random keys for a fixed
+ * time:
+ *
+ *   read    a lookup, in a read-side section of its own
+ *   write   half of them an insert-if-absent of a freshly allocated element
+ *           (freed at once when the key is there already), half a lookup and
+ *           a delete of what it found, the element freed through call_rcu()
+ *
+ * at 90/10 and 50/50 reads to writes, and T from 1 to 64 threads. Each mix and
+ * T runs twice:
+ *
+ *   1. 1 lock   one stripe: every writer behind the same lock, the way a
+ *               table with one serialised writer is shared today
+ *   2. striped  HTABLE_MT_STRIPE_BITS stripes, a cache line each
+ *
+ * Reported: operations per second in total for both, the speedup, and built
+ * with CONFIG_MEASURE the share of writes that found their stripe held. The
+ * self-check is the element count: the inserts that won minus the deletes
+ * that won must be what the table holds at the end. With more threads than
+ * cores a preempted lock holder stalls its stripe's waiters for a time slice,
+ * which flattens the one-lock curve first.
+ *
+ * This program exists only when CONFIG_RCU is enabled (see the Kbuild).
+ *
+ *   htable_mt                  2^20 buckets, up to 64 threads, 300 ms a run
+ *   htable_mt <bits> [<max threads> [<ms>]]
+ */
+
+#include <hpc/compiler.h>
+#include <hpc/cpu.h>
+#include <hpc/hash/fn.h>
+#include <hpc/hash/htable_mt.h>
+#include <hpc/rcu.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct item {
+	u64 key;
+	struct hnode h;
+	struct rcu_head rcu;
+};
+
+struct worker {
+	struct htable_mt *t;
+	u64 seed;
+	u32 keys;
+	u32 read_pct;
+	u64 ops;
+	s64 delta;                 /* inserts won minus deletes won */
+} _align(CPU_CACHE_LINE);
+
+static volatile int stop;
+
+static inline u64
+ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static inline u64
+xrand(u64 *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static inline u32
+key_hash(u64 key)
+{
+	return (u32)hash_u64(key, 32);
+}
+
+static bool
+item_eq(const struct hnode *a, const struct hnode *b)
+{
+	return container_of(a, struct item, h)->key ==
+	       container_of(b, struct item, h)->key;
+}
+
+static void
+item_free(struct rcu_head *rcu)
+{
+	free(container_of(rcu, struct item, rcu));
+}
+
+/* Inside a read-side section. */
+static inline struct item *
+find(struct htable_mt *t, u64 key)
+{
+	htable_mt_for_each_possible(t, key_hash(key), it, struct item, h)
+		if (it->key == key)
+			return it;
+	return NULL;
+}
+
+static void
+op(struct worker *w)
+{
+	u64 r = xrand(&w->seed), key = (r >> 32) % w->keys;
+	struct item *x;
+
+	if (r % 100 < w->read_pct) {
+		rcu_read_lock();
+		x = find(w->t, key);
+		rcu_read_unlock();
+		__asm__ __volatile__("" :: "r"(x));
+	} else if (r & 0x100) {
+		x = (struct item *)malloc(sizeof(*x));
+		x->key = key;
+		rcu_read_lock();
+		if (htable_mt_insert(w->t, &x->h, key_hash(key), item_eq))
+			free(x);
+		else
+			w->delta++;
+		rcu_read_unlock();
+	} else {
+		rcu_read_lock();
+		if ((x = find(w->t, key)) && htable_mt_del(w->t, &x->h)) {
+			call_rcu(&x->rcu, item_free);
+			w->delta--;
+		}
+		rcu_read_unlock();
+	}
+}
+
+static void *
+worker_run(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+
+	rcu_register_thread();
+	while (!CMM_LOAD_SHARED(stop)) {
+		for (unsigned i = 0; i < 64; i++)
+			op(w);
+		w->ops += 64;
+#ifdef CONFIG_RCU_QSBR
+		rcu_quiescent_state();
+#endif
+	}
+	rcu_unregister_thread();
+	return NULL;
+}
+
+struct result {
+	double rate;
+	double contended;          /* percent of writes */
+	int fail;
+};
+
+static void
+run(u32 bits, u32 stripe_bits, u32 read_pct, unsigned nt, unsigned ms,
+    struct result *res)
+{
+	struct worker *w = (struct worker *)aligned_alloc(CPU_CACHE_LINE,
+	                                                  nt * sizeof(*w));
+	struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+	struct htable_measure m = { 0 };
+	struct htable_mt t;
+	pthread_t th[nt];
+	u64 t0, ops = 0, seed = 0x2545f4914f6cdd1dull;
+	s64 count;
+
+	memset(res, 0, sizeof(*res));
+	if (!w || htable_mt_init(&t, bits, stripe_bits)) {
+		free(w);
+		res->fail = 1;
+		return;
+	}
+	/* half the key space present to start with */
+	for (u32 k = 0; k < 1U << bits; k += 2) {
+		struct item *x = (struct item *)malloc(sizeof(*x));
+		x->key = k;
+		htable_mt_add(&t, &x->h, key_hash(k));
+	}
+	count = htable_mt_count(&t);
+#ifdef CONFIG_MEASURE
+	t.measure = &m;
+#endif
+	(void)m;
+
+	stop = 0;
+	for (unsigned i = 0; i < nt; i++) {
+		memset(&w[i], 0, sizeof(w[i]));
+		w[i].t = &t;
+		w[i].seed = xrand(&seed) | 1;
+		w[i].keys = 1U << bits;
+		w[i].read_pct = read_pct;
+		pthread_create(&th[i], NULL, worker_run, &w[i]);
+	}
+	t0 = ns_now();
+	nanosleep(&ts, NULL);
+	CMM_STORE_SHARED(stop, 1);
+	for (unsigned i = 0; i < nt; i++) {
+		pthread_join(th[i], NULL);
+		ops += w[i].ops;
+		count += w[i].delta;
+	}
+	t0 = ns_now() - t0;
+	res->rate = (double)ops * 1e9 / (double)t0;
+	res->contended = m.add + m.del ? 100.0 * m.contended /
+	                 (double)(ops * (100 - read_pct) / 100) : 0;
+	res->fail = count != (s64)htable_mt_count(&t);
+
+	/* nobody is left to read: free the rest directly */
+	for (u32 i = 0; i < 1U << bits; i++)
+		queue_for_each_delsafe(&t.tab[i], x, struct item, h.q)
+			free(x);
+	rcu_barrier();
+	htable_mt_fini(&t);
+	free(w);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const u32 mix[] = { 90, 50 };
+	u32 bits = argc > 1 ? (u32)strtoul(argv[1], NULL, 0) : 20;
+	unsigned max = argc > 2 ? (unsigned)strtoul(argv[2], NULL, 0) : 64;
+	unsigned ms = argc > 3 ? (unsigned)strtoul(argv[3], NULL, 0) : 300;
+
+	if (bits < 8 || bits > 26 || !max || max > 1024 || !ms)
+		return 2;
+
+	printf("2^%u buckets and keys, half present, %u stripes, "
+	       "%u ms a run\n\n", bits, 1U << __min(HTABLE_MT_STRIPE_BITS, bits),
+	       ms);
+	printf("%-5s %7s %12s %12s %8s", "mix", "threads", "1 lock Mop/s",
+	       "striped", "speedup");
+	if (measure_available)
+		printf(" %11s %11s", "1 lock cont", "striped");
+	printf("\n");
+	for (u32 x = 0; x < ARRAY_SIZE(mix); x++)
+		for (unsigned nt = 1; nt <= max; nt *= 2) {
+			struct result r[2];
+
+			run(bits, 0, mix[x], nt, ms, &r[0]);
+			run(bits, HTABLE_MT_STRIPE_BITS, mix[x], nt, ms, &r[1]);
+			if (r[0].fail || r[1].fail) {
+				fprintf(stderr, "%u/%u at %u threads self-check "
+				        "FAIL\n", mix[x], 100 - mix[x], nt);
+				return 1;
+			}
+			printf("%2u/%-2u %7u %12.2f %12.2f %8.2f", mix[x],
+			       100 - mix[x], nt, r[0].rate / 1e6,
+			       r[1].rate / 1e6, r[1].rate / r[0].rate);
+			if (measure_available)
+				printf(" %10.2f%% %10.2f%%", r[0].contended,
+				       r[1].contended);
+			printf("\n");
+		}
+	return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * Benchmark for the lockless readers of hpc/hash/htable_rcu.h
+ *
+ * N keys in a resizable RCU table, and R reader threads looking up random
+ * keys present, each lookup a read-side section of its own, for a fixed time.
+ * Two ways for every R:
+ *
+ *   1. steady  nobody writes: the lookup rate the read side is capable of
+ *   2. resize  a writer thread shrinks the table by two levels and grows it
+ *              back, over and over - a zip, then unzips with grace periods
+ *              between their passes - for as long as the readers run
+ *
+ * Reported per run: lookups per second in total and per reader, and for the
+ * resize run how many resizes the writer finished meanwhile. Every lookup
+ * must find its key, resize or not: that is the self-check, and a miss fails
+ * the run. The ratio of the two rates is what a resize costs the readers -
+ * chains twice as long while zipped, and the cache misses of a table being
+ * rewritten - and the steady rates across R are how the read side scales;
+ * on a box with fewer cores than readers they flatten where the cores end.
+ *
+ * This program exists only when CONFIG_RCU is enabled (see the Kbuild).
+ *
+ *   htable_rcu                 1M keys, up to 16 readers, 500 ms a run
+ *   htable_rcu <keys> [<max readers> [<ms>]]
+ */
+
+#include <hpc/compiler.h>
+#include <hpc/cpu.h>
+#include <hpc/hash/fn.h>
+#include <hpc/hash/htable_rcu.h>
+#include <hpc/rcu.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct item {
+	u64 key;
+	struct hnode h;
+};
+
+struct reader {
+	struct htable_rcu *t;
+	struct item *item;
+	u32 n;
+	u64 seed;
+	u64 lookups;
+	u64 misses;
+} _align(CPU_CACHE_LINE);
+
+struct writer {
+	struct htable_rcu *t;
+	u32 bits;
+	u64 resizes;
+	int fail;
+};
+
+static volatile int stop;
+
+static inline u64
+ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static inline u64
+xrand(u64 *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static inline u32
+key_hash(u64 key)
+{
+	return (u32)hash_u64(key, 32);
+}
+
+static void *
+reader_run(void *arg)
+{
+	struct reader *r = (struct reader *)arg;
+
+	rcu_register_thread();
+	while (!CMM_LOAD_SHARED(stop)) {
+		for (unsigned i = 0; i < 256; i++) {
+			u64 key = r->item[xrand(&r->seed) % r->n].key;
+			bool hit = false;
+
+			rcu_read_lock();
+			htable_rcu_for_each_possible(r->t, key_hash(key), it,
+			                             struct item, h)
+				if (it->key == key) {
+					hit = true;
+					break;
+				}
+			rcu_read_unlock();
+			r->misses += !hit;
+		}
+		r->lookups += 256;
+#ifdef CONFIG_RCU_QSBR
+		rcu_quiescent_state();
+#endif
+	}
+	rcu_unregister_thread();
+	return NULL;
+}
+
+static void *
+writer_run(void *arg)
+{
+	struct writer *w = (struct writer *)arg;
+
+	while (!CMM_LOAD_SHARED(stop)) {
+		w->fail |= htable_rcu_resize(w->t, w->bits - 2);
+		w->fail |= htable_rcu_resize(w->t, w->bits);
+		w->resizes += 4;
+	}
+	return NULL;
+}
+
+/* Lookups per second over @ms with @nr readers; 0 on a miss or a failure. */
+static double
+run(struct htable_rcu *t, struct item *item, u32 n, unsigned nr,
+    unsigned ms, bool resize, u64 *resizes)
+{
+	struct reader *r = (struct reader *)aligned_alloc(CPU_CACHE_LINE,
+	                                                  nr * sizeof(*r));
+	struct writer w = { .t = t, .bits = t->tab->bits };
+	struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+	pthread_t th[nr], wt;
+	u64 t0, total = 0, misses = 0;
+
+	if (!r)
+		return 0;
+	stop = 0;
+	for (unsigned i = 0; i < nr; i++) {
+		memset(&r[i], 0, sizeof(r[i]));
+		r[i].t = t;
+		r[i].item = item;
+		r[i].n = n;
+		r[i].seed = 0x9e3779b97f4a7c15ull * (i + 1);
+		pthread_create(&th[i], NULL, reader_run, &r[i]);
+	}
+	if (resize)
+		pthread_create(&wt, NULL, writer_run, &w);
+	t0 = ns_now();
+	nanosleep(&ts, NULL);
+	CMM_STORE_SHARED(stop, 1);
+	for (unsigned i = 0; i < nr; i++) {
+		pthread_join(th[i], NULL);
+		total += r[i].lookups;
+		misses += r[i].misses;
+	}
+	t0 = ns_now() - t0;
+	if (resize)
+		pthread_join(wt, NULL);
+	free(r);
+	*resizes = w.resizes;
+	if (misses || w.fail)
+		return 0;
+	return (double)total * 1e9 / (double)t0;
+}
+
+int
+main(int argc, char **argv)
+{
+	u32 n = argc > 1 ? (u32)strtoul(argv[1], NULL, 0) : 1u << 20;
+	unsigned max = argc > 2 ? (unsigned)strtoul(argv[2], NULL, 0) : 16;
+	unsigned ms = argc > 3 ? (unsigned)strtoul(argv[3], NULL, 0) : 500;
+	struct htable_rcu t;
+	struct item *item;
+	u64 seed = 0x2545f4914f6cdd1dull;
+
+	if (n < 1000 || !max || max > 256 || !ms)
+		return 2;
+	item = (struct item *)calloc(n, sizeof(*item));
+	if (!item || htable_rcu_init(&t, 4)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (u32 i = 0; i < n; i++) {
+		item[i].key = xrand(&seed);
+		htable_rcu_add(&t, &item[i].h, key_hash(item[i].key));
+	}
+
+	printf("%u keys in 2^%u buckets, %u ms a run, resize between 2^%u "
+	       "and 2^%u\n\n", n, t.tab->bits, ms, t.tab->bits - 2,
+	       t.tab->bits);
+	printf("%7s %-6s %12s %12s %8s %8s\n", "readers", "mode", "Mlookup/s",
+	       "per reader", "ratio", "resizes");
+	for (unsigned nr = 1; nr <= max; nr *= 2) {
+		double rate[2];
+		u64 resizes[2];
+
+		for (int resize = 0; resize < 2; resize++) {
+			rate[resize] = run(&t, item, n, nr, ms, resize,
+			                   &resizes[resize]);
+			if (!rate[resize]) {
+				fprintf(stderr, "%u readers %s self-check FAIL\n",
+				        nr, resize ? "resize" : "steady");
+				return 1;
+			}
+			printf("%7u %-6s %12.2f %12.2f %8.2f %8llu\n", nr,
+			       resize ? "resize" : "steady", rate[resize] / 1e6,
+			       rate[resize] / 1e6 / nr, rate[resize] / rate[0],
+			       (unsigned long long)resizes[resize]);
+		}
+	}
+	htable_rcu_fini(&t);
+	free(item);
+	return 0;
+}
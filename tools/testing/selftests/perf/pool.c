@@ -0,0 +1,278 @@
+/*
+ * Benchmark for the chunked arena of hpc/mem/pool.h as request-scoped scratch
+ *
+ * Every request allocates a few dozen objects - headers and nodes mostly, some
+ * strings and buffers, now and then a large one - writes each, and ends. It
+ * runs three ways:
+ *
+ *   1. malloc    malloc() per object, free() per object at the end
+ *   2. restore   mm_pool_alloc() per object, mm_pool_restore() at the end
+ *                to a savepoint taken at the start
+ *   3. flush     mm_pool_alloc() per object, mm_pool_flush() at the end
+ *
+ * The object sizes are drawn up front, the same sequence for every run, so the
+ * timed loop is allocator calls and the writes; each object is stamped and the
+ * stamp checked at the end of its request. Reports ns per request and per
+ * allocation, single-threaded and with 1..N threads each running its own
+ * arena. With CONFIG_MEASURE the arena runs also report the chunks mapped
+ * against those reused from the block cache - after the first requests the
+ * mapped count should stop moving.
+ *
+ * A second table is about TLB reach: an arena of 64-byte nodes, 256 MiB of
+ * them, linked into one random cycle and walked, once on base pages and once
+ * with MM_HUGE_PAGE. Each step is a dependent load to a random node, so the
+ * time per step is mostly a cache miss plus, on base pages, a dTLB miss and a
+ * page walk. The backing the huge arena got - hugetlbfs, THP or, where
+ * neither is available, base pages after all - is printed with it.
+ *
+ *   pool                      500000 requests of 48 objects
+ *   pool <requests> <objs>
+ */
+
+#include <hpc/compiler.h>
+#include <mem/pool.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+enum { MALLOC, RESTORE, FLUSH };
+static const char *mode_name[] = { "malloc", "restore", "flush" };
+
+static inline u64
+ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static u64 rng_state = 0x2545f4914f6cdd1dull;
+
+static inline u64
+xrand(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static u32
+request_size(void)
+{
+	u32 r = (u32)(xrand() % 1000);
+	if (r < 750)
+		return 8 + (u32)(xrand() % 120);          /* headers, nodes    */
+	if (r < 990)
+		return 128 + (u32)(xrand() % 1900);       /* strings, buffers  */
+	return 4096 + (u32)(xrand() % 60000);         /* the odd big one   */
+}
+
+struct bench {
+	pthread_t tid;
+	const u32 *size;      /* objects' sizes, request after request        */
+	u32 requests, objs;
+	int mode;
+	u64 ns;
+	u64 chunks, recycled;
+	int fail;
+};
+
+static void *
+bench_main(void *arg)
+{
+	struct bench *b = (struct bench *)arg;
+	struct mm_pool *pool = mm_pool_create(16384, 0);
+	struct mm_pool_measure m = { 0 };
+	void **obj = (void **)calloc(b->objs, sizeof(*obj));
+	const u32 *size = b->size;
+	struct mm_savep sp;
+	u64 t0;
+
+#ifdef CONFIG_MEASURE
+	pool->measure = &m;
+#endif
+	(void)m;
+	t0 = ns_now();
+	for (u32 r = 0; r < b->requests; r++, size += b->objs) {
+		if (b->mode == RESTORE)
+			mm_pool_save(pool, &sp);
+		for (u32 i = 0; i < b->objs; i++) {
+			obj[i] = b->mode == MALLOC ? malloc(size[i])
+			                           : mm_pool_alloc(pool, size[i]);
+			memset(obj[i], (int)i, size[i] < 64 ? size[i] : 64);
+		}
+		for (u32 i = 0; i < b->objs; i++) {
+			b->fail |= *(u8 *)obj[i] != (u8)i;
+			if (b->mode == MALLOC)
+				free(obj[i]);
+		}
+		if (b->mode == RESTORE)
+			mm_pool_restore(pool, &sp);
+		else if (b->mode == FLUSH)
+			mm_pool_flush(pool);
+	}
+	b->ns = ns_now() - t0;
+#ifdef CONFIG_MEASURE
+	b->chunks = m.chunk;
+	b->recycled = m.recycle;
+#endif
+	mm_pool_destroy(pool);
+	free(obj);
+	return NULL;
+}
+
+/* ns per request, the slowest thread's; -1 on a failed self-check */
+static double
+run(const u32 *size, u32 requests, u32 objs, unsigned threads, int mode,
+    u64 *chunks, u64 *recycled)
+{
+	struct bench *b = (struct bench *)calloc(threads, sizeof(*b));
+	u64 slowest = 0;
+	int fail = 0;
+	unsigned i;
+
+	*chunks = *recycled = 0;
+	for (i = 0; i < threads; i++) {
+		b[i] = (struct bench){ .size = size, .requests = requests,
+		                       .objs = objs, .mode = mode };
+		pthread_create(&b[i].tid, NULL, bench_main, &b[i]);
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(b[i].tid, NULL);
+		fail |= b[i].fail;
+		*chunks += b[i].chunks;
+		*recycled += b[i].recycled;
+		if (b[i].ns > slowest)
+			slowest = b[i].ns;
+	}
+	free(b);
+	return fail ? -1 : (double)slowest / requests;
+}
+
+struct hop {
+	struct hop *next;
+	u8 pad[56];
+};
+
+static const char *backing_name[] = { "base pages", "THP", "hugetlbfs" };
+
+/* ns per step of a random walk over @mib MiB of hops in one arena */
+static double
+tlb_walk(unsigned mib, int flags, int *backing)
+{
+	struct mm_pool *pool = mm_pool_create(VM_HUGE_PAGE_SIZE, flags);
+	size_t n = ((size_t)mib << 20) / sizeof(struct hop), steps = 20000000;
+	struct hop **hop = (struct hop **)malloc(n * sizeof(*hop));
+	struct hop *p;
+	u64 t0, ns;
+
+	for (size_t i = 0; i < n; i++)
+		hop[i] = (struct hop *)mm_pool_alloc(pool, sizeof(struct hop));
+	for (size_t i = n - 1; i > 0; i--) {      /* one random cycle */
+		size_t j = (size_t)(xrand() % i);
+		struct hop *x = hop[i];
+		hop[i] = hop[j];
+		hop[j] = x;
+	}
+	for (size_t i = 0; i < n; i++)
+		hop[i]->next = hop[(i + 1) % n];
+	p = hop[0];
+	free(hop);
+
+	t0 = ns_now();
+	for (size_t i = 0; i < steps; i++)
+		p = p->next;
+	ns = ns_now() - t0;
+	__asm__ __volatile__("" : : "r"(p));
+
+	*backing = mm_pool_backing(pool);
+	mm_pool_destroy(pool);
+	return (double)ns / steps;
+}
+
+static int
+test_pool(void)
+{
+	struct mm_pool *pool = mm_pool_create(4096, 0);
+	struct mm_savep sp;
+	int rv = 0;
+
+	mm_pool_save(pool, &sp);
+	char *s = mm_pool_printf(pool, "%s-%d", "request", 42);
+	rv |= strcmp(s, "request-42") != 0;
+	mm_pool_alloc(pool, 100000);
+	mm_pool_restore(pool, &sp);
+	rv |= mm_pool_size(pool) != 0;
+	mm_pool_destroy(pool);
+	return rv ? -1 : 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned max = (unsigned)(cpus > 0 ? cpus : 1), n;
+	u32 requests = argc > 1 ? (u32)strtoul(argv[1], NULL, 0) : 500000;
+	u32 objs = argc > 2 ? (u32)strtoul(argv[2], NULL, 0) : 48;
+	u64 chunks, recycled, bytes = 0;
+	u32 *size;
+
+	if (test_pool() < 0) {
+		fprintf(stderr, "pool self-check FAIL\n");
+		return 1;
+	}
+	if (!requests || !objs)
+		return 2;
+	size = (u32 *)malloc((size_t)requests * objs * sizeof(*size));
+	if (!size) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (u64 i = 0; i < (u64)requests * objs; i++)
+		bytes += size[i] = request_size();
+	printf("%u requests of %u objects, %.0f bytes a request on average\n\n",
+	       requests, objs, (double)bytes / requests);
+
+	printf("threads  %-8s %10s %10s %8s %12s\n", "mode", "ns/req", "ns/alloc",
+	       "ratio", "chunks");
+	for (n = 1; n <= max; n = n < max && n * 2 > max ? max : n * 2) {
+		double base = 0;
+		for (int mode = MALLOC; mode <= FLUSH; mode++) {
+			double ns = run(size, requests, objs, n, mode, &chunks,
+			                &recycled);
+			if (ns < 0) {
+				fprintf(stderr, "threads=%u %s self-check FAIL\n", n,
+				        mode_name[mode]);
+				return 1;
+			}
+			if (mode == MALLOC)
+				base = ns;
+			printf("%7u  %-8s %10.1f %10.2f %7.2fx", n, mode_name[mode],
+			       ns, ns / objs, base / ns);
+			if (mode != MALLOC && measure_available)
+				printf(" %5llu mapped %llu reused",
+				       (unsigned long long)chunks,
+				       (unsigned long long)recycled);
+			printf("\n");
+		}
+		if (n == max)
+			break;
+	}
+	free(size);
+
+	printf("\nrandom walk over 256 MiB of 64-byte nodes\n");
+	printf("%-10s %10s   %s\n", "pages", "ns/step", "backing");
+	for (int huge = 0; huge < 2; huge++) {
+		int backing;
+		double ns = tlb_walk(256, huge ? MM_HUGE_PAGE : 0, &backing);
+		printf("%-10s %10.1f   %s\n", huge ? "huge" : "base", ns,
+		       backing_name[backing]);
+	}
+	return 0;
+}
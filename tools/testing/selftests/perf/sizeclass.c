@@ -0,0 +1,315 @@
+/*
+ * Test and benchmark for hpc/mem/sizeclass.h
+ *
+ * Replays one allocation trace through two allocators:
+ *
+ *   1. glibc     malloc()/realloc()/free()
+ *   2. sizeclass mm_sizeclass_alloc()/mm_sizeclass_realloc()/mm_sizeclass_free()
+ *
+ * A trace is a text file, one operation per line, naming allocations by slot:
+ *
+ *     a <slot> <size>     allocate <size> bytes into <slot>
+ *     r <slot> <size>     realloc <slot> to <size> bytes
+ *     f <slot>            free <slot>
+ *
+ * `sizeclass <trace>` replays a recorded one. With no argument a synthetic
+ * trace is generated instead: a live set of a few thousand objects churning
+ * with sizes drawn the way service traces tend to look - mostly under 128
+ * bytes, a long tail into the kilobytes, the odd large buffer - and an
+ * occasional realloc() growing a buffer.
+ *
+ * The trace is parsed into memory first, so the timed loop is allocator calls
+ * and nothing else; every block is stamped on allocation and checked before it
+ * is freed, so both allocators run the same memory traffic. Reports ns per
+ * operation for each, single-threaded and with 1..N threads replaying private
+ * copies of the trace at once.
+ */
+
+#include <hpc/compiler.h>
+#include <mem/sizeclass.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+struct op {
+	char kind;            /* 'a', 'r' or 'f'                              */
+	u32 slot;
+	u32 size;
+};
+
+struct trace {
+	struct op *op;
+	u32 n;
+	u32 slots;
+};
+
+static inline u64
+ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static u64 rng_state = 0x2545f4914f6cdd1dull;
+
+static inline u64
+xrand(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+static void
+trace_push(struct trace *t, u32 *cap, char kind, u32 slot, u32 size)
+{
+	if (t->n == *cap) {
+		*cap = *cap ? *cap * 2 : 4096;
+		t->op = (struct op *)realloc(t->op, *cap * sizeof(*t->op));
+		if (!t->op) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	t->op[t->n++] = (struct op){ .kind = kind, .slot = slot, .size = size };
+	if (slot >= t->slots)
+		t->slots = slot + 1;
+}
+
+static u32
+synthetic_size(void)
+{
+	u32 r = (u32)(xrand() % 100);
+	if (r < 70)
+		return 8 + (u32)(xrand() % 120);          /* headers, nodes    */
+	if (r < 95)
+		return 128 + (u32)(xrand() % 4000);       /* strings, buffers  */
+	if (r < 99)
+		return 4096 + (u32)(xrand() % 28000);     /* packets, pages    */
+	return 32768 + (u32)(xrand() % 200000);       /* the odd big one   */
+}
+
+static void
+trace_synthetic(struct trace *t, u32 ops, u32 live)
+{
+	u8 *used = (u8 *)calloc(live, 1);
+	u32 cap = 0, i;
+
+	for (i = 0; i < ops; i++) {
+		u32 slot = (u32)(xrand() % live);
+		if (!used[slot]) {
+			trace_push(t, &cap, 'a', slot, synthetic_size());
+			used[slot] = 1;
+		} else if (xrand() % 16 == 0) {
+			trace_push(t, &cap, 'r', slot, synthetic_size());
+		} else {
+			trace_push(t, &cap, 'f', slot, 0);
+			used[slot] = 0;
+		}
+	}
+	for (i = 0; i < live; i++)
+		if (used[i])
+			trace_push(t, &cap, 'f', i, 0);
+	free(used);
+}
+
+static int
+trace_load(struct trace *t, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char kind;
+	u32 slot, size, cap = 0;
+	char line[128];
+
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		size = 0;
+		if (sscanf(line, " %c %u %u", &kind, &slot, &size) < 2)
+			continue;
+		if (kind != 'a' && kind != 'r' && kind != 'f')
+			continue;
+		trace_push(t, &cap, kind, slot, size);
+	}
+	fclose(f);
+	return 0;
+}
+
+/* ---- replay -------------------------------------------------------------- */
+
+struct replay {
+	pthread_t tid;
+	const struct trace *t;
+	int sizeclass;
+	u64 ns;
+	int fail;
+};
+
+static inline void
+stamp(void *p, u32 slot, u32 size)
+{
+	if (size >= sizeof(u32))
+		memcpy(p, &slot, sizeof(slot));
+}
+
+static inline int
+check(void *p, u32 slot, u32 size)
+{
+	u32 v;
+	if (size < sizeof(u32))
+		return 0;
+	memcpy(&v, p, sizeof(v));
+	return v != slot;
+}
+
+static void *
+replay_main(void *arg)
+{
+	struct replay *r = (struct replay *)arg;
+	const struct trace *t = r->t;
+	void **slot = (void **)calloc(t->slots, sizeof(*slot));
+	u32 *size = (u32 *)calloc(t->slots, sizeof(*size));
+	u64 t0;
+	u32 i;
+
+	t0 = ns_now();
+	for (i = 0; i < t->n; i++) {
+		const struct op *op = &t->op[i];
+		void *p = slot[op->slot];
+		switch (op->kind) {
+		case 'a':
+			if (p)                    /* a trace reusing a live slot */
+				break;
+			p = r->sizeclass ? mm_sizeclass_alloc(op->size)
+			                 : malloc(op->size);
+			stamp(p, op->slot, op->size);
+			slot[op->slot] = p;
+			size[op->slot] = op->size;
+			break;
+		case 'r':
+			if (!p)
+				break;
+			r->fail |= check(p, op->slot, size[op->slot]);
+			p = r->sizeclass ? mm_sizeclass_realloc(p, op->size)
+			                 : realloc(p, op->size);
+			stamp(p, op->slot, op->size);
+			slot[op->slot] = p;
+			size[op->slot] = op->size;
+			break;
+		case 'f':
+			if (!p)
+				break;
+			r->fail |= check(p, op->slot, size[op->slot]);
+			if (r->sizeclass)
+				mm_sizeclass_free(p);
+			else
+				free(p);
+			slot[op->slot] = NULL;
+			break;
+		}
+	}
+	r->ns = ns_now() - t0;
+
+	for (i = 0; i < t->slots; i++) {
+		if (!slot[i])
+			continue;
+		if (r->sizeclass)
+			mm_sizeclass_free(slot[i]);
+		else
+			free(slot[i]);
+	}
+	free(slot);
+	free(size);
+	return NULL;
+}
+
+/* ns per operation, the slowest thread's; -1 on a failed self-check */
+static double
+run(const struct trace *t, unsigned threads, int sizeclass)
+{
+	struct replay *r = (struct replay *)calloc(threads, sizeof(*r));
+	u64 slowest = 0;
+	int fail = 0;
+	unsigned i;
+
+	for (i = 0; i < threads; i++) {
+		r[i].t = t;
+		r[i].sizeclass = sizeclass;
+		pthread_create(&r[i].tid, NULL, replay_main, &r[i]);
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(r[i].tid, NULL);
+		fail |= r[i].fail;
+		if (r[i].ns > slowest)
+			slowest = r[i].ns;
+	}
+	free(r);
+	return fail ? -1 : (double)slowest / t->n;
+}
+
+static int
+test_sizeclass(void)
+{
+	unsigned i;
+	for (i = 0; i < SIZECLASS_COUNT; i++)
+		if (sizeclass_of(sizeclass_size(i)) != i)
+			return -1;
+	void *p = mm_sizeclass_alloc(1000);
+	if (!p || mm_sizeclass_usable(p) < 1000)
+		return -1;
+	mm_sizeclass_free(p);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct trace t = { 0 };
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned max = (unsigned)(cpus > 0 ? cpus : 1), n;
+	struct mm_sizeclass_stat st;
+	u64 spans = 0;
+	unsigned i;
+
+	if (test_sizeclass() < 0) {
+		fprintf(stderr, "sizeclass self-check FAIL\n");
+		return 1;
+	}
+	if (argc > 1) {
+		if (trace_load(&t, argv[1]) < 0) {
+			perror(argv[1]);
+			return 1;
+		}
+	} else {
+		trace_synthetic(&t, 2000000, 4096);
+	}
+	printf("trace: %u operations over %u slots\n\n", t.n, t.slots);
+
+	printf("threads   glibc (ns/op)   sizeclass (ns/op)   ratio\n");
+	for (n = 1; n <= max; n = n < max && n * 2 > max ? max : n * 2) {
+		double a = run(&t, n, 0);
+		double b = run(&t, n, 1);
+		if (a < 0 || b < 0) {
+			fprintf(stderr, "threads=%u replay self-check FAIL\n", n);
+			return 1;
+		}
+		printf("%7u   %13.1f   %17.1f   %5.2fx\n", n, a, b, a / b);
+		if (n == max)
+			break;
+	}
+
+	for (i = 0; i < SIZECLASS_COUNT; i++)
+		if (!mm_sizeclass_stat(i, &st))
+			spans += (u64)st.spans * st.span_size;
+	printf("\nsizeclass span memory cut: %llu KiB\n",
+	       (unsigned long long)(spans >> 10));
+	free(t.op);
+	return 0;
+}
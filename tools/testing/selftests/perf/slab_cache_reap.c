@@ -0,0 +1,153 @@
+/*
+ * Test and benchmark for the expiry index of hpc/mem/slab_cache.h
+ *
+ * The cost of keeping an expiring cache of N blocks clean, both ways:
+ *
+ *   1. scan   slab_cache_reap() testing every committed block's entry
+ *   2. wheel  slab_cache_reap() after slab_cache_set_wheel(), visiting only
+ *             the blocks that are due
+ *
+ * The workload is a steady cache on a 1 s gc cadence: N blocks with idle
+ * timeouts of around L (uniform in L/2..3L/2, and spread over 0..L to begin
+ * with, as if the cache had been running for a while), a hot 5% touched every
+ * simulated second so they never go idle - with the wheel they are re-filed
+ * lazily - and every reaped block replaced by a fresh one. Two simulated
+ * minutes per run; both runs draw the same random numbers, so they must reap
+ * the same counts at every step, which is the self-check.
+ *
+ * A reap's share of the cache is about 1/L per second, and that is the whole
+ * story: the scan costs the same at any L, the wheel costs what expires. The
+ * table shows where the two meet. Reports the mean wall time of one reap
+ * (including freeing what it reaps), of one touch, and the blocks a reap
+ * examined, for `slab_cache_reap <N>` blocks (default 1 Mi).
+ */
+
+#include <hpc/compiler.h>
+#include <mem/slab_cache.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+
+enum {
+	BLOCK   = 64,
+	SECONDS = 120,
+	HOT_PCT = 5,
+};
+
+static inline u64
+ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static u64 rng_state;
+
+static inline u32
+xrand(u32 n)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (u32)(rng_state % n);
+}
+
+struct result {
+	double reap_ns;       /* mean per reap                                */
+	double touch_ns;      /* mean per touch                               */
+	double visited;       /* blocks examined per reap                     */
+	double reaped;        /* blocks reaped per reap                       */
+	u32 step[SECONDS];    /* reaped per step, for the self-check          */
+};
+
+static int
+run(u32 n, u32 life, int wheel, struct result *r)
+{
+	struct slab_policy pol = { .min = n, .max = n };
+	struct slab_cache c;
+	u32 hot = n / 100 * HOT_PCT, i, s, k;
+	void **blk = (void **)calloc(hot, sizeof(*blk));
+	u64 reap_ns = 0, touch_ns = 0, visited = 0, reaped = 0, t0;
+	timestamp_t now = 1000000;
+
+	memset(r, 0, sizeof(*r));
+	rng_state = 0x2545f4914f6cdd1dull;
+	if (!blk || slab_cache_init(&c, BLOCK, &pol, 0, 0))
+		return -1;
+	if (wheel && slab_cache_set_wheel(&c, now))
+		return -1;
+
+	for (i = 0; i < hot; i++)
+		blk[i] = slab_cache_alloc_ex(&c, now, 0, life);
+	for (; i < n; i++)
+		slab_cache_alloc_ex(&c, now, 0, 1 + xrand(life));
+
+	for (s = 0; s < SECONDS; s++) {
+		now += 1000;
+
+		t0 = ns_now();
+		for (i = 0; i < hot; i++)
+			slab_cache_touch(&c, blk[i], now);
+		touch_ns += ns_now() - t0;
+
+		t0 = ns_now();
+		r->step[s] = slab_cache_reap(&c, now);
+		reap_ns += ns_now() - t0;
+		visited += wheel ? 0 : slab_committed(&c.slab);
+		reaped += r->step[s];
+
+		for (k = 0; k < r->step[s]; k++)
+			slab_cache_alloc_ex(&c, now, 0, life / 2 + xrand(life));
+	}
+	if (wheel)
+		visited = c.wheel.visits;
+
+	r->reap_ns = (double)reap_ns / SECONDS;
+	r->touch_ns = (double)touch_ns / ((double)hot * SECONDS);
+	r->visited = (double)visited / SECONDS;
+	r->reaped = (double)reaped / SECONDS;
+	slab_cache_fini(&c);
+	free(blk);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const u32 life[] = { 10000, 60000, 600000, 3600000 };
+	u32 n = argc > 1 ? (u32)strtoul(argv[1], NULL, 0) : 1u << 20;
+	struct result *scan = (struct result *)malloc(sizeof(*scan));
+	struct result *wheel = (struct result *)malloc(sizeof(*wheel));
+	unsigned l, s;
+
+	printf("%u blocks, reap every 1 s\n\n", n);
+	printf("%8s %8s  %10s %10s  %9s %9s  %9s %9s  %7s\n", "life",
+	       "reaped", "scan reap", "wheel reap", "scan tch", "wheel tch",
+	       "scan vis", "wheel vis", "speedup");
+	for (l = 0; l < sizeof(life) / sizeof(life[0]); l++) {
+		if (run(n, life[l], 0, scan) || run(n, life[l], 1, wheel)) {
+			fprintf(stderr, "n=%u: cache init FAIL\n", n);
+			return 1;
+		}
+		for (s = 0; s < SECONDS; s++) {
+			if (scan->step[s] != wheel->step[s]) {
+				fprintf(stderr, "life=%u step %u: scan reaped %u, "
+				        "wheel %u FAIL\n", life[l], s,
+				        scan->step[s], wheel->step[s]);
+				return 1;
+			}
+		}
+		printf("%6us %8.0f  %7.0f us %7.0f us  %6.1f ns %6.1f ns  "
+		       "%9.0f %9.0f  %6.1fx\n", life[l] / 1000, scan->reaped,
+		       scan->reap_ns / 1e3, wheel->reap_ns / 1e3,
+		       scan->touch_ns, wheel->touch_ns, scan->visited,
+		       wheel->visited, scan->reap_ns / wheel->reap_ns);
+	}
+	free(scan);
+	free(wheel);
+	return 0;
+}
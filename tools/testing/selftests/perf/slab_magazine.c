@@ -0,0 +1,253 @@
+/*
+ * Test and benchmark for hpc/mem/slab_magazine.h and the lock-free slab mode
+ *
+ * Thread scaling of the ways to share one struct slab between threads:
+ *
+ *   1. mutex     every slab_alloc()/slab_free() under one pthread mutex
+ *   2. magazine  slab_magazine_alloc()/slab_magazine_free() through a
+ *                per-thread cache over a struct slab_depot
+ *   3. lockfree  slab_alloc_lockfree()/slab_free_lockfree(), every thread on
+ *                the one tagged-index free list
+ *
+ * Every thread runs the same loop: a private table of LIVE slots, each step
+ * picks a slot at random and frees the block in it or allocates one into it,
+ * so the set of live blocks churns at a steady ~50% occupancy and every block
+ * is written on allocation and checked on free. The blocks are shared: with
+ * the magazine layer a block freed by one thread is routinely allocated by
+ * another, which is the case it has to get right.
+ *
+ * Reports the aggregate throughput (million operations per second, one alloc
+ * or one free = one operation) for 1..N threads, and each variant's ratio to
+ * the mutex.
+ * N defaults to the number of online CPUs; `slab_magazine <N>` overrides it.
+ */
+
+#include <hpc/compiler.h>
+#include <mem/slab_magazine.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+enum {
+	BLOCK   = 64,
+	LIVE    = 1024,
+	OPS     = 2000000,
+};
+
+static inline u64
+ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static const struct slab_policy policy = { .min = 1024, .max = 1u << 20 };
+
+/* ---- the two variants behind one interface ------------------------------- */
+
+struct shared {
+	pthread_mutex_t lock;
+	struct slab slab;
+	struct slab_depot depot;
+	pthread_barrier_t start;
+	int mode;
+};
+
+enum { MUTEX, MAGAZINE, LOCKFREE };
+
+struct worker {
+	pthread_t tid;
+	struct shared *sh;
+	u64 seed;
+	u64 ns;
+	int fail;
+};
+
+static inline u32
+xrand(u64 *s)
+{
+	*s ^= *s << 13; *s ^= *s >> 7; *s ^= *s << 17;
+	return (u32)*s;
+}
+
+#define CHURN(ALLOC, FREE)                                                  \
+	for (i = 0; i < OPS; i++) {                                         \
+		u32 k = xrand(&w->seed) % LIVE;                             \
+		if (live[k]) {                                              \
+			if (*live[k] != (u64)(uintptr_t)&live[k])           \
+				w->fail = 1;                                \
+			FREE(live[k]);                                      \
+			live[k] = NULL;                                     \
+		} else if ((live[k] = (u64 *)(ALLOC))) {                    \
+			*live[k] = (u64)(uintptr_t)&live[k];                \
+		}                                                           \
+	}
+
+static inline void *
+mutex_alloc(struct shared *sh)
+{
+	pthread_mutex_lock(&sh->lock);
+	void *p = slab_alloc(&sh->slab);
+	pthread_mutex_unlock(&sh->lock);
+	return p;
+}
+
+static inline void
+mutex_free(struct shared *sh, void *p)
+{
+	pthread_mutex_lock(&sh->lock);
+	slab_free(&sh->slab, p);
+	pthread_mutex_unlock(&sh->lock);
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	struct shared *sh = w->sh;
+	struct slab_magazine_cpu cpu;
+	u64 **live = (u64 **)calloc(LIVE, sizeof(*live));
+	u64 t0;
+	unsigned i;
+
+	if (!live ||
+	    (sh->mode == MAGAZINE && slab_magazine_attach(&cpu, &sh->depot))) {
+		w->fail = 1;
+		pthread_barrier_wait(&sh->start);
+		return NULL;
+	}
+
+	pthread_barrier_wait(&sh->start);
+	t0 = ns_now();
+	if (sh->mode == MAGAZINE) {
+#define MA() slab_magazine_alloc(&cpu)
+#define MF(p) slab_magazine_free(&cpu, p)
+		CHURN(MA(), MF);
+#undef MA
+#undef MF
+	} else if (sh->mode == LOCKFREE) {
+#define LA() slab_alloc_lockfree(&sh->slab)
+#define LF(p) slab_free_lockfree(&sh->slab, p)
+		CHURN(LA(), LF);
+#undef LA
+#undef LF
+	} else {
+#define XA() mutex_alloc(sh)
+#define XF(p) mutex_free(sh, p)
+		CHURN(XA(), XF);
+#undef XA
+#undef XF
+	}
+	w->ns = ns_now() - t0;
+
+	for (i = 0; i < LIVE; i++) {
+		if (!live[i])
+			continue;
+		if (sh->mode == MAGAZINE)
+			slab_magazine_free(&cpu, live[i]);
+		else if (sh->mode == LOCKFREE)
+			slab_free_lockfree(&sh->slab, live[i]);
+		else
+			mutex_free(sh, live[i]);
+	}
+	if (sh->mode == MAGAZINE)
+		slab_magazine_detach(&cpu);
+	free(live);
+	return NULL;
+}
+
+/* Aggregate Mops/s for @threads threads; -1 on a failed self-check. */
+static double
+run(unsigned threads, int mode)
+{
+	struct shared sh;
+	struct worker *w = (struct worker *)calloc(threads, sizeof(*w));
+	double mops = 0;
+	u64 slowest = 0;
+	int fail = 0;
+	unsigned i;
+
+	memset(&sh, 0, sizeof(sh));
+	sh.mode = mode;
+	pthread_mutex_init(&sh.lock, NULL);
+	pthread_barrier_init(&sh.start, NULL, threads);
+	if (!w || (mode == MAGAZINE ? slab_depot_init(&sh.depot, BLOCK, &policy)
+	                    : slab_init(&sh.slab, BLOCK, &policy))) {
+		fprintf(stderr, "init failed\n");
+		exit(1);
+	}
+
+	for (i = 0; i < threads; i++) {
+		w[i].sh = &sh;
+		w[i].seed = 0x9e3779b97f4a7c15ull * (i + 1);
+		pthread_create(&w[i].tid, NULL, worker_main, &w[i]);
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(w[i].tid, NULL);
+		fail |= w[i].fail;
+		if (w[i].ns > slowest)
+			slowest = w[i].ns;
+	}
+
+	/* every block has come back: nothing leaked, nothing doubled */
+	if (mode == MAGAZINE) {
+		slab_depot_reap(&sh.depot);
+		fail |= slab_used(&sh.depot.slab) != 0;
+		slab_depot_fini(&sh.depot);
+	} else {
+		fail |= slab_used(&sh.slab) != 0;
+		slab_fini(&sh.slab);
+	}
+	pthread_barrier_destroy(&sh.start);
+	pthread_mutex_destroy(&sh.lock);
+	free(w);
+
+	if (fail)
+		return -1;
+	if (slowest)
+		mops = (double)threads * OPS / ((double)slowest / 1e3);
+	return mops;
+}
+
+/* 1, 2, 3, 4, then doubling, and always @max itself */
+static unsigned
+next_threads(unsigned t, unsigned max)
+{
+	if (t < 4)
+		return t + 1;
+	if (t < max && t * 2 > max)
+		return max;
+	return t * 2;
+}
+
+int
+main(int argc, char **argv)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned max = argc > 1 ? (unsigned)strtoul(argv[1], NULL, 10)
+	                        : (unsigned)(cpus > 0 ? cpus : 1);
+	unsigned t;
+
+	if (!max)
+		max = 1;
+
+	printf("threads   mutex (Mops/s)   magazine (Mops/s)   lockfree (Mops/s)\n");
+	for (t = 1; t <= max; t = next_threads(t, max)) {
+		double a = run(t, MUTEX);
+		double b = run(t, MAGAZINE);
+		double c = run(t, LOCKFREE);
+		if (a < 0 || b < 0 || c < 0) {
+			fprintf(stderr, "threads=%u self-check FAIL\n", t);
+			return 1;
+		}
+		printf("%7u   %14.2f   %10.2f %5.2fx   %10.2f %5.2fx\n",
+		       t, a, b, b / a, c, c / a);
+	}
+	return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * Test and benchmark for the address-ordered mode of hpc/mem/slab.h
+ *
+ * What a spike leaves behind, both ways:
+ *
+ *   1. lifo     the default free list, the block freed last handed out next
+ *   2. ordered  slab_set_ordered(), the lowest free index handed out next
+ *
+ * The workload is a service with a steady live set of BASE blocks, churning -
+ * a replacement allocated and a random live block freed, each stamped on
+ * allocation and checked on free - that takes a spike to SPIKE times as many
+ * and comes back down: the spike blocks are allocated while the base set keeps
+ * churning, then freed in random order while it still does. From then on the
+ * churn goes on alone, and after every BASE replacements (one turnover of the
+ * live set) slab_gc() runs under a policy that releases every free tail grain.
+ *
+ * Reports, per turnover, the committed and the resident size of each slab -
+ * resident read with mincore() over the reservation, so it is what the
+ * kernel really holds - and the mean cost of one churn step (a free and an
+ * allocation) in each mode, the price the ordered mode pays for its search.
+ * `slab_ordered <BASE>` sets the live set (default 16 Ki blocks of 256 bytes).
+ */
+
+#include <hpc/compiler.h>
+#include <mem/slab.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+enum {
+	BLOCK     = 256,
+	SPIKE     = 16,
+	TURNOVERS = 8,
+};
+
+static inline u64
+ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static u64 rng_state;
+
+static inline u32
+xrand(u32 n)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (u32)(rng_state % n);
+}
+
+struct result {
+	double peak;                  /* committed MiB at the top of the spike */
+	double committed[TURNOVERS];  /* MiB after each turnover's gc          */
+	double resident[TURNOVERS];
+	double churn_ns;              /* mean per free + alloc                 */
+	int fail;
+};
+
+static double
+resident_mib(struct slab *slab)
+{
+	size_t pg = (size_t)sysconf(_SC_PAGESIZE);
+	uintptr_t a = align_to((uintptr_t)slab->page, pg);
+	uintptr_t b = ((uintptr_t)slab->page + slab->length) & ~(pg - 1);
+	size_t n = (b - a) / pg, i, in = 0;
+	unsigned char *vec = (unsigned char *)malloc(n ? n : 1);
+
+	if (!vec || mincore((void *)a, b - a, vec)) {
+		free(vec);
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+		in += vec[i] & 1;
+	free(vec);
+	return (double)(in * pg) / (1 << 20);
+}
+
+static inline double
+committed_mib(struct slab *slab)
+{
+	return (double)slab_committed_bytes(slab) / (1 << 20);
+}
+
+static inline void *
+get(struct slab *slab, u32 tag, struct result *r)
+{
+	u32 *p = (u32 *)slab_alloc(slab);
+	if (!p)
+		r->fail = 1;
+	else
+		*p = tag;
+	return p;
+}
+
+static inline void
+put(struct slab *slab, void *p, u32 tag, struct result *r)
+{
+	if (*(u32 *)p != tag)
+		r->fail = 1;
+	slab_free(slab, p);
+}
+
+/*
+ * Replace one random block of the base set: the new one arrives before the old
+ * one leaves, so a LIFO slab hands out whatever was freed last, not the block
+ * being replaced.
+ */
+static inline void
+churn(struct slab *slab, void **live, u32 base, u32 *serial, struct result *r)
+{
+	u32 k = xrand(base);
+	void *old = live[k];
+	live[k] = get(slab, serial[k] + 1, r);
+	put(slab, old, serial[k]++, r);
+}
+
+static int
+run(u32 base, bool ordered, struct result *r)
+{
+	u32 spike = base * SPIKE, i, t;
+	struct slab_policy pol = {
+		.min = 0, .max = base + spike + 1, .grow_step = 1024,
+		.shrink_usage_pct = 90, .shrink_release_pct = 100,
+	};
+	void **live = (void **)calloc(base, sizeof(void *));
+	void **peak = (void **)calloc(spike, sizeof(void *));
+	u32 *serial = (u32 *)calloc(base, sizeof(u32));
+	struct slab slab;
+	u64 ns = 0, t0;
+
+	memset(r, 0, sizeof(*r));
+	rng_state = 0x2545f4914f6cdd1dull;
+	if (!live || !peak || !serial || slab_init(&slab, BLOCK, &pol) ||
+	    slab_set_ordered(&slab, ordered))
+		return -1;
+
+	for (i = 0; i < base; i++)
+		live[i] = get(&slab, 0, r);
+
+	/* up: the spike arrives while the base set churns */
+	for (i = 0; i < spike; i++) {
+		peak[i] = get(&slab, ~0u, r);
+		churn(&slab, live, base, serial, r);
+	}
+	r->peak = committed_mib(&slab);
+
+	/* down: the spike leaves in random order, the churn goes on */
+	for (i = spike; i > 0; i--) {
+		u32 k = xrand(i);
+		put(&slab, peak[k], ~0u, r);
+		peak[k] = peak[i - 1];
+		churn(&slab, live, base, serial, r);
+	}
+
+	/* after: turnovers of the base set, a gc after each */
+	for (t = 0; t < TURNOVERS; t++) {
+		t0 = ns_now();
+		for (i = 0; i < base; i++)
+			churn(&slab, live, base, serial, r);
+		ns += ns_now() - t0;
+		while (slab_gc(&slab, 0) < 0)
+			;
+		r->committed[t] = committed_mib(&slab);
+		r->resident[t] = resident_mib(&slab);
+	}
+	r->churn_ns = (double)ns / ((double)base * TURNOVERS);
+	if (slab_used(&slab) != base)
+		r->fail = 1;
+
+	slab_fini(&slab);
+	free(live);
+	free(peak);
+	free(serial);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	u32 base = argc > 1 ? (u32)strtoul(argv[1], NULL, 0) : 16384;
+	struct result lifo, ordered;
+	unsigned t;
+
+	if (run(base, false, &lifo) || run(base, true, &ordered)) {
+		fprintf(stderr, "slab init FAIL\n");
+		return 1;
+	}
+	if (lifo.fail || ordered.fail) {
+		fprintf(stderr, "block stamp self-check FAIL\n");
+		return 1;
+	}
+
+	printf("%u live blocks of %u bytes (%.1f MiB), spike to %ux: "
+	       "lifo %.1f MiB, ordered %.1f MiB committed\n\n", base, BLOCK,
+	       (double)base * BLOCK / (1 << 20), SPIKE + 1, lifo.peak,
+	       ordered.peak);
+	printf("%9s  %15s %15s  %15s %15s\n", "turnover", "lifo committed",
+	       "lifo resident", "ord committed", "ord resident");
+	for (t = 0; t < TURNOVERS; t++)
+		printf("%9u  %11.1f MiB %11.1f MiB  %11.1f MiB %11.1f MiB\n",
+		       t + 1, lifo.committed[t], lifo.resident[t],
+		       ordered.committed[t], ordered.resident[t]);
+	printf("\nfree + alloc: lifo %.1f ns, ordered %.1f ns (%.2fx)\n",
+	       lifo.churn_ns, ordered.churn_ns,
+	       ordered.churn_ns / lifo.churn_ns);
+	return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Test and benchmark for slab_prefault() in hpc/mem/slab.h
+ *
+ * What the allocation path pays for the memory behind a grow, both ways:
+ *
+ *   1. demand    the slab grows on exhaustion, and the allocation that grows
+ *                it and the caller's first write take the page faults
+ *   2. ahead     an idle loop calls slab_prefault() between bursts, so the
+ *                blocks are committed and resident before they are asked for
+ *
+ * The workload is bursts of B allocations, each block written whole the way a
+ * receive buffer is, with an idle gap between bursts in which the second way
+ * spends a budget of pages on slab_prefault(), keeping a burst and a half of
+ * blocks ahead. Only the bursts are timed, and only their minor faults
+ * (getrusage) counted, so what the idle loop does is out of both figures - it
+ * is the point of moving work there. Blocks are kept, so every burst needs
+ * fresh memory.
+ *
+ * Reports minor faults and ns per allocation (mean, 99th percentile, max) for
+ * 2 KiB and 16 KiB blocks, and the faults the measure says were avoided on a
+ * CONFIG_MEASURE build. `slab_prefault <MiB>` sets the memory per run
+ * (default 256 MiB).
+ */
+
+#include <hpc/compiler.h>
+#include <mem/slab.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+enum {
+	BURST  = 64,          /* allocations per burst                        */
+	BUDGET = 1024,        /* pages slab_prefault() may populate per gap   */
+};
+
+static inline u64
+ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static inline long
+minflt(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_minflt;
+}
+
+static int
+cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+	return x < y ? -1 : x > y;
+}
+
+struct result {
+	long faults;          /* minor faults inside the bursts               */
+	double mean;          /* ns per allocation                            */
+	u32 p99, max;
+	u64 avoided;          /* the prefault measure                         */
+	int fail;
+};
+
+static int
+run(unsigned bsize, u32 n, bool ahead, struct result *r)
+{
+	struct slab_policy pol = {
+		.min = 0, .max = n, .grow_step = 256,
+	};
+	struct slab_measure m;
+	u32 *lat = (u32 *)calloc(n, sizeof(u32));
+	struct slab slab;
+	u64 total = 0;
+	u32 i, k;
+
+	memset(r, 0, sizeof(*r));
+	memset(&m, 0, sizeof(m));
+	if (!lat || slab_init(&slab, bsize, &pol))
+		return -1;
+	/* a burst and a half ahead, in grains */
+	pol.prefault = ahead ? (3 * BURST / 2 + slab_grain(&slab) - 1) /
+	                       slab_grain(&slab) : 0;
+	slab_set_policy(&slab, &pol);
+#ifdef CONFIG_MEASURE
+	slab.measure = &m;
+#endif
+	for (i = 0; i < n; i += BURST) {
+		long f0;
+		/* the idle gap */
+		while (slab_prefault(&slab, BUDGET))
+			;
+		f0 = minflt();
+		for (k = i; k < i + BURST && k < n; k++) {
+			u64 t0 = ns_now();
+			void *p = slab_alloc(&slab);
+			if (!p) {
+				r->fail = 1;
+				break;
+			}
+			memset(p, (int)k, bsize);
+			lat[k] = (u32)(ns_now() - t0);
+			total += lat[k];
+		}
+		r->faults += minflt() - f0;
+	}
+	qsort(lat, n, sizeof(u32), cmp_u32);
+	r->mean = (double)total / n;
+	r->p99 = lat[(u64)n * 99 / 100];
+	r->max = lat[n - 1];
+#ifdef CONFIG_MEASURE
+	r->avoided = m.prefault;
+#endif
+	slab_fini(&slab);
+	free(lat);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const unsigned bsize[] = { 2048, 16384 };
+	size_t mib = argc > 1 ? strtoul(argv[1], NULL, 0) : 256;
+	struct result d, a;
+	unsigned b;
+
+	printf("%zu MiB of blocks per run, bursts of %u, %u pages per gap\n\n",
+	       mib, BURST, BUDGET);
+	printf("%6s %-7s %9s %9s %9s %9s %9s\n", "block", "", "faults",
+	       "mean ns", "p99 ns", "max ns", "avoided");
+	for (b = 0; b < sizeof(bsize) / sizeof(bsize[0]); b++) {
+		u32 n = (u32)((mib << 20) / bsize[b]);
+		if (run(bsize[b], n, false, &d) || run(bsize[b], n, true, &a)) {
+			fprintf(stderr, "slab init FAIL\n");
+			return 1;
+		}
+		if (d.fail || a.fail) {
+			fprintf(stderr, "block %u: allocation FAIL\n", bsize[b]);
+			return 1;
+		}
+		printf("%5uK %-7s %9ld %9.1f %9u %9u %9s\n", bsize[b] >> 10,
+		       "demand", d.faults, d.mean, d.p99, d.max, "");
+		printf("%6s %-7s %9ld %9.1f %9u %9u", "", "ahead", a.faults,
+		       a.mean, a.p99, a.max);
+		if (measure_available)
+			printf(" %9llu\n", (unsigned long long)a.avoided);
+		else
+			printf(" %9s\n", "n/a");
+	}
+	return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Test and benchmark for the tiered reclaim of hpc/mem/slab.h
+ *
+ * What shrink/grow thrash costs, by how a shrink hands its pages back:
+ *
+ *   1. dontneed  MADV_DONTNEED at once, the default
+ *   2. free      MADV_FREE, policy.reclaim = SLAB_RECLAIM_FREE
+ *
+ * The workload is bursty: a burst takes N blocks and writes each whole, the
+ * dip after it frees them all, and slab_gc() shrinks the slab back to its
+ * minimum before the next burst. With the first way every burst faults its
+ * memory back in; with the second the pages are still there unless the host
+ * needed them meanwhile, and the burst writes into them without a fault. The
+ * tail is never old enough here to reach the later tiers. Every block is
+ * checked to hold the burst's stamp before the dip.
+ *
+ * Reports minor faults and ns per block of a burst, and the blocks the measure
+ * saw rewarmed on a CONFIG_MEASURE build, for 2 KiB and 16 KiB blocks.
+ * `slab_reclaim <MiB>` sets the burst size (default 64 MiB), `<MiB> <bursts>`
+ * the number of bursts (default 20).
+ */
+
+#include <hpc/compiler.h>
+#include <mem/slab.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+static inline u64
+ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static inline long
+minflt(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_minflt;
+}
+
+struct result {
+	double faults;        /* per burst                                    */
+	double ns;            /* per block of a burst                         */
+	u64 rewarm;           /* the measure, over all bursts                 */
+	int fail;
+};
+
+static int
+run(unsigned bsize, u32 n, u32 bursts, u8 reclaim, struct result *r)
+{
+	struct slab_policy pol = {
+		.min = 0, .max = n, .grow_step = 256, .shrink_usage_pct = 10,
+		.shrink_release_pct = 100, .reclaim = reclaim,
+	};
+	void **blk = (void **)calloc(n, sizeof(void *));
+	struct slab_measure m;
+	struct slab slab;
+	u64 ns = 0;
+	long faults = 0;
+	u32 b, i;
+
+	memset(r, 0, sizeof(*r));
+	memset(&m, 0, sizeof(m));
+	if (!blk || slab_init(&slab, bsize, &pol))
+		return -1;
+#ifdef CONFIG_MEASURE
+	slab.measure = &m;
+#endif
+	for (b = 0; b < bursts; b++) {
+		long f0 = minflt();
+		u64 t0 = ns_now();
+		for (i = 0; i < n; i++) {
+			if (!(blk[i] = slab_alloc(&slab))) {
+				r->fail = 1;
+				break;
+			}
+			memset(blk[i], (int)b, bsize);
+		}
+		ns += ns_now() - t0;
+		faults += minflt() - f0;
+		for (i = 0; i < n && !r->fail; i++)
+			r->fail |= *((u8 *)blk[i] + bsize - 1) != (u8)b;
+		if (r->fail)
+			break;
+		slab_free_bulk(&slab, blk, n);
+		slab_gc(&slab, b);
+		r->fail |= slab_committed(&slab) != 0;
+	}
+	r->faults = (double)faults / bursts;
+	r->ns = (double)ns / ((double)bursts * n);
+#ifdef CONFIG_MEASURE
+	r->rewarm = m.rewarm;
+#endif
+	slab_fini(&slab);
+	free(blk);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const unsigned bsize[] = { 2048, 16384 };
+	size_t mib = argc > 1 ? strtoul(argv[1], NULL, 0) : 64;
+	u32 bursts = argc > 2 ? (u32)strtoul(argv[2], NULL, 0) : 20;
+	struct result z, f;
+	unsigned b;
+
+	printf("bursts of %zu MiB, %u of them, shrunk to nothing in between\n\n",
+	       mib, bursts);
+	printf("%6s %-9s %14s %12s %12s\n", "block", "", "faults/burst",
+	       "ns/block", "rewarmed");
+	for (b = 0; b < sizeof(bsize) / sizeof(bsize[0]); b++) {
+		u32 n = (u32)((mib << 20) / bsize[b]);
+		if (run(bsize[b], n, bursts, SLAB_RECLAIM_DONTNEED, &z) ||
+		    run(bsize[b], n, bursts, SLAB_RECLAIM_FREE, &f)) {
+			fprintf(stderr, "slab init FAIL\n");
+			return 1;
+		}
+		if (z.fail || f.fail) {
+			fprintf(stderr, "block %u: burst self-check FAIL\n",
+			        bsize[b]);
+			return 1;
+		}
+		printf("%5uK %-9s %14.0f %12.1f %12s\n", bsize[b] >> 10,
+		       "dontneed", z.faults, z.ns, "");
+		printf("%6s %-9s %14.0f %12.1f", "", "free", f.faults, f.ns);
+		if (measure_available)
+			printf(" %12llu\n", (unsigned long long)f.rewarm);
+		else
+			printf(" %12s\n", "n/a");
+	}
+	return 0;
+}
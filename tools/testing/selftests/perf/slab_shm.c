@@ -0,0 +1,243 @@
+/*
+ * Benchmark for the cross-process shared slab of hpc/mem/slab_shm.h
+ *
+ * A producer process hands messages to a consumer process, forked from it,
+ * two ways:
+ *
+ *   1. socket  write() of the message into a unix stream socketpair, read()
+ *              into the consumer's buffer: the payload is copied into the
+ *              kernel and out again, and every message is two syscalls
+ *   2. shm     slab_shm_alloc_wait() of a block in the shared memfd, the
+ *              payload written in place, slab_shm_send() of its index; the
+ *              consumer slab_shm_recv()s it, reads it where it lies and
+ *              slab_shm_free()s it. Syscalls only to wake a sleeper.
+ *
+ * Both write every byte of the payload on one side and read every byte on the
+ * other, so what differs is the copy and the syscalls. The shm slab has 256
+ * blocks, so the producer runs at most that far ahead and then waits for the
+ * consumer's frees, much as a full socket buffer stops the writer. Each
+ * message carries its sequence number, which the consumer checks and folds
+ * into a sum it returns through a pipe: that is the self-check.
+ *
+ * On a single CPU the two sides take turns and every hand-off that finds the
+ * other asleep costs a futex wake; the shm path still saves the copies and
+ * half the syscalls. With a CPU each, waiters spin first (SLAB_SHM_SPIN).
+ *
+ *   slab_shm                  1 GiB or 2M messages per size, whichever first
+ *   slab_shm <MiB>            that many MiB per size
+ */
+
+#include <hpc/compiler.h>
+#include <mem/slab_shm.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define BLOCKS   256
+#define MAX_MSGS (2u << 20)
+
+enum { SOCKET, SHM };
+static const char *mode_name[] = { "socket", "shm" };
+
+static inline u64
+ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+/* Fill the payload: the sequence number first, then a pattern of it. */
+static inline void
+msg_write(u64 *p, u32 size, u64 seq)
+{
+	for (u32 i = 0; i < size / 8; i++)
+		p[i] = seq + i;
+}
+
+/* Read every word; returns the sum, or ~0 when the sequence is not @seq. */
+static inline u64
+msg_read(const u64 *p, u32 size, u64 seq)
+{
+	u64 sum = 0;
+	if (p[0] != seq)
+		return ~0ull;
+	for (u32 i = 0; i < size / 8; i++)
+		sum += p[i];
+	return sum;
+}
+
+static u64
+msg_sum(u32 size, u64 n)
+{
+	u64 sum = 0, w = size / 8;
+	for (u64 s = 0; s < n; s++)
+		sum += s * w + w * (w - 1) / 2;
+	return sum;
+}
+
+static int
+read_full(int fd, void *buf, size_t len)
+{
+	u8 *p = (u8 *)buf;
+	while (len) {
+		ssize_t r = read(fd, p, len);
+		if (r <= 0)
+			return -1;
+		p += r;
+		len -= (size_t)r;
+	}
+	return 0;
+}
+
+static int
+write_full(int fd, const void *buf, size_t len)
+{
+	const u8 *p = (const u8 *)buf;
+	while (len) {
+		ssize_t r = write(fd, p, len);
+		if (r <= 0)
+			return -1;
+		p += r;
+		len -= (size_t)r;
+	}
+	return 0;
+}
+
+static u64
+consume_socket(int fd, u32 size, u64 n)
+{
+	u64 *buf = (u64 *)aligned_alloc(64, size), sum = 0;
+	for (u64 s = 0; s < n; s++) {
+		u64 v;
+		if (read_full(fd, buf, size) ||
+		    (v = msg_read(buf, size, s)) == ~0ull) {
+			sum = ~0ull;
+			break;
+		}
+		sum += v;
+	}
+	free(buf);
+	return sum;
+}
+
+static u64
+consume_shm(int fd, u64 n)
+{
+	struct slab_shm sh;
+	u64 sum = 0;
+	u32 size;
+
+	if (slab_shm_attach(&sh, fd))
+		return ~0ull;
+	size = slab_shm_block_size(&sh);
+	for (u64 s = 0; s < n; s++) {
+		u64 *p = (u64 *)slab_shm_recv(&sh, 10000), v;
+		if (!p || (v = msg_read(p, size, s)) == ~0ull) {
+			sum = ~0ull;
+			break;
+		}
+		sum += v;
+		slab_shm_free(&sh, p);
+	}
+	slab_shm_detach(&sh);
+	return sum;
+}
+
+/* One run; returns the nanoseconds it took, 0 if the self-check failed. */
+static u64
+run(int mode, u32 size, u64 n)
+{
+	struct slab_shm sh;
+	int sv[2], res[2], status;
+	u64 t0, ns, sum = ~0ull;
+	u64 *buf = NULL;
+	pid_t pid;
+
+	if (pipe(res))
+		return 0;
+	if (mode == SOCKET) {
+		int sz = 4 << 20;
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+			return 0;
+		setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+		setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+		buf = (u64 *)aligned_alloc(64, size);
+	} else if (slab_shm_create(&sh, "perf-shm", size, BLOCKS)) {
+		perror("slab_shm_create");
+		return 0;
+	}
+
+	t0 = ns_now();
+	if (!(pid = fork())) {
+		sum = mode == SOCKET ? consume_socket(sv[1], size, n)
+		                     : consume_shm(slab_shm_fd(&sh), n);
+		_exit(write_full(res[1], &sum, sizeof(sum)) ? 1 : 0);
+	}
+	for (u64 s = 0; s < n; s++) {
+		if (mode == SOCKET) {
+			msg_write(buf, size, s);
+			if (write_full(sv[0], buf, size))
+				break;
+		} else {
+			u64 *p = (u64 *)slab_shm_alloc_wait(&sh, 10000);
+			if (!p)
+				break;
+			msg_write(p, size, s);
+			slab_shm_send(&sh, p);
+		}
+	}
+	if (read_full(res[0], &sum, sizeof(sum)))
+		sum = ~0ull;
+	ns = ns_now() - t0;
+	waitpid(pid, &status, 0);
+
+	if (mode == SOCKET) {
+		close(sv[0]);
+		close(sv[1]);
+		free(buf);
+	} else {
+		slab_shm_close(&sh);
+	}
+	close(res[0]);
+	close(res[1]);
+	return sum == msg_sum(size, n) ? ns : 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const u32 sizes[] = { 64, 1024, 16384, 65536 };
+	u64 bytes = (argc > 1 ? strtoull(argv[1], NULL, 0) : 1024) << 20;
+
+	if (!bytes)
+		return 2;
+	printf("%u blocks in the shared slab, %llu MiB per size\n\n", BLOCKS,
+	       (unsigned long long)(bytes >> 20));
+	printf("%-8s %-7s %10s %12s %10s %8s\n", "size", "mode", "msgs",
+	       "msgs/s", "GB/s", "ratio");
+	for (u32 i = 0; i < ARRAY_SIZE(sizes); i++) {
+		u64 n = __min(bytes / sizes[i], (u64)MAX_MSGS);
+		double base = 0;
+		for (int mode = SOCKET; mode <= SHM; mode++) {
+			u64 ns = run(mode, sizes[i], n);
+			if (!ns) {
+				fprintf(stderr, "%s %u self-check FAIL\n",
+				        mode_name[mode], sizes[i]);
+				return 1;
+			}
+			double rate = (double)n * 1e9 / (double)ns;
+			if (mode == SOCKET)
+				base = rate;
+			printf("%-8u %-7s %10llu %12.0f %10.2f %7.2fx\n", sizes[i],
+			       mode_name[mode], (unsigned long long)n, rate,
+			       rate * sizes[i] / 1e9, rate / base);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,281 @@
+/*
+ * Trace replay for the adaptive policy controller of hpc/mem/slab_tune.h
+ *
+ * Runs one alloc/free trace through two slabs:
+ *
+ *   1. fixed     a hand-tuned policy, as deployed
+ *   2. adaptive  the same policy as the starting point, with slab_tune_step()
+ *                deciding on every history row
+ *
+ * and reports, for each, the grow and shrink steps taken (the round trips the
+ * controller is there to cut), the allocations that failed, and the committed
+ * memory - peak, time-weighted mean, and time spent over the budget. The grow
+ * and shrink steps are counted from the committed set itself, so the numbers
+ * are the same in any build; the adaptive run needs a measure history to
+ * decide on, so without CONFIG_MEASURE it runs the fixed policy again.
+ *
+ * A trace is text, one event per line, `<ms> <+n|-n>`: at trace time ms,
+ * allocate n blocks, or free the n most recently allocated. '#' starts a
+ * comment. gc runs every 100 ms of trace time and a history row is saved every
+ * second. Without a trace the program makes its own: a day compressed into 24
+ * minutes, the base load following a diurnal curve, with a burst on top every
+ * few seconds that is gone half a second later.
+ *
+ *   slab_tune                  replay the synthetic day
+ *   slab_tune <trace>          replay a recorded trace
+ *   slab_tune -w <trace>       write the synthetic day out and exit
+ *   slab_tune -b <blocks>      RSS budget (default: peak load and a quarter)
+ */
+
+#include <hpc/compiler.h>
+#include <mem/slab.h>
+#include <mem/slab_tune.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BSIZE    4096
+#define GC_MS    100
+#define ROW_MS   1000
+#define MAXLIVE  (1u << 16)
+
+struct event {
+	timestamp_t at;
+	int n;
+};
+
+struct trace {
+	struct event *ev;
+	size_t count, cap;
+	u32 peak;             /* the most blocks live at once                 */
+};
+
+struct result {
+	u64 grows, shrinks, fails;
+	u32 peak;
+	double mean;          /* committed blocks, time-weighted              */
+	double over;          /* share of the time over the budget            */
+	u32 step;             /* the knobs at the end                         */
+	timestamp_t after;
+};
+
+static void
+trace_add(struct trace *t, timestamp_t at, int n)
+{
+	if (t->count == t->cap) {
+		t->cap = t->cap ? t->cap * 2 : 4096;
+		t->ev = realloc(t->ev, t->cap * sizeof(*t->ev));
+		if (!t->ev)
+			abort();
+	}
+	t->ev[t->count++] = (struct event){ .at = at, .n = n };
+}
+
+static void
+trace_peak(struct trace *t)
+{
+	long live = 0;
+	for (size_t i = 0; i < t->count; i++) {
+		live += t->ev[i].n;
+		if (live > (long)t->peak)
+			t->peak = (u32)live;
+	}
+}
+
+/* A day in 24 minutes: a diurnal base and short bursts on top of it. */
+static void
+trace_synth(struct trace *t)
+{
+	const timestamp_t day = 24 * 60 * 1000;
+	long base = 0, want;
+	unsigned seed = 1;
+
+	for (timestamp_t at = 0; at < day; at += GC_MS) {
+		double phase = sin(M_PI * (double)at / (double)day);
+		want = 200 + (long)(3000 * phase * phase);
+		if (want != base)
+			trace_add(t, at, (int)(want - base));
+		base = want;
+		if (at % 3000 == 0) {     /* a burst, gone 500 ms later */
+			int burst = 300 + (int)((seed = seed * 1103515245u + 12345u)
+			                        >> 16) % 1200;
+			trace_add(t, at + 1, burst);
+			trace_add(t, at + 500, -burst);
+		}
+	}
+	/* the bursts interleave with the base by time */
+	for (size_t i = 1; i < t->count; i++) {
+		struct event e = t->ev[i];
+		size_t j = i;
+		while (j && t->ev[j - 1].at > e.at) {
+			t->ev[j] = t->ev[j - 1];
+			j--;
+		}
+		t->ev[j] = e;
+	}
+}
+
+static int
+trace_read(struct trace *t, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[128];
+	unsigned long long at;
+	int n;
+
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (line[0] != '#' && sscanf(line, "%llu %d", &at, &n) == 2)
+			trace_add(t, (timestamp_t)at, n);
+	fclose(f);
+	return 0;
+}
+
+static int
+trace_write(struct trace *t, const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return -1;
+	fprintf(f, "# slab_tune trace: <ms> <+alloc|-free> blocks\n");
+	for (size_t i = 0; i < t->count; i++)
+		fprintf(f, "%llu %+d\n", (unsigned long long)t->ev[i].at,
+		        t->ev[i].n);
+	return fclose(f);
+}
+
+static int
+replay(struct trace *t, const struct slab_policy *pol, u32 budget,
+       bool adaptive, struct result *r)
+{
+	static struct slab_history hist;
+	struct slab_tune tune;
+	struct slab slab;
+	void **blk = calloc(MAXLIVE, sizeof(void *));
+	u32 live = 0, was;
+	timestamp_t now = 0, gc = GC_MS, end;
+	double area = 0, over = 0;
+	size_t i = 0;
+
+	memset(r, 0, sizeof(*r));
+	if (!blk || slab_init(&slab, BSIZE, pol))
+		return -1;
+	measure_history_init(slab, &hist, now);
+	measure_history_every(slab, &hist, ROW_MS, now);
+#ifdef CONFIG_MEASURE
+	slab.measure = measure_history_live(&hist);
+#endif
+	slab_tune_init(&tune, &slab, budget);
+	end = t->count ? t->ev[t->count - 1].at + GC_MS : 0;
+
+#define TALLY(_was) do { \
+	if (slab_committed(&slab) > (_was)) r->grows++; \
+	if (slab_committed(&slab) < (_was)) r->shrinks++; \
+} while (0)
+
+	for (now = 0; now <= end; now = gc, gc += GC_MS) {
+		for (; i < t->count && t->ev[i].at < gc; i++) {
+			int n = t->ev[i].n;
+			for (; n > 0 && live < MAXLIVE; n--) {
+				was = slab_committed(&slab);
+				if (!(blk[live] = slab_alloc(&slab))) {
+					r->fails++;
+					continue;
+				}
+				live++;
+				TALLY(was);
+			}
+			for (; n < 0 && live; n++)
+				slab_free(&slab, blk[--live]);
+		}
+		was = slab_committed(&slab);
+		slab_gc(&slab, gc);
+		TALLY(was);
+		if (measure_history_tick(slab, &hist, gc) && adaptive)
+			slab_tune_step(&tune, &slab, &hist);
+
+		area += slab_committed(&slab);
+		if (budget && slab_committed(&slab) > budget)
+			over++;
+		if (slab_committed(&slab) > r->peak)
+			r->peak = slab_committed(&slab);
+	}
+#undef TALLY
+	r->mean = area / (double)(end / GC_MS + 1);
+	r->over = over / (double)(end / GC_MS + 1);
+	r->step = slab.policy.grow_step;
+	r->after = slab.policy.shrink_after;
+	while (live)
+		slab_free(&slab, blk[--live]);
+	slab_fini(&slab);
+	free(blk);
+	return 0;
+}
+
+static void
+report(const char *name, struct result *r)
+{
+	printf("%-9s %8llu %8llu %6llu %8u %10.0f %7.1f%% %6u %8llu\n", name,
+	       (unsigned long long)r->grows, (unsigned long long)r->shrinks,
+	       (unsigned long long)r->fails, r->peak, r->mean, r->over * 100,
+	       r->step, (unsigned long long)r->after);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct slab_policy pol = {
+		.min = 0, .max = MAXLIVE, .grow_step = 16,
+		.shrink_usage_pct = 50, .shrink_release_pct = 50,
+		.shrink_after = 1000,
+	};
+	struct trace t = { 0 };
+	struct result f, a;
+	const char *out = NULL;
+	u32 budget = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "w:b:")) != -1) {
+		switch (c) {
+		case 'w': out = optarg; break;
+		case 'b': budget = (u32)strtoul(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "usage: %s [-w trace] [-b blocks] [trace]\n",
+			        argv[0]);
+			return 2;
+		}
+	}
+	if (optind < argc) {
+		if (trace_read(&t, argv[optind])) {
+			perror(argv[optind]);
+			return 1;
+		}
+	} else {
+		trace_synth(&t);
+	}
+	if (out)
+		return trace_write(&t, out) ? 1 : 0;
+	trace_peak(&t);
+	if (!budget)
+		budget = t.peak + t.peak / 4;
+
+	printf("%zu events, peak %u blocks of %u B, budget %u blocks%s\n\n",
+	       t.count, t.peak, BSIZE, budget,
+	       measure_history_depth ? "" : " (no measure history: adaptive"
+	                                    " runs fixed)");
+	printf("%-9s %8s %8s %6s %8s %10s %8s %6s %8s\n", "policy", "grows",
+	       "shrinks", "fails", "peak", "mean", "over", "step", "after");
+	if (replay(&t, &pol, budget, false, &f) ||
+	    replay(&t, &pol, budget, true, &a)) {
+		fprintf(stderr, "slab init FAIL\n");
+		return 1;
+	}
+	report("fixed", &f);
+	report("adaptive", &a);
+	free(t.ev);
+	return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * Test and benchmark for slab_zalloc() in hpc/mem/slab.h
+ *
+ * The cost of handing out zeroed blocks, both ways:
+ *
+ *   1. memset  slab_alloc() and a memset() of the whole block
+ *   2. zalloc  slab_zalloc(), clearing only the blocks that may be dirty
+ *
+ * Each run takes N blocks from a fresh slab (the grow is part of it, as it is
+ * for a real consumer), then writes, frees and takes them all again - the first
+ * pass is all fresh blocks, the second all recycled ones, so the second is
+ * where the two ways should cost the same. After the
+ * first pass the resident size of the reservation is read with mincore(): the
+ * memset faults in every page of every block, the zalloc only the page its
+ * free-list link is on. Blocks are checked to read zero after both passes.
+ *
+ * Reports ns per block for each pass and the resident MiB after the fresh one,
+ * for 2 KiB and 16 KiB blocks. `slab_zalloc <MiB>` sets the payload per run
+ * (default 256 MiB).
+ */
+
+#include <hpc/compiler.h>
+#include <mem/slab.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static inline u64
+ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+struct result {
+	double fresh_ns;      /* per block, first pass                        */
+	double recycled_ns;   /* per block, second pass                       */
+	double resident;      /* MiB after the first pass                     */
+	int fail;
+};
+
+static double
+resident_mib(struct slab *slab)
+{
+	size_t pg = (size_t)sysconf(_SC_PAGESIZE);
+	size_t n = (size_t)(slab->length + pg - 1) / pg, i, in = 0;
+	unsigned char *vec = (unsigned char *)malloc(n ? n : 1);
+
+	if (!vec || mincore(slab->page, (size_t)slab->length, vec)) {
+		free(vec);
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+		in += vec[i] & 1;
+	free(vec);
+	return (double)(in * pg) / (1 << 20);
+}
+
+/* A block reads zero: its first and last word and a word every page. */
+static inline int
+dirty(const u8 *p, size_t len)
+{
+	size_t off;
+	for (off = 0; off < len; off += 4096)
+		if (*(const u32 *)(p + off))
+			return 1;
+	return *(const u32 *)(p + len - sizeof(u32)) != 0;
+}
+
+static inline void *
+get(struct slab *slab, size_t bsize, bool zalloc)
+{
+	void *p;
+	if (zalloc)
+		return slab_zalloc(slab);
+	if ((p = slab_alloc(slab)))
+		memset(p, 0, bsize);
+	return p;
+}
+
+static int
+run(unsigned bsize, u32 n, bool zalloc, struct result *r)
+{
+	struct slab_policy pol = { .min = 0, .max = n, .grow_step = 64 };
+	void **blk = (void **)calloc(n, sizeof(void *));
+	struct slab slab;
+	u32 i;
+	u64 t0;
+
+	memset(r, 0, sizeof(*r));
+	if (!blk || slab_init(&slab, bsize, &pol))
+		return -1;
+
+	t0 = ns_now();
+	for (i = 0; i < n; i++)
+		if (!(blk[i] = get(&slab, bsize, zalloc)))
+			r->fail = 1;
+	r->fresh_ns = (double)(ns_now() - t0) / n;
+	r->resident = resident_mib(&slab);
+	for (i = 0; i < n && !r->fail; i++)
+		r->fail |= dirty((u8 *)blk[i], bsize);
+
+	/* dirty every block the caller's way, return them, take them again */
+	for (i = 0; i < n && !r->fail; i++) {
+		memset(blk[i], 0x5a, bsize);
+		slab_free(&slab, blk[i]);
+	}
+	t0 = ns_now();
+	for (i = 0; i < n && !r->fail; i++)
+		if (!(blk[i] = get(&slab, bsize, zalloc)))
+			r->fail = 1;
+	r->recycled_ns = (double)(ns_now() - t0) / n;
+	for (i = 0; i < n && !r->fail; i++)
+		r->fail |= dirty((u8 *)blk[i], bsize);
+
+	slab_fini(&slab);
+	free(blk);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const unsigned bsize[] = { 2048, 16384 };
+	size_t mib = argc > 1 ? strtoul(argv[1], NULL, 0) : 256;
+	struct result ms, za;
+	unsigned b;
+
+	printf("%zu MiB of blocks per run, %s backend\n\n", mib,
+	       SLAB_VM_ZEROES ? "zeroing" : "non-zeroing");
+	printf("%6s  %10s %10s  %10s %10s  %11s %11s\n", "block", "memset",
+	       "zalloc", "memset", "zalloc", "memset", "zalloc");
+	printf("%6s  %21s  %21s  %23s\n", "", "fresh ns/block",
+	       "recycled ns/block", "resident MiB");
+	for (b = 0; b < sizeof(bsize) / sizeof(bsize[0]); b++) {
+		u32 n = (u32)((mib << 20) / bsize[b]);
+		if (run(bsize[b], n, false, &ms) || run(bsize[b], n, true, &za)) {
+			fprintf(stderr, "slab init FAIL\n");
+			return 1;
+		}
+		if (ms.fail || za.fail) {
+			fprintf(stderr, "block %u: zero self-check FAIL\n",
+			        bsize[b]);
+			return 1;
+		}
+		printf("%5uK  %10.1f %10.1f  %10.1f %10.1f", bsize[b] >> 10,
+		       ms.fresh_ns, za.fresh_ns, ms.recycled_ns,
+		       za.recycled_ns);
+		/* mincore() wants a page-aligned mapping: not from the heap */
+		if (ms.resident < 0 || za.resident < 0)
+			printf("  %11s %11s\n", "n/a", "n/a");
+		else
+			printf("  %11.1f %11.1f\n", ms.resident, za.resident);
+	}
+	return 0;
+}
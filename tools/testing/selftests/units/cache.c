@@ -0,0 +1,271 @@
+/*
+ * Unit tests for the expiring page cache, <mem/cache.h>.
+ *
+ * The cache is used as a response cache would use it: bodies of every size
+ * stored as runs of pages, dropped by their owner or expired by a reap, the
+ * pages of one size taken by the next run of another. The units check that
+ * runs split and merge back, that expiry follows the TTL and the idle window
+ * with the expire hook called on every reaped run, that a gc leaves exactly
+ * @keep pages resident and gives the rest back, and that room split between
+ * dirty and released runs is found by releasing the dirty ones.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <hpc/compiler.h>
+#include <mem/cache.h>
+
+#define PAGE  4096
+
+static u8 *
+at(struct mm_cache *c, u32 index)
+{
+	return (u8 *)get_page(&c->pages, index);
+}
+
+/* Is the page resident? */
+static bool
+resident(void *page)
+{
+	unsigned char vec = 0;
+	assert_int_equal(mincore(page, PAGE, &vec), 0);
+	return vec & 1;
+}
+
+static void
+test_split_merge(void **state)
+{
+	(void)state;
+	struct mm_cache_measure m = { 0 };
+	struct mm_cache c;
+	struct page *p[4];
+
+	assert_int_equal(mm_cache_init(&c, 12, 64, NULL), 0);
+#ifdef CONFIG_MEASURE
+	c.measure = &m;
+#endif
+	(void)m;
+	assert_int_equal(mm_cache_clean(&c), 64);
+
+	/* first fit from the front, whole pages */
+	assert_ptr_equal(p[0] = mm_cache_alloc(&c, 1, 0), at(&c, 0));
+	assert_ptr_equal(p[1] = mm_cache_alloc(&c, PAGE, 0), at(&c, 1));
+	assert_ptr_equal(p[2] = mm_cache_alloc(&c, PAGE + 1, 0), at(&c, 2));
+	assert_ptr_equal(p[3] = mm_cache_alloc(&c, 3 * PAGE, 0), at(&c, 4));
+	assert_int_equal(mm_cache_size(&c, p[0]), PAGE);
+	assert_int_equal(mm_cache_size(&c, p[2]), 2 * PAGE);
+	assert_int_equal(mm_cache_size(&c, p[3]), 3 * PAGE);
+	assert_int_equal(mm_cache_used(&c), 7);
+	assert_int_equal(mm_cache_live(&c), 4);
+	for (u32 i = 0; i < 4; i++)
+		memset(p[i], 0x10 + i, mm_cache_size(&c, p[i]));
+
+	/* freed neighbours merge into one dirty run */
+	mm_cache_free(&c, p[1]);
+	mm_cache_free(&c, p[2]);
+	assert_int_equal(mm_cache_dirty(&c), 3);
+	assert_int_equal(c.run[1].pages, 3);
+	assert_ptr_equal(mm_cache_alloc(&c, 3 * PAGE, 0), at(&c, 1));
+	assert_int_equal(mm_cache_dirty(&c), 0);
+
+	/* a run too big for the array, and sizes whose page count wraps */
+	assert_null(mm_cache_alloc(&c, 65 * PAGE, 0));
+	assert_null(mm_cache_alloc(&c, SIZE_MAX - 100, 0));
+	assert_null(mm_cache_alloc(&c, SIZE_MAX, 0));
+	assert_int_equal(((u8 *)p[3])[3 * PAGE - 1], 0x13);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.alloc, 5);
+	assert_int_equal(m.free, 2);
+	assert_int_equal(m.merge, 1);
+	assert_int_equal(m.fail, 3);
+	assert_int_equal(m.used, 7);
+	assert_int_equal(m.total, 64);
+#endif
+	mm_cache_fini(&c);
+}
+
+static void
+test_reuse_across_sizes(void **state)
+{
+	(void)state;
+	struct mm_cache c;
+	struct page *p[16], *big;
+
+	assert_int_equal(mm_cache_init(&c, 12, 32, NULL), 0);
+	for (u32 i = 0; i < 16; i++)
+		p[i] = mm_cache_alloc(&c, 100 + i, 0);
+	for (u32 i = 0; i < 16; i += 2)
+		mm_cache_free(&c, p[i]);
+	for (u32 i = 1; i < 16; i += 2)
+		mm_cache_free(&c, p[i]);
+	assert_int_equal(mm_cache_dirty(&c), 16);
+	assert_int_equal(mm_cache_live(&c), 0);
+
+	/* the sixteen single pages come back as one run, dirty before clean */
+	big = mm_cache_alloc(&c, 16 * PAGE, 0);
+	assert_ptr_equal(big, p[0]);
+	mm_cache_free(&c, big);
+
+	/* and as two runs of eight, then eight of two */
+	assert_ptr_equal(mm_cache_alloc(&c, 8 * PAGE, 0), at(&c, 0));
+	assert_ptr_equal(mm_cache_alloc(&c, 8 * PAGE, 0), at(&c, 8));
+	for (u32 i = 0; i < 8; i++)
+		assert_non_null(mm_cache_alloc(&c, 2 * PAGE, 0));
+	assert_null(mm_cache_alloc(&c, 1, 0));
+	assert_int_equal(mm_cache_used(&c), 32);
+	mm_cache_fini(&c);
+}
+
+struct expired {
+	struct page *page[8];
+	u32 n;
+};
+
+static void
+on_expire(void *arg, struct page *page)
+{
+	struct expired *e = (struct expired *)arg;
+	e->page[e->n++] = page;
+}
+
+static void
+test_expiry(void **state)
+{
+	(void)state;
+	struct expired e = { .n = 0 };
+	struct mm_cache_policy pol = {
+		.ttl = 100, .idle = 0, .expire = on_expire, .arg = &e,
+	};
+	struct mm_cache c;
+	struct page *a, *b, *d;
+
+	assert_int_equal(mm_cache_init(&c, 12, 32, &pol), 0);
+	a = mm_cache_alloc(&c, 5 * PAGE, 0);          /* TTL 100 */
+	b = mm_cache_alloc_ex(&c, PAGE, 0, 0, 50);    /* idle 50 */
+	d = mm_cache_alloc_ex(&c, PAGE, 0, 0, 0);     /* forever  */
+
+	assert_true(mm_cache_touch(&c, b, 40));
+	assert_int_equal(mm_cache_reap(&c, 80), 0);
+	assert_true(mm_cache_expired(&c, b, 90));
+	assert_false(mm_cache_touch(&c, b, 90));
+	assert_int_equal(mm_cache_reap(&c, 95), 1);
+	assert_ptr_equal(e.page[0], b);
+	assert_int_equal(mm_cache_reap(&c, 100), 1);
+	assert_ptr_equal(e.page[1], a);
+	assert_int_equal(mm_cache_live(&c), 1);
+
+	/* a deadline set by hand, and one lifted */
+	mm_cache_expires(&c, d, 150);
+	assert_int_equal(mm_cache_reap(&c, 149), 0);
+	mm_cache_expires(&c, d, 0);
+	assert_int_equal(mm_cache_reap(&c, 1000), 0);
+	mm_cache_expires(&c, d, 10);
+	assert_int_equal(mm_cache_reap(&c, 1000), 1);
+	assert_ptr_equal(e.page[2], d);
+	assert_int_equal(mm_cache_live(&c), 0);
+	assert_int_equal(mm_cache_used(&c), 0);
+
+	/* reaped pages are as good as freed ones */
+	assert_ptr_equal(mm_cache_alloc(&c, 7 * PAGE, 2000), at(&c, 0));
+	mm_cache_fini(&c);
+}
+
+static void
+test_gc_keep(void **state)
+{
+	(void)state;
+	struct mm_cache_measure m = { 0 };
+	struct mm_cache_policy pol = { .ttl = 10, .keep = 4 };
+	struct mm_cache c;
+	struct page *p[8];
+	u32 i;
+
+	assert_int_equal(mm_cache_init(&c, 12, 32, &pol), 0);
+#ifdef CONFIG_MEASURE
+	c.measure = &m;
+#endif
+	(void)m;
+	for (i = 0; i < 8; i++) {
+		p[i] = mm_cache_alloc(&c, 2 * PAGE, 0);
+		memset(p[i], 0x5a, 2 * PAGE);
+	}
+	for (i = 0; i < 16; i++)
+		assert_true(resident(at(&c, i)));
+
+	/* everything expires; four pages stay resident, twelve go back */
+	assert_int_equal(mm_cache_gc(&c, 10), 12);
+	assert_int_equal(mm_cache_live(&c), 0);
+	assert_int_equal(mm_cache_dirty(&c), 4);
+	assert_int_equal(mm_cache_clean(&c), 28);
+	for (i = 0; i < 4; i++) {
+		assert_true(resident(at(&c, i)));
+		assert_int_equal(at(&c, i)[0], 0x5a);
+	}
+	for (i = 4; i < 16; i++) {
+		assert_false(resident(at(&c, i)));
+		assert_int_equal(at(&c, i)[PAGE - 1], 0);
+	}
+
+	/* the dirty pages go first, then released ones merged back whole */
+	assert_ptr_equal(mm_cache_alloc(&c, 4 * PAGE, 20), at(&c, 0));
+	assert_ptr_equal(mm_cache_alloc(&c, 28 * PAGE, 20), at(&c, 4));
+	assert_int_equal(mm_cache_gc(&c, 20), 0);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.expire, 8);
+	assert_int_equal(m.release, 12);
+	assert_int_equal(m.dirty, 0);
+	assert_int_equal(m.clean, 0);
+	assert_int_equal(m.used, 32);
+#endif
+	mm_cache_fini(&c);
+}
+
+static void
+test_purge(void **state)
+{
+	(void)state;
+	struct mm_cache_measure m = { 0 };
+	struct mm_cache c;
+	struct page *a, *b;
+
+	assert_int_equal(mm_cache_init(&c, 12, 16, NULL), 0);
+#ifdef CONFIG_MEASURE
+	c.measure = &m;
+#endif
+	(void)m;
+	a = mm_cache_alloc(&c, 8 * PAGE, 0);
+	b = mm_cache_alloc(&c, 4 * PAGE, 0);
+	assert_int_equal(mm_cache_clean(&c), 4);
+
+	/* four dirty pages next to four clean ones: neither run takes eight */
+	mm_cache_free(&c, b);
+	assert_int_equal(mm_cache_dirty(&c), 4);
+	assert_ptr_equal(mm_cache_alloc(&c, 8 * PAGE, 0), at(&c, 8));
+	assert_int_equal(mm_cache_dirty(&c), 0);
+	assert_int_equal(mm_cache_clean(&c), 0);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.purge, 1);
+	assert_int_equal(m.release, 4);
+#endif
+	mm_cache_free(&c, a);
+	mm_cache_fini(&c);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_split_merge),
+		cmocka_unit_test(test_reuse_across_sizes),
+		cmocka_unit_test(test_expiry),
+		cmocka_unit_test(test_gc_keep),
+		cmocka_unit_test(test_purge),
+	};
+	return cmocka_run_group_tests_name("cache", tests, NULL, NULL);
+}
@@ -0,0 +1,161 @@
+/*
+ * Unit tests for the buffer hash backends of <hpc/hash/fn.h>.
+ *
+ * The units check hash_crc32c() against the published CRC-32C check values and
+ * that it chains; that hash_clhash() tells apart every length of one buffer,
+ * the zero padding and the 1 KiB block boundary included; and, for every
+ * backend hash_buffer() can run, that it is stable and spreads structured keys
+ * over a table's buckets about as well as random numbers would, counted with
+ * CONFIG_MEASURE by the hash_measure collision counter. Whichever backends run
+ * in software on the machine running the units are tested all the same.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hpc/compiler.h>
+#include <hpc/hash/fn.h>
+#include <hpc/hash/table.h>
+
+#define BITS  12
+#define KEYS  (1u << BITS)
+
+static void
+test_crc32c_vectors(void **state)
+{
+	(void)state;
+	u8 zero[32], ones[32], inc[32];
+
+	memset(zero, 0, sizeof(zero));
+	memset(ones, 0xff, sizeof(ones));
+	for (u32 i = 0; i < 32; i++)
+		inc[i] = (u8)i;
+	/* RFC 3720, B.4 */
+	assert_int_equal(hash_crc32c(0, zero, 32), 0x8a9136aa);
+	assert_int_equal(hash_crc32c(0, ones, 32), 0x62a8ab43);
+	assert_int_equal(hash_crc32c(0, inc, 32), 0x46dd794e);
+	assert_int_equal(hash_crc32c(0, "123456789", 9), 0xe3069283);
+	assert_int_equal(hash_crc32c(0, "", 0), 0);
+
+	/* continued in pieces of every split, the value of the whole */
+	for (u32 i = 0; i <= 32; i++)
+		assert_int_equal(hash_crc32c(hash_crc32c(0, inc, i), inc + i,
+		                             32 - i), 0x46dd794e);
+}
+
+static void
+test_clhash_lengths(void **state)
+{
+	(void)state;
+	enum { MAX = 2200 };
+	u8 *buf = calloc(MAX, 1);
+	u64 *h = calloc(MAX + 1, sizeof(*h));
+
+	assert_non_null(buf);
+	assert_non_null(h);
+	/* all zeroes: only the length term tells the prefixes apart */
+	for (u32 n = 0; n <= MAX; n++)
+		h[n] = hash_clhash(buf, n);
+	for (u32 n = 0; n <= MAX; n++)
+		for (u32 m = n + 1; m <= MAX; m++)
+			assert_true(h[n] != h[m]);
+
+	/* a byte flipped anywhere, the first and last block alike */
+	for (u32 i = 0; i < MAX; i++)
+		buf[i] = (u8)(i * 131 + 7);
+	for (u32 i = 0; i < MAX; i += 3) {
+		u64 before = hash_clhash(buf, MAX);
+		buf[i] ^= 0x10;
+		assert_true(hash_clhash(buf, MAX) != before);
+		buf[i] ^= 0x10;
+		assert_true(hash_clhash(buf, MAX) == before);
+	}
+	free(buf);
+	free(h);
+}
+
+struct item {
+	u8 key[64];
+	struct qnode node;
+};
+
+/*
+ * KEYS keys of @len bytes, a counter in the first four and the rest zero: the
+ * keys a weak hash puts into few buckets. Returns the colliding insertions.
+ */
+static u64
+collisions(u32 len)
+{
+	static struct item item[KEYS];
+	struct hash_measure m = { 0 };
+	static DECLARE_HASHTABLE(table, BITS);
+	u64 seen = 0;
+
+#ifdef CONFIG_MEASURE
+	hash_measure = &m;
+#endif
+	hash_init_table(table, BITS);
+	memset(item, 0, sizeof(item));
+	for (u32 i = 0; i < KEYS; i++) {
+		memcpy(item[i].key, &i, sizeof(i));
+		u32 b = hash_buffer_u32(item[i].key, len, BITS);
+		if (!hash_empty(table, b))
+			seen++;
+		hash_add(table, &item[i].node, b);
+	}
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.collision, seen);
+	assert_int_equal(m.entries, KEYS);
+	hash_measure = NULL;
+#endif
+	(void)m;
+	return seen;
+}
+
+static void
+test_backends(void **state)
+{
+	(void)state;
+	static const char *name[] = { "xxhash", "crc32c", "clhash" };
+	enum hash_backend was = hash_backend();
+	/* n - m (1 - (1 - 1/m)^n) for n keys into m buckets, here n = m */
+	double expect = KEYS - KEYS * (1 - pow(1 - 1.0 / KEYS, KEYS));
+
+	assert_true(hash_backend_hw(HASH_BACKEND_XXHASH));
+	assert_int_equal(hash_backend_set(HASH_BACKEND_COUNT), -1);
+	for (int b = 0; b < HASH_BACKEND_COUNT; b++) {
+		u8 a[2] = { 'a', 0 };
+
+		assert_int_equal(hash_backend_set((enum hash_backend)b), 0);
+		assert_int_equal(hash_backend(), b);
+		assert_string_equal(hash_backend_name((enum hash_backend)b),
+		                    name[b]);
+		assert_true(hash_buffer(a, 1) == hash_buffer(a, 1));
+		assert_true(hash_buffer(a, 1) != hash_buffer(a, 2));
+		assert_true(hash_string("hash") == hash_buffer((u8 *)"hash", 4));
+
+		/* within 10% of what random buckets would do */
+		for (u32 len = 4; len <= 64; len *= 4) {
+			u64 c = collisions(len);
+			assert_true(c > expect * 0.9 && c < expect * 1.1);
+		}
+	}
+	assert_int_equal(hash_backend_set(was), 0);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_crc32c_vectors),
+		cmocka_unit_test(test_clhash_lengths),
+		cmocka_unit_test(test_backends),
+	};
+	return cmocka_run_group_tests_name("hash_fn", tests, NULL, NULL);
+}
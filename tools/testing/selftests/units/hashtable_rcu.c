@@ -11,6 +11,11 @@
  * test additionally goes through a real read-side section, grace period and
  * call_rcu() callback, which is what pins the header's publication to the
  * liburcu flavour actually linked.
+ *
+ * The resizable table <hpc/hash/htable_rcu.h> gets a grow and shrink through
+ * the API, and the unzip step of a grow taken apart by hand: a reader parked
+ * in the other bucket's run still finds its keys after one step, and would not
+ * after the next - which is why a grace period separates the two.
  */
 
 #include <stdarg.h>
@@ -21,7 +26,9 @@
 #include <cmocka.h>
 
 #include <hpc/compiler.h>
+#include <hpc/hash/fn.h>
 #include <hpc/hash/table.h>
+#include <hpc/hash/htable_rcu.h>
 #include <hpc/rcu.h>
 
 struct data { unsigned int id, hash; struct qnode q; };
@@ -166,6 +173,105 @@ test_table_rcu_retire(void **state)
 	rcu_unregister_thread();
 }
 
+/* ---- the resizable table ------------------------------------------------ */
+
+struct item { unsigned int key; struct hnode h; };
+
+static struct item *
+item_find(struct htable_rcu *t, unsigned int key)
+{
+	htable_rcu_for_each_possible(t, (u32)hash_u64(key, 32), it, struct item, h)
+		if (it->key == key)
+			return it;
+	return NULL;
+}
+
+static void
+test_htable_rcu_resize(void **state)
+{
+	(void)state;
+	static struct item it[300];
+	struct htable_rcu t;
+
+	rcu_register_thread();
+	assert_int_equal(htable_rcu_init(&t, 4), 0);
+	for (unsigned int i = 0; i < 300; i++) {
+		it[i].key = i;
+		htable_rcu_add(&t, &it[i].h, (u32)hash_u64(i, 32));
+	}
+	assert_int_equal(t.tab->bits, 9);          /* 300 > 256 */
+	rcu_read_lock();
+	for (unsigned int i = 0; i < 300; i++)
+		assert_ptr_equal(item_find(&t, i), &it[i]);
+	assert_null(item_find(&t, 300));
+	rcu_read_unlock();
+
+	/* down three levels by hand, then back up on the dels' threshold */
+	assert_int_equal(htable_rcu_resize(&t, 6), 0);
+	assert_int_equal(t.tab->bits, 6);
+	for (unsigned int i = 0; i < 300; i++)
+		assert_ptr_equal(item_find(&t, i), &it[i]);
+	for (unsigned int i = 0; i < 295; i++)
+		htable_rcu_del(&t, &it[i].h);
+	assert_int_equal(htable_rcu_count(&t), 5);
+	assert_int_equal(t.tab->bits, 5);          /* 5 < 64 / 8, 5 >= 32 / 8 */
+	for (unsigned int i = 295; i < 300; i++)
+		assert_ptr_equal(item_find(&t, i), &it[i]);
+	assert_int_equal(htable_rcu_resize(&t, 3), -1);
+	synchronize_rcu();
+	htable_rcu_fini(&t);
+	rcu_unregister_thread();
+}
+
+static unsigned int
+walk_from(struct qnode *it, u32 side)
+{
+	unsigned int seen = 0;
+
+	for (; it; it = it->next) {
+		struct item *x = container_of(it, struct item, h.q);
+		if ((x->h.hash & 16) == side)
+			seen |= 1u << x->key;
+	}
+	return seen;
+}
+
+static void
+test_htable_rcu_unzip(void **state)
+{
+	(void)state;
+	/* one old chain of 16 buckets: a0 b0 a1 b1 a2, a to 0 and b to 16 */
+	struct item x[5] = {
+		{ 0, { .hash = 0 } }, { 1, { .hash = 16 } }, { 2, { .hash = 0 } },
+		{ 3, { .hash = 16 } }, { 4, { .hash = 0 } },
+	};
+	struct qnode *a = &x[0].h.q, *b = &x[1].h.q, *parked;
+
+	for (unsigned int i = 0; i < 4; i++)
+		x[i].h.q.next = &x[i + 1].h.q;
+	x[4].h.q.next = NULL;
+
+	/* a reader of bucket 0 came in by a0 and stands on b0 */
+	parked = a->next;
+	assert_ptr_equal(__htable_rcu_unzip(a, 16), b);
+	assert_ptr_equal(a->next, &x[2].h.q);
+	/* it walks on past b0 into a1 and a2, both found */
+	assert_int_equal(walk_from(parked, 0), (1u << 2) | (1u << 4));
+	assert_int_equal(walk_from(a, 0), (1u << 0) | (1u << 2) | (1u << 4));
+
+	/* the next step of the chain without a grace period strands it */
+	assert_ptr_equal(__htable_rcu_unzip(b, 16), &x[2].h.q);
+	assert_int_equal(walk_from(parked, 0), 1u << 4);
+
+	/* the rest: two clean chains */
+	assert_ptr_equal(__htable_rcu_unzip(&x[2].h.q, 16), &x[3].h.q);
+	assert_ptr_equal(__htable_rcu_unzip(&x[3].h.q, 16), &x[4].h.q);
+	assert_null(__htable_rcu_unzip(&x[4].h.q, 16));
+	assert_int_equal(walk_from(a, 16), 0);
+	assert_int_equal(walk_from(b, 0), 0);
+	assert_int_equal(walk_from(b, 16), (1u << 1) | (1u << 3));
+}
+
 int
 main(void)
 {
@@ -173,6 +279,8 @@ main(void)
 		cmocka_unit_test(test_table_rcu),
 		cmocka_unit_test(test_table_rcu_buckets),
 		cmocka_unit_test(test_table_rcu_retire),
+		cmocka_unit_test(test_htable_rcu_resize),
+		cmocka_unit_test(test_htable_rcu_unzip),
 	};
 	return cmocka_run_group_tests_name("hashtable_rcu", tests, NULL, NULL);
 }
@@ -27,13 +27,21 @@
  *     cache either forgoes recency or re-publishes a fresh node. This one forgoes
  *     it, and expiry is what bounds the chains.
  *
+ * A second phase drives the resizable table <hpc/hash/htable_rcu.h> instead:
+ * a stable set of keys every reader must find on every lookup, while the writer
+ * grows the table under them with churn keys and shrinks it away again, over
+ * and over. A lookup that misses a stable key is a reader that fell through a
+ * half-unzipped chain, and fails the run.
+ *
  * This unit exists only when CONFIG_RCU is enabled (see the Kbuild), so nothing
  * here is conditional.
  */
 
 #include "stress_util.h"
 
+#include <hpc/hash/fn.h>
 #include <hpc/hash/table.h>
+#include <hpc/hash/htable_rcu.h>
 
 #define CACHE_BITS  8                      /* 256 slots */
 #define CACHE_SLOTS (1u << CACHE_BITS)
@@ -349,12 +357,209 @@ test_stress_hash_cache_under_readers(void **state)
 	stress_arena_fini(a);
 }
 
+/* ---- resize under load -------------------------------------------------- */
+
+#define RESIZE_STABLE  256u                /* keys every lookup must find    */
+#define RESIZE_CHURN   4096u               /* keys that grow the table       */
+#define RESIZE_CYCLES  8u                  /* grow/shrink cycles, x the scale */
+#define RESIZE_DWELL   256u                /* sections between one that parks */
+#define RESIZE_MAGIC   0x5E1F7AB1u
+
+struct entry {
+	u32 key;
+	u32 magic;                         /* 0 once retired: a reader on it
+	                                    * read past a grace period       */
+	struct hnode h;
+};
+
+struct resize_table {
+	struct htable_rcu t;
+	struct entry e[RESIZE_STABLE + RESIZE_CHURN];
+};
+
+static u32
+entry_hash(u32 key)
+{
+	return (u32)hash_u64(key, 32);
+}
+
+/*
+ * Look up stable keys only, each in a section of its own, and walk the whole
+ * chain: the churn nodes of the bucket - and, mid-grow, those of the bucket it
+ * is still zipped with - are what a reader has to get past.
+ */
+static void *
+resize_reader(void *arg)
+{
+	struct stress_reader *r = (struct stress_reader *)arg;
+	struct resize_table *c = (struct resize_table *)r->container;
+	struct timespec ts = { 0, STRESS_DWELL_NS };
+
+	stress_reader_register();
+	stress_gate_arrive(r->gate);
+
+	while (!CMM_LOAD_SHARED(*r->stop)) {
+		for (unsigned n = 0; n < 64; n++) {
+			u32 key = stress_rand(&r->seed) % RESIZE_STABLE;
+			unsigned steps = 0;
+			bool hit = false, park;
+
+			r->m.lookups++;
+			r->m.sections++;
+			park = !(r->m.sections & (RESIZE_DWELL - 1));
+			rcu_read_lock();
+			htable_rcu_for_each_possible(&c->t, entry_hash(key), it,
+			                             struct entry, h) {
+				if (++steps > STRESS_STEPS) {
+					r->m.aborts++;
+					break;
+				}
+				r->m.visits++;
+				r->m.checks++;
+				if (CMM_LOAD_SHARED(it->magic) != RESIZE_MAGIC) {
+					r->m.torn++;
+					break;
+				}
+				hit |= it->key == key;
+				/* now and then park on a node not ours, mid-chain:
+				 * mid-grow it is likely the other bucket's run, the
+				 * one the writer unzips past, and the next pass has
+				 * to wait for the reader to step off it */
+				if (park && it->key != key) {
+					park = false;
+					r->m.dwells++;
+					nanosleep(&ts, NULL);
+				}
+			}
+			rcu_read_unlock();
+			if (hit)
+				r->m.hits++;
+		}
+		stress_quiescent();
+	}
+
+	r->m.threads = 1;
+	stress_reader_unregister();
+	return NULL;
+}
+
+/* Every node in the bucket its hash names, every @prev link its predecessor. */
+static u32
+resize_check(struct htable_rcu *t)
+{
+	struct htable_rcu_tab *tab = t->tab;
+	u32 mask = (1U << tab->bits) - 1, n = 0;
+
+	for (u32 i = 0; i <= mask; i++) {
+		struct qnode **prev = &tab->b[i].first;
+		for (struct qnode *it = *prev; it; it = it->next) {
+			assert_int_equal(container_of(it, struct hnode, q)->hash &
+			                 mask, i);
+			assert_ptr_equal(it->prev, prev);
+			prev = &it->next;
+			n++;
+		}
+	}
+	return n;
+}
+
+static void
+test_stress_resize_under_readers(void **state)
+{
+	(void)state;
+	struct resize_table *c = calloc(1, sizeof(*c));
+	struct stress_reader readers[STRESS_READERS];
+	struct htable_measure m = { 0 };
+	struct reader_measure rm;
+	struct stress_gate gate;
+	pthread_t th[STRESS_READERS];
+	struct timespec t0;
+	volatile int stop = 0;
+	u32 cycles = RESIZE_CYCLES * stress_scale(), lo = 31, hi = 0, done;
+
+	assert_non_null(c);
+	memset(&rm, 0, sizeof(rm));
+	assert_int_equal(htable_rcu_init(&c->t, 4), 0);
+#ifdef CONFIG_MEASURE
+	c->t.measure = &m;
+#endif
+	(void)m;
+	for (u32 i = 0; i < RESIZE_STABLE + RESIZE_CHURN; i++)
+		c->e[i].key = i;
+	for (u32 i = 0; i < RESIZE_STABLE; i++) {
+		c->e[i].magic = RESIZE_MAGIC;
+		htable_rcu_add(&c->t, &c->e[i].h, entry_hash(i));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	stress_readers_start(th, readers, STRESS_READERS, resize_reader, NULL, c,
+	                     &gate, &stop);
+
+	/*
+	 * Each cycle grows from the floor by doubling on adds, shrinks by the
+	 * dels as far as the threshold allows, and is taken the rest of the way
+	 * down by an explicit resize, a zip of several levels in one call. The
+	 * churn entries come back only after a grace period, killed in between.
+	 */
+	for (done = 0; done < cycles; done++) {
+		for (u32 i = RESIZE_STABLE; i < RESIZE_STABLE + RESIZE_CHURN; i++) {
+			c->e[i].magic = RESIZE_MAGIC;
+			htable_rcu_add(&c->t, &c->e[i].h, entry_hash(i));
+		}
+		hi = __max(hi, c->t.tab->bits);
+		for (u32 i = RESIZE_STABLE; i < RESIZE_STABLE + RESIZE_CHURN; i++)
+			htable_rcu_del(&c->t, &c->e[i].h);
+		assert_int_equal(htable_rcu_resize(&c->t, c->t.min_bits), 0);
+		lo = __min(lo, c->t.tab->bits);
+		synchronize_rcu();
+		for (u32 i = RESIZE_STABLE; i < RESIZE_STABLE + RESIZE_CHURN; i++)
+			CMM_STORE_SHARED(c->e[i].magic, 0);
+		if (done && stress_ms_since(&t0) > STRESS_BUDGET_MS * stress_scale())
+			break;
+	}
+
+	stress_readers_join(th, readers, STRESS_READERS, &stop, &gate, &rm);
+
+	printf("#\n# htable_rcu resize stress: %u readers + 1 writer, %lu ms,"
+	       " %u cycles between 2^%u and 2^%u buckets\n", STRESS_READERS,
+	       stress_ms_since(&t0), done, lo, hi);
+	printf("#   readers: %llu lookups, %llu hits, %llu visits\n",
+	       (unsigned long long)rm.lookups, (unsigned long long)rm.hits,
+	       (unsigned long long)rm.visits);
+	fflush(stdout);
+
+	/* never a miss, never a retired node, never a runaway walk */
+	assert_int_equal(rm.hits, rm.lookups);
+	assert_int_equal(rm.aborts, 0);
+	assert_int_equal(lo, 4);
+	assert_int_equal(hi, 13);
+
+	/* back up, by the explicit path, and the chains are clean */
+	assert_int_equal(htable_rcu_resize(&c->t, 10), 0);
+	assert_int_equal(resize_check(&c->t), RESIZE_STABLE);
+	assert_int_equal(htable_rcu_count(&c->t), RESIZE_STABLE);
+	for (u32 i = 0; i < RESIZE_STABLE; i++)
+		htable_rcu_del(&c->t, &c->e[i].h);
+	assert_int_equal(resize_check(&c->t), 0);
+	assert_int_equal(c->t.tab->bits, 4);
+#ifdef CONFIG_MEASURE
+	assert_true(m.grow >= done * 9);
+	assert_true(m.shrink >= done * 9);
+	assert_true(m.move > 0);
+	assert_int_equal(m.entries, 0);
+#endif
+	synchronize_rcu();
+	htable_rcu_fini(&c->t);
+	free(c);
+}
+
 int
 main(void)
 {
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(test_integrity_detector),
 		cmocka_unit_test(test_stress_hash_cache_under_readers),
+		cmocka_unit_test(test_stress_resize_under_readers),
 	};
 	return cmocka_run_group_tests_name("hashtable_rcu_stress", tests,
 	                                   NULL, NULL);
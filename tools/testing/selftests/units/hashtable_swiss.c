@@ -0,0 +1,201 @@
+/*
+ * Unit tests for the open-addressing Swiss table, <hpc/hash/swiss.h>.
+ *
+ * The units insert, find and delete through a generated u64 -> u32 map, pile
+ * keys onto one home slot with a degenerate hash to check that backward-shift
+ * deletion keeps every other key of the run reachable, and wrap a run past the
+ * end of the control array. A random churn against a shadow array checks the
+ * table after every step; it also runs through a grow and a shrink. With
+ * CONFIG_MEASURE they check the hash_measure counts.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include <hpc/compiler.h>
+#include <hpc/hash/fn.h>
+#include <hpc/hash/swiss.h>
+
+#define mix(k)        hash_u64(k, 64)
+#define same(a, b)    ((a) == (b))
+
+DEFINE_SWISS_TABLE(map, u64, u32, mix, same)
+
+/* Every key to one home, slot 3; the tag from the key so some tags differ. */
+#define home3(k)      (((u64)3 << 7) | ((k) & 0x7f))
+DEFINE_SWISS_TABLE(pile, u64, u32, home3, same)
+
+/* Every key to the last slot of a 16-slot table. */
+#define last(k)       (((u64)15 << 7) | ((k) & 0x7f))
+DEFINE_SWISS_TABLE(wrap, u64, u32, last, same)
+
+static void
+test_insert_find_del(void **state)
+{
+	(void)state;
+	struct hash_measure m = { 0 };
+	struct map t;
+	bool added;
+	u32 *v;
+
+	assert_int_equal(map_init(&t, 100), 0);
+#ifdef CONFIG_MEASURE
+	t.measure = &m;
+#endif
+	(void)m;
+	assert_int_equal(t.mask + 1, 128);
+	for (u64 k = 1; k <= 100; k++)
+		assert_int_equal(map_put(&t, k * 7919, (u32)k), 0);
+	assert_int_equal(map_count(&t), 100);
+	assert_int_equal(t.mask + 1, 128);        /* no grow: 100 of 111 */
+
+	for (u64 k = 1; k <= 100; k++) {
+		assert_non_null(v = map_find(&t, k * 7919));
+		assert_int_equal(*v, k);
+	}
+	assert_null(map_find(&t, 0));
+	assert_null(map_find(&t, 7919 * 101));
+
+	/* insert-if-absent hands back the value that is there */
+	v = map_insert(&t, 7919 * 5, &added);
+	assert_false(added);
+	assert_int_equal(*v, 5);
+	v = map_insert(&t, 42, &added);
+	assert_true(added);
+	assert_int_equal(*v, 0);
+
+	for (u64 k = 2; k <= 100; k += 2)
+		assert_true(map_del(&t, k * 7919));
+	assert_false(map_del(&t, 7919 * 2));
+	assert_int_equal(map_count(&t), 51);
+	for (u64 k = 1; k <= 100; k++)
+		assert_true(!map_find(&t, k * 7919) == !(k & 1));
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.add, 101);
+	assert_int_equal(m.del, 50);
+	assert_int_equal(m.entries, 51);
+	assert_true(m.collision > 0);
+#endif
+	map_fini(&t);
+}
+
+static void
+test_backward_shift(void **state)
+{
+	(void)state;
+	struct pile t;
+	u32 pos = 0, n = 0;
+
+	assert_int_equal(pile_init(&t, 8), 0);
+	assert_int_equal(t.mask + 1, 16);
+	for (u64 k = 0; k < 10; k++)
+		assert_int_equal(pile_put(&t, k, (u32)k), 0);
+	/* one run from slot 3, in insertion order */
+	for (u32 i = 0; i < 10; i++)
+		assert_int_equal(t.slot[3 + i].key, i);
+
+	/* out of the middle: the tail moves up a slot, nothing is marked */
+	assert_true(pile_del(&t, 4));
+	assert_int_equal(t.slot[7].key, 5);
+	assert_true(t.ctrl[12] & SWISS_EMPTY);
+	assert_true(pile_del(&t, 0));
+	assert_int_equal(t.slot[3].key, 1);
+	for (u64 k = 0; k < 10; k++)
+		assert_true(!pile_find(&t, k) == (k == 0 || k == 4));
+
+	while (pile_next(&t, &pos))
+		n++;
+	assert_int_equal(n, 8);
+	for (u64 k = 1; k < 10; k++)
+		if (k != 4)
+			assert_true(pile_del(&t, k));
+	assert_int_equal(pile_count(&t), 0);
+	for (u32 i = 0; i < 16 + SWISS_GROUP; i++)
+		assert_int_equal(t.ctrl[i], SWISS_EMPTY);
+	pile_fini(&t);
+}
+
+static void
+test_wrap(void **state)
+{
+	(void)state;
+	struct wrap t;
+
+	assert_int_equal(wrap_init(&t, 8), 0);
+	for (u64 k = 0; k < 6; k++)
+		assert_int_equal(wrap_put(&t, k, (u32)k + 100), 0);
+	/* slot 15, then 0 to 4; the mirrored control bytes follow */
+	assert_int_equal(t.slot[15].key, 0);
+	assert_int_equal(t.slot[0].key, 1);
+	assert_int_equal(t.ctrl[16], t.ctrl[0]);
+	assert_int_equal(t.ctrl[20], t.ctrl[4]);
+
+	/* deleting at the end pulls a key back across the wrap */
+	assert_true(wrap_del(&t, 0));
+	assert_int_equal(t.slot[15].key, 1);
+	assert_int_equal(t.ctrl[20], SWISS_EMPTY);
+	for (u64 k = 1; k < 6; k++)
+		assert_int_equal(*wrap_find(&t, k), k + 100);
+	wrap_fini(&t);
+}
+
+static void
+test_churn_resize(void **state)
+{
+	(void)state;
+	enum { KEYS = 4096 };
+	static u32 shadow[KEYS];
+	struct map t;
+	u64 seed = 0x9e3779b97f4a7c15ull;
+	u32 live = 0;
+
+	memset(shadow, 0, sizeof(shadow));
+	assert_int_equal(map_init(&t, 0), 0);
+	assert_int_equal(t.mask + 1, SWISS_GROUP);
+	for (u32 step = 0; step < 200000; step++) {
+		u64 k;
+		seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+		k = seed % KEYS;
+		if (shadow[k]) {
+			assert_int_equal(*map_find(&t, k), shadow[k]);
+			assert_true(map_del(&t, k));
+			shadow[k] = 0;
+			live--;
+		} else {
+			assert_null(map_find(&t, k));
+			assert_int_equal(map_put(&t, k, step + 1), 0);
+			shadow[k] = step + 1;
+			live++;
+		}
+		assert_int_equal(map_count(&t), live);
+	}
+	assert_true((u64)live * 100 <= (u64)(t.mask + 1) * SWISS_MAX_LOAD);
+
+	/* shrink to fit, and everything is still there */
+	assert_int_equal(map_resize(&t, 0), 0);
+	assert_true(t.mask + 1 < 2 * __swiss_capacity(live, SWISS_MAX_LOAD));
+	for (u64 k = 0; k < KEYS; k++) {
+		u32 *v = map_find(&t, k);
+		if (shadow[k])
+			assert_int_equal(*v, shadow[k]);
+		else
+			assert_null(v);
+	}
+	map_fini(&t);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_insert_find_del),
+		cmocka_unit_test(test_backward_shift),
+		cmocka_unit_test(test_wrap),
+		cmocka_unit_test(test_churn_resize),
+	};
+	return cmocka_run_group_tests_name("hashtable_swiss", tests, NULL, NULL);
+}
@@ -0,0 +1,206 @@
+/*
+ * Unit tests for the incrementally resized chained table, <hpc/hash/htable.h>.
+ *
+ * The units grow a table through several doublings one element at a time,
+ * checking after every add that each operation moved no more than its share
+ * of buckets and that every element is still found, mid-resize or not; empty
+ * it again through the shrinks; walk it whole while a resize is half done;
+ * and check that a step of 0 rehashes everything in the add that crossed the
+ * threshold. A random churn against a shadow array runs last.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include <hpc/compiler.h>
+#include <hpc/hash/fn.h>
+#include <hpc/hash/htable.h>
+
+struct item {
+	u32 key;
+	struct hnode h;
+};
+
+static u32
+key_hash(u32 key)
+{
+	return (u32)hash_u64(key, 32);
+}
+
+static struct item *
+find(struct htable *t, u32 key)
+{
+	htable_for_each_possible(t, key_hash(key), it, struct item, h)
+		if (it->key == key)
+			return it;
+	return NULL;
+}
+
+static void
+test_grow_incremental(void **state)
+{
+	(void)state;
+	enum { N = 4000 };
+	static struct item it[N];
+	struct htable_measure m = { 0 };
+	struct htable t;
+	u32 resizing = 0;
+
+	assert_int_equal(htable_init(&t, 4), 0);
+#ifdef CONFIG_MEASURE
+	t.measure = &m;
+#endif
+	(void)m;
+	t.step = 2;
+	for (u32 i = 0; i < N; i++) {
+		u32 before = t.migrate;
+		bool was = htable_resizing(&t);
+#ifdef CONFIG_MEASURE
+		u64 moved = m.migrate;
+#endif
+		it[i].key = i * 2654435761u;
+		htable_add(&t, &it[i].h, key_hash(it[i].key));
+		/* the add's share: two buckets, ten times that visited at most */
+		if (was && htable_resizing(&t))
+			assert_true(t.migrate - before <= 20);
+#ifdef CONFIG_MEASURE
+		assert_true(m.migrate - moved <= 2);
+#endif
+		resizing += htable_resizing(&t);
+		if (i % 97 == 0)
+			for (u32 j = 0; j <= i; j++)
+				assert_ptr_equal(find(&t, it[j].key), &it[j]);
+	}
+	assert_true(resizing > 0);
+	assert_int_equal(htable_count(&t), N);
+	assert_true(1U << t.bits >= N / 2);
+	htable_flush(&t);
+	assert_false(htable_resizing(&t));
+	assert_int_equal(1U << t.bits, 4096);
+	for (u32 j = 0; j < N; j++)
+		assert_ptr_equal(find(&t, it[j].key), &it[j]);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.grow, 8);
+	assert_int_equal(m.add, N);
+	assert_int_equal(m.entries, N);
+	assert_int_equal(m.buckets, 4096);
+	assert_true(m.move >= N / 2);
+#endif
+
+	/* and back down, never below where it started */
+	for (u32 i = 0; i < N; i++) {
+		htable_del(&t, &it[i].h);
+		if (i % 211 == 0)
+			for (u32 j = i + 1; j < N; j++)
+				assert_ptr_equal(find(&t, it[j].key), &it[j]);
+	}
+	htable_flush(&t);
+	assert_int_equal(htable_count(&t), 0);
+	assert_int_equal(t.bits, 4);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.shrink, 8);
+	assert_int_equal(m.del, N);
+#endif
+	htable_fini(&t);
+}
+
+static void
+test_walk_mid_resize(void **state)
+{
+	(void)state;
+	static struct item it[300];
+	struct htable t;
+	u32 n = 0, seen = 0;
+
+	assert_int_equal(htable_init(&t, 8), 0);
+	t.step = 1;
+	for (u32 i = 0; i < 257; i++) {
+		it[i].key = i;
+		htable_add(&t, &it[i].h, key_hash(i));
+	}
+	assert_true(htable_resizing(&t));
+	assert_true(t.migrate < 1U << t.old_bits);
+	htable_for_each(&t, x, struct item, h) {
+		n++;
+		seen += x->key;
+	}
+	assert_int_equal(n, 257);
+	assert_int_equal(seen, 256 * 257 / 2);
+	htable_fini(&t);
+}
+
+static void
+test_stop_the_world(void **state)
+{
+	(void)state;
+	static struct item it[100];
+	struct htable t;
+
+	assert_int_equal(htable_init(&t, 4), 0);
+	t.step = 0;
+	for (u32 i = 0; i < 100; i++) {
+		it[i].key = i;
+		htable_add(&t, &it[i].h, key_hash(i));
+		assert_false(htable_resizing(&t));
+	}
+	assert_int_equal(t.bits, 7);
+	for (u32 i = 0; i < 100; i++)
+		assert_ptr_equal(find(&t, i), &it[i]);
+	htable_fini(&t);
+}
+
+static void
+test_churn(void **state)
+{
+	(void)state;
+	enum { KEYS = 2048 };
+	static struct item it[KEYS];
+	static bool in[KEYS];
+	struct htable t;
+	u64 seed = 0x2545f4914f6cdd1dull;
+	u32 live = 0;
+
+	memset(in, 0, sizeof(in));
+	assert_int_equal(htable_init(&t, 4), 0);
+	t.step = 1;
+	for (u32 step = 0; step < 100000; step++) {
+		u32 k;
+		seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+		k = (u32)(seed % KEYS);
+		/* bias towards one half then the other: grows and shrinks */
+		if ((step / 20000) & 1 ? !in[k] && seed % 4 : in[k] && !(seed % 4))
+			continue;
+		if (in[k]) {
+			assert_ptr_equal(find(&t, k), &it[k]);
+			htable_del(&t, &it[k].h);
+			in[k] = false;
+			live--;
+		} else {
+			assert_null(find(&t, k));
+			it[k].key = k;
+			htable_add(&t, &it[k].h, key_hash(k));
+			in[k] = true;
+			live++;
+		}
+		assert_int_equal(htable_count(&t), live);
+	}
+	for (u32 k = 0; k < KEYS; k++)
+		assert_true(!find(&t, k) == !in[k]);
+	htable_fini(&t);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_grow_incremental),
+		cmocka_unit_test(test_walk_mid_resize),
+		cmocka_unit_test(test_stop_the_world),
+		cmocka_unit_test(test_churn),
+	};
+	return cmocka_run_group_tests_name("htable", tests, NULL, NULL);
+}
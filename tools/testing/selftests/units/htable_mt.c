@@ -0,0 +1,257 @@
+/*
+ * Unit tests for the striped multi-writer table, <hpc/hash/htable_mt.h>.
+ *
+ * The units check insert-if-absent and the delete that reports who unlinked,
+ * single threaded; the stripe layout; and then race four writers inserting the
+ * same keys and deleting them again while two readers walk the table: of all
+ * the writers inserting a key exactly one may win, of all deleting it exactly
+ * one, and a reader must only ever see whole elements. With CONFIG_MEASURE the
+ * htable_measure counts, updated by every writer at once, must add up.
+ *
+ * This unit exists only when CONFIG_RCU is enabled (see the Kbuild), so nothing
+ * here is conditional.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hpc/compiler.h>
+#include <hpc/hash/fn.h>
+#include <hpc/hash/htable_mt.h>
+#include <hpc/rcu.h>
+
+#define KEYS     4096u
+#define WRITERS  4u
+#define READERS  2u
+#define MAGIC    0x0DDBA11u
+
+struct item {
+	u32 key;
+	u32 magic;
+	struct hnode h;
+};
+
+static u32
+key_hash(u32 key)
+{
+	return (u32)hash_u64(key, 32);
+}
+
+static bool
+item_eq(const struct hnode *a, const struct hnode *b)
+{
+	return container_of(a, struct item, h)->key ==
+	       container_of(b, struct item, h)->key;
+}
+
+/* Inside a read-side section. */
+static struct item *
+find(struct htable_mt *t, u32 key)
+{
+	htable_mt_for_each_possible(t, key_hash(key), it, struct item, h)
+		if (it->key == key)
+			return it;
+	return NULL;
+}
+
+static void
+test_insert_if_absent(void **state)
+{
+	(void)state;
+	static struct item a[100], b[100];
+	struct htable_measure m = { 0 };
+	struct htable_mt t;
+
+	rcu_register_thread();
+	assert_int_equal(htable_mt_init(&t, 6, 2), 0);
+#ifdef CONFIG_MEASURE
+	t.measure = &m;
+#endif
+	(void)m;
+	for (u32 i = 0; i < 100; i++) {
+		a[i].key = b[i].key = i;
+		assert_null(htable_mt_insert(&t, &a[i].h, key_hash(i), item_eq));
+	}
+	/* the second of a key is turned away, and told which one is there */
+	rcu_read_lock();
+	for (u32 i = 0; i < 100; i++)
+		assert_ptr_equal(htable_mt_insert(&t, &b[i].h, key_hash(i),
+		                                  item_eq), &a[i].h);
+	rcu_read_unlock();
+	assert_int_equal(htable_mt_count(&t), 100);
+	assert_true(qnode_unhashed(&b[7].h.q));
+
+	/* a delete says whether it was the one that unlinked */
+	rcu_read_lock();
+	assert_ptr_equal(find(&t, 7), &a[7]);
+	assert_true(htable_mt_del(&t, &a[7].h));
+	assert_false(htable_mt_del(&t, &a[7].h));
+	assert_null(find(&t, 7));
+	rcu_read_unlock();
+	synchronize_rcu();
+	assert_null(htable_mt_insert(&t, &b[7].h, key_hash(7), item_eq));
+	assert_int_equal(htable_mt_count(&t), 100);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.add, 101);
+	assert_int_equal(m.del, 1);
+	assert_int_equal(m.entries, 100);
+	assert_true(m.collision > 0);
+	assert_int_equal(m.contended, 0);
+#endif
+	htable_mt_fini(&t);
+	rcu_unregister_thread();
+}
+
+static void
+test_stripes(void **state)
+{
+	(void)state;
+	struct htable_mt t;
+
+	assert_int_equal(sizeof(struct htable_mt_stripe), CPU_CACHE_LINE);
+	assert_int_equal(htable_mt_init(&t, 4, HTABLE_MT_STRIPE_BITS), 0);
+	assert_int_equal(t.stripe_bits, 4);          /* no more than buckets */
+	assert_int_equal((uintptr_t)t.stripe % CPU_CACHE_LINE, 0);
+	htable_mt_fini(&t);
+	assert_int_equal(htable_mt_init(&t, 32, 0), -1);
+}
+
+struct race {
+	struct htable_mt *t;
+	struct item *item;            /* KEYS of the writer's own           */
+	volatile int *stop;
+	u32 *arrived;                 /* writers done inserting             */
+	unsigned seed;
+	u32 won, unlinked;            /* writer: inserts and deletes won    */
+	u64 seen, torn;               /* reader: elements walked, bad ones  */
+};
+
+static void *
+writer(void *arg)
+{
+	struct race *r = (struct race *)arg;
+
+	rcu_register_thread();
+	/* everybody inserts every key, in an order of their own */
+	for (u32 i = 0; i < KEYS; i++) {
+		u32 k = (i * 2654435761u + r->seed) % KEYS;
+		r->item[k].key = k;
+		r->item[k].magic = MAGIC;
+		rcu_read_lock();
+		r->won += !htable_mt_insert(r->t, &r->item[k].h, key_hash(k),
+		                           item_eq);
+		rcu_read_unlock();
+	}
+	/* all of them, before anybody deletes: else a key deleted early is
+	 * inserted again by a late writer, and won twice */
+	__atomic_add_fetch(r->arrived, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(r->arrived, __ATOMIC_SEQ_CST) < WRITERS)
+		sched_yield();
+	/* and then deletes whichever element it finds */
+	for (u32 i = 0; i < KEYS; i++) {
+		u32 k = (i * 40503u + r->seed) % KEYS;
+		struct item *x;
+		rcu_read_lock();
+		if ((x = find(r->t, k)))
+			r->unlinked += htable_mt_del(r->t, &x->h);
+		rcu_read_unlock();
+	}
+	rcu_unregister_thread();
+	return NULL;
+}
+
+static void *
+reader(void *arg)
+{
+	struct race *r = (struct race *)arg;
+
+	rcu_register_thread();
+	while (!CMM_LOAD_SHARED(*r->stop)) {
+		u32 k = (r->seed = r->seed * 1103515245u + 12345u) % KEYS;
+		rcu_read_lock();
+		htable_mt_for_each_possible(r->t, key_hash(k), it, struct item,
+		                            h) {
+			r->seen++;
+			r->torn += it->magic != MAGIC || it->key >= KEYS;
+		}
+		rcu_read_unlock();
+	}
+	rcu_unregister_thread();
+	return NULL;
+}
+
+static void
+test_racing_writers(void **state)
+{
+	(void)state;
+	struct item *item = calloc(WRITERS * KEYS, sizeof(*item));
+	struct race w[WRITERS], r[READERS];
+	pthread_t wt[WRITERS], rt[READERS];
+	struct htable_measure m = { 0 };
+	struct htable_mt t;
+	volatile int stop = 0;
+	u32 won = 0, unlinked = 0, arrived = 0;
+
+	assert_non_null(item);
+	assert_int_equal(htable_mt_init(&t, 10, 3), 0);
+#ifdef CONFIG_MEASURE
+	t.measure = &m;
+#endif
+	(void)m;
+	memset(w, 0, sizeof(w));
+	memset(r, 0, sizeof(r));
+	for (u32 i = 0; i < READERS; i++) {
+		r[i].t = &t;
+		r[i].stop = &stop;
+		r[i].seed = i + 1;
+		assert_int_equal(pthread_create(&rt[i], NULL, reader, &r[i]), 0);
+	}
+	for (u32 i = 0; i < WRITERS; i++) {
+		w[i].t = &t;
+		w[i].item = &item[i * KEYS];
+		w[i].arrived = &arrived;
+		w[i].seed = i * 977;
+		assert_int_equal(pthread_create(&wt[i], NULL, writer, &w[i]), 0);
+	}
+	for (u32 i = 0; i < WRITERS; i++) {
+		assert_int_equal(pthread_join(wt[i], NULL), 0);
+		won += w[i].won;
+		unlinked += w[i].unlinked;
+	}
+	CMM_STORE_SHARED(stop, 1);
+	for (u32 i = 0; i < READERS; i++) {
+		assert_int_equal(pthread_join(rt[i], NULL), 0);
+		assert_int_equal(r[i].torn, 0);
+	}
+
+	assert_int_equal(won, KEYS);
+	assert_int_equal(unlinked, KEYS);
+	assert_int_equal(htable_mt_count(&t), 0);
+	for (u32 i = 0; i < 1U << t.bits; i++)
+		assert_true(queue_empty(&t.tab[i]));
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.add, KEYS);
+	assert_int_equal(m.del, KEYS);
+	assert_int_equal(m.entries, 0);
+#endif
+	htable_mt_fini(&t);
+	free(item);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_insert_if_absent),
+		cmocka_unit_test(test_stripes),
+		cmocka_unit_test(test_racing_writers),
+	};
+	return cmocka_run_group_tests_name("htable_mt", tests, NULL, NULL);
+}
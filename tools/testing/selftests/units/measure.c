@@ -93,8 +93,8 @@ test_slab_metric_table(void **state)
 {
 	(void)state;
 
-	assert_int_equal(measure_count(slab), 11);  /* 8 counter + 2 gauge + 1 ratio */
-	assert_int_equal(measure_nfield(slab), 10); /* ratio has no storage */
+	assert_int_equal(measure_count(slab), 18);  /* 15 counter + 2 gauge + 1 ratio */
+	assert_int_equal(measure_nfield(slab), 17); /* ratio has no storage */
 
 	unsigned counters = 0, gauges = 0, ratios = 0;
 	measure_for_each(slab, i) {
@@ -105,16 +105,16 @@ test_slab_metric_table(void **state)
 		}
 		assert_non_null(measure_desc(slab, i));
 	}
-	assert_int_equal(counters, 8);
+	assert_int_equal(counters, 15);
 	assert_int_equal(gauges, 2);
 	assert_int_equal(ratios, 1);
 
 	/* gauges follow the counters; the ratio is last */
-	expect_name(measure_name(slab, 8), "used");
-	expect_name(measure_name(slab, 9), "committed");
-	expect_name(measure_name(slab, 10), "usage");
-	assert_int_equal(measure_kind(slab, 8), MEASURE_GAUGE);
-	assert_int_equal(measure_kind(slab, 10), MEASURE_RATIO);
+	expect_name(measure_name(slab, 15), "used");
+	expect_name(measure_name(slab, 16), "committed");
+	expect_name(measure_name(slab, 17), "usage");
+	assert_int_equal(measure_kind(slab, 15), MEASURE_GAUGE);
+	assert_int_equal(measure_kind(slab, 17), MEASURE_RATIO);
 }
 
 static void
@@ -137,7 +137,7 @@ test_slab_ratio(void **state)
 	assert_int_equal(measure_at(slab, &m, r), 75);
 
 	/* a stored field read generically returns the field itself */
-	assert_int_equal(measure_at(slab, &m, 8), 3);   /* used */
+	assert_int_equal(measure_at(slab, &m, 15), 3);   /* used */
 }
 
 /* aggregation: per-thread structs summed to a global, ratio recomputed */
@@ -190,7 +190,7 @@ test_slab_sections(void **state)
 	measure_for_each_counter(slab, i) { nc++; assert_int_equal(measure_kind(slab, i), MEASURE_COUNTER); }
 	measure_for_each_gauge(slab, i)   { ng++; assert_int_equal(measure_kind(slab, i), MEASURE_GAUGE); }
 	measure_for_each_ratio(slab, i)   { nr++; assert_int_equal(measure_kind(slab, i), MEASURE_RATIO); }
-	assert_int_equal(nc, 8);
+	assert_int_equal(nc, 15);
 	assert_int_equal(ng, 2);
 	assert_int_equal(nr, 1);
 
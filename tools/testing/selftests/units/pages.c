@@ -0,0 +1,214 @@
+/*
+ * Unit tests for the buddy mode of the page array, <mem/page.h>.
+ *
+ * The units split a block down to single pages and merge it back whole, tile
+ * a map whose size is not a power of two and check that its end block never
+ * merges, and churn random orders over a thousand pages checking every block
+ * for alignment, overlap and contents. With CONFIG_MEASURE they also check
+ * the split and merge counts and the fragmentation gauge.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <hpc/compiler.h>
+#include <mem/page.h>
+
+#define MAP (PROT_READ | PROT_WRITE)
+#define ANON (MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE)
+
+static u32
+index_of(struct pages *vm, struct page *page)
+{
+	assert_non_null(page);
+	return page_index(vm, page);
+}
+
+static void
+test_split_merge(void **state)
+{
+	(void)state;
+	struct pages_measure m = { 0 };
+	struct pages vm;
+	struct page *a, *b, *c;
+
+	assert_int_equal(pages_map(&vm, MAP, ANON, 12, 16), 0);
+	assert_int_equal(pages_buddy(&vm, 4), 0);
+#ifdef CONFIG_MEASURE
+	vm.measure = &m;
+#endif
+	(void)m;
+	assert_int_equal(vm.avail, 16);
+	assert_int_equal(vm.areamap, 1U << 4);
+
+	/* one page splits the block four times, the halves left free */
+	assert_int_equal(index_of(&vm, a = pages_alloc_order(&vm, 0)), 0);
+	assert_int_equal(vm.areamap, 0xf);
+	assert_int_equal(index_of(&vm, b = pages_alloc_order(&vm, 0)), 1);
+	assert_int_equal(index_of(&vm, c = pages_alloc_order(&vm, 2)), 4);
+	assert_int_equal(vm.avail, 10);
+	assert_ptr_equal(get_page(&vm, 4), c);
+	memset(c, 0x5a, 4 << 12);
+
+	assert_null(pages_alloc_order(&vm, 4));
+	assert_null(pages_alloc_order(&vm, 5));
+
+	/* freed in any order, the buddies find each other */
+	pages_free_order(&vm, a, 0);
+	pages_free_order(&vm, c, 2);
+	assert_int_equal(vm.areamap & (1U << 4), 0);
+	pages_free_order(&vm, b, 0);
+	assert_int_equal(vm.avail, 16);
+	assert_int_equal(vm.areamap, 1U << 4);
+	assert_int_equal(index_of(&vm, a = pages_alloc_order(&vm, 4)), 0);
+	pages_free_order(&vm, a, 4);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.split, 4);
+	assert_int_equal(m.merge, 4);
+	assert_int_equal(m.fail, 2);
+	assert_int_equal(m.alloc, 4);
+	assert_int_equal(m.largest, 16);
+	assert_int_equal(m.frag, 0);
+#endif
+	pages_free(&vm);
+}
+
+static void
+test_non_pow2(void **state)
+{
+	(void)state;
+	struct pages vm;
+	struct page *p[4];
+
+	/* 13 pages: blocks of 8, 4 and 1 */
+	assert_int_equal(pages_map(&vm, MAP, ANON, 12, 13), 0);
+	assert_int_equal(pages_buddy(&vm, 3), 0);
+	assert_int_equal(vm.areamap, (1U << 3) | (1U << 2) | 1U);
+	assert_int_equal(vm.avail, 13);
+
+	assert_int_equal(index_of(&vm, p[0] = pages_alloc_order(&vm, 3)), 0);
+	assert_null(pages_alloc_order(&vm, 3));
+	assert_int_equal(index_of(&vm, p[1] = pages_alloc_order(&vm, 0)), 12);
+	assert_int_equal(index_of(&vm, p[2] = pages_alloc_order(&vm, 1)), 8);
+	assert_int_equal(index_of(&vm, p[3] = pages_alloc_order(&vm, 1)), 10);
+	assert_int_equal(vm.avail, 0);
+	assert_null(pages_alloc_order(&vm, 0));
+
+	/* the last page has no buddy in the map and stays on its own */
+	pages_free_order(&vm, p[1], 0);
+	pages_free_order(&vm, p[3], 1);
+	pages_free_order(&vm, p[2], 1);
+	pages_free_order(&vm, p[0], 3);
+	assert_int_equal(vm.areamap, (1U << 3) | (1U << 2) | 1U);
+	assert_int_equal(vm.avail, 13);
+	pages_free(&vm);
+}
+
+static void
+test_fragmentation(void **state)
+{
+	(void)state;
+	struct pages_measure m = { 0 };
+	struct pages vm;
+	struct page *p[16];
+	u32 i;
+
+	assert_int_equal(pages_map(&vm, MAP, ANON, 12, 16), 0);
+	assert_int_equal(pages_buddy(&vm, 4), 0);
+#ifdef CONFIG_MEASURE
+	vm.measure = &m;
+#endif
+	(void)m;
+	for (i = 0; i < 16; i++)
+		assert_int_equal(index_of(&vm, p[i] = pages_alloc_order(&vm, 0)), i);
+	/* every other page free: eight pages, none of them merging */
+	for (i = 0; i < 16; i += 2)
+		pages_free_order(&vm, p[i], 0);
+	assert_int_equal(vm.avail, 8);
+	assert_int_equal(vm.areamap, 1U);
+	assert_null(pages_alloc_order(&vm, 1));
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.avail, 8);
+	assert_int_equal(m.largest, 1);
+	assert_int_equal(m.frag, 87);
+	assert_int_equal(m.merge, 0);
+#endif
+	for (i = 1; i < 16; i += 2)
+		pages_free_order(&vm, p[i], 0);
+	assert_int_equal(vm.areamap, 1U << 4);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.merge, 15);
+	assert_int_equal(m.frag, 0);
+#endif
+	assert_int_equal(pages_buddy(&vm, PAGES_MAX_ORDER + 1), -1);
+	pages_free(&vm);
+}
+
+static void
+test_random_churn(void **state)
+{
+	(void)state;
+	enum { TOTAL = 1024, SLOTS = 256 };
+	struct pages vm;
+	struct page *blk[SLOTS] = { 0 };
+	u32 order[SLOTS], owner[TOTAL];
+	u32 seed = 12345;
+
+	assert_int_equal(pages_map(&vm, MAP, ANON, 12, TOTAL), 0);
+	assert_int_equal(pages_buddy(&vm, 10), 0);
+	for (u32 i = 0; i < TOTAL; i++)
+		owner[i] = ~0U;
+
+	for (u32 step = 0; step < 20000; step++) {
+		u32 s, idx, n;
+		seed = seed * 1103515245 + 12345;
+		s = (seed >> 8) % SLOTS;
+		if (blk[s]) {
+			idx = page_index(&vm, blk[s]);
+			n = 1U << order[s];
+			for (u32 j = 0; j < n; j++) {
+				assert_int_equal(owner[idx + j], s);
+				assert_int_equal(*(u32 *)get_page(&vm, idx + j), s);
+				owner[idx + j] = ~0U;
+			}
+			pages_free_order(&vm, blk[s], order[s]);
+			blk[s] = NULL;
+			continue;
+		}
+		order[s] = (seed >> 20) % 6;
+		if (!(blk[s] = pages_alloc_order(&vm, order[s])))
+			continue;
+		idx = page_index(&vm, blk[s]);
+		n = 1U << order[s];
+		assert_int_equal(idx & (n - 1), 0);
+		assert_true(idx + n <= TOTAL);
+		for (u32 j = 0; j < n; j++) {
+			assert_int_equal(owner[idx + j], ~0U);
+			owner[idx + j] = s;
+			*(u32 *)get_page(&vm, idx + j) = s;
+		}
+	}
+	for (u32 s = 0; s < SLOTS; s++)
+		if (blk[s])
+			pages_free_order(&vm, blk[s], order[s]);
+	assert_int_equal(vm.avail, TOTAL);
+	assert_int_equal(vm.areamap, 1U << 10);
+	pages_free(&vm);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_split_merge),
+		cmocka_unit_test(test_non_pow2),
+		cmocka_unit_test(test_fragmentation),
+		cmocka_unit_test(test_random_churn),
+	};
+	return cmocka_run_group_tests_name("pages", tests, NULL, NULL);
+}
@@ -0,0 +1,329 @@
+/*
+ * Unit tests for the chunked arena, <mem/pool.h>.
+ *
+ * The arena is used the way a request handler uses it: a savepoint at the
+ * start of the scope, allocations of every size in it - some spilling into
+ * fresh chunks, some large enough for a chunk of their own - and a restore at
+ * the end. The units check that a restore gives back exactly what the scope
+ * took, that nested savepoints unwind in order, that the chunks a scope
+ * opened come back from the block cache the next time instead of from the
+ * OS, and that the last allocation can be freed, grown and shrunk in place.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include <hpc/compiler.h>
+#include <mem/pool.h>
+
+static void
+assert_aligned(void *p)
+{
+	assert_int_equal((uintptr_t)p & (MM_POOL_ALIGN - 1), 0);
+}
+
+/* Allocate @n objects of varied sizes, stamp each, return the bytes taken. */
+static size_t
+scope_fill(struct mm_pool *pool, u8 **obj, u32 n, u8 stamp)
+{
+	size_t bytes = 0;
+	for (u32 i = 0; i < n; i++) {
+		size_t size = 1 + (i * 37) % 700;
+		if (i % 50 == 49)
+			size = 3 * CPU_PAGE_SIZE + i;     /* a large one */
+		obj[i] = mm_pool_alloc(pool, size);
+		assert_non_null(obj[i]);
+		assert_aligned(obj[i]);
+		memset(obj[i], stamp, size);
+		bytes += size;
+	}
+	return bytes;
+}
+
+static void
+test_accounting(void **state)
+{
+	(void)state;
+	struct mm_pool *pool = mm_pool_create(CPU_PAGE_SIZE, 0);
+	struct mm_pool_measure m = { 0 };
+	size_t avail, total;
+	u8 *a, *b, *c;
+
+	assert_non_null(pool);
+#ifdef CONFIG_MEASURE
+	pool->measure = &m;
+#endif
+	(void)m;
+	assert_int_equal(mm_pool_size(pool), 0);
+	total = mm_pool_total(pool);
+	avail = mm_pool_avail(pool);
+	assert_true(avail > 0 && avail < total);
+
+	a = mm_pool_alloc(pool, 10);
+	b = mm_pool_alloc(pool, 24);
+	assert_aligned(a);
+	assert_aligned(b);
+	assert_int_equal(mm_pool_size(pool), 34);
+	assert_true(mm_pool_avail(pool) <= avail - 34);
+
+	/* the last allocation rewinds, anything else waits */
+	mm_pool_free(pool, a);
+	assert_int_equal(mm_pool_size(pool), 34);
+	mm_pool_free(pool, b);
+	assert_int_equal(mm_pool_size(pool), 10);
+	c = mm_pool_alloc(pool, 24);
+	assert_ptr_equal(c, b);
+
+	/* a large allocation takes a chunk of its own, and gives it back */
+	c = mm_pool_alloc(pool, 4 * CPU_PAGE_SIZE);
+	assert_int_equal(mm_pool_size(pool), 34 + 4 * CPU_PAGE_SIZE);
+	assert_true(mm_pool_total(pool) >= total + 4 * CPU_PAGE_SIZE);
+	mm_pool_free(pool, c);
+	assert_int_equal(mm_pool_size(pool), 34);
+	assert_int_equal(mm_pool_total(pool), total);
+	assert_true(mm_pool_cached(pool) >= 4 * CPU_PAGE_SIZE);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.alloc, 4);
+	assert_int_equal(m.large, 1);
+	assert_int_equal(m.rewind, 2);
+	assert_int_equal(m.defer, 1);
+	assert_int_equal(m.size, 34);
+	assert_int_equal(m.total, total);
+#endif
+	mm_pool_flush(pool);
+	assert_int_equal(mm_pool_size(pool), 0);
+	assert_int_equal(mm_pool_avail(pool), avail);
+	mm_pool_destroy(pool);
+}
+
+static void
+test_savepoints_nest(void **state)
+{
+	(void)state;
+	struct mm_pool *pool = mm_pool_create(CPU_PAGE_SIZE, 0);
+	struct mm_savep outer, inner;
+	u8 *o[200], *in[200];
+	size_t size, total, bytes;
+
+	mm_pool_alloc(pool, 100);
+	size = mm_pool_size(pool);
+	total = mm_pool_total(pool);
+
+	mm_pool_save(pool, &outer);
+	bytes = scope_fill(pool, o, 200, 0x11);
+	assert_int_equal(mm_pool_size(pool), size + bytes);
+	assert_true(mm_pool_total(pool) > total);
+
+	mm_pool_save(pool, &inner);
+	scope_fill(pool, in, 200, 0x22);
+	mm_pool_restore(pool, &inner);
+	assert_int_equal(mm_pool_size(pool), size + bytes);
+	/* the outer scope's objects are untouched */
+	for (u32 i = 0; i < 200; i++)
+		assert_int_equal(o[i][0], 0x11);
+
+	mm_pool_restore(pool, &outer);
+	assert_int_equal(mm_pool_size(pool), size);
+	assert_int_equal(mm_pool_total(pool), total);
+	assert_true(mm_pool_cached(pool) > 0);
+	mm_pool_destroy(pool);
+}
+
+static void
+test_push_pop(void **state)
+{
+	(void)state;
+	struct mm_pool *pool = mm_pool_create(CPU_PAGE_SIZE, 0);
+	u8 *obj[100];
+	size_t level[4];
+
+	for (int d = 0; d < 4; d++) {
+		level[d] = mm_pool_size(pool);
+		mm_pool_push(pool);
+		scope_fill(pool, obj, 100, (u8)d);
+	}
+	for (int d = 3; d >= 0; d--) {
+		mm_pool_pop(pool);
+		assert_int_equal(mm_pool_size(pool), level[d]);
+	}
+	mm_pool_pop(pool);                        /* nothing left: no-op */
+	assert_int_equal(mm_pool_size(pool), 0);
+	mm_pool_destroy(pool);
+}
+
+static void
+test_block_cache(void **state)
+{
+	(void)state;
+	struct mm_pool *pool = mm_pool_create(CPU_PAGE_SIZE, 0);
+	struct mm_pool_measure m = { 0 };
+	struct mm_savep sp;
+	u8 *obj[300];
+	size_t cached, peak;
+
+#ifdef CONFIG_MEASURE
+	pool->measure = &m;
+#endif
+	(void)m;
+	/* the first request maps its chunks ... */
+	mm_pool_save(pool, &sp);
+	scope_fill(pool, obj, 300, 1);
+	peak = mm_pool_total(pool);
+	mm_pool_restore(pool, &sp);
+	cached = mm_pool_cached(pool);
+	assert_int_equal(cached + mm_pool_total(pool), peak);
+#ifdef CONFIG_MEASURE
+	u64 chunks = m.chunk;
+	assert_true(chunks > 0);
+	assert_int_equal(m.recycle, 0);
+#endif
+	/* ... and every one after runs on the same chunks, flush or restore */
+	for (int r = 0; r < 10; r++) {
+		mm_pool_save(pool, &sp);
+		scope_fill(pool, obj, 300, (u8)r);
+		assert_int_equal(mm_pool_total(pool), peak);
+		if (r & 1)
+			mm_pool_flush(pool);
+		else
+			mm_pool_restore(pool, &sp);
+		assert_int_equal(mm_pool_cached(pool), cached);
+	}
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.chunk, chunks);
+	assert_int_equal(m.recycle, 10 * chunks);
+	assert_int_equal(m.release, 0);
+#endif
+	assert_int_equal(mm_pool_trim(pool, 0), cached);
+	assert_int_equal(mm_pool_cached(pool), 0);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.release, chunks);
+#endif
+	mm_pool_destroy(pool);
+}
+
+static void
+test_realloc_printf(void **state)
+{
+	(void)state;
+	struct mm_pool *pool = mm_pool_create(CPU_PAGE_SIZE, 0);
+	char *s, *t, big[3000];
+	u8 *p, *q;
+
+	/* the last allocation grows and shrinks in place */
+	p = mm_pool_alloc(pool, 16);
+	memset(p, 7, 16);
+	assert_ptr_equal(mm_pool_realloc(pool, p, 64), p);
+	assert_int_equal(mm_pool_size(pool), 64);
+	assert_ptr_equal(mm_pool_realloc(pool, p, 8), p);
+	assert_int_equal(mm_pool_size(pool), 8);
+
+	/* anything else is copied */
+	q = mm_pool_alloc(pool, 8);
+	memset(q, 9, 8);
+	p = mm_pool_realloc(pool, p, 32);
+	assert_ptr_not_equal(p, q);
+	assert_int_equal(p[0], 7);
+	assert_int_equal(p[7], 7);
+
+	/* a large one is remapped, its contents kept */
+	p = mm_pool_alloc(pool, 2 * CPU_PAGE_SIZE);
+	memset(p, 5, 2 * CPU_PAGE_SIZE);
+	q = mm_pool_realloc(pool, p, 64 * CPU_PAGE_SIZE);
+	assert_int_equal(q[0], 5);
+	assert_int_equal(q[2 * CPU_PAGE_SIZE - 1], 5);
+	q[64 * CPU_PAGE_SIZE - 1] = 1;
+	mm_pool_free(pool, q);
+
+	/* strings that outgrow the chunk they started in */
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = 0;
+	for (int i = 0; i < 20; i++) {
+		s = mm_pool_printf(pool, "%d:%s", i, big);
+		assert_int_equal(strlen(s), strlen(big) + 2 + (i >= 10));
+		assert_int_equal(s[strlen(s) - 1], 'x');
+	}
+	t = mm_pool_strdup(pool, "scratch");
+	assert_string_equal(t, "scratch");
+	mm_pool_destroy(pool);
+}
+
+static void
+test_overlay(void **state)
+{
+	(void)state;
+	static u64 mem[512];
+	struct mm_pool *pool;
+	u8 *obj[100];
+
+	assert_null(mm_pool_overlay(mem, 16));
+	pool = mm_pool_overlay(mem, sizeof(mem));
+	assert_ptr_equal(pool, mem);
+	assert_true(mm_pool_avail(pool) > sizeof(mem) / 2);
+	/* the caller's memory first, then mapped chunks; only those are freed */
+	obj[0] = mm_pool_alloc(pool, 64);
+	assert_true(obj[0] > (u8 *)mem && obj[0] < (u8 *)(mem + 512));
+	scope_fill(pool, obj, 100, 3);
+	mm_pool_flush(pool);
+	assert_int_equal(mm_pool_size(pool), 0);
+	mm_pool_destroy(pool);
+}
+
+static void
+test_huge_pages(void **state)
+{
+	(void)state;
+	struct mm_pool *pool = mm_pool_create(CPU_PAGE_SIZE, MM_HUGE_PAGE);
+	struct mm_pool_measure m = { 0 };
+	size_t hdr = align_addr(sizeof(struct mm_vblock));
+	u8 *p, *q;
+
+	assert_non_null(pool);
+#ifdef CONFIG_MEASURE
+	pool->measure = &m;
+#endif
+	(void)m;
+	/* whatever it got, the chunk is whole huge pages, and so is the first */
+	assert_int_equal((pool->blocksize + hdr) % VM_HUGE_PAGE_SIZE, 0);
+	assert_int_equal((mm_pool_total(pool) + hdr) % VM_HUGE_PAGE_SIZE, 0);
+	assert_true(mm_pool_backing(pool) >= VM_BACKING_PAGE &&
+	            mm_pool_backing(pool) <= VM_BACKING_HUGETLB);
+	if (mm_pool_backing(pool) != VM_BACKING_PAGE)
+		assert_int_equal((uintptr_t)pool % VM_HUGE_PAGE_SIZE, 0);
+
+	/* a large chunk rounds to huge pages, and grows by a copy */
+	p = mm_pool_alloc(pool, 3 * VM_HUGE_PAGE_SIZE / 2);
+	memset(p, 0x5a, 3 * VM_HUGE_PAGE_SIZE / 2);
+	assert_int_equal((mm_pool_total(pool) + 2 * hdr) % VM_HUGE_PAGE_SIZE, 0);
+	q = mm_pool_realloc(pool, p, 5 * VM_HUGE_PAGE_SIZE / 2);
+	assert_int_equal(q[0], 0x5a);
+	assert_int_equal(q[3 * VM_HUGE_PAGE_SIZE / 2 - 1], 0x5a);
+	q[5 * VM_HUGE_PAGE_SIZE / 2 - 1] = 1;
+	assert_int_equal(mm_pool_size(pool), 5 * VM_HUGE_PAGE_SIZE / 2);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.chunk, 2);
+	if (mm_pool_backing(pool) != VM_BACKING_PAGE)
+		assert_int_equal(m.hugetlb + m.thp, 2);
+	mm_pool_flush(pool);
+	assert_int_equal(m.backing, mm_pool_backing(pool));
+#endif
+	mm_pool_destroy(pool);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_accounting),
+		cmocka_unit_test(test_savepoints_nest),
+		cmocka_unit_test(test_push_pop),
+		cmocka_unit_test(test_block_cache),
+		cmocka_unit_test(test_realloc_printf),
+		cmocka_unit_test(test_overlay),
+		cmocka_unit_test(test_huge_pages),
+	};
+	return cmocka_run_group_tests_name("pool", tests, NULL, NULL);
+}
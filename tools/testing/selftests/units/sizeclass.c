@@ -0,0 +1,327 @@
+/*
+ * Unit tests for the size-class allocator, <mem/sizeclass.h>.
+ *
+ * The class arithmetic first - sizeclass_of() and sizeclass_size() are each
+ * other's inverse, and no size lands in a class too small for it - then the
+ * allocator through both of its interfaces: small and large objects, the
+ * alignment promises, realloc() in place and across the large boundary, a size
+ * no machine can map failing with ENOMEM rather than exiting, and a threaded
+ * unit freeing across threads.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <hpc/compiler.h>
+#include <mem/sizeclass.h>
+
+static void
+test_class_table(void **state)
+{
+	(void)state;
+	unsigned i;
+
+	assert_int_equal(sizeclass_size(0), SIZECLASS_MIN);
+	assert_int_equal(sizeclass_size(SIZECLASS_COUNT - 1), SIZECLASS_MAX);
+	for (i = 0; i < SIZECLASS_COUNT; i++) {
+		u32 size = sizeclass_size(i);
+		assert_int_equal(size % SIZECLASS_MIN, 0);
+		assert_int_equal(sizeclass_of(size), i);
+		if (i)
+			assert_true(size > sizeclass_size(i - 1));
+		/* geometric from 128 up: a class at most 25% over the last */
+		if (i > SIZECLASS_SMALL_STEPS)
+			assert_true(size * 4 <= sizeclass_size(i - 1) * 5);
+	}
+}
+
+static void
+test_class_of_every_size(void **state)
+{
+	(void)state;
+	size_t size;
+
+	for (size = 1; size <= SIZECLASS_MAX; size++) {
+		unsigned c = sizeclass_of(size);
+		assert_true(c < SIZECLASS_COUNT);
+		assert_true(sizeclass_size(c) >= size);
+		if (c)
+			assert_true(sizeclass_size(c - 1) < size);
+	}
+}
+
+static void
+test_small_alloc_free(void **state)
+{
+	(void)state;
+	void *p[64];
+	unsigned i;
+
+	for (i = 0; i < 64; i++) {
+		size_t size = 1 + i * 97;
+		p[i] = mm_sizeclass_alloc(size);
+		assert_non_null(p[i]);
+		assert_int_equal((uintptr_t)p[i] % SIZECLASS_MIN, 0);
+		assert_true(mm_sizeclass_usable(p[i]) >= size);
+		memset(p[i], (int)i, size);
+	}
+	for (i = 0; i < 64; i++) {
+		assert_int_equal(((u8 *)p[i])[0], (u8)i);
+		mm_sizeclass_free(p[i]);
+	}
+
+	/* a freed object is the next one its class hands out */
+	p[0] = mm_sizeclass_alloc(100);
+	mm_sizeclass_free(p[0]);
+	assert_ptr_equal(mm_sizeclass_alloc(100), p[0]);
+	mm_sizeclass_free(p[0]);
+	mm_sizeclass_free(NULL);
+}
+
+static void
+test_refill_spans(void **state)
+{
+	(void)state;
+	struct mm_sizeclass_stat st;
+	unsigned c = sizeclass_of(48);
+	u32 spans, i, n;
+	void **held;
+
+	assert_int_equal(mm_sizeclass_stat(c, &st), 0);
+	assert_int_equal(st.size, 48);
+	assert_true(st.per_span >= 16);
+	assert_int_equal(st.span_size % 65536, 0);
+	spans = st.spans;
+
+	/* three spans' worth forces at least two refills */
+	n = 3 * st.per_span;
+	held = (void **)mm_sizeclass_alloc(n * sizeof(*held));
+	for (i = 0; i < n; i++)
+		assert_non_null(held[i] = mm_sizeclass_alloc(48));
+	assert_int_equal(mm_sizeclass_stat(c, &st), 0);
+	assert_true(st.spans >= spans + 2);
+	for (i = 0; i < n; i++)
+		mm_sizeclass_free(held[i]);
+	mm_sizeclass_free(held);
+	assert_int_equal(mm_sizeclass_stat(SIZECLASS_COUNT, &st), -1);
+}
+
+static void
+test_large(void **state)
+{
+	(void)state;
+	struct mm_sizeclass_stat st;
+	size_t size = SIZECLASS_MAX + 1;
+	u64 live;
+	u8 *p;
+
+	assert_int_equal(mm_sizeclass_stat(0, &st), 0);
+	live = st.large;
+	p = (u8 *)mm_sizeclass_alloc(size);
+	assert_non_null(p);
+	assert_int_equal((uintptr_t)p % SIZECLASS_MIN, 0);
+	assert_true(mm_sizeclass_usable(p) >= size);
+	memset(p, 0x5a, size);
+	assert_int_equal(mm_sizeclass_stat(0, &st), 0);
+	assert_int_equal(st.large, live + 1);
+	mm_sizeclass_free(p);
+	assert_int_equal(mm_sizeclass_stat(0, &st), 0);
+	assert_int_equal(st.large, live);
+}
+
+static void
+test_memalign(void **state)
+{
+	(void)state;
+	size_t align;
+
+	for (align = 16; align <= 65536; align <<= 1) {
+		void *a = mm_sizeclass_memalign(align, 24);
+		void *b = mm_sizeclass_memalign(align, SIZECLASS_MAX + 100);
+		assert_non_null(a);
+		assert_non_null(b);
+		assert_int_equal((uintptr_t)a % align, 0);
+		assert_int_equal((uintptr_t)b % align, 0);
+		assert_true(mm_sizeclass_usable(a) >= 24);
+		assert_true(mm_sizeclass_usable(b) >= SIZECLASS_MAX + 100);
+		memset(b, 1, SIZECLASS_MAX + 100);
+		mm_sizeclass_free(a);
+		mm_sizeclass_free(b);
+	}
+}
+
+static void
+test_realloc(void **state)
+{
+	(void)state;
+	u8 *p, *q;
+	size_t i;
+
+	p = (u8 *)mm_sizeclass_realloc(NULL, 100);
+	for (i = 0; i < 100; i++)
+		p[i] = (u8)i;
+	/* same class: stays put */
+	assert_ptr_equal(mm_sizeclass_realloc(p, 110), p);
+
+	/* small -> large -> larger -> small, contents carried along */
+	q = (u8 *)mm_sizeclass_realloc(p, 100000);
+	for (i = 0; i < 100; i++)
+		assert_int_equal(q[i], (u8)i);
+	memset(q + 100, 7, 100000 - 100);
+	p = (u8 *)mm_sizeclass_realloc(q, 1000000);
+	for (i = 0; i < 100; i++)
+		assert_int_equal(p[i], (u8)i);
+	assert_int_equal(p[99999], 7);
+	q = (u8 *)mm_sizeclass_realloc(p, 50);
+	for (i = 0; i < 50; i++)
+		assert_int_equal(q[i], (u8)i);
+	assert_null(mm_sizeclass_realloc(q, 0));
+}
+
+/*
+ * 1 PiB is past the 47-bit user address space, so the mapping fails whatever
+ * the overcommit policy: every entry point returns NULL with ENOMEM and the
+ * block realloc() was asked to grow is still there, contents and all.
+ */
+static void
+test_out_of_memory(void **state)
+{
+	(void)state;
+	size_t huge = (size_t)1 << 50;
+	u8 *p;
+
+	errno = 0;
+	assert_null(mm_sizeclass_alloc(huge));
+	assert_int_equal(errno, ENOMEM);
+	errno = 0;
+	assert_null(mm_sizeclass_memalign(4096, huge));
+	assert_int_equal(errno, ENOMEM);
+	errno = 0;
+	assert_null(mm_sizeclass_calloc(1, huge));
+	assert_int_equal(errno, ENOMEM);
+	errno = 0;
+	assert_null(mm_sizeclass_alloc(SIZE_MAX - 100));
+	assert_int_equal(errno, ENOMEM);
+
+	p = (u8 *)mm_sizeclass_alloc(SIZECLASS_MAX + 1);
+	assert_non_null(p);
+	memset(p, 0x3c, SIZECLASS_MAX + 1);
+	errno = 0;
+	assert_null(mm_sizeclass_realloc(p, huge));
+	assert_int_equal(errno, ENOMEM);
+	errno = 0;
+	assert_null(mm_sizeclass_realloc(p, SIZE_MAX - 100));
+	assert_int_equal(errno, ENOMEM);
+	assert_true(mm_sizeclass_usable(p) >= SIZECLASS_MAX + 1);
+	assert_int_equal(p[0], 0x3c);
+	assert_int_equal(p[SIZECLASS_MAX], 0x3c);
+	mm_sizeclass_free(p);
+}
+
+static void
+test_calloc_and_mm(void **state)
+{
+	(void)state;
+	struct mm *mm = mm_sizeclass();
+	u8 *p;
+	size_t i;
+
+	p = (u8 *)mm_sizeclass_alloc(256);
+	memset(p, 0xff, 256);
+	mm_sizeclass_free(p);
+	p = (u8 *)mm_sizeclass_calloc(16, 16);      /* likely the same object */
+	for (i = 0; i < 256; i++)
+		assert_int_equal(p[i], 0);
+	mm_sizeclass_free(p);
+	assert_null(mm_sizeclass_calloc((size_t)1 << 40, (size_t)1 << 40));
+
+	p = (u8 *)mm_alloc(mm, 40);
+	assert_non_null(p);
+	p = (u8 *)mm_realloc(mm, p, 4000);
+	assert_non_null(p);
+	mm_free(mm, p);
+}
+
+/* ---- threads ------------------------------------------------------------- */
+
+enum { THREADS = 4, ROUNDS = 20000, RING = 256 };
+
+/* Each thread frees what its neighbour allocated, through a shared ring. */
+static void *volatile ring[THREADS][RING];
+
+struct worker {
+	pthread_t tid;
+	unsigned id;
+	int fail;
+};
+
+static void *
+worker_main(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	unsigned next = (w->id + 1) % THREADS, i;
+
+	for (i = 0; i < ROUNDS; i++) {
+		size_t size = 8 + (i * 131 + w->id * 17) % 3000;
+		u64 *p = (u64 *)mm_sizeclass_alloc(size);
+		void *old;
+		if (!p) {
+			w->fail = 1;
+			break;
+		}
+		*p = (u64)size;
+		old = __atomic_exchange_n(&ring[next][i % RING], p,
+		                          __ATOMIC_ACQ_REL);
+		if (old) {
+			if (mm_sizeclass_usable(old) < *(u64 *)old)
+				w->fail = 1;
+			mm_sizeclass_free(old);
+		}
+	}
+	return NULL;
+}
+
+static void
+test_threads(void **state)
+{
+	(void)state;
+	struct worker w[THREADS];
+	unsigned i, j;
+
+	for (i = 0; i < THREADS; i++) {
+		w[i] = (struct worker){ .id = i };
+		assert_int_equal(pthread_create(&w[i].tid, NULL, worker_main,
+		                                &w[i]), 0);
+	}
+	for (i = 0; i < THREADS; i++) {
+		pthread_join(w[i].tid, NULL);
+		assert_int_equal(w[i].fail, 0);
+	}
+	for (i = 0; i < THREADS; i++)
+		for (j = 0; j < RING; j++)
+			mm_sizeclass_free(ring[i][j]);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_class_table),
+		cmocka_unit_test(test_class_of_every_size),
+		cmocka_unit_test(test_small_alloc_free),
+		cmocka_unit_test(test_refill_spans),
+		cmocka_unit_test(test_large),
+		cmocka_unit_test(test_memalign),
+		cmocka_unit_test(test_realloc),
+		cmocka_unit_test(test_out_of_memory),
+		cmocka_unit_test(test_calloc_and_mm),
+		cmocka_unit_test(test_threads),
+	};
+	return cmocka_run_group_tests_name("sizeclass", tests, NULL, NULL);
+}
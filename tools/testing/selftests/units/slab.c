@@ -17,6 +17,8 @@
 #include <setjmp.h>
 #include <cmocka.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include <hpc/compiler.h>
 
@@ -762,6 +764,918 @@ test_grain_coarse_unit(void **state)
 	assert_int_equal(slab_grain_round(42, 1), 42);
 }
 
+/* ---- lock-free mode ------------------------------------------------------ */
+
+/* Single-threaded, the lock-free calls are the plain ones plus a tag. */
+static void
+test_lockfree_basic(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 4, .max = 64 };
+	struct slab vm;
+	void *a, *b;
+	u32 tag;
+
+	assert_int_equal(slab_init(&vm, 512, &pol), 0);
+	tag = vm.tag;
+	a = slab_alloc_lockfree(&vm);
+	b = slab_alloc_lockfree(&vm);
+	assert_non_null(a);
+	assert_non_null(b);
+	assert_ptr_not_equal(a, b);
+	assert_int_equal(slab_used(&vm), 2);
+	assert_int_equal(vm.tag, tag + 2);       /* every pop bumps the tag */
+
+	slab_free_lockfree(&vm, a);
+	assert_int_equal(slab_used(&vm), 1);
+	assert_ptr_equal(slab_alloc_lockfree(&vm), a);   /* still LIFO */
+
+	/* the exclusive paths work on the same list afterwards */
+	slab_free(&vm, a);
+	slab_free_lockfree(&vm, b);
+	assert_int_equal(slab_used(&vm), 0);
+	assert_int_equal(slab_grow_lockfree(&vm, 1), slab_grain(&vm));
+	assert_int_equal(slab_shrink(&vm, slab_grain(&vm)), slab_grain(&vm));
+	assert_int_equal(slab_committed(&vm), slab_policy_min(&vm));
+	slab_fini(&vm);
+}
+
+/* Exhaustion grows lock-free, by whole grains, up to max and no further. */
+static void
+test_lockfree_grow(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 2, .max = 6, .grow_step = 2 };
+	struct slab vm;
+	void *blk[6];
+	u32 i;
+
+	assert_int_equal(slab_init(&vm, SLAB_GRAIN_BYTES, &pol), 0);
+	for (i = 0; i < 6; i++)
+		assert_non_null(blk[i] = slab_alloc_lockfree(&vm));
+	assert_int_equal(slab_committed(&vm), 6);
+	assert_null(slab_alloc_lockfree(&vm));
+	for (i = 0; i < 6; i++)
+		slab_free_lockfree(&vm, blk[i]);
+	assert_int_equal(slab_avail(&vm), 6);
+	assert_int_equal(slab_grow_lockfree(&vm, 1), 0);
+	slab_fini(&vm);
+}
+
+enum { LF_THREADS = 4, LF_LIVE = 64, LF_ROUNDS = 50000 };
+
+struct lf_worker {
+	pthread_t tid;
+	struct slab *vm;
+	struct slab_class *sc;
+	u32 seed;
+	int fail;
+};
+
+/*
+ * Each thread churns its own table of live blocks, stamping every block it
+ * owns with the slot's address: a block handed to two threads at once - the
+ * ABA failure - shows up as a stamp overwritten by the other owner.
+ */
+static void *
+lf_worker_main(void *arg)
+{
+	struct lf_worker *w = (struct lf_worker *)arg;
+	u64 *live[LF_LIVE] = { 0 };
+	u32 i;
+
+	for (i = 0; i < LF_ROUNDS; i++) {
+		u32 k = (w->seed = w->seed * 1103515245u + 12345u) >> 8;
+		k %= LF_LIVE;
+		if (live[k]) {
+			if (*live[k] != (u64)(uintptr_t)&live[k])
+				w->fail = 1;
+			if (w->vm)
+				slab_free_lockfree(w->vm, live[k]);
+			else
+				slab_class_free_lockfree(w->sc, live[k]);
+			live[k] = NULL;
+		} else {
+			live[k] = (u64 *)(w->vm ? slab_alloc_lockfree(w->vm)
+			                        : slab_class_alloc_lockfree(w->sc));
+			if (live[k])
+				*live[k] = (u64)(uintptr_t)&live[k];
+		}
+	}
+	for (i = 0; i < LF_LIVE; i++) {
+		if (!live[i])
+			continue;
+		if (w->vm)
+			slab_free_lockfree(w->vm, live[i]);
+		else
+			slab_class_free_lockfree(w->sc, live[i]);
+	}
+	return NULL;
+}
+
+static void
+lf_run(struct slab *vm, struct slab_class *sc)
+{
+	struct lf_worker w[LF_THREADS];
+	u32 i;
+
+	for (i = 0; i < LF_THREADS; i++) {
+		w[i] = (struct lf_worker){ .vm = vm, .sc = sc, .seed = i * 7 + 1 };
+		assert_int_equal(pthread_create(&w[i].tid, NULL, lf_worker_main,
+		                                &w[i]), 0);
+	}
+	for (i = 0; i < LF_THREADS; i++) {
+		pthread_join(w[i].tid, NULL);
+		assert_int_equal(w[i].fail, 0);
+	}
+}
+
+/*
+ * Threads racing alloc, free and the grow an exhausted list triggers. The
+ * slab starts at one grain so growth happens under contention; afterwards
+ * every block is back, and the list holds exactly the committed blocks.
+ */
+static void
+test_lockfree_threads(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 1, .max = 4096, .grow_step = 1 };
+	struct slab vm;
+	u32 n = 0, i;
+
+	assert_int_equal(slab_init(&vm, 64, &pol), 0);
+	lf_run(&vm, NULL);
+	assert_int_equal(slab_used(&vm), 0);
+	for (i = vm.list; i != SLAB_NIL; i = ((struct slab_node *)
+	                                      slab_at(&vm, i))->avail)
+		n++;
+	assert_int_equal(n, slab_committed(&vm));
+	for (i = 0; i < slab_committed(&vm); i++)
+		assert_false(BITSET_TEST(vm.map, i));
+	slab_fini(&vm);
+}
+
+static void
+test_lockfree_class_threads(void **state)
+{
+	(void)state;
+	struct slab_class_policy pol = { .min = 1, .max = 4096, .grow_step = 1 };
+	struct slab_class sc;
+
+	assert_int_equal(slab_class_init(&sc, &pol), 0);
+	lf_run(NULL, &sc);
+	assert_int_equal(slab_class_used(&sc), 0);
+	assert_int_equal(sc.stat.used, 0);
+	assert_true(sc.stat.peak > 0 && sc.stat.peak <= LF_THREADS * LF_LIVE);
+	slab_class_fini(&sc);
+}
+
+/* ---- address-ordered mode ------------------------------------------------ */
+
+static void
+test_ordered_lowest_first(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 0, .max = 512, .grow_step = 16 };
+	struct slab vm;
+	void *blk[200];
+	u32 i;
+
+	assert_int_equal(slab_init(&vm, 64, &pol), 0);
+	assert_int_equal(slab_set_ordered(&vm, true), 0);
+	assert_true(slab_ordered(&vm));
+
+	/* a fresh slab hands out 0, 1, 2, ... growing as it goes */
+	for (i = 0; i < 200; i++) {
+		blk[i] = slab_alloc(&vm);
+		assert_non_null(blk[i]);
+		assert_int_equal(slab_index(&vm, blk[i]), i);
+	}
+	assert_int_equal(slab_used(&vm), 200);
+
+	/* free a scatter across several map words; they come back ascending */
+	slab_free(&vm, blk[150]);
+	slab_free(&vm, blk[3]);
+	slab_free(&vm, blk[64]);
+	slab_free(&vm, blk[127]);
+	assert_int_equal(slab_index(&vm, slab_alloc(&vm)), 3);
+	assert_int_equal(slab_index(&vm, slab_alloc(&vm)), 64);
+	assert_int_equal(slab_index(&vm, slab_alloc(&vm)), 127);
+	assert_int_equal(slab_index(&vm, slab_alloc(&vm)), 150);
+	/* then the committed prefix, then a grow */
+	while (slab_avail(&vm))
+		assert_true(slab_index(&vm, slab_alloc(&vm)) >= 200);
+	i = slab_committed(&vm);
+	assert_int_equal(slab_index(&vm, slab_alloc(&vm)), i);
+	assert_int_equal(slab_used(&vm), i + 1);
+	slab_fini(&vm);
+}
+
+static void
+test_ordered_exhaustion(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 64, .max = 64 };
+	struct slab vm;
+	void *blk[64];
+	u32 i;
+
+	assert_int_equal(slab_init(&vm, 64, &pol), 0);
+	assert_int_equal(slab_set_ordered(&vm, true), 0);
+	for (i = 0; i < slab_committed(&vm); i++)
+		assert_non_null(blk[i] = slab_alloc(&vm));
+	assert_null(slab_alloc(&vm));             /* a full word, at max */
+	slab_free(&vm, blk[63]);
+	assert_ptr_equal(slab_alloc(&vm), blk[63]);
+	assert_null(slab_alloc(&vm));
+	slab_fini(&vm);
+}
+
+/*
+ * The reason for the mode: after a spike, replacing the survivors moves them to
+ * the front, and the gc gets the tail back. The LIFO slab under the same history
+ * keeps its high-water mark.
+ */
+static u32
+ordered_spike(bool ordered)
+{
+	struct slab_policy pol = {
+		.min = 0, .max = 4096, .grow_step = 64,
+		.shrink_usage_pct = 50, .shrink_release_pct = 100,
+	};
+	struct slab vm;
+	void *blk[4096];
+	u32 live[256], i, k, seed = 1, committed;
+
+	assert_int_equal(slab_init(&vm, SLAB_GRAIN_BYTES / 4, &pol), 0);
+	assert_int_equal(slab_set_ordered(&vm, ordered), 0);
+	for (i = 0; i < 4096; i++)
+		assert_non_null(blk[i] = slab_alloc(&vm));
+
+	/* the spike ends: 256 random survivors, the rest freed */
+	for (i = 0; i < 256; i++) {
+		seed = seed * 1103515245u + 12345u;
+		live[i] = i * 16 + (seed >> 16) % 16;
+	}
+	for (i = k = 0; i < 4096; i++) {
+		if (k < 256 && live[k] == i)
+			k++;
+		else
+			slab_free(&vm, blk[i]);
+	}
+
+	/* each survivor is replaced once, in a scrambled order */
+	for (i = 0; i < 256; i++) {
+		k = (i * 97) % 256;
+		slab_free(&vm, blk[live[k]]);
+		blk[live[k]] = slab_alloc(&vm);
+		live[k] = slab_index(&vm, blk[live[k]]);
+		blk[live[k]] = slab_at(&vm, live[k]);
+	}
+	assert_int_equal(slab_used(&vm), 256);
+	while (slab_gc(&vm, 0) < 0)
+		;
+	assert_int_equal(slab_used(&vm), 256);
+	committed = slab_committed(&vm);
+	slab_fini(&vm);
+	return committed;
+}
+
+static void
+test_ordered_spike_shrinks(void **state)
+{
+	(void)state;
+	u32 lifo = ordered_spike(false), ordered = ordered_spike(true);
+
+	/* LIFO hands each survivor's block straight back to its replacement */
+	assert_int_equal(lifo, 4096);
+	/* ordered moved every replacement below the live count */
+	assert_int_equal(ordered, 256);
+}
+
+static void
+test_ordered_switch(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 0, .max = 128, .grow_step = 128 };
+	struct slab vm;
+	u32 *blk[8], i;
+
+	assert_int_equal(slab_init(&vm, 64, &pol), 0);
+	for (i = 0; i < 8; i++) {
+		blk[i] = (u32 *)slab_alloc(&vm);
+		*blk[i] = i;
+	}
+	slab_free(&vm, blk[2]);
+	slab_free(&vm, blk[5]);
+
+	/* LIFO -> ordered: held blocks kept, lowest free first */
+	assert_int_equal(slab_set_ordered(&vm, true), 0);
+	assert_int_equal(slab_used(&vm), 6);
+	blk[2] = (u32 *)slab_alloc(&vm);
+	assert_int_equal(slab_index(&vm, blk[2]), 2);   /* not 5, freed last */
+	*blk[2] = 2;
+
+	/* ordered -> LIFO: the rebuilt list starts at the lowest free block */
+	assert_int_equal(slab_set_ordered(&vm, false), 0);
+	assert_false(slab_ordered(&vm));
+	blk[5] = (u32 *)slab_alloc(&vm);
+	assert_int_equal(slab_index(&vm, blk[5]), 5);
+	*blk[5] = 5;
+	for (i = 0; i < 8; i++)
+		assert_int_equal(*blk[i], i);
+	assert_int_equal(slab_used(&vm), 8);
+	assert_int_equal(slab_used(&vm) + slab_avail(&vm), slab_committed(&vm));
+	slab_free(&vm, blk[7]);
+	assert_ptr_equal(slab_alloc(&vm), blk[7]);   /* LIFO again */
+	slab_fini(&vm);
+}
+
+/* ---- compaction ---------------------------------------------------------- */
+
+/*
+ * The owner of the blocks in these units: a table from an object id to its
+ * block, the first word of which is the id. relocate() repoints the table, and
+ * refuses to move the ids it is told are pinned.
+ */
+struct owner {
+	u32 *obj[64];
+	u32 pinned;                   /* id never to move, ~0 for none */
+	u32 calls;
+};
+
+static bool
+owner_relocate(void *from, void *to, void *arg)
+{
+	struct owner *o = (struct owner *)arg;
+	u32 id = *(u32 *)from;
+
+	o->calls++;
+	assert_ptr_equal(o->obj[id], from);
+	assert_int_equal(*(u32 *)to, id);         /* the copy is already there */
+	if (id == o->pinned)
+		return false;
+	o->obj[id] = (u32 *)to;
+	return true;
+}
+
+/* Allocate 64 one-grain blocks with id == index, keep only @keep. */
+static void
+owner_fill(struct slab *vm, struct owner *o, const u32 *keep, u32 n)
+{
+	u32 *blk[64], i, k;
+
+	memset(o, 0, sizeof(*o));
+	o->pinned = ~0u;
+	for (i = 0; i < 64; i++) {
+		blk[i] = (u32 *)slab_alloc(vm);
+		assert_non_null(blk[i]);
+	}
+	for (i = 0; i < 64; i++) {
+		u32 ix = slab_index(vm, blk[i]);
+		for (k = 0; k < n && keep[k] != ix; k++)
+			;
+		if (k < n) {
+			*blk[i] = ix;
+			o->obj[ix] = blk[i];
+		} else {
+			slab_free(vm, blk[i]);
+		}
+	}
+}
+
+static void
+test_compact_moves_stragglers(void **state)
+{
+	(void)state;
+	static const u32 keep[] = { 1, 2, 40, 62, 63 };
+	struct slab_policy pol = { .min = 0, .max = 64, .grow_step = 64 };
+	struct slab vm;
+	struct owner o;
+	u32 i;
+
+	assert_int_equal(slab_init(&vm, SLAB_GRAIN_BYTES, &pol), 0);
+	owner_fill(&vm, &o, keep, 5);
+	assert_int_equal(slab_shrink(&vm, 64), 0);   /* 63 pins the lot */
+
+	/* the three above 8 move into 0, 3, 4 - highest first */
+	assert_int_equal(slab_compact(&vm, 8, 64, owner_relocate, &o), 3);
+	assert_int_equal(o.calls, 3);
+	assert_int_equal(slab_index(&vm, o.obj[63]), 0);
+	assert_int_equal(slab_index(&vm, o.obj[62]), 3);
+	assert_int_equal(slab_index(&vm, o.obj[40]), 4);
+	assert_int_equal(slab_index(&vm, o.obj[1]), 1);
+	for (i = 0; i < 5; i++)
+		assert_int_equal(*o.obj[keep[i]], keep[i]);
+	assert_int_equal(slab_used(&vm), 5);
+
+	/* now the tail goes, and the free list is whole */
+	assert_int_equal(slab_shrink(&vm, 64), 59);
+	assert_int_equal(slab_committed(&vm), 5);
+	assert_int_equal(slab_avail(&vm), 0);
+
+	/* nothing above the target is left: a second pass moves nothing */
+	assert_int_equal(slab_compact(&vm, 5, 64, owner_relocate, &o), 0);
+	assert_int_equal(slab_compact(&vm, 0, 64, NULL, &o), 0);
+	slab_fini(&vm);
+}
+
+static void
+test_compact_budget_and_pin(void **state)
+{
+	(void)state;
+	static const u32 keep[] = { 10, 20, 30, 63 };
+	struct slab_policy pol = { .min = 0, .max = 64, .grow_step = 64 };
+	struct slab vm;
+	struct owner o;
+	void *p;
+
+	assert_int_equal(slab_init(&vm, SLAB_GRAIN_BYTES, &pol), 0);
+	owner_fill(&vm, &o, keep, 4);
+	o.pinned = 30;
+
+	/* budget 2: 63 moves, 30 is pinned, 20 waits for the next call */
+	assert_int_equal(slab_compact(&vm, 4, 2, owner_relocate, &o), 1);
+	assert_int_equal(slab_index(&vm, o.obj[63]), 0);
+	assert_int_equal(slab_index(&vm, o.obj[30]), 30);
+	assert_int_equal(slab_index(&vm, o.obj[20]), 20);
+	assert_int_equal(slab_compact(&vm, 4, 2, owner_relocate, &o), 1);
+	assert_int_equal(slab_index(&vm, o.obj[20]), 1);
+	assert_int_equal(slab_index(&vm, o.obj[30]), 30);
+
+	/* the pinned block caps the shrink; the free list stays sound */
+	assert_int_equal(slab_shrink(&vm, 64), 33);
+	assert_int_equal(slab_used(&vm), 4);
+	assert_int_equal(slab_avail(&vm), 27);
+	while (slab_avail(&vm)) {
+		p = slab_alloc(&vm);
+		assert_true(slab_index(&vm, p) < 30);
+	}
+	assert_int_equal(slab_used(&vm), 31);
+	slab_fini(&vm);
+}
+
+/* slab_gc() compacts ahead of the tail it releases, within its budget. */
+static void
+test_gc_compacts(void **state)
+{
+	(void)state;
+	static const u32 keep[] = { 0, 1, 50, 63 };
+	struct slab_policy pol = {
+		.min = 0, .max = 64, .grow_step = 64,
+		.shrink_usage_pct = 50, .shrink_release_pct = 100,
+		.relocate = owner_relocate, .compact_budget = 1,
+	};
+#ifdef CONFIG_MEASURE
+	struct slab_measure m = { 0 };
+#endif
+	struct slab vm;
+	struct owner o;
+
+	pol.arg = &o;
+	assert_int_equal(slab_init(&vm, SLAB_GRAIN_BYTES, &pol), 0);
+	owner_fill(&vm, &o, keep, 4);
+#ifdef CONFIG_MEASURE
+	vm.measure = &m;
+#endif
+
+	/* one move per round: 63 first, then 50 */
+	assert_int_equal(slab_gc(&vm, 0), -13);
+	assert_int_equal(slab_committed(&vm), 51);
+	assert_int_equal(slab_gc(&vm, 0), -47);
+	assert_int_equal(slab_committed(&vm), 4);
+	assert_int_equal(slab_index(&vm, o.obj[63]), 2);
+	assert_int_equal(slab_index(&vm, o.obj[50]), 3);
+	assert_int_equal(*o.obj[50], 50);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.compact, 2);
+#endif
+	slab_fini(&vm);
+}
+
+static void
+test_compact_ordered(void **state)
+{
+	(void)state;
+	static const u32 keep[] = { 5, 61, 62 };
+	struct slab_policy pol = { .min = 0, .max = 64, .grow_step = 64 };
+	struct slab vm;
+	struct owner o;
+
+	assert_int_equal(slab_init(&vm, SLAB_GRAIN_BYTES, &pol), 0);
+	assert_int_equal(slab_set_ordered(&vm, true), 0);
+	owner_fill(&vm, &o, keep, 3);
+	assert_int_equal(slab_compact(&vm, 8, 8, owner_relocate, &o), 2);
+	assert_int_equal(slab_index(&vm, o.obj[62]), 0);
+	assert_int_equal(slab_index(&vm, o.obj[61]), 1);
+	/* the summary saw the moves: next is 2, and 61/62 are free again */
+	assert_int_equal(slab_index(&vm, slab_alloc(&vm)), 2);
+	assert_int_equal(slab_shrink(&vm, 64), 58);
+	assert_int_equal(slab_committed(&vm), 6);
+	slab_fini(&vm);
+}
+
+/* ---- bulk calls ---------------------------------------------------------- */
+
+/* Every committed block's map bit agrees with the free list. */
+static void
+bulk_check_map(struct slab *vm)
+{
+	u32 i, n = 0;
+	for (i = vm->list; i != SLAB_NIL; i = ((struct slab_node *)
+	                                       slab_at(vm, i))->avail) {
+		assert_false(BITSET_TEST(vm->map, i));
+		n++;
+	}
+	assert_int_equal(n, slab_avail(vm));
+	for (i = n = 0; i < slab_committed(vm); i++)
+		n += BITSET_TEST(vm->map, i) ? 1 : 0;
+	assert_int_equal(n, slab_used(vm));
+}
+
+/*
+ * A batch is the loop of single calls it replaces: two slabs under the same
+ * history, one driven in batches, the other a block at a time, hand out the
+ * same indices in the same order, and their maps agree.
+ */
+static void
+bulk_matches_single(bool ordered)
+{
+	static const u32 batch[] = { 1, 7, 64, 65, 130, 3 };
+	struct slab_policy pol = { .min = 0, .max = 1024, .grow_step = 48 };
+	struct slab a, b;
+	void *pa[1024], *pb[1024];
+	u32 live = 0, i, j, k;
+
+	assert_int_equal(slab_init(&a, 64, &pol), 0);
+	assert_int_equal(slab_init(&b, 64, &pol), 0);
+	assert_int_equal(slab_set_ordered(&a, ordered), 0);
+	assert_int_equal(slab_set_ordered(&b, ordered), 0);
+	for (j = 0; j < 24; j++) {
+		u32 n = batch[j % 6];
+		if (j % 3 != 2) {
+			k = slab_alloc_bulk(&a, pa + live, n);
+			assert_int_equal(k, n);
+			for (i = 0; i < n; i++) {
+				pb[live + i] = slab_alloc(&b);
+				assert_int_equal(slab_index(&a, pa[live + i]),
+				                 slab_index(&b, pb[live + i]));
+			}
+			live += n;
+		} else {
+			/* free a run from the middle, in batch order */
+			u32 at = live / 3;
+			n = n < live - at ? n : live - at;
+			slab_free_bulk(&a, pa + at, n);
+			for (i = 0; i < n; i++)
+				slab_free(&b, pb[at + i]);
+			memmove(pa + at, pa + at + n, (live - at - n) * sizeof(void *));
+			memmove(pb + at, pb + at + n, (live - at - n) * sizeof(void *));
+			live -= n;
+		}
+		assert_int_equal(slab_used(&a), live);
+		assert_int_equal(slab_committed(&a), slab_committed(&b));
+		assert_memory_equal(a.map, b.map, BITSET_SIZE(a.committed - 1));
+	}
+	if (!ordered)
+		bulk_check_map(&a);
+	slab_fini(&a);
+	slab_fini(&b);
+}
+
+static void
+test_bulk_matches_single(void **state)
+{
+	(void)state;
+	bulk_matches_single(false);
+	bulk_matches_single(true);
+}
+
+/* A batch past max comes back short, with the blocks it did get valid. */
+static void
+test_bulk_partial_on_exhaustion(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 0, .max = 128, .grow_step = 32 };
+	struct slab vm;
+	void *blk[200];
+	u32 k, i;
+#ifdef CONFIG_MEASURE
+	struct slab_measure m = { 0 };
+#endif
+
+	assert_int_equal(slab_init(&vm, 64, &pol), 0);
+#ifdef CONFIG_MEASURE
+	vm.measure = &m;
+#endif
+	k = slab_alloc_bulk(&vm, blk, 200);
+	assert_int_equal(k, 128);
+	assert_int_equal(slab_used(&vm), 128);
+	assert_int_equal(slab_avail(&vm), 0);
+	for (i = 0; i < k; i++)
+		memset(blk[i], (int)i, 64);
+	assert_int_equal(slab_alloc_bulk(&vm, blk + k, 1), 0);
+	slab_free_bulk(&vm, blk, k);
+	assert_int_equal(slab_used(&vm), 0);
+	bulk_check_map(&vm);
+	/* as a loop of frees: the last block of the batch is the next out */
+	assert_int_equal(slab_alloc_bulk(&vm, blk + 128, 4), 4);
+	for (i = 0; i < 4; i++)
+		assert_ptr_equal(blk[128 + i], blk[127 - i]);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.alloc, 132);
+	assert_int_equal(m.free, 128);
+	assert_int_equal(m.fail, 2);
+	assert_int_equal(m.used, 4);
+#endif
+	slab_fini(&vm);
+}
+
+static void
+test_bulk_class(void **state)
+{
+	(void)state;
+	struct slab_class_policy pol = { .min = 0, .max = 256, .grow_step = 16 };
+	struct slab_class sc;
+	void *blk[350];
+	u32 i, n = 0;
+
+	assert_int_equal(slab_class_init(&sc, &pol), 0);
+	assert_int_equal(slab_class_alloc_bulk(&sc, blk, 100), 100);
+	assert_int_equal(sc.stat.used, 100);
+	slab_class_free_bulk(&sc, blk + 10, 80);
+	assert_int_equal(sc.stat.used, 20);
+	assert_int_equal(sc.stat.peak, 100);
+	assert_int_equal(slab_class_alloc_bulk(&sc, blk + 100, 250), 236);
+	assert_int_equal(sc.stat.fails, 1);
+	assert_ptr_equal(blk[100], blk[89]);
+	slab_class_free_bulk(&sc, blk, 10);
+	slab_class_free_bulk(&sc, blk + 90, 246);
+	assert_int_equal(sc.stat.used, 0);
+	assert_int_equal(slab_class_avail(&sc), slab_class_committed(&sc));
+	for (i = sc.list; i != SLAB_NIL; i = ((struct slab_class_node *)
+	                                      slab_class_at(&sc, i))->avail)
+		n++;
+	assert_int_equal(n, 256);
+	for (i = 0; i < 256; i++)
+		assert_false(BITSET_TEST(sc.map, i));
+	slab_class_fini(&sc);
+}
+
+/* ---- zeroed allocation --------------------------------------------------- */
+
+static bool
+zeroed(const void *p, size_t len)
+{
+	const u8 *b = (const u8 *)p;
+	size_t i;
+	for (i = 0; i < len; i++)
+		if (b[i])
+			return false;
+	return true;
+}
+
+/*
+ * A fresh block comes back zero without being written past its link - its
+ * other pages stay unfaulted - and a recycled one comes back zero because it
+ * was cleared. Under a backend with no zero guarantee every block is cleared.
+ */
+static void
+test_zalloc_fresh_and_recycled(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 0, .max = 16, .grow_step = 4 };
+	struct slab vm;
+	u8 *a, *b, *c;
+#ifdef CONFIG_MEASURE
+	struct slab_measure m = { 0 };
+#endif
+
+	assert_int_equal(slab_init(&vm, 16384, &pol), 0);
+#ifdef CONFIG_MEASURE
+	vm.measure = &m;
+#endif
+	assert_int_equal(vm.virgin, SLAB_VM_ZEROES ? 0 : slab_policy_max(&vm));
+	a = (u8 *)slab_zalloc(&vm);
+	b = (u8 *)slab_zalloc(&vm);
+#if SLAB_VM_ZEROES
+	{
+		unsigned char vec[4];
+		/* the grow wrote b's link, the zalloc wrote it again: nothing else */
+		assert_int_equal(mincore(b, 16384, vec), 0);
+		assert_true(vec[0] & 1);
+		assert_false((vec[1] | vec[2] | vec[3]) & 1);
+	}
+	assert_int_equal(vm.virgin, 2);
+#endif
+	assert_true(zeroed(a, 16384) && zeroed(b, 16384));
+	memset(a, 0xa5, 16384);
+	slab_free(&vm, a);
+	c = (u8 *)slab_zalloc(&vm);
+	assert_ptr_equal(c, a);                   /* recycled, so cleared */
+	assert_true(zeroed(c, 16384));
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.virgin, SLAB_VM_ZEROES ? 2 : 0);
+	assert_int_equal(m.alloc, 3);
+#endif
+	slab_fini(&vm);
+}
+
+/* A released tail is zero again: the mark comes down with the shrink. */
+static void
+test_zalloc_after_release(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 0, .max = 64, .grow_step = 32 };
+	struct slab vm;
+	void *blk[64];
+	u32 i, k;
+
+	assert_int_equal(slab_init(&vm, SLAB_GRAIN_BYTES, &pol), 0);
+	assert_int_equal(slab_zalloc_bulk(&vm, blk, 64), 64);
+	for (i = 0; i < 64; i++)
+		memset(blk[i], 0x5a, SLAB_GRAIN_BYTES);
+	slab_free_bulk(&vm, blk + 32, 32);
+	assert_int_equal(slab_shrink(&vm, 32), 32);
+	assert_int_equal(vm.virgin, SLAB_VM_ZEROES ? 32 : 64);
+
+	/* the regrown blocks read zero whether or not they were cleared */
+	assert_int_equal(slab_zalloc_bulk(&vm, blk + 32, 32), 32);
+	for (i = 32; i < 64; i++)
+		assert_true(zeroed(blk[i], SLAB_GRAIN_BYTES));
+
+	/* a partial batch of recycled blocks is cleared, the rest untouched */
+	slab_free_bulk(&vm, blk, 4);
+	k = slab_zalloc_bulk(&vm, blk, 8);
+	assert_int_equal(k, 4);
+	for (i = 0; i < k; i++)
+		assert_true(zeroed(blk[i], SLAB_GRAIN_BYTES));
+	assert_int_equal(*(u8 *)blk[4], 0x5a);
+	slab_fini(&vm);
+}
+
+/* Pages of @n blocks a prefault reports: one more off a page-aligned base. */
+static void
+expect_pages(u32 got, u32 want)
+{
+	assert_true(got >= want && got <= want + 1);
+}
+
+/* Grow-ahead: populate a budget at a time, then commit what was populated. */
+static void
+test_prefault_grows_ahead(void **state)
+{
+	(void)state;
+	enum { B = 4 * SLAB_GRAIN_BYTES, P = B / CPU_PAGE_SIZE, ALL = 1u << 30 };
+	struct slab_policy pol = { .min = 0, .max = 16, .grow_step = 1 };
+	struct slab vm;
+	void *a, *b;
+	u32 n;
+#ifdef CONFIG_MEASURE
+	struct slab_measure m = { 0 };
+#endif
+
+	assert_int_equal(slab_init(&vm, B, &pol), 0);
+#ifdef CONFIG_MEASURE
+	vm.measure = &m;
+#endif
+	assert_int_equal(slab_grain(&vm), 1);
+	assert_int_equal(slab_prefault(&vm, ALL), 0);      /* off */
+	pol.prefault = 2;
+	slab_set_policy(&vm, &pol);
+
+	/* a one-page budget still populates a whole block, and commits it */
+	expect_pages(slab_prefault(&vm, 1), P);
+	assert_int_equal(slab_committed(&vm), 1);
+	assert_int_equal(vm.faulted, 1);
+	expect_pages(slab_prefault(&vm, ALL), P);
+	assert_int_equal(slab_committed(&vm), 2);
+	assert_int_equal(slab_avail(&vm), 2);
+	assert_int_equal(slab_prefault(&vm, ALL), 0);      /* far enough ahead */
+#ifdef SLAB_VM_MMAP
+	{
+		unsigned char vec[2 * P];
+		unsigned i;
+		assert_int_equal(mincore(vm.page, 2 * (size_t)B, vec), 0);
+		for (i = 0; i < 2 * P; i++)
+			assert_true(vec[i] & 1);
+	}
+#endif
+	/* populated, not spoiled: the blocks are still known zero */
+	assert_int_equal(vm.virgin, SLAB_VM_ZEROES ? 0 : slab_policy_max(&vm));
+
+	a = slab_zalloc(&vm);
+	assert_true(zeroed(a, B));
+	b = slab_alloc(&vm);
+	expect_pages(slab_prefault(&vm, ALL), 2 * P);      /* two behind again */
+	assert_int_equal(slab_committed(&vm), 4);
+	assert_int_equal(slab_avail(&vm), 2);
+#ifdef CONFIG_MEASURE
+	assert_true(m.prefault >= 4 * P && m.prefault <= 4 * P + 3);
+	assert_int_equal(m.grow, 3);
+#endif
+
+	/* a release takes the pages, and the populated mark with them */
+	slab_free(&vm, b);
+	slab_free(&vm, a);
+	assert_int_equal(slab_shrink(&vm, 4), 4);
+	assert_int_equal(vm.faulted, 0);
+	expect_pages(slab_prefault(&vm, ALL), 2 * P);
+	assert_int_equal(slab_committed(&vm), 2);
+	slab_fini(&vm);
+
+	/*
+	 * What init and the allocations committed they fault in themselves:
+	 * grow-ahead starts past it, not at block 0.
+	 */
+	pol.min = 4;
+	pol.prefault = 1;
+	assert_int_equal(slab_init(&vm, B, &pol), 0);
+#ifdef CONFIG_MEASURE
+	memset(&m, 0, sizeof(m));
+	vm.measure = &m;
+#endif
+	assert_int_equal(vm.faulted, 4);
+	for (n = 0; n < 6; n++)
+		assert_non_null(slab_alloc(&vm));
+	assert_int_equal(slab_committed(&vm), 6);
+	assert_int_equal(vm.faulted, 6);
+	expect_pages(slab_prefault(&vm, ALL), P);           /* one block only */
+	assert_int_equal(slab_committed(&vm), 7);
+	assert_int_equal(slab_avail(&vm), 1);
+	assert_int_equal(slab_prefault(&vm, ALL), 0);
+#ifdef CONFIG_MEASURE
+	assert_true(m.prefault >= P && m.prefault <= P + 1);
+	assert_int_equal(m.grow, 3);
+#endif
+	slab_fini(&vm);
+}
+
+/* Tiered reclaim: MADV_FREE first, cold with age, released for good last. */
+static void
+test_reclaim_tiers(void **state)
+{
+	(void)state;
+	struct slab_policy pol = {
+		.min = 0, .max = 64, .grow_step = 32,
+		.reclaim = SLAB_RECLAIM_FREE, .cold_after = 10,
+		.release_after = 100,
+	};
+	struct slab vm;
+	void *blk[64];
+	u32 i;
+#ifdef CONFIG_MEASURE
+	struct slab_measure m = { 0 };
+#endif
+
+	assert_int_equal(slab_init(&vm, SLAB_GRAIN_BYTES, &pol), 0);
+#ifdef CONFIG_MEASURE
+	vm.measure = &m;
+#endif
+	assert_int_equal(slab_alloc_bulk(&vm, blk, 64), 64);
+	for (i = 0; i < 64; i++)
+		memset(blk[i], 0x5a, SLAB_GRAIN_BYTES);
+	slab_free_bulk(&vm, blk + 32, 32);
+	assert_int_equal(slab_shrink(&vm, 32), 32);
+	assert_int_equal(slab_committed(&vm), 32);
+#ifdef SLAB_VM_MMAP
+	/* lazily: the mark stays up, as the pages may come back as they were */
+	assert_int_equal(vm.lazy_end, 64);
+	assert_int_equal(vm.virgin, 64);
+
+	assert_int_equal(slab_gc(&vm, 1000), 0);   /* the age starts here */
+	assert_int_equal(vm.lazy_tier, SLAB_RECLAIM_FREE);
+	assert_int_equal(slab_gc(&vm, 1010), 0);
+	assert_int_equal(vm.lazy_tier, SLAB_RECLAIM_FREE + 1);
+	assert_int_equal(slab_gc(&vm, 1050), 0);
+	assert_int_equal(vm.lazy_end, 64);
+	assert_int_equal(slab_gc(&vm, 1100), 0);
+	assert_int_equal(vm.lazy_end, 0);
+	assert_int_equal(vm.virgin, SLAB_VM_ZEROES ? 32 : 64);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.lazy, 32);
+	assert_int_equal(m.cold, 32);
+	assert_int_equal(m.zap, 32);
+#endif
+#endif
+
+	/* a grow back into a lazy tail takes it back; its blocks still clear */
+	slab_free_bulk(&vm, blk + 16, 16);
+	assert_int_equal(slab_shrink(&vm, 16), 16);
+	assert_int_equal(slab_grow(&vm, 32), 32);
+#ifdef SLAB_VM_MMAP
+	assert_int_equal(vm.lazy_end, 0);
+#endif
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.rewarm, SLAB_VM_ZEROES ? 16 : 0);
+#endif
+	for (i = 16; i < 32; i++) {
+		blk[i] = slab_zalloc(&vm);
+		assert_true(zeroed(blk[i], SLAB_GRAIN_BYTES));
+	}
+	slab_fini(&vm);
+}
+
 int
 main(void)
 {
@@ -785,6 +1699,25 @@ main(void)
 		cmocka_unit_test(test_grain_coarse_unit),
 		cmocka_unit_test(test_static_variant),
 		cmocka_unit_test(test_tcp_reorder),
+		cmocka_unit_test(test_lockfree_basic),
+		cmocka_unit_test(test_lockfree_grow),
+		cmocka_unit_test(test_lockfree_threads),
+		cmocka_unit_test(test_lockfree_class_threads),
+		cmocka_unit_test(test_ordered_lowest_first),
+		cmocka_unit_test(test_ordered_exhaustion),
+		cmocka_unit_test(test_ordered_spike_shrinks),
+		cmocka_unit_test(test_ordered_switch),
+		cmocka_unit_test(test_compact_moves_stragglers),
+		cmocka_unit_test(test_compact_budget_and_pin),
+		cmocka_unit_test(test_gc_compacts),
+		cmocka_unit_test(test_compact_ordered),
+		cmocka_unit_test(test_bulk_matches_single),
+		cmocka_unit_test(test_bulk_partial_on_exhaustion),
+		cmocka_unit_test(test_bulk_class),
+		cmocka_unit_test(test_zalloc_fresh_and_recycled),
+		cmocka_unit_test(test_zalloc_after_release),
+		cmocka_unit_test(test_prefault_grows_ahead),
+		cmocka_unit_test(test_reclaim_tiers),
 	};
 	return cmocka_run_group_tests_name("slab", tests, NULL, NULL);
 }
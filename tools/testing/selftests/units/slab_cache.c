@@ -1,7 +1,8 @@
 /*
  * Unit tests for the expiring block cache over the slab: TTL expiry, idle
- * expiry (with touch), reaping back to the free list, and the build-time
- * struct slab_cache_class variant.
+ * expiry (with touch), reaping back to the free list, the build-time
+ * struct slab_cache_class variant, and the timing wheel expiry index checked
+ * against the full scan.
  */
 
 #include <stdarg.h>
@@ -223,6 +224,231 @@ test_cache_class_variant(void **state)
 	slab_cache_class_fini(&c);
 }
 
+/* ---- timing wheel expiry index ------------------------------------------- */
+
+static u64 wheel_rng = 0x9e3779b97f4a7c15ull;
+
+static inline u32
+wheel_rand(u32 n)
+{
+	wheel_rng ^= wheel_rng << 13;
+	wheel_rng ^= wheel_rng >> 7;
+	wheel_rng ^= wheel_rng << 17;
+	return (u32)(wheel_rng % n);
+}
+
+enum { WHEEL_BLOCKS = 512 };
+
+/*
+ * One random history of allocs, touches, frees and reaps with mixed TTLs and
+ * idle timeouts - milliseconds to beyond the wheel's 2^24 ms reach, and time
+ * jumping by as much - driven through a cache with the wheel. Before each reap
+ * the expected victims are the blocks slab_cache_expired() says are expired;
+ * the reap has to free exactly those.
+ */
+static void
+wheel_history(struct slab_cache *c, timestamp_t t, unsigned steps)
+{
+	void *blk[WHEEL_BLOCKS] = { 0 };
+	bool due[WHEEL_BLOCKS];
+	unsigned i, n;
+
+	for (n = 0; n < steps; n++) {
+		u32 op = wheel_rand(100), k = wheel_rand(WHEEL_BLOCKS);
+		if (op < 40 && !blk[k]) {
+			static const u32 span[] = { 1, 50, 3000, 30000, 1u << 25 };
+			u32 ttl = wheel_rand(2) ? wheel_rand(span[wheel_rand(5)] + 1) : 0;
+			u32 idle = wheel_rand(2) ? wheel_rand(span[wheel_rand(5)] + 1) : 0;
+			if (k < 16) {               /* the hot few: idle-bound only */
+				ttl = 0;
+				idle = 1 + wheel_rand(500);
+			}
+			blk[k] = slab_cache_alloc_ex(c, t, ttl, idle);
+			assert_non_null(blk[k]);
+		} else if (op < 70 && blk[k %= 16]) {   /* a hot few, touched */
+			if (!slab_cache_touch(c, blk[k], t))
+				assert_true(slab_cache_expired(c, blk[k], t));
+		} else if (op < 75 && blk[k]) {
+			slab_cache_free(c, blk[k]);
+			blk[k] = NULL;
+		} else if (op < 85) {
+			u32 expect = 0, jump = wheel_rand(64) ? wheel_rand(50)
+			                     : wheel_rand(16) ? wheel_rand(5000)
+			                                      : wheel_rand(1u << 26);
+			t += jump;
+			for (i = 0; i < WHEEL_BLOCKS; i++) {
+				due[i] = blk[i] && slab_cache_expired(c, blk[i], t);
+				expect += due[i];
+			}
+			assert_int_equal(slab_cache_reap(c, t), expect);
+			for (i = 0; i < WHEEL_BLOCKS; i++) {
+				if (!blk[i])
+					continue;
+				assert_int_equal(
+					c->ent[slab_index(&c->slab, blk[i])].used,
+					!due[i]);
+				if (due[i])
+					blk[i] = NULL;
+			}
+		}
+	}
+	for (i = 0; i < WHEEL_BLOCKS; i++)
+		if (blk[i])
+			slab_cache_free(c, blk[i]);
+	assert_int_equal(slab_cache_live(c), 0);
+	assert_int_equal(c->wheel.count, 0);
+}
+
+static void
+test_cache_wheel_matches_scan(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 4, .max = WHEEL_BLOCKS, .grow_step = 64 };
+	struct slab_cache c;
+	unsigned round;
+
+	for (round = 0; round < 8; round++) {
+		assert_int_equal(slab_cache_init(&c, 64, &pol, 0, 0), 0);
+		assert_int_equal(slab_cache_set_wheel(&c, 0), 0);
+		wheel_history(&c, (timestamp_t)round * 1000000007ull, 20000);
+		slab_cache_fini(&c);
+	}
+}
+
+/* Blocks live before the wheel is set are indexed by slab_cache_set_wheel(). */
+static void
+test_cache_wheel_set_late(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 4, .max = 16, .grow_step = 4 };
+	struct slab_cache c;
+	timestamp_t t = 100000;
+	void *a, *b;
+
+	assert_int_equal(slab_cache_init(&c, 256, &pol, 500, 0), 0);
+	a = slab_cache_alloc(&c, t);
+	b = slab_cache_alloc_ex(&c, t, 0, 0);       /* never expires */
+	assert_int_equal(slab_cache_set_wheel(&c, t + 10), 0);
+	assert_int_equal(c.wheel.count, 1);
+
+	assert_int_equal(slab_cache_reap(&c, t + 499), 0);
+	assert_int_equal(slab_cache_reap(&c, t + 500), 1);
+	assert_int_equal(slab_cache_live(&c), 1);
+	assert_false(slab_cache_expired(&c, b, t + 1000000000));
+	(void)a;
+	slab_cache_fini(&c);
+}
+
+/*
+ * Touch is one store; the block is re-filed when its old bucket comes due.
+ * A reap with nothing due visits nothing, however many blocks are live.
+ */
+static void
+test_cache_wheel_lazy_touch(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 0, .max = 1024, .grow_step = 256 };
+	struct slab_cache c;
+	timestamp_t t = 0;
+	void *blk[1000];
+	unsigned i;
+
+	assert_int_equal(slab_cache_init(&c, 64, &pol, 0, 1000), 0);
+	assert_int_equal(slab_cache_set_wheel(&c, t), 0);
+	for (i = 0; i < 1000; i++)
+		assert_non_null(blk[i] = slab_cache_alloc(&c, t));
+
+	/* nothing due before 1000: no block is looked at */
+	assert_int_equal(slab_cache_reap(&c, t + 999), 0);
+	assert_int_equal(c.wheel.visits, 0);
+
+	/* keep the first ten alive, many times over */
+	for (t = 100; t < 1000; t += 100)
+		for (i = 0; i < 10; i++)
+			assert_true(slab_cache_touch(&c, blk[i], t));
+
+	/* every block visited once: 990 reaped, 10 re-filed */
+	assert_int_equal(slab_cache_reap(&c, 1000), 990);
+	assert_int_equal(c.wheel.visits, 1000);
+	assert_int_equal(c.wheel.refiles, 10);
+	assert_int_equal(slab_cache_live(&c), 10);
+
+	assert_int_equal(slab_cache_reap(&c, 1899), 0);
+	assert_int_equal(c.wheel.visits, 1000);
+	assert_int_equal(slab_cache_reap(&c, 1900), 10);
+	assert_int_equal(slab_cache_live(&c), 0);
+	slab_cache_fini(&c);
+}
+
+static void
+test_cache_class_wheel(void **state)
+{
+	(void)state;
+	struct slab_class_policy pol = { .min = 4, .max = 16, .grow_step = 4 };
+	struct slab_cache_class c;
+	timestamp_t t = 7000;
+	void *a, *b;
+
+	assert_int_equal(slab_cache_class_init(&c, &pol, 300, 100), 0);
+	assert_int_equal(slab_cache_class_set_wheel(&c, t), 0);
+	a = slab_cache_class_alloc(&c, t);
+	b = slab_cache_class_alloc(&c, t);
+	assert_true(slab_cache_class_touch(&c, a, t + 90));
+
+	assert_int_equal(slab_cache_class_reap(&c, t + 99), 0);
+	assert_int_equal(slab_cache_class_reap(&c, t + 100), 1);    /* b idle */
+	assert_int_equal(slab_cache_class_reap(&c, t + 189), 0);
+	assert_int_equal(slab_cache_class_reap(&c, t + 190), 1);    /* a idle */
+	assert_int_equal(slab_cache_class_live(&c), 0);
+	assert_int_equal(slab_class_used(&c.cls), 0);
+
+	/* TTL still bounds a block touched within every idle window */
+	a = slab_cache_class_alloc(&c, t);
+	for (t += 50; t < 7300; t += 50)
+		assert_true(slab_cache_class_touch(&c, a, t));
+	assert_int_equal(slab_cache_class_reap(&c, 7299), 0);
+	assert_true(slab_cache_class_expired(&c, a, 7300));
+	assert_int_equal(slab_cache_class_reap(&c, 7300), 1);
+	(void)b;
+	slab_cache_class_fini(&c);
+}
+
+/* A batch is filed and expires block by block, like the single calls. */
+static void
+test_cache_bulk(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 0, .max = 64, .grow_step = 8 };
+	struct slab_class_policy cpol = { .min = 0, .max = 64, .grow_step = 8 };
+	struct slab_cache c;
+	struct slab_cache_class cc;
+	timestamp_t t = 1000;
+	void *blk[80];
+
+	assert_int_equal(slab_cache_init(&c, 256, &pol, 0, 100), 0);
+	assert_int_equal(slab_cache_set_wheel(&c, t), 0);
+	assert_int_equal(slab_cache_alloc_bulk(&c, t, blk, 40), 40);
+	assert_int_equal(slab_cache_live(&c), 40);
+	assert_true(slab_cache_touch(&c, blk[0], t + 50));
+	slab_cache_free_bulk(&c, blk + 30, 10);
+	assert_int_equal(slab_cache_live(&c), 30);
+	/* the freed ten are off the wheel; the untouched 29 go idle */
+	assert_int_equal(slab_cache_reap(&c, t + 100), 29);
+	assert_int_equal(slab_cache_reap(&c, t + 150), 1);
+	assert_int_equal(slab_used(&c.slab), 0);
+	assert_int_equal(slab_cache_alloc_bulk(&c, t, blk, 80), 64);
+	assert_int_equal(slab_cache_live(&c), 64);
+	slab_cache_fini(&c);
+
+	assert_int_equal(slab_cache_class_init(&cc, &cpol, 0, 100), 0);
+	assert_int_equal(slab_cache_class_alloc_bulk(&cc, t, blk, 20), 20);
+	slab_cache_class_free_bulk(&cc, blk, 5);
+	assert_int_equal(slab_cache_class_live(&cc), 15);
+	assert_int_equal(slab_cache_class_reap(&cc, t + 100), 15);
+	assert_int_equal(slab_class_used(&cc.cls), 0);
+	slab_cache_class_fini(&cc);
+}
+
 int
 main(void)
 {
@@ -233,6 +459,11 @@ main(void)
 		cmocka_unit_test(test_cache_gc_shrinks_after_expiry),
 		cmocka_unit_test(test_cache_touch_keeps_block_alive),
 		cmocka_unit_test(test_cache_class_variant),
+		cmocka_unit_test(test_cache_wheel_matches_scan),
+		cmocka_unit_test(test_cache_wheel_set_late),
+		cmocka_unit_test(test_cache_wheel_lazy_touch),
+		cmocka_unit_test(test_cache_class_wheel),
+		cmocka_unit_test(test_cache_bulk),
 	};
 	return cmocka_run_group_tests_name("slab_cache", tests, NULL, NULL);
 }
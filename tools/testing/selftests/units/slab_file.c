@@ -0,0 +1,244 @@
+/*
+ * Unit tests for the persistent slab cache, <mem/slab_file.h>.
+ *
+ * Each unit runs a cache over a memfd or a file in $TMPDIR, detaches or
+ * abandons it, and attaches again: a clean round trip keeps blocks, payload
+ * and free list; an abandoned one is recovered from the bitmap and entries,
+ * half-done allocations included; a file of another geometry is refused; and
+ * a shrink punches the released blocks out of the file.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <hpc/compiler.h>
+#include <mem/slab_file.h>
+
+#define BLOCK 256
+#define N     64
+
+static const struct slab_policy pol = {
+	.min = 0, .max = 65536, .grow_step = 64,
+};
+
+/* Fill @n blocks, each stamped with its ordinal, and return their refs. */
+static void
+fill(struct slab_file *f, u32 *ref, u32 n, timestamp_t now)
+{
+	u32 i;
+	for (i = 0; i < n; i++) {
+		u32 *p = (u32 *)slab_cache_alloc(&f->cache, now);
+		assert_non_null(p);
+		p[0] = i;
+		p[BLOCK / sizeof(u32) - 1] = ~i;
+		ref[i] = slab_file_ref(f, p);
+	}
+}
+
+static void
+check(struct slab_file *f, const u32 *ref, u32 from, u32 to)
+{
+	u32 i;
+	for (i = from; i < to; i++) {
+		u32 *p = (u32 *)slab_file_get(f, ref[i]);
+		assert_non_null(p);
+		assert_int_equal(p[0], i);
+		assert_int_equal(p[BLOCK / sizeof(u32) - 1], ~i);
+	}
+}
+
+static int
+memfd(void)
+{
+	int fd = memfd_create("slab_file", 0);
+	assert_true(fd >= 0);
+	return fd;
+}
+
+static void
+test_clean_round_trip(void **state)
+{
+	(void)state;
+	struct slab_file f;
+	u32 ref[N], i, committed, avail;
+	void *p, *q;
+	int fd = memfd();
+
+	assert_int_equal(slab_file_attach(&f, fd, BLOCK, &pol, 1000, 0), 0);
+	assert_int_equal(f.how, SLAB_FILE_CREATED);
+	fill(&f, ref, N, 10);
+	/* a hole in the middle: the free list has to survive the trip */
+	for (i = 8; i < 16; i++)
+		slab_cache_free(&f.cache, slab_file_get(&f, ref[i]));
+	committed = slab_committed(&f.cache.slab);
+	avail = f.cache.slab.avail;
+	assert_int_equal(slab_file_detach(&f), fd);
+
+	assert_int_equal(slab_file_attach(&f, fd, BLOCK, &pol, 1000, 0), 0);
+	assert_int_equal(f.how, SLAB_FILE_ATTACHED);
+	assert_int_equal(f.hdr->attaches, 2);
+	assert_int_equal(slab_cache_live(&f.cache), N - 8);
+	assert_int_equal(slab_committed(&f.cache.slab), committed);
+	assert_int_equal(f.cache.slab.avail, avail);
+	check(&f, ref, 0, 8);
+	check(&f, ref, 16, N);
+	for (i = 8; i < 16; i++)
+		assert_null(slab_file_get(&f, ref[i]));
+
+	/* LIFO as before: the last block freed is the first one back */
+	p = slab_cache_alloc(&f.cache, 20);
+	assert_int_equal(slab_file_ref(&f, p), ref[15]);
+	/* the TTL recorded before the detach still applies */
+	assert_int_equal(slab_cache_reap(&f.cache, 1010), N - 8);
+	assert_int_equal(slab_cache_live(&f.cache), 1);
+	q = slab_file_get(&f, ref[15]);
+	assert_ptr_equal(p, q);
+	slab_cache_free(&f.cache, p);
+	assert_int_equal(slab_used(&f.cache.slab), 0);
+	slab_file_detach(&f);
+	close(fd);
+}
+
+static void
+test_recovers_after_crash(void **state)
+{
+	(void)state;
+	struct slab_file f;
+	u32 ref[N], i, torn, lost, far;
+	int fd = memfd();
+
+	assert_int_equal(slab_file_attach(&f, fd, BLOCK, &pol, 0, 0), 0);
+	fill(&f, ref, N, 10);
+	for (i = 0; i < N; i += 2)
+		slab_cache_free(&f.cache, slab_file_get(&f, ref[i]));
+	/* an alloc that got as far as the map, and a free as far as the entry */
+	torn = slab_index(&f.cache.slab, slab_alloc(&f.cache.slab));
+	lost = ref[1];
+	f.cache.ent[lost].used = 0;
+	/* ... and a block of a grow the header never heard of */
+	far = f.cache.slab.committed + 100;
+	BITSET_SET(f.cache.slab.map, far);
+	f.cache.ent[far].used = 1;
+	*(u32 *)slab_at(&f.cache.slab, far) = 0xfa;
+
+	/* die attached: no detach, just drop the mapping */
+	SLAB_MEM_FREE(f.cache.slab.order);
+	SLAB_VM_FILE_UNMAP(f.base, f.length);
+
+	assert_int_equal(slab_file_attach(&f, fd, BLOCK, &pol, 0, 0), 0);
+	assert_int_equal(f.how, SLAB_FILE_RECOVERED);
+	assert_int_equal(f.hdr->recoveries, 1);
+	assert_int_equal(f.repaired, 2);
+	assert_true(slab_committed(&f.cache.slab) > far);
+	assert_int_equal(*(u32 *)slab_file_get(&f, far), 0xfa);
+	assert_int_equal(slab_cache_live(&f.cache), N / 2 - 1 + 1);
+	assert_int_equal(slab_used(&f.cache.slab), slab_cache_live(&f.cache));
+	assert_null(slab_file_get(&f, torn));
+	assert_null(slab_file_get(&f, lost));
+	for (i = 3; i < N; i += 2)
+		check(&f, ref, i, i + 1);
+
+	/* the relinked list hands out every free block once, the live ones never */
+	for (i = 0; i < f.cache.slab.committed - slab_cache_live(&f.cache); i++) {
+		u32 *p = (u32 *)slab_cache_alloc(&f.cache, 20);
+		assert_non_null(p);
+		assert_true(f.cache.ent[slab_file_ref(&f, p)].atime == 20);
+	}
+	check(&f, ref, 3, 4);
+	slab_file_detach(&f);
+	close(fd);
+}
+
+static void
+test_refuses_other_geometry(void **state)
+{
+	(void)state;
+	struct slab_policy big = pol;
+	struct slab_file f;
+	int fd = memfd();
+
+	assert_int_equal(slab_file_attach(&f, fd, BLOCK, &pol, 0, 0), 0);
+	slab_file_detach(&f);
+
+	assert_int_equal(slab_file_attach(&f, fd, 2 * BLOCK, &pol, 0, 0), -1);
+	assert_int_equal(errno, EINVAL);
+	big.max = 2 * pol.max;
+	assert_int_equal(slab_file_attach(&f, fd, BLOCK, &big, 0, 0), -1);
+	assert_int_equal(errno, EINVAL);
+	/* a max that rounds to the same block count is the same geometry */
+	big.max = pol.max - 1;
+	assert_int_equal(slab_file_attach(&f, fd, BLOCK, &big, 0, 0), 0);
+	assert_int_equal(f.how, SLAB_FILE_ATTACHED);
+	slab_file_detach(&f);
+	close(fd);
+}
+
+static void
+test_path_and_release(void **state)
+{
+	(void)state;
+	struct slab_policy shrink = pol;
+	const char *tmp = getenv("TMPDIR");
+	char path[256];
+	struct slab_file f;
+	struct stat st;
+	u32 ref[N], before, burst, i;
+	void **blk;
+
+	snprintf(path, sizeof(path), "%s/slab_file.XXXXXX", tmp ? tmp : "/tmp");
+	close(mkstemp(path));
+	shrink.shrink_usage_pct = 50;
+	shrink.shrink_release_pct = 100;
+
+	assert_int_equal(slab_file_open(&f, path, BLOCK, &shrink, 0, 0), 0);
+	assert_int_equal(f.how, SLAB_FILE_CREATED);
+	fill(&f, ref, N, 0);
+	/* a burst of a few grains past the kept blocks, gone again */
+	burst = 4 * f.cache.slab.grain;
+	blk = (void **)calloc(burst, sizeof(void *));
+	assert_non_null(blk);
+	for (i = 0; i < burst; i++)
+		assert_non_null(blk[i] = slab_cache_alloc(&f.cache, 0));
+	for (i = 0; i < burst; i++)
+		memset(blk[i], 0x5a, BLOCK);
+	assert_int_equal(fstat(f.fd, &st), 0);
+	before = (u32)st.st_blocks;
+	for (i = 0; i < burst; i++)
+		slab_cache_free(&f.cache, blk[i]);
+	assert_true(slab_cache_gc(&f.cache, 0) < 0);
+	assert_int_equal(fstat(f.fd, &st), 0);
+	/* the file gave the tail back, where the filesystem can punch holes */
+	if (st.st_blocks < before) {
+		void *z = slab_zalloc(&f.cache.slab);
+		assert_non_null(z);
+		slab_free(&f.cache.slab, z);
+	}
+	slab_file_close(&f);
+
+	assert_int_equal(slab_file_open(&f, path, BLOCK, &shrink, 0, 0), 0);
+	assert_int_equal(f.how, SLAB_FILE_ATTACHED);
+	check(&f, ref, 0, N);
+	slab_file_close(&f);
+	free(blk);
+	unlink(path);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_clean_round_trip),
+		cmocka_unit_test(test_recovers_after_crash),
+		cmocka_unit_test(test_refuses_other_geometry),
+		cmocka_unit_test(test_path_and_release),
+	};
+	return cmocka_run_group_tests_name("slab_file", tests, NULL, NULL);
+}
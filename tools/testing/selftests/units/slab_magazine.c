@@ -0,0 +1,298 @@
+/*
+ * Unit tests for the magazine front-end, <mem/slab_magazine.h>.
+ *
+ * The single-threaded units drive one or two caches by hand to walk each path:
+ * the thread-local pop and push, the loaded/prev swap, the depot exchange in
+ * both directions, the fill from the slab and the working-set gc. The last unit
+ * is the reason the layer exists - several threads allocating and freeing each
+ * other's blocks - and checks that no block is ever handed out twice and that
+ * everything comes back to the slab once every thread has detached.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <hpc/compiler.h>
+#include <mem/slab_magazine.h>
+
+#define R SLAB_MAGAZINE_ROUNDS
+#define B SLAB_MAGAZINE_BATCH
+
+static void
+test_attach_detach(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 4, .max = 1024 };
+	struct slab_depot d;
+	struct slab_magazine_cpu cpu;
+
+	assert_int_equal(slab_depot_init(&d, 64, &pol), 0);
+	assert_int_equal(slab_magazine_attach(&cpu, &d), 0);
+	assert_int_equal(d.magazines, 2);
+	assert_int_equal(slab_magazine_cached(&cpu), 0);
+
+	slab_magazine_detach(&cpu);
+	assert_int_equal(d.nempty, 2);
+	assert_null(cpu.depot);
+	slab_depot_fini(&d);
+}
+
+static void
+test_fill_and_local_path(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 4, .max = 1024 };
+	struct slab_depot d;
+	struct slab_magazine_cpu cpu;
+	void *p, *q;
+
+	assert_int_equal(slab_depot_init(&d, 64, &pol), 0);
+	assert_int_equal(slab_magazine_attach(&cpu, &d), 0);
+
+	/* first allocation fills half a magazine from the slab */
+	p = slab_magazine_alloc(&cpu);
+	assert_non_null(p);
+	assert_int_equal(cpu.stat.fills, 1);
+	assert_int_equal(slab_used(&d.slab), B);
+	assert_int_equal(slab_magazine_cached(&cpu), B - 1);
+
+	/* the rest of the batch never touches the slab */
+	memset(p, 0xaa, 64);
+	slab_magazine_free(&cpu, p);
+	q = slab_magazine_alloc(&cpu);
+	assert_ptr_equal(p, q);                 /* LIFO through the magazine */
+	assert_int_equal(cpu.stat.fills, 1);
+	assert_int_equal(slab_used(&d.slab), B);
+
+	slab_magazine_free(&cpu, q);
+	slab_magazine_detach(&cpu);
+	/* a partial magazine drains into the slab */
+	assert_int_equal(slab_used(&d.slab), 0);
+	slab_depot_fini(&d);
+}
+
+static void
+test_swap_and_exchange(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 4, .max = 4096 };
+	struct slab_depot d;
+	struct slab_magazine_cpu a, b;
+	void *p[3 * R];
+	unsigned i;
+
+	assert_int_equal(slab_depot_init(&d, 64, &pol), 0);
+	assert_int_equal(slab_magazine_attach(&a, &d), 0);
+	assert_int_equal(slab_magazine_attach(&b, &d), 0);
+
+	for (i = 0; i < 3 * R; i++)
+		assert_non_null(p[i] = slab_magazine_alloc(&a));
+	assert_int_equal(slab_used(&d.slab), 3 * R);
+
+	/* 2R frees fill both magazines, with one swap in between */
+	for (i = 0; i < 2 * R; i++)
+		slab_magazine_free(&a, p[i]);
+	assert_int_equal(a.stat.swaps >= 1, 1);
+	assert_int_equal(slab_magazine_cached(&a), 2 * R);
+	assert_int_equal(d.nfull, 0);
+
+	/* the next free trades a full magazine for an empty one */
+	slab_magazine_free(&a, p[2 * R]);
+	assert_int_equal(d.nfull, 1);
+	assert_int_equal(slab_depot_cached(&d), R);
+
+	/* another thread picks that full magazine up instead of the slab */
+	u64 fills = b.stat.fills;
+	assert_non_null(slab_magazine_alloc(&b));
+	assert_int_equal(b.stat.full, 1);
+	assert_int_equal(b.stat.fills, fills);
+	assert_int_equal(d.nfull, 0);
+
+	slab_magazine_detach(&a);
+	slab_magazine_detach(&b);
+	/* full magazines went to the depot whole; a reap drains them too */
+	slab_depot_reap(&d);
+	/* a never freed its last R - 1, b holds one: the rest are back */
+	assert_int_equal(slab_used(&d.slab), R);
+	slab_depot_fini(&d);
+}
+
+static void
+test_full_magazines_survive_flush(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 4, .max = 4096 };
+	struct slab_depot d;
+	struct slab_magazine_cpu cpu;
+	void *p[R];
+	unsigned i;
+
+	assert_int_equal(slab_depot_init(&d, 64, &pol), 0);
+	assert_int_equal(slab_magazine_attach(&cpu, &d), 0);
+	for (i = 0; i < R; i++)
+		p[i] = slab_magazine_alloc(&cpu);
+	for (i = 0; i < R; i++)
+		slab_magazine_free(&cpu, p[i]);
+
+	/* one full magazine is handed to the depot whole, not drained */
+	slab_magazine_flush(&cpu);
+	assert_int_equal(slab_magazine_cached(&cpu), 0);
+	assert_int_equal(d.nfull, 1);
+	assert_int_equal(slab_used(&d.slab), R);
+
+	assert_int_equal(slab_depot_reap(&d), R);
+	assert_int_equal(d.nfull, 0);
+	assert_int_equal(slab_used(&d.slab), 0);
+
+	slab_magazine_detach(&cpu);
+	slab_depot_fini(&d);
+}
+
+static void
+test_gc_working_set(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 4, .max = 4096 };
+	struct slab_depot d;
+	struct slab_magazine_cpu cpu;
+	void *p[4 * R];
+	unsigned i;
+
+	assert_int_equal(slab_depot_init(&d, 64, &pol), 0);
+	assert_int_equal(slab_magazine_attach(&cpu, &d), 0);
+	for (i = 0; i < 4 * R; i++)
+		p[i] = slab_magazine_alloc(&cpu);
+	for (i = 0; i < 4 * R; i++)
+		slab_magazine_free(&cpu, p[i]);
+	assert_int_equal(d.nfull, 2);
+
+	/* the first gc only opens the interval: the minima start at zero */
+	slab_depot_gc(&d, 0);
+	assert_int_equal(d.nfull, 2);
+	assert_int_equal(d.full_min, 2);
+
+	/* nobody took a full magazine since: both go back to the slab */
+	slab_depot_gc(&d, 1);
+	assert_int_equal(d.nfull, 0);
+	assert_int_equal(slab_used(&d.slab), 2 * R);
+
+	/* the empties the trim produced were unused for an interval too */
+	u32 empties = d.nempty;
+	assert_int_equal(empties > 0, 1);
+	slab_depot_gc(&d, 2);
+	assert_int_equal(d.nempty, 0);
+	assert_int_equal(d.magazines, 2);
+
+	/* the thread's own two full magazines were out of gc's reach */
+	slab_magazine_detach(&cpu);
+	assert_int_equal(d.nfull, 2);
+	assert_int_equal(slab_depot_reap(&d), 2 * R);
+	assert_int_equal(slab_used(&d.slab), 0);
+	slab_depot_fini(&d);
+}
+
+static void
+test_exhausted(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 8, .max = 8 };
+	struct slab_depot d;
+	struct slab_magazine_cpu cpu;
+	unsigned n = 0;
+
+	/* a grain-sized block keeps min == max == committed at exactly 8 */
+	assert_int_equal(slab_depot_init(&d, SLAB_GRAIN_BYTES, &pol), 0);
+	assert_int_equal(slab_magazine_attach(&cpu, &d), 0);
+	while (slab_magazine_alloc(&cpu))
+		n++;
+	assert_int_equal(n, slab_committed(&d.slab));
+	assert_int_equal(cpu.stat.fails, 1);
+	slab_magazine_detach(&cpu);
+	slab_depot_fini(&d);
+}
+
+/* ---- threads ------------------------------------------------------------- */
+
+enum { THREADS = 4, LIVE = 200, ROUNDS = 20000 };
+
+struct worker {
+	pthread_t tid;
+	struct slab_depot *d;
+	unsigned seed;
+	int fail;
+};
+
+static void *
+worker_main(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	struct slab_magazine_cpu cpu;
+	u64 *live[LIVE] = { 0 };
+	unsigned i;
+
+	if (slab_magazine_attach(&cpu, w->d)) {
+		w->fail = 1;
+		return NULL;
+	}
+	for (i = 0; i < ROUNDS; i++) {
+		unsigned k = (w->seed = w->seed * 1103515245u + 12345u) % LIVE;
+		if (live[k]) {
+			/* a block handed out twice would have been overwritten */
+			if (*live[k] != (u64)(uintptr_t)&live[k])
+				w->fail = 1;
+			slab_magazine_free(&cpu, live[k]);
+			live[k] = NULL;
+		} else if ((live[k] = (u64 *)slab_magazine_alloc(&cpu))) {
+			*live[k] = (u64)(uintptr_t)&live[k];
+		}
+	}
+	for (i = 0; i < LIVE; i++)
+		if (live[i])
+			slab_magazine_free(&cpu, live[i]);
+	slab_magazine_detach(&cpu);
+	return NULL;
+}
+
+static void
+test_threads(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 64, .max = 1 << 16 };
+	struct slab_depot d;
+	struct worker w[THREADS];
+	unsigned i;
+
+	assert_int_equal(slab_depot_init(&d, 64, &pol), 0);
+	for (i = 0; i < THREADS; i++) {
+		w[i] = (struct worker){ .d = &d, .seed = i + 1 };
+		assert_int_equal(pthread_create(&w[i].tid, NULL, worker_main, &w[i]), 0);
+	}
+	for (i = 0; i < THREADS; i++) {
+		pthread_join(w[i].tid, NULL);
+		assert_int_equal(w[i].fail, 0);
+	}
+	slab_depot_reap(&d);
+	assert_int_equal(slab_used(&d.slab), 0);
+	assert_int_equal(d.magazines, d.nempty);
+	slab_depot_fini(&d);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_attach_detach),
+		cmocka_unit_test(test_fill_and_local_path),
+		cmocka_unit_test(test_swap_and_exchange),
+		cmocka_unit_test(test_full_magazines_survive_flush),
+		cmocka_unit_test(test_gc_working_set),
+		cmocka_unit_test(test_exhausted),
+		cmocka_unit_test(test_threads),
+	};
+	return cmocka_run_group_tests_name("slab_magazine", tests, NULL, NULL);
+}
@@ -0,0 +1,333 @@
+/*
+ * Unit tests for the object cache, <mem/slab_obj.h>, and the movable free-list
+ * link of <mem/slab.h> under it.
+ *
+ * The object is the kind the cache is for: a list head that points at itself
+ * when empty, a lock word, a preallocated buffer and a use count that survives
+ * from one allocation to the next. The units check that the constructor runs
+ * once per committed block, and spoils no zero block when there is none, and
+ * the destructor once per released one; that neither the free-list link nor
+ * an alloc/free cycle disturbs a constructed field; and that a slab with its
+ * link moved still allocates, frees, zeroes and runs lock-free as before - a
+ * lazily released tail it grows back into included.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include <hpc/compiler.h>
+#include <mem/slab_obj.h>
+
+struct obj {
+	struct obj *head_next;        /* an empty list: points at itself      */
+	struct obj *head_prev;
+	u32 lock;
+	u32 next;                     /* scratch while in use; may hold the link */
+	void *buf;                    /* preallocated, kept across frees      */
+	u64 uses;
+	u8 payload[72];
+};
+
+struct counts {
+	u32 ctors;
+	u32 dtors;
+};
+
+static void
+obj_ctor(void *p, void *arg)
+{
+	struct obj *o = p;
+	memset(o, 0, sizeof(*o));
+	o->head_next = o->head_prev = o;
+	o->lock = 0x10c;
+	o->next = 0xffffffffu;
+	o->buf = malloc(64);
+	((struct counts *)arg)->ctors++;
+}
+
+static void
+obj_dtor(void *p, void *arg)
+{
+	struct obj *o = p;
+	assert_ptr_equal(o->head_next, o);
+	assert_int_equal(o->lock, 0x10c);
+	free(o->buf);
+	o->buf = NULL;
+	((struct counts *)arg)->dtors++;
+}
+
+static void
+assert_constructed(struct obj *o)
+{
+	assert_ptr_equal(o->head_next, o);
+	assert_ptr_equal(o->head_prev, o);
+	assert_int_equal(o->lock, 0x10c);
+	assert_non_null(o->buf);
+}
+
+static void
+test_ctor_once(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 0, .max = 4096, .grow_step = 64 };
+	struct counts n = { 0 };
+	struct slab_obj c;
+	struct obj *o[256];
+	u32 i, ctors;
+
+	assert_int_equal(slab_obj_init(&c, sizeof(struct obj), SLAB_OBJ_LINK_AUTO,
+	                               &pol, obj_ctor, obj_dtor, &n), 0);
+	/* the link sits behind the object, in the block's slack */
+	assert_true(slab_link(slab_obj_slab(&c)) >= sizeof(struct obj));
+	assert_int_equal(slab_block_size(slab_obj_slab(&c)), 128);
+
+	for (i = 0; i < 256; i++) {
+		assert_non_null(o[i] = slab_obj_alloc(&c));
+		assert_constructed(o[i]);
+		o[i]->uses++;
+		memset(o[i]->payload, (int)i, sizeof(o[i]->payload));
+	}
+	ctors = n.ctors;
+	assert_int_equal(ctors, slab_committed(slab_obj_slab(&c)));
+	assert_int_equal(c.stat.ctors, ctors);
+
+	/* round trips: no constructor, and the state as it was freed */
+	for (u32 round = 0; round < 4; round++) {
+		slab_obj_free_bulk(&c, (void **)o, 256);
+		assert_int_equal(slab_obj_alloc_bulk(&c, (void **)o, 256), 256);
+		for (i = 0; i < 256; i++) {
+			assert_constructed(o[i]);
+			assert_int_equal(o[i]->uses, round + 1);
+			o[i]->uses++;
+		}
+	}
+	assert_int_equal(n.ctors, ctors);
+
+	for (i = 0; i < 256; i++)
+		slab_obj_free(&c, o[i]);
+	slab_obj_fini(&c);
+	assert_int_equal(n.dtors, ctors);
+}
+
+static void
+test_dtor_on_release(void **state)
+{
+	(void)state;
+	struct slab_policy pol = {
+		.min = 0, .max = 4096, .grow_step = 64,
+		.shrink_usage_pct = 50, .shrink_release_pct = 100,
+	};
+	struct counts n = { 0 };
+	struct slab_obj c;
+	void *o[1024];
+	u32 committed, released, kept;
+
+	assert_int_equal(slab_obj_init(&c, sizeof(struct obj), SLAB_OBJ_LINK_AUTO,
+	                               &pol, obj_ctor, obj_dtor, &n), 0);
+	assert_int_equal(slab_obj_alloc_bulk(&c, o, 1024), 1024);
+	committed = slab_committed(slab_obj_slab(&c));
+	assert_int_equal(n.ctors, committed);
+
+	/* a shrink destructs exactly what it releases, before it goes */
+	slab_obj_free_bulk(&c, o + 64, 1024 - 64);
+	released = slab_obj_shrink(&c, committed);
+	assert_true(released > 0);
+	kept = slab_committed(slab_obj_slab(&c));
+	assert_int_equal(n.dtors, released);
+	assert_int_equal(c.constructed, kept);
+
+	/* growing back constructs afresh */
+	assert_true(slab_obj_grow(&c, released) > 0);
+	assert_int_equal(c.constructed, slab_committed(slab_obj_slab(&c)));
+	assert_int_equal(n.ctors, committed + (slab_committed(slab_obj_slab(&c)) -
+	                                       kept));
+	assert_int_equal(slab_obj_alloc_bulk(&c, o + 64, 512), 512);
+	for (u32 i = 0; i < 64 + 512; i++)
+		assert_constructed(o[i]);
+
+	/* gc releases through the same hook */
+	slab_obj_free_bulk(&c, o, 64 + 512);
+	assert_true(slab_obj_gc(&c, 1) < 0);
+	assert_int_equal(n.ctors - n.dtors, c.constructed);
+	slab_obj_fini(&c);
+	assert_int_equal(n.ctors, n.dtors);
+}
+
+static void
+test_link_in_object(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 64, .max = 1024, .grow_step = 64 };
+	struct counts n = { 0 };
+	struct slab_obj c;
+	struct obj *o[128];
+	u32 i;
+
+	/* a field of the object's own; nothing else in it may be touched */
+	assert_int_equal(slab_obj_init(&c, sizeof(struct obj), 1,
+	                               &pol, obj_ctor, NULL, &n), -1);
+	assert_int_equal(slab_obj_init(&c, sizeof(struct obj),
+	                               offsetof(struct obj, next),
+	                               &pol, obj_ctor, NULL, &n), 0);
+	assert_int_equal(n.ctors, 64);            /* policy.min, at init */
+	for (i = 0; i < 128; i++) {
+		assert_non_null(o[i] = slab_obj_alloc(&c));
+		assert_constructed(o[i]);
+		o[i]->uses = i;
+	}
+	slab_obj_free_bulk(&c, (void **)o, 128);
+	for (i = 0; i < 128; i++) {
+		struct obj *p = slab_obj_alloc(&c);
+		assert_constructed(p);
+		free(p->buf);                      /* no dtor in this cache */
+		p->buf = NULL;
+	}
+	slab_obj_fini(&c);
+}
+
+static void
+test_slab_link_moved(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 0, .max = 256, .grow_step = 64 };
+	struct slab vm;
+	u8 *blk[256];
+	u32 i, j;
+
+	assert_int_equal(slab_init(&vm, 256, &pol), 0);
+	assert_int_equal(slab_set_link(&vm, 2), -1);      /* misaligned */
+	assert_int_equal(slab_set_link(&vm, 256), -1);    /* past the block */
+	assert_int_equal(slab_alloc_bulk(&vm, (void **)blk, 64), 64);
+	for (i = 0; i < 64; i++)
+		memset(blk[i], 0xa5, 256);
+	slab_free_bulk(&vm, (void **)blk + 32, 32);
+
+	/* moved on a live slab: the free list is rebuilt at the new offset */
+	assert_int_equal(slab_set_link(&vm, 252), 0);
+	assert_int_equal(slab_avail(&vm), 32);
+	for (i = 32; i < 64; i++) {
+		slab_free(&vm, blk[i - 32]);
+		/* everything but the link word is as it was left */
+		assert_int_equal(blk[i - 32][0], 0xa5);
+	}
+	/* the blocks freed under the new link come back first, intact */
+	assert_int_equal(slab_alloc_bulk(&vm, (void **)blk, 32), 32);
+	for (i = 0; i < 32; i++)
+		for (j = 0; j < 252; j++)
+			assert_int_equal(blk[i][j], 0xa5);
+	assert_int_equal(slab_alloc_bulk(&vm, (void **)blk + 32, 32), 32);
+
+	/* fresh blocks still read as zero */
+	for (i = 64; i < 128; i++) {
+		assert_non_null(blk[i] = slab_zalloc(&vm));
+		for (j = 0; j < 256; j++)
+			assert_int_equal(blk[i][j], 0);
+	}
+
+	/* the lock-free mode follows the link too */
+	slab_free_bulk(&vm, (void **)blk, 128);
+	for (i = 0; i < 256; i++)
+		assert_non_null(blk[i] = slab_alloc_lockfree(&vm));
+	assert_null(slab_alloc_lockfree(&vm));
+	for (i = 0; i < 256; i++)
+		slab_free_lockfree(&vm, blk[i]);
+	assert_int_equal(slab_avail(&vm), 256);
+	slab_fini(&vm);
+}
+
+/*
+ * Blocks committed once and released lazily keep their old link words: moved
+ * with such a tail above the committed prefix, the grow back into it must
+ * still hand them out as zero.
+ */
+static void
+test_slab_link_lazy_tail(void **state)
+{
+	(void)state;
+	struct slab_policy pol = {
+		.min = 0, .max = 128, .grow_step = 64,
+		.reclaim = SLAB_RECLAIM_FREE, .release_after = 1000,
+	};
+	struct slab vm;
+	u8 *blk[64];
+	u32 i, j;
+
+	assert_int_equal(slab_init(&vm, 256, &pol), 0);
+	assert_int_equal(slab_grow(&vm, 64), 64);
+	assert_int_equal(slab_alloc_bulk(&vm, (void **)blk, 16), 16);
+	assert_int_equal(slab_shrink(&vm, 32), 32);
+	assert_int_equal(slab_committed(&vm), 32);
+#ifdef SLAB_VM_MMAP
+	assert_int_equal(vm.lazy_end, 64);
+#endif
+	assert_int_equal(slab_set_link(&vm, 128), 0);
+	assert_int_equal(slab_grow(&vm, 32), 32);
+	for (i = 16; i < 64; i++) {
+		assert_non_null(blk[i - 16] = slab_zalloc(&vm));
+		for (j = 0; j < 256; j++)
+			assert_int_equal(blk[i - 16][j], 0);
+	}
+	slab_fini(&vm);
+}
+
+static void
+fill_ctor(void *p, void *arg)
+{
+	memset(p, 0xab, 256);
+	((struct counts *)arg)->ctors++;
+}
+
+/*
+ * Nothing to construct is nothing spoiled: an empty cache growing by nothing
+ * keeps the zero mark above the constructed bytes of a lazily released tail.
+ */
+static void
+test_ctor_empty_grow(void **state)
+{
+	(void)state;
+	struct slab_policy pol = {
+		.min = 0, .max = 128, .grow_step = 32,
+		.reclaim = SLAB_RECLAIM_FREE, .release_after = 1000,
+	};
+	struct counts n = { 0 };
+	struct slab_obj c;
+	struct slab *vm;
+	u32 virgin;
+
+	assert_int_equal(slab_obj_init(&c, 256, SLAB_OBJ_LINK_AUTO, &pol,
+	                               fill_ctor, NULL, &n), 0);
+	vm = slab_obj_slab(&c);
+	assert_int_equal(vm->virgin, SLAB_VM_ZEROES ? 0 : slab_policy_max(vm));
+	assert_int_equal(slab_obj_grow(&c, 32), 32);
+	assert_int_equal(n.ctors, 32);
+	virgin = vm->virgin;
+	assert_true(virgin >= 32);
+
+	assert_int_equal(slab_obj_shrink(&c, 32), 32);
+	assert_int_equal(slab_committed(vm), 0);
+#ifdef SLAB_VM_MMAP
+	assert_int_equal(vm->lazy_end, 32);
+#endif
+	assert_int_equal(slab_obj_grow(&c, 0), 0);
+	assert_int_equal(vm->virgin, virgin);
+	assert_int_equal(n.ctors, 32);
+	slab_obj_fini(&c);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_ctor_once),
+		cmocka_unit_test(test_dtor_on_release),
+		cmocka_unit_test(test_link_in_object),
+		cmocka_unit_test(test_slab_link_moved),
+		cmocka_unit_test(test_slab_link_lazy_tail),
+		cmocka_unit_test(test_ctor_empty_grow),
+	};
+	return cmocka_run_group_tests_name("slab_obj", tests, NULL, NULL);
+}
@@ -0,0 +1,272 @@
+/*
+ * Unit tests for the slab memory pressure source, <mem/slab_pressure.h>.
+ *
+ * Each unit points the source at fake PSI and cgroup v2 files in a scratch
+ * directory and rewrites them in place, as the kernel does: the parsing and the
+ * once-per-tick poll over the kept-open descriptors, the levels, the harder
+ * shrink of slab_pressure_gc() under pressure and the grow veto near
+ * memory.high.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include <hpc/compiler.h>
+#include <mem/slab_pressure.h>
+
+struct fake {
+	char dir[256];
+	char psi[300];
+};
+
+static void
+put(struct fake *f, const char *name, const char *fmt, ...)
+{
+	char path[320], buf[512];
+	va_list ap;
+	int fd, n;
+
+	snprintf(path, sizeof(path), "%s/%s", f->dir, name);
+	va_start(ap, fmt);
+	n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	/* in place: the source holds the file open */
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	assert_true(fd >= 0);
+	assert_int_equal(write(fd, buf, (size_t)n), n);
+	close(fd);
+}
+
+static void
+psi(struct fake *f, const char *some, const char *full)
+{
+	put(f, "pressure",
+	    "some avg10=%s avg60=0.00 avg300=0.00 total=1234\n"
+	    "full avg10=%s avg60=0.00 avg300=0.00 total=567\n", some, full);
+}
+
+static void
+events(struct fake *f, unsigned high, unsigned max, unsigned oom)
+{
+	put(f, "memory.events",
+	    "low 0\nhigh %u\nmax %u\noom %u\noom_kill 0\noom_group_kill 0\n",
+	    high, max, oom);
+}
+
+static int
+setup(void **state)
+{
+	struct fake *f = calloc(1, sizeof(*f));
+	const char *tmp = getenv("TMPDIR");
+
+	snprintf(f->dir, sizeof(f->dir), "%s/slab_pressure.XXXXXX",
+	         tmp ? tmp : "/tmp");
+	if (!mkdtemp(f->dir))
+		return -1;
+	snprintf(f->psi, sizeof(f->psi), "%s/pressure", f->dir);
+	psi(f, "0.00", "0.00");
+	events(f, 0, 0, 0);
+	put(f, "memory.current", "%u\n", 100u << 20);
+	put(f, "memory.high", "max\n");
+	*state = f;
+	return 0;
+}
+
+static int
+teardown(void **state)
+{
+	struct fake *f = *state;
+	const char *names[] = { "pressure", "memory.events", "memory.current",
+	                        "memory.high" };
+	char path[320];
+
+	for (unsigned i = 0; i < array_size(names); i++) {
+		snprintf(path, sizeof(path), "%s/%s", f->dir, names[i]);
+		unlink(path);
+	}
+	rmdir(f->dir);
+	free(f);
+	return 0;
+}
+
+static void
+test_poll_once_per_tick(void **state)
+{
+	struct fake *f = *state;
+	struct slab_pressure p;
+
+	assert_int_equal(slab_pressure_open(&p, f->psi, f->dir), 0);
+	psi(f, "3.25", "0.50");
+	put(f, "memory.current", "%u\n", 200u << 20);
+	put(f, "memory.high", "%u\n", 400u << 20);
+
+	assert_int_equal(slab_pressure_poll(&p, 10), SLAB_PRESSURE_NONE);
+	assert_int_equal(p.some, 325);
+	assert_int_equal(p.full, 50);
+	assert_true(p.current == 200ull << 20);
+	assert_true(p.high == 400ull << 20);
+	assert_false(p.near_high);
+
+	/* the same tick reuses the reading, whatever the files say now */
+	psi(f, "42.00", "0.00");
+	assert_int_equal(slab_pressure_poll(&p, 10), SLAB_PRESSURE_NONE);
+	assert_int_equal(p.some, 325);
+	assert_int_equal(p.stat.polls, 1);
+
+	/* the next one reads them again, through the same descriptors */
+	assert_int_equal(slab_pressure_poll(&p, 11), SLAB_PRESSURE_SOME);
+	assert_int_equal(p.some, 4200);
+	assert_int_equal(p.stat.polls, 2);
+
+	/* with an interval, only once it has passed */
+	p.interval = 100;
+	psi(f, "0.00", "0.00");
+	assert_int_equal(slab_pressure_poll(&p, 110), SLAB_PRESSURE_SOME);
+	assert_int_equal(slab_pressure_poll(&p, 111), SLAB_PRESSURE_NONE);
+	assert_int_equal(p.stat.polls, 3);
+	assert_int_equal(p.stat.errors, 0);
+	slab_pressure_close(&p);
+}
+
+static void
+test_levels(void **state)
+{
+	struct fake *f = *state;
+	struct slab_pressure p;
+	timestamp_t now = 1;
+
+	assert_int_equal(slab_pressure_open(&p, f->psi, f->dir), 0);
+	events(f, 7, 1, 0);                       /* the first poll: baseline */
+	assert_int_equal(slab_pressure_poll(&p, now++), SLAB_PRESSURE_NONE);
+
+	events(f, 8, 1, 0);                       /* throttled at memory.high */
+	assert_int_equal(slab_pressure_poll(&p, now++), SLAB_PRESSURE_SOME);
+	assert_int_equal(slab_pressure_poll(&p, now++), SLAB_PRESSURE_NONE);
+	events(f, 8, 1, 1);                       /* the OOM killer ran       */
+	assert_int_equal(slab_pressure_poll(&p, now++), SLAB_PRESSURE_FULL);
+	assert_int_equal(slab_pressure_poll(&p, now++), SLAB_PRESSURE_NONE);
+
+	psi(f, "0.00", "5.00");
+	assert_int_equal(slab_pressure_poll(&p, now++), SLAB_PRESSURE_FULL);
+	psi(f, "0.00", "0.00");
+
+	/* within the headroom of memory.high, then over it */
+	put(f, "memory.high", "%u\n", 100u << 20);
+	put(f, "memory.current", "%u\n", 96u << 20);
+	assert_int_equal(slab_pressure_poll(&p, now++), SLAB_PRESSURE_NONE);
+	assert_true(p.near_high);
+	put(f, "memory.current", "%u\n", 101u << 20);
+	assert_int_equal(slab_pressure_poll(&p, now++), SLAB_PRESSURE_FULL);
+	put(f, "memory.high", "max\n");
+	assert_int_equal(slab_pressure_poll(&p, now++), SLAB_PRESSURE_NONE);
+	assert_false(p.near_high);
+	slab_pressure_close(&p);
+
+	/* a source left out, or missing, reads as none */
+	assert_int_equal(slab_pressure_open(&p, f->psi, ""), 0);
+	assert_int_equal(p.fd_events, -1);
+	assert_int_equal(slab_pressure_poll(&p, 1), SLAB_PRESSURE_NONE);
+	slab_pressure_close(&p);
+	assert_int_equal(slab_pressure_open(&p, "", "/nonexistent"), -1);
+	assert_int_equal(errno, ENOENT);
+}
+
+static void
+test_gc_shrinks_harder(void **state)
+{
+	struct fake *f = *state;
+	struct slab_policy pol = {
+		.min = 0, .max = 64, .grow_step = 64,
+		.grow_usage_pct = 90, .shrink_usage_pct = 25,
+		.shrink_release_pct = 25, .shrink_after = 1000,
+	};
+	struct slab_pressure p;
+	struct slab vm;
+	void *blk[64];
+
+	assert_int_equal(slab_pressure_open(&p, f->psi, f->dir), 0);
+	assert_int_equal(slab_init(&vm, SLAB_GRAIN_BYTES, &pol), 0);
+	assert_int_equal(slab_alloc_bulk(&vm, blk, 64), 64);
+	slab_free_bulk(&vm, blk + 8, 56);
+
+	/* no pressure: the dwell holds the memory */
+	assert_int_equal(slab_pressure_gc(&p, &vm, 1), 0);
+	assert_int_equal(slab_pressure_gc(&p, &vm, 200), 0);
+	assert_int_equal(slab_committed(&vm), 64);
+
+	/* some: a quarter of the dwell, twice the release */
+	psi(f, "12.00", "0.00");
+	assert_int_equal(slab_pressure_gc(&p, &vm, 300), -28);
+	assert_int_equal(slab_committed(&vm), 36);
+	/* the slab's own policy is back */
+	assert_true(vm.policy.shrink_after == 1000);
+	assert_int_equal(vm.policy.shrink_release_pct, 25);
+	assert_int_equal(vm.policy.shrink_usage_pct, 25);
+
+	/* full: everything free goes at once */
+	psi(f, "30.00", "8.00");
+	assert_int_equal(slab_pressure_gc(&p, &vm, 301), -28);
+	assert_int_equal(slab_committed(&vm), 8);
+	assert_int_equal(slab_avail(&vm), 0);
+	assert_int_equal(p.stat.boosts, 2);
+
+	slab_free_bulk(&vm, blk, 8);
+	slab_fini(&vm);
+	slab_pressure_close(&p);
+}
+
+static void
+test_grow_vetoed_near_high(void **state)
+{
+	struct fake *f = *state;
+	struct slab_policy pol = {
+		.min = 0, .max = 64, .grow_step = 16, .grow_usage_pct = 50,
+		.check = slab_pressure_check,
+	};
+	struct slab_pressure p;
+	struct slab vm;
+	void *blk[32];
+
+	assert_int_equal(slab_pressure_open(&p, f->psi, f->dir), 0);
+	pol.arg = &p;
+	assert_int_equal(slab_init(&vm, SLAB_GRAIN_BYTES, &pol), 0);
+	assert_int_equal(slab_alloc_bulk(&vm, blk, 16), 16);
+
+	put(f, "memory.high", "%u\n", 100u << 20);
+	put(f, "memory.current", "%u\n", 99u << 20);
+	/* gc grows on the watermark no more ... */
+	assert_int_equal(slab_pressure_gc(&p, &vm, 1), 0);
+	assert_true(p.near_high);
+	assert_int_equal(slab_committed(&vm), 16);
+	/* ... and neither does an exhausted slab */
+	assert_null(slab_alloc(&vm));
+	assert_true(p.stat.vetoes >= 1);
+
+	/* the cgroup got its memory back */
+	put(f, "memory.current", "%u\n", 50u << 20);
+	assert_int_equal(slab_pressure_gc(&p, &vm, 2), 16);
+	assert_non_null(blk[16] = slab_alloc(&vm));
+
+	slab_free_bulk(&vm, blk, 17);
+	slab_fini(&vm);
+	slab_pressure_close(&p);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_poll_once_per_tick,
+		                                setup, teardown),
+		cmocka_unit_test_setup_teardown(test_levels, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_gc_shrinks_harder,
+		                                setup, teardown),
+		cmocka_unit_test_setup_teardown(test_grow_vetoed_near_high,
+		                                setup, teardown),
+	};
+	return cmocka_run_group_tests_name("slab_pressure", tests, NULL, NULL);
+}
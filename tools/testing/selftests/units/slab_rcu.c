@@ -260,6 +260,40 @@ test_alloc_cancels_a_pending_retire(void **state)
 	slab_rcu_fini(&r);
 }
 
+/* So does a batch the free list cannot cover, and only that. */
+static void
+test_bulk_alloc_cancels_a_pending_retire(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 0, .max = 64, .grow_step = 4 };
+	struct slab_rcu r;
+	void *blk[8];
+
+	assert_int_equal(slab_rcu_init(&r, CPU_PAGE_SIZE, &pol, 0), 0);
+	slab_rcu_set_interval(&r, 0);
+	assert_int_equal(slab_grow(slab_rcu_slab(&r), 8), 8);
+	assert_int_equal(slab_rcu_alloc_bulk(&r, blk, 8), 8);
+
+	/* free 4..7, the tail grain, and retire it */
+	slab_rcu_free_bulk(&r, blk + 4, 4);
+	slab_rcu_plan_shrink(&r, 4);
+	assert_int_equal(slab_rcu_tick(&r, 1000), -4);
+	assert_int_equal(slab_rcu_state(&r), SLAB_RCU_RETIRED);
+
+	/* a batch the list covers leaves the retire alone */
+	slab_rcu_free_bulk(&r, blk, 2);
+	assert_int_equal(slab_rcu_alloc_bulk(&r, blk, 2), 2);
+	assert_int_equal(slab_rcu_state(&r), SLAB_RCU_RETIRED);
+
+	/* one that must grow abandons it first */
+	assert_int_equal(slab_rcu_alloc_bulk(&r, blk + 4, 4), 4);
+	assert_int_equal(slab_rcu_state(&r), SLAB_RCU_IDLE);
+	assert_int_equal(slab_rcu_stat(&r)->cancels, 1);
+	assert_int_equal(slab_used(slab_rcu_slab(&r)), 8);
+
+	slab_rcu_fini(&r);
+}
+
 /* Only one retire is in flight at a time; a second plan waits its turn. */
 static void
 test_one_retire_at_a_time(void **state)
@@ -356,6 +390,70 @@ test_plan_gc_records_instead_of_acting(void **state)
 	slab_rcu_fini(&r);
 }
 
+/*
+ * A compaction moves the block at once but holds its old slot back: the old
+ * copy stays allocated and readable until the grace period is in, so no retire
+ * can take it from under a reader that reached it before the move.
+ */
+static bool
+rcu_relocate(void *from, void *to, void *arg)
+{
+	void **obj = (void **)arg;
+	assert_ptr_equal(*obj, from);
+	rcu_assign_pointer(*obj, to);
+	return true;
+}
+
+static void
+test_compact_holds_the_old_slot(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 0, .max = 64, .grow_step = 4 };
+	struct slab_rcu r;
+	struct slab *s;
+	void *blk[8], *obj = NULL;
+	u32 i;
+
+	assert_int_equal(slab_rcu_init(&r, CPU_PAGE_SIZE, &pol, 0), 0);
+	slab_rcu_set_interval(&r, 0);
+	s = slab_rcu_slab(&r);
+	assert_int_equal(slab_grow(s, 8), 8);
+	for (i = 0; i < 8; i++)
+		blk[i] = slab_rcu_alloc(&r);
+	for (i = 0; i < 8; i++) {
+		if (slab_index(s, blk[i]) == 7)
+			obj = blk[i];
+		else
+			slab_rcu_free(&r, blk[i]);
+	}
+	assert_non_null(obj);
+	stamp_write(obj, 7);
+
+	/* moved to the bottom; the old slot is still allocated and intact */
+	assert_int_equal(slab_rcu_compact(&r, 4, 8, rcu_relocate, &obj), 1);
+	assert_int_equal(slab_index(s, obj), 0);
+	assert_true(stamp_valid(obj));
+	assert_true(stamp_valid(slab_at(s, 7)));
+	assert_int_equal(slab_rcu_compacting(&r), 1);
+	assert_int_equal(slab_used(s), 2);
+
+	/* one compaction in flight at a time */
+	assert_int_equal(slab_rcu_compact(&r, 4, 8, rcu_relocate, &obj), 0);
+
+	/* after the grace period the slot is free and the tail can go */
+	slab_rcu_sync(&r);
+	assert_int_equal(slab_rcu_compacting(&r), 0);
+	assert_int_equal(slab_used(s), 1);
+	assert_int_equal(slab_rcu_stat(&r)->compactions, 1);
+	assert_int_equal(slab_rcu_stat(&r)->blocks_moved, 1);
+	slab_rcu_plan_shrink(&r, 4);
+	assert_int_equal(slab_rcu_tick(&r, 1000), -4);
+	assert_int_equal(slab_rcu_sync(&r), 4);
+	assert_true(stamp_valid(obj));
+
+	slab_rcu_fini(&r);
+}
+
 /* ---- the race: a parked reader holds the release back -------------------- */
 
 struct parked {
@@ -650,9 +748,11 @@ main(void)
 		cmocka_unit_test(test_shrink_retires_then_releases),
 		cmocka_unit_test(test_grow_cancels_a_pending_retire),
 		cmocka_unit_test(test_alloc_cancels_a_pending_retire),
+		cmocka_unit_test(test_bulk_alloc_cancels_a_pending_retire),
 		cmocka_unit_test(test_one_retire_at_a_time),
 		cmocka_unit_test(test_tick_interval),
 		cmocka_unit_test(test_plan_gc_records_instead_of_acting),
+		cmocka_unit_test(test_compact_holds_the_old_slot),
 		cmocka_unit_test(test_parked_reader_holds_release_back),
 		cmocka_unit_test(test_stress_readers_never_see_released_memory),
 	};
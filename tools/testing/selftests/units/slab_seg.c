@@ -0,0 +1,200 @@
+/*
+ * Unit tests for the segmented slab, <mem/slab_seg.h>.
+ *
+ * Each unit drives a slab whose segment holds a few pages of blocks, so that a
+ * handful of allocations crosses segment boundaries: growing past policy.max,
+ * the index round trip across segments, stable addresses while segments come
+ * and go, the release of empty segments by gc and trim, and the segment cap.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include <hpc/compiler.h>
+#include <mem/slab_seg.h>
+
+#define BLOCK 256
+
+static void
+test_grows_past_max(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 0, .max = 1 };
+	struct slab_seg s;
+	void **blk;
+	u32 per, n, i;
+
+	assert_int_equal(slab_seg_init(&s, BLOCK, &pol, 0), 0);
+	per = slab_seg_blocks(&s);
+	/* a segment is at least a grain, however small max is */
+	assert_true(per >= slab_grain_for(s.shift));
+	assert_int_equal(slab_seg_count(&s), 1);
+
+	n = 3 * per + 1;
+	blk = (void **)calloc(n, sizeof(void *));
+	assert_non_null(blk);
+	for (i = 0; i < n; i++) {
+		blk[i] = slab_seg_alloc(&s);
+		assert_non_null(blk[i]);
+		memset(blk[i], (int)i, BLOCK);
+	}
+	assert_int_equal(slab_seg_count(&s), 4);
+	assert_int_equal(s.stat.adds, 3);
+	assert_int_equal(slab_seg_used(&s), n);
+
+	/* index <-> block across segments; the top bit is never set */
+	for (i = 0; i < n; i++) {
+		u32 idx = slab_seg_index(&s, blk[i]);
+		assert_true(idx != SLAB_NIL);
+		assert_true(idx < 0x80000000u);
+		assert_ptr_equal(slab_seg_at(&s, idx), blk[i]);
+		assert_ptr_equal(slab_seg_segment(&s, blk[i]),
+		                 s.seg[idx >> s.bits]);
+	}
+	/* every segment is aligned to its size */
+	for (i = 0; i < SLAB_SEG_SLOTS; i++)
+		if (s.base[i])
+			assert_int_equal((uintptr_t)s.base[i] &
+			                 (((uintptr_t)1 << s.seg_log) - 1), 0);
+
+	for (i = 0; i < n; i++)
+		slab_seg_free(&s, blk[i]);
+	assert_int_equal(slab_seg_used(&s), 0);
+	free(blk);
+	slab_seg_fini(&s);
+}
+
+static void
+test_addresses_stay(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 0, .max = 1 };
+	struct slab_seg s;
+	void **blk;
+	u32 per, n, i;
+
+	assert_int_equal(slab_seg_init(&s, BLOCK, &pol, 0), 0);
+	per = slab_seg_blocks(&s);
+	n = 2 * per;
+	blk = (void **)calloc(n, sizeof(void *));
+	assert_non_null(blk);
+
+	/* stamp the home segment, then add and release another beside it */
+	for (i = 0; i < per; i++) {
+		blk[i] = slab_seg_alloc(&s);
+		*(u32 *)blk[i] = i;
+	}
+	for (i = per; i < n; i++)
+		blk[i] = slab_seg_alloc(&s);
+	assert_int_equal(slab_seg_count(&s), 2);
+	for (i = per; i < n; i++)
+		slab_seg_free(&s, blk[i]);
+	assert_int_equal(slab_seg_trim(&s), 1);
+	assert_int_equal(slab_seg_count(&s), 1);
+
+	for (i = 0; i < per; i++) {
+		assert_int_equal(*(u32 *)blk[i], i);
+		assert_ptr_equal(slab_seg_at(&s, slab_seg_index(&s, blk[i])),
+		                 blk[i]);
+		slab_seg_free(&s, blk[i]);
+	}
+	free(blk);
+	slab_seg_fini(&s);
+}
+
+static void
+test_gc_releases_empty_segments(void **state)
+{
+	(void)state;
+	struct slab_policy pol = {
+		.min = 0, .max = 1, .shrink_usage_pct = 25,
+		.shrink_release_pct = 100, .shrink_after = 10,
+	};
+	struct slab_seg s;
+	void **blk;
+	u32 per, n, i;
+#ifdef CONFIG_MEASURE
+	struct slab_measure m = { 0 };
+#endif
+
+	assert_int_equal(slab_seg_init(&s, BLOCK, &pol, 0), 0);
+#ifdef CONFIG_MEASURE
+	slab_seg_set_measure(&s, &m);
+#endif
+	per = slab_seg_blocks(&s);
+	n = 3 * per;
+	blk = (void **)calloc(n, sizeof(void *));
+	assert_non_null(blk);
+	for (i = 0; i < n; i++)
+		assert_non_null(blk[i] = slab_seg_alloc(&s));
+	assert_int_equal(slab_seg_count(&s), 3);
+
+	/* keep one block of the home segment, free the rest */
+	for (i = 1; i < n; i++)
+		slab_seg_free(&s, blk[i]);
+	assert_int_equal(slab_seg_gc(&s, 100), 0);   /* arms the idle timers */
+	assert_int_equal(slab_seg_count(&s), 3);
+	assert_true(slab_seg_gc(&s, 200) < 0);
+	assert_int_equal(slab_seg_count(&s), 1);
+	assert_int_equal(s.stat.releases, 2);
+	assert_int_equal(slab_seg_used(&s), 1);
+	assert_ptr_equal(slab_seg_segment(&s, blk[0]), s.seg[s.home]);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.used, 1);
+	assert_int_equal(m.alloc, n);
+#endif
+
+	/* the released space comes back as new segments on demand */
+	for (i = 1; i < n; i++)
+		assert_non_null(blk[i] = slab_seg_alloc(&s));
+	assert_int_equal(slab_seg_count(&s), 3);
+	for (i = 0; i < n; i++)
+		slab_seg_free(&s, blk[i]);
+	assert_int_equal(slab_seg_trim(&s), 2);
+	assert_int_equal(slab_seg_used(&s), 0);
+	free(blk);
+	slab_seg_fini(&s);
+}
+
+static void
+test_segment_cap(void **state)
+{
+	(void)state;
+	struct slab_policy pol = { .min = 0, .max = 1 };
+	struct slab_seg s;
+	void **blk;
+	u32 per, i;
+
+	assert_int_equal(slab_seg_init(&s, BLOCK, &pol, 2), 0);
+	per = slab_seg_blocks(&s);
+	blk = (void **)calloc(2 * per, sizeof(void *));
+	assert_non_null(blk);
+	for (i = 0; i < 2 * per; i++)
+		assert_non_null(blk[i] = slab_seg_alloc(&s));
+	assert_null(slab_seg_alloc(&s));
+	assert_int_equal(slab_seg_count(&s), 2);
+
+	/* a freed block is found again in whichever segment it is */
+	slab_seg_free(&s, blk[3]);
+	assert_ptr_equal(slab_seg_alloc(&s), blk[3]);
+	for (i = 0; i < 2 * per; i++)
+		slab_seg_free(&s, blk[i]);
+	free(blk);
+	slab_seg_fini(&s);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_grows_past_max),
+		cmocka_unit_test(test_addresses_stay),
+		cmocka_unit_test(test_gc_releases_empty_segments),
+		cmocka_unit_test(test_segment_cap),
+	};
+	return cmocka_run_group_tests_name("slab_seg", tests, NULL, NULL);
+}
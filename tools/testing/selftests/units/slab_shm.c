@@ -0,0 +1,253 @@
+/*
+ * Unit tests for the cross-process shared slab, <mem/slab_shm.h>.
+ *
+ * The units exhaust and refill a shared slab, attach the same memfd twice in
+ * one process and find the same blocks by index at both addresses, then fork:
+ * a child that attaches, receives blocks off the ring, checks their payloads
+ * and frees them for the parent to allocate again, and a parent asleep in
+ * slab_shm_alloc_wait() until the child frees. The child reports through its
+ * exit status; cmocka asserts stay in the parent.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <hpc/compiler.h>
+#include <mem/slab_shm.h>
+
+#define BSIZE 256
+
+static void
+test_alloc_exhaust(void **state)
+{
+	(void)state;
+	struct slab_measure m = { 0 };
+	struct slab_shm sh;
+	void *p[64];
+	u32 total, i;
+
+	assert_int_equal(slab_shm_create(&sh, "unit-shm", 200, 1), 0);
+#ifdef CONFIG_MEASURE
+	sh.measure = &m;
+#endif
+	(void)m;
+	assert_int_equal(slab_shm_block_size(&sh), BSIZE);
+	total = sh.hdr->total;
+	assert_true(total >= 1 && total <= 64);
+	assert_int_equal(sh.hdr->ring & (sh.hdr->ring - 1), 0);
+	assert_true(sh.hdr->ring >= total);
+	assert_int_equal(sh.hdr->committed, 0);
+	assert_int_equal(slab_shm_avail(&sh), total);
+
+	for (i = 0; i < total; i++) {
+		assert_non_null(p[i] = slab_shm_alloc(&sh));
+		assert_int_equal((uintptr_t)p[i] % BSIZE, 0);
+		assert_true(slab_shm_index(&sh, p[i]) < total);
+		assert_ptr_equal(slab_shm_at(&sh, slab_shm_index(&sh, p[i])), p[i]);
+		memset(p[i], (int)i, BSIZE);
+	}
+	assert_null(slab_shm_alloc(&sh));
+	assert_null(slab_shm_alloc_wait(&sh, 0));
+	assert_int_equal(slab_shm_avail(&sh), 0);
+	for (i = 0; i < total; i++)
+		assert_int_equal(((u8 *)p[i])[BSIZE - 1], (u8)i);
+
+	/* freed blocks come back, last freed first */
+	slab_shm_free(&sh, p[3 % total]);
+	assert_ptr_equal(slab_shm_alloc(&sh), p[3 % total]);
+	for (i = 0; i < total; i++)
+		slab_shm_free(&sh, p[i]);
+	assert_int_equal(slab_shm_avail(&sh), total);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(m.alloc, total + 1);
+	assert_int_equal(m.free, total + 1);
+	assert_int_equal(m.fail, 2);
+	assert_int_equal(m.commit, total);
+#endif
+	slab_shm_close(&sh);
+}
+
+static void
+test_two_mappings(void **state)
+{
+	(void)state;
+	struct slab_shm a, b;
+	u8 *p, *q;
+	int fd;
+
+	assert_int_equal(slab_shm_create(&a, "unit-shm", BSIZE, 64), 0);
+	fd = slab_shm_fd(&a);
+	assert_int_equal(slab_shm_attach(&b, fd), 0);
+	assert_ptr_not_equal(a.base, b.base);
+	assert_int_equal(a.hdr->attaches, 2);
+
+	/* allocated through one mapping, read and freed through the other */
+	p = (u8 *)slab_shm_alloc(&a);
+	memcpy(p, "hello", 6);
+	slab_shm_send(&a, p);
+	assert_non_null(q = (u8 *)slab_shm_recv(&b, 0));
+	assert_int_equal(slab_shm_index(&b, q), slab_shm_index(&a, p));
+	assert_string_equal((char *)q, "hello");
+	assert_null(slab_shm_recv(&b, 0));
+	slab_shm_free(&b, q);
+	assert_ptr_equal(slab_shm_alloc(&a), p);
+	slab_shm_free(&a, p);
+
+	assert_int_equal(slab_shm_detach(&b), fd);
+	assert_int_equal(a.hdr->attaches, 1);
+	slab_shm_close(&a);
+}
+
+static void
+test_attach_invalid(void **state)
+{
+	(void)state;
+	struct slab_shm sh;
+	char junk[8192];
+	int fd = memfd_create("unit-junk", 0);
+
+	assert_true(fd >= 0);
+	assert_int_equal(slab_shm_attach(&sh, fd), -1);
+	assert_int_equal(errno, EINVAL);
+	memset(junk, 0x5a, sizeof(junk));
+	assert_int_equal(write(fd, junk, sizeof(junk)), sizeof(junk));
+	assert_int_equal(slab_shm_attach(&sh, fd), -1);
+	assert_int_equal(errno, EINVAL);
+	close(fd);
+}
+
+static void
+test_recv_timeout(void **state)
+{
+	(void)state;
+	struct slab_shm sh;
+	u64 t0;
+
+	assert_int_equal(slab_shm_create(&sh, "unit-shm", BSIZE, 64), 0);
+	t0 = __slab_shm_now_ms();
+	assert_null(slab_shm_recv(&sh, 30));
+	assert_true(__slab_shm_now_ms() - t0 >= 30);
+	assert_int_equal(sh.hdr->ring_waiters, 0);
+	slab_shm_close(&sh);
+}
+
+/* The child: receive @n blocks, check the stamps, free them. Exit 0 if good. */
+static int
+consumer(int fd, u32 n)
+{
+	struct slab_shm sh;
+	int bad = 0;
+
+	if (slab_shm_attach(&sh, fd))
+		return 2;
+	for (u32 i = 0; i < n; i++) {
+		u32 *p = (u32 *)slab_shm_recv(&sh, 5000);
+		if (!p)
+			return 3;
+		bad |= p[0] != i || p[BSIZE / 4 - 1] != ~i;
+		slab_shm_free(&sh, p);
+	}
+	slab_shm_detach(&sh);
+	return bad;
+}
+
+static void
+test_fork_handoff(void **state)
+{
+	(void)state;
+	enum { N = 20000 };
+	struct slab_shm sh;
+	int status;
+	pid_t pid;
+
+	/* far fewer blocks than messages: the child's frees feed the parent */
+	assert_int_equal(slab_shm_create(&sh, "unit-shm", BSIZE, 64), 0);
+	pid = fork();
+	assert_true(pid >= 0);
+	if (!pid)
+		_exit(consumer(slab_shm_fd(&sh), N));
+
+	for (u32 i = 0; i < N; i++) {
+		u32 *p = (u32 *)slab_shm_alloc_wait(&sh, 5000);
+		assert_non_null(p);
+		p[0] = i;
+		p[BSIZE / 4 - 1] = ~i;
+		slab_shm_send(&sh, p);
+	}
+	assert_int_equal(waitpid(pid, &status, 0), pid);
+	assert_true(WIFEXITED(status));
+	assert_int_equal(WEXITSTATUS(status), 0);
+	assert_int_equal(slab_shm_avail(&sh), sh.hdr->total);
+	assert_null(slab_shm_recv(&sh, 0));
+	slab_shm_close(&sh);
+}
+
+static void
+test_fork_alloc_wait(void **state)
+{
+	(void)state;
+	struct slab_shm sh;
+	void *p[64];
+	u32 total, i;
+	int status, pipefd[2];
+	char c;
+	pid_t pid;
+
+	assert_int_equal(slab_shm_create(&sh, "unit-shm", BSIZE, 64), 0);
+	total = sh.hdr->total;
+	for (i = 0; i < total; i++)
+		assert_non_null(p[i] = slab_shm_alloc(&sh));
+	for (i = 0; i < total; i++)
+		slab_shm_send(&sh, p[i]);
+	assert_int_equal(pipe(pipefd), 0);
+
+	/* the child frees one block once the parent is asleep waiting for it */
+	pid = fork();
+	assert_true(pid >= 0);
+	if (!pid) {
+		struct slab_shm c;
+		void *q;
+		if (slab_shm_attach(&c, slab_shm_fd(&sh)) ||
+		    read(pipefd[0], &q, 1) != 1)
+			_exit(2);
+		while (!__atomic_load_n(&c.hdr->free_waiters, __ATOMIC_ACQUIRE))
+			usleep(1000);
+		usleep(20000);
+		if (!(q = slab_shm_recv(&c, 0)))
+			_exit(3);
+		slab_shm_free(&c, q);
+		_exit(0);
+	}
+
+	assert_null(slab_shm_alloc(&sh));
+	c = 'x';
+	assert_int_equal(write(pipefd[1], &c, 1), 1);
+	assert_ptr_equal(slab_shm_alloc_wait(&sh, 5000), p[0]);
+	assert_int_equal(waitpid(pid, &status, 0), pid);
+	assert_true(WIFEXITED(status));
+	assert_int_equal(WEXITSTATUS(status), 0);
+	assert_int_equal(sh.hdr->free_waiters, 0);
+	close(pipefd[0]);
+	close(pipefd[1]);
+	slab_shm_close(&sh);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_alloc_exhaust),
+		cmocka_unit_test(test_two_mappings),
+		cmocka_unit_test(test_attach_invalid),
+		cmocka_unit_test(test_recv_timeout),
+		cmocka_unit_test(test_fork_handoff),
+		cmocka_unit_test(test_fork_alloc_wait),
+	};
+	return cmocka_run_group_tests_name("slab_shm", tests, NULL, NULL);
+}
@@ -0,0 +1,197 @@
+/*
+ * Unit tests for the adaptive slab policy controller, <mem/slab_tune.h>.
+ *
+ * Each unit drives a slab through a load pattern one history row at a time -
+ * a row every second of a clock the test keeps - and checks what the
+ * controller made of the rows: a longer dwell and a larger step for a slab
+ * that oscillates, smaller ones for a slab over its RSS budget, and a decay of
+ * both for a slab that sits on idle memory. The decisions are read back from
+ * the controller's measure as well as from the policy.
+ *
+ * The controller decides on history rows, so without CONFIG_MEASURE (no slab
+ * counters, no rows) the units skip.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <string.h>
+
+#include <hpc/compiler.h>
+#include <mem/slab_tune.h>
+
+#define ROW 1000                              /* ms between history rows */
+
+DEFINE_MEASURE_HISTORY(slab, hist);
+
+struct rig {
+	struct slab vm;
+	struct slab_tune tune;
+	struct slab_tune_measure tm;
+	timestamp_t now;
+	void *blk[1024];
+	u32 live;
+};
+
+static void
+rig_init(struct rig *r, const struct slab_policy *pol, u32 budget)
+{
+	memset(r, 0, sizeof(*r));
+	r->now = 1;
+	assert_int_equal(slab_init(&r->vm, SLAB_GRAIN_BYTES, pol), 0);
+	measure_history_init(slab, &hist, r->now);
+	measure_history_every(slab, &hist, ROW, r->now);
+#ifdef CONFIG_MEASURE
+	r->vm.measure = measure_history_live(&hist);
+#endif
+	slab_tune_init(&r->tune, &r->vm, budget);
+#ifdef CONFIG_MEASURE
+	r->tune.measure = &r->tm;
+#endif
+}
+
+/* Hold @live blocks through one row: allocate or free to it, gc, save. */
+static int
+rig_row(struct rig *r, u32 live)
+{
+	while (r->live < live) {
+		r->blk[r->live] = slab_alloc(&r->vm);
+		assert_non_null(r->blk[r->live]);
+		r->live++;
+	}
+	while (r->live > live)
+		slab_free(&r->vm, r->blk[--r->live]);
+	slab_gc(&r->vm, r->now);
+	slab_gc(&r->vm, r->now + ROW / 2);
+	r->now += ROW;
+	assert_int_equal(measure_history_tick(slab, &hist, r->now), 1);
+	return slab_tune_step(&r->tune, &r->vm, &hist);
+}
+
+static void
+rig_fini(struct rig *r)
+{
+	while (r->live)
+		slab_free(&r->vm, r->blk[--r->live]);
+	slab_fini(&r->vm);
+}
+
+static void
+test_oscillation(void **state)
+{
+	(void)state;
+	struct slab_policy pol = {
+		.min = 0, .max = 1024, .grow_step = 8, .shrink_usage_pct = 25,
+		.shrink_release_pct = 100, .shrink_after = 200,
+	};
+	struct rig *r;
+	int i, all = 0;
+	u32 held;
+
+	if (!measure_history_depth || !measure_available)
+		skip();
+	r = calloc(1, sizeof(*r));
+	rig_init(r, &pol, 0);
+	/* bursts of 128 blocks, each dip shrunk away within the row */
+	for (i = 0; i < 7; i++)
+		all |= rig_row(r, i & 1 ? 0 : 128);
+	held = slab_committed(&r->vm);
+	all |= rig_row(r, 0);
+
+	assert_true(all & SLAB_TUNE_DWELL_UP);
+	assert_true(all & SLAB_TUNE_STEP_UP);
+	assert_false(all & SLAB_TUNE_OVER);
+	/* riding out the dip now: the last dip released nothing */
+	assert_true(r->vm.policy.shrink_after >= ROW / 2);
+	assert_int_equal(slab_committed(&r->vm), held);
+	assert_true(r->vm.policy.grow_step > 8);
+	assert_true(r->vm.policy.grow_step <= r->tune.step_max);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(r->tm.decide, 7);        /* from the second row on */
+	assert_true(r->tm.flips >= 1);
+	assert_true(r->tm.dwell_up >= 1);
+	assert_true(r->tm.step_up >= 1);
+	assert_int_equal(r->tm.grow_step, r->vm.policy.grow_step);
+	assert_int_equal(r->tm.shrink_after, r->vm.policy.shrink_after);
+	assert_int_equal(r->tm.peak, held);
+#endif
+	/* a row decided on is not decided on again */
+	assert_int_equal(slab_tune_step(&r->tune, &r->vm, &hist), 0);
+	rig_fini(r);
+	free(r);
+}
+
+static void
+test_over_budget(void **state)
+{
+	(void)state;
+	struct slab_policy pol = {
+		.min = 0, .max = 1024, .grow_step = 64, .shrink_usage_pct = 25,
+		.shrink_release_pct = 50, .shrink_after = 4000,
+	};
+	struct rig *r;
+	int d;
+
+	if (!measure_history_depth || !measure_available)
+		skip();
+	r = calloc(1, sizeof(*r));
+	rig_init(r, &pol, 96);
+	rig_row(r, 10);
+	d = rig_row(r, 100);                      /* committed 128 > 96 */
+	assert_true(d & SLAB_TUNE_OVER);
+	assert_true(d & SLAB_TUNE_STEP_DOWN);
+	assert_true(d & SLAB_TUNE_DWELL_DOWN);
+	assert_int_equal(r->vm.policy.grow_step, 32);
+	assert_true(r->vm.policy.shrink_after == 2000);
+#ifdef CONFIG_MEASURE
+	assert_int_equal(r->tm.over, 1);
+	assert_int_equal(r->tm.budget, 96);
+	assert_int_equal(measure_at(slab_tune, &r->tm, measure_count(slab_tune) - 1),
+	                 133);                    /* budget_use: 128 of 96 */
+#endif
+	rig_fini(r);
+	free(r);
+}
+
+static void
+test_idle_decay(void **state)
+{
+	(void)state;
+	struct slab_policy pol = {
+		.min = 0, .max = 1024, .grow_step = 64, .shrink_usage_pct = 50,
+		.shrink_release_pct = 50, .shrink_after = 8000,
+	};
+	struct rig *r;
+	int i, all = 0;
+
+	if (!measure_history_depth || !measure_available)
+		skip();
+	r = calloc(1, sizeof(*r));
+	rig_init(r, &pol, 0);
+	rig_row(r, 64);
+	/* a quarter used, for good: the dwell comes down until it releases */
+	for (i = 0; i < 12; i++)
+		all |= rig_row(r, 16);
+	assert_true(all & SLAB_TUNE_DWELL_DOWN);
+	assert_true(all & SLAB_TUNE_STEP_DOWN);
+	assert_false(all & SLAB_TUNE_DWELL_UP);
+	assert_true(r->vm.policy.shrink_after < 8000);
+	assert_true(r->vm.policy.grow_step < 64);
+	assert_true(r->vm.policy.grow_step >= r->tune.step_min);
+	assert_true(slab_committed(&r->vm) < 64);
+	rig_fini(r);
+	free(r);
+}
+
+int
+main(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_oscillation),
+		cmocka_unit_test(test_over_budget),
+		cmocka_unit_test(test_idle_decay),
+	};
+	return cmocka_run_group_tests_name("slab_tune", tests, NULL, NULL);
+}